@@ -0,0 +1,259 @@
+#include "git-compat-util.h"
+#include "ahead-behind-cache.h"
+#include "chunk-format.h"
+#include "commit-graph.h"
+#include "config.h"
+#include "csum-file.h"
+#include "ewah/ewok.h"
+#include "gettext.h"
+#include "hash.h"
+#include "lockfile.h"
+#include "object-file.h"
+#include "object-store-ll.h"
+#include "repository.h"
+#include "wrapper.h"
+
+#define AHBH_SIGNATURE 0x41484248 /* "AHBH" */
+#define AHBH_VERSION 1
+#define AHBH_HEADER_SIZE 12
+
+/*
+ * Entries beyond this number are dropped when writing the cache,
+ * unless they were used by the current process.
+ */
+#define AHBH_MAX_ENTRIES 65536
+
+struct ahead_behind_entry {
+	struct object_id base;
+	struct object_id tip;
+	uint32_t ahead;
+	uint32_t behind;
+};
+
+struct ahead_behind_cache {
+	char *path;
+
+	/* The entries of the file, if any. */
+	const unsigned char *data;
+	size_t data_len;
+	size_t nr;
+	struct bitmap *used;
+
+	/* New entries, in no particular order. */
+	struct ahead_behind_entry *added;
+	size_t added_nr, added_alloc;
+};
+
+static size_t entry_width(void)
+{
+	return 2 * the_hash_algo->rawsz + 2 * sizeof(uint32_t);
+}
+
+static const unsigned char *entry_at(struct ahead_behind_cache *cache,
+				     size_t i)
+{
+	return cache->data + AHBH_HEADER_SIZE + st_mult(i, entry_width());
+}
+
+static int load_ahead_behind_cache(struct ahead_behind_cache *cache)
+{
+	struct stat st;
+	size_t len, min_len = AHBH_HEADER_SIZE + the_hash_algo->rawsz;
+	void *data;
+	int fd;
+
+	fd = git_open(cache->path);
+	if (fd < 0)
+		return 0;
+	if (fstat(fd, &st)) {
+		close(fd);
+		return error_errno(_("failed to read %s"), cache->path);
+	}
+
+	len = xsize_t(st.st_size);
+	if (len < min_len || (len - min_len) % entry_width()) {
+		close(fd);
+		return error(_("ahead-behind cache %s is corrupt"), cache->path);
+	}
+
+	data = xmmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (get_be32(data) != AHBH_SIGNATURE ||
+	    get_be32((unsigned char *)data + 4) != AHBH_VERSION ||
+	    get_be32((unsigned char *)data + 8) != oid_version(the_hash_algo)) {
+		munmap(data, len);
+		return error(_("ahead-behind cache %s has an unknown format"),
+			     cache->path);
+	}
+
+	cache->data = data;
+	cache->data_len = len;
+	cache->nr = (len - min_len) / entry_width();
+	return 0;
+}
+
+struct ahead_behind_cache *ahead_behind_cache_open(struct repository *r)
+{
+	struct ahead_behind_cache *cache;
+	int enabled;
+
+	if (repo_config_get_bool(r, "commitgraph.aheadbehindcache", &enabled) ||
+	    !enabled)
+		return NULL;
+	if (!generation_numbers_enabled(r))
+		return NULL;
+
+	CALLOC_ARRAY(cache, 1);
+	cache->path = xstrfmt("%s/info/ahead-behind-cache",
+			      r->objects->odb->path);
+	load_ahead_behind_cache(cache);
+	cache->used = bitmap_new();
+	return cache;
+}
+
+static int entry_cmp(const unsigned char *entry,
+		     const struct object_id *base,
+		     const struct object_id *tip)
+{
+	size_t rawsz = the_hash_algo->rawsz;
+	int cmp = memcmp(entry, base->hash, rawsz);
+
+	if (cmp)
+		return cmp;
+	return memcmp(entry + rawsz, tip->hash, rawsz);
+}
+
+int ahead_behind_cache_lookup(struct ahead_behind_cache *cache,
+			      const struct object_id *base,
+			      const struct object_id *tip,
+			      unsigned int *ahead, unsigned int *behind)
+{
+	size_t lo = 0, hi = cache->nr;
+
+	while (lo < hi) {
+		size_t mi = lo + (hi - lo) / 2;
+		const unsigned char *entry = entry_at(cache, mi);
+		int cmp = entry_cmp(entry, base, tip);
+
+		if (!cmp) {
+			entry += 2 * the_hash_algo->rawsz;
+			*ahead = get_be32(entry);
+			*behind = get_be32(entry + 4);
+			bitmap_set(cache->used, mi);
+			return 1;
+		}
+		if (cmp < 0)
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+	return 0;
+}
+
+void ahead_behind_cache_add(struct ahead_behind_cache *cache,
+			    const struct object_id *base,
+			    const struct object_id *tip,
+			    unsigned int ahead, unsigned int behind)
+{
+	struct ahead_behind_entry *e;
+
+	ALLOC_GROW(cache->added, cache->added_nr + 1, cache->added_alloc);
+	e = &cache->added[cache->added_nr++];
+	oidcpy(&e->base, base);
+	oidcpy(&e->tip, tip);
+	e->ahead = ahead;
+	e->behind = behind;
+}
+
+static int added_cmp(const void *va, const void *vb)
+{
+	const struct ahead_behind_entry *a = va, *b = vb;
+	int cmp = oidcmp(&a->base, &b->base);
+
+	if (cmp)
+		return cmp;
+	return oidcmp(&a->tip, &b->tip);
+}
+
+static void write_added(struct hashfile *f, const struct ahead_behind_entry *e)
+{
+	hashwrite(f, e->base.hash, the_hash_algo->rawsz);
+	hashwrite(f, e->tip.hash, the_hash_algo->rawsz);
+	hashwrite_be32(f, e->ahead);
+	hashwrite_be32(f, e->behind);
+}
+
+int ahead_behind_cache_write(struct ahead_behind_cache *cache)
+{
+	struct lock_file lk = LOCK_INIT;
+	struct hashfile *f;
+	size_t i = 0, j = 0, nr = 0, used, budget;
+
+	if (!cache->added_nr)
+		return 0;
+
+	if (safe_create_leading_directories(cache->path) ||
+	    hold_lock_file_for_update_mode(&lk, cache->path, 0, 0444) < 0)
+		return 0;
+
+	QSORT(cache->added, cache->added_nr, added_cmp);
+	for (i = 1; i < cache->added_nr; i++)
+		if (added_cmp(&cache->added[nr], &cache->added[i]))
+			cache->added[++nr] = cache->added[i];
+	cache->added_nr = nr + 1;
+
+	/* Make room for everything used in this process first. */
+	used = cache->added_nr + bitmap_popcount(cache->used);
+	budget = used < AHBH_MAX_ENTRIES ? AHBH_MAX_ENTRIES - used : 0;
+
+	f = hashfd(get_lock_file_fd(&lk), get_lock_file_path(&lk));
+	hashwrite_be32(f, AHBH_SIGNATURE);
+	hashwrite_be32(f, AHBH_VERSION);
+	hashwrite_be32(f, oid_version(the_hash_algo));
+
+	i = 0;
+	while (i < cache->nr || j < cache->added_nr) {
+		const unsigned char *entry = i < cache->nr ? entry_at(cache, i) : NULL;
+		int cmp;
+
+		if (!entry)
+			cmp = 1;
+		else if (j >= cache->added_nr)
+			cmp = -1;
+		else
+			cmp = entry_cmp(entry, &cache->added[j].base,
+					&cache->added[j].tip);
+
+		if (cmp < 0) {
+			if (bitmap_get(cache->used, i))
+				hashwrite(f, entry, entry_width());
+			else if (budget) {
+				hashwrite(f, entry, entry_width());
+				budget--;
+			}
+			i++;
+			continue;
+		}
+
+		write_added(f, &cache->added[j++]);
+		if (!cmp)
+			i++;
+	}
+
+	finalize_hashfile(f, NULL, FSYNC_COMPONENT_COMMIT_GRAPH,
+			  CSUM_HASH_IN_STREAM | CSUM_FSYNC);
+	return commit_lock_file(&lk);
+}
+
+void ahead_behind_cache_free(struct ahead_behind_cache *cache)
+{
+	if (!cache)
+		return;
+	if (cache->data)
+		munmap((void *)cache->data, cache->data_len);
+	bitmap_free(cache->used);
+	free(cache->added);
+	free(cache->path);
+	free(cache);
+}
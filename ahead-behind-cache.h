@@ -0,0 +1,59 @@
+#ifndef AHEAD_BEHIND_CACHE_H
+#define AHEAD_BEHIND_CACHE_H
+
+struct object_id;
+struct repository;
+
+/*
+ * A cache of ahead/behind counts, stored in "info/ahead-behind-cache"
+ * of the object directory next to the commit-graph.
+ *
+ * As commits never change, the counts between two commits never
+ * change either, and the cache is keyed by the object IDs of the base
+ * and the tip alone. It is only used while a commit-graph is in use,
+ * as that is also what rules out replace objects, grafts and shallow
+ * clones, all of which could change the counts.
+ *
+ * The file starts with a header of three 4-byte network-order
+ * integers: the signature "AHBH", the version (1) and the hash
+ * function id (1 for SHA-1, 2 for SHA-256). It is followed by the
+ * entries sorted by base and then tip, each consisting of the object
+ * IDs of base and tip and two 4-byte network-order integers holding
+ * the ahead and behind counts, and a trailing checksum.
+ */
+struct ahead_behind_cache;
+
+/*
+ * Open the cache of the repository's main object directory. Returns
+ * NULL if "commitGraph.aheadBehindCache" is not enabled or the
+ * repository does not use a commit-graph. A missing or unreadable file
+ * results in an empty cache.
+ */
+struct ahead_behind_cache *ahead_behind_cache_open(struct repository *r);
+
+/*
+ * Look up the counts of 'tip' against 'base'. Returns 1 and fills in
+ * 'ahead' and 'behind' if they are cached, 0 otherwise.
+ */
+int ahead_behind_cache_lookup(struct ahead_behind_cache *cache,
+			      const struct object_id *base,
+			      const struct object_id *tip,
+			      unsigned int *ahead, unsigned int *behind);
+
+/* Remember the counts of 'tip' against 'base'. */
+void ahead_behind_cache_add(struct ahead_behind_cache *cache,
+			    const struct object_id *base,
+			    const struct object_id *tip,
+			    unsigned int ahead, unsigned int behind);
+
+/*
+ * Write out the cache if entries were added since it was opened. The
+ * entries looked up or added are kept, while others are dropped when
+ * the cache grows too large. Gives up quietly if somebody else is
+ * writing the file at the same time.
+ */
+int ahead_behind_cache_write(struct ahead_behind_cache *cache);
+
+void ahead_behind_cache_free(struct ahead_behind_cache *cache);
+
+#endif /* AHEAD_BEHIND_CACHE_H */
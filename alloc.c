@@ -16,6 +16,7 @@
 #include "repository.h"
 #include "tag.h"
 #include "alloc.h"
+#include "thread-utils.h"
 
 #define BLOCKING 1024
 
@@ -34,11 +35,37 @@ struct alloc_state {
 	/* bookkeeping of allocations */
 	void **slabs;
 	int slab_nr, slab_alloc;
+
+	pthread_mutex_t mutex;
 };
 
+static int alloc_use_lock;
+static pthread_mutex_t commit_index_mutex;
+
+void enable_alloc_lock(void)
+{
+	if (alloc_use_lock)
+		return;
+
+	alloc_use_lock = 1;
+	pthread_mutex_init(&commit_index_mutex, NULL);
+}
+
+void disable_alloc_lock(void)
+{
+	if (!alloc_use_lock)
+		return;
+
+	alloc_use_lock = 0;
+	pthread_mutex_destroy(&commit_index_mutex);
+}
+
 struct alloc_state *allocate_alloc_state(void)
 {
-	return xcalloc(1, sizeof(struct alloc_state));
+	struct alloc_state *s = xcalloc(1, sizeof(struct alloc_state));
+
+	pthread_mutex_init(&s->mutex, NULL);
+	return s;
 }
 
 void clear_alloc_state(struct alloc_state *s)
@@ -49,12 +76,15 @@ void clear_alloc_state(struct alloc_state *s)
 	}
 
 	FREE_AND_NULL(s->slabs);
+	pthread_mutex_destroy(&s->mutex);
 }
 
 static inline void *alloc_node(struct alloc_state *s, size_t node_size)
 {
 	void *ret;
 
+	if (alloc_use_lock)
+		pthread_mutex_lock(&s->mutex);
 	if (!s->nr) {
 		s->nr = BLOCKING;
 		s->p = xmalloc(BLOCKING * node_size);
@@ -65,6 +95,8 @@ static inline void *alloc_node(struct alloc_state *s, size_t node_size)
 	s->nr--;
 	ret = s->p;
 	s->p = (char *)s->p + node_size;
+	if (alloc_use_lock)
+		pthread_mutex_unlock(&s->mutex);
 	memset(ret, 0, node_size);
 
 	return ret;
@@ -106,7 +138,14 @@ void *alloc_object_node(struct repository *r)
 static unsigned int alloc_commit_index(void)
 {
 	static unsigned int parsed_commits_count;
-	return parsed_commits_count++;
+	unsigned int ret;
+
+	if (alloc_use_lock)
+		pthread_mutex_lock(&commit_index_mutex);
+	ret = parsed_commits_count++;
+	if (alloc_use_lock)
+		pthread_mutex_unlock(&commit_index_mutex);
+	return ret;
 }
 
 void init_commit_node(struct commit *c)
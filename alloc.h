@@ -17,4 +17,11 @@ void *alloc_object_node(struct repository *r);
 struct alloc_state *allocate_alloc_state(void);
 void clear_alloc_state(struct alloc_state *s);
 
+/*
+ * Make the functions above safe to call from several threads at once;
+ * see enable_parsed_object_lock(), which calls these.
+ */
+void enable_alloc_lock(void);
+void disable_alloc_lock(void);
+
 #endif
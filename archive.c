@@ -14,6 +14,7 @@
 #include "tree.h"
 #include "tree-walk.h"
 #include "attr.h"
+#include "bulk-read.h"
 #include "archive.h"
 #include "parse-options.h"
 #include "unpack-trees.h"
@@ -78,14 +79,18 @@ static void format_subst(const struct commit *commit,
 	free(to_free);
 }
 
+/*
+ * Convert the contents of "oid" for writing them to the archive. If
+ * "buffer" is NULL, the object is read first.
+ */
 static void *object_file_to_archive(const struct archiver_args *args,
 				    const char *path,
 				    const struct object_id *oid,
 				    unsigned int mode,
+				    void *buffer,
 				    enum object_type *type,
 				    unsigned long *sizep)
 {
-	void *buffer;
 	const struct commit *commit = args->convert ? args->commit : NULL;
 	struct checkout_metadata meta;
 
@@ -94,7 +99,8 @@ static void *object_file_to_archive(const struct archiver_args *args,
 			       (args->tree ? &args->tree->object.oid : NULL), oid);
 
 	path += args->baselen;
-	buffer = repo_read_object_file(the_repository, oid, type, sizep);
+	if (!buffer)
+		buffer = repo_read_object_file(the_repository, oid, type, sizep);
 	if (buffer && S_ISREG(mode)) {
 		struct strbuf buf = STRBUF_INIT;
 		size_t size = 0;
@@ -118,12 +124,137 @@ struct directory {
 	char path[FLEX_ARRAY];
 };
 
+/*
+ * An entry which has been found by read_tree() but not written yet.
+ * Entries are queued up so that the blobs among them can be read with
+ * bulk_read_objects(), and are then written in the order they were
+ * queued in.
+ */
+struct pending_entry {
+	struct object_id oid;
+	char *path;
+	size_t pathlen;
+	unsigned int mode;
+	unsigned int convert : 1;
+	/* whether the contents are passed to write_entry or streamed */
+	unsigned int read : 1;
+	void *buffer;
+	enum object_type type;
+	unsigned long size;
+};
+
+/* Write the queued entries once there are this many, or this many bytes. */
+#define MAX_PENDING_ENTRIES 4096
+#define MAX_PENDING_SIZE (64 * 1024 * 1024)
+
 struct archiver_context {
 	struct archiver_args *args;
 	write_archive_entry_fn_t write_entry;
 	struct directory *bottom;
+
+	struct pending_entry *pending;
+	size_t pending_nr, pending_alloc;
+	unsigned long pending_size;
+	/* the object ids of the entries to read, and their positions */
+	struct object_id *pending_oids;
+	size_t *pending_pos;
+	size_t pending_oids_nr, pending_oids_alloc, pending_pos_alloc;
 };
 
+static int pending_entry_read(const struct object_id *oid,
+			      enum object_type type, unsigned long size,
+			      void *buf, void *data)
+{
+	struct archiver_context *c = data;
+	struct pending_entry *e = &c->pending[c->pending_pos[oid - c->pending_oids]];
+
+	e->buffer = buf;
+	e->type = type;
+	e->size = size;
+	return 0;
+}
+
+static void clear_pending_entries(struct archiver_context *c)
+{
+	size_t i;
+
+	for (i = 0; i < c->pending_nr; i++) {
+		free(c->pending[i].path);
+		free(c->pending[i].buffer);
+	}
+	c->pending_nr = 0;
+	c->pending_size = 0;
+	c->pending_oids_nr = 0;
+}
+
+static int write_pending_entries(struct archiver_context *c)
+{
+	struct archiver_args *args = c->args;
+	size_t i;
+	int err = 0;
+
+	bulk_read_objects(args->repo, c->pending_oids, c->pending_oids_nr,
+			  pending_entry_read, c);
+
+	for (i = 0; i < c->pending_nr && !err; i++) {
+		struct pending_entry *e = &c->pending[i];
+
+		if (!e->read) {
+			err = c->write_entry(args, &e->oid, e->path, e->pathlen,
+					     e->mode, NULL, e->size);
+			continue;
+		}
+
+		args->convert = e->convert;
+		e->buffer = object_file_to_archive(args, e->path, &e->oid,
+						   e->mode, e->buffer,
+						   &e->type, &e->size);
+		if (!e->buffer)
+			err = error(_("cannot read '%s'"), oid_to_hex(&e->oid));
+		else
+			err = c->write_entry(args, &e->oid, e->path, e->pathlen,
+					     e->mode, e->buffer, e->size);
+	}
+
+	clear_pending_entries(c);
+	return err;
+}
+
+static int queue_entry(struct archiver_context *c,
+		       const struct object_id *oid,
+		       const char *path, size_t pathlen, unsigned int mode,
+		       int read, unsigned long size)
+{
+	struct pending_entry *e;
+
+	ALLOC_GROW(c->pending, c->pending_nr + 1, c->pending_alloc);
+	e = &c->pending[c->pending_nr++];
+	memset(e, 0, sizeof(*e));
+	oidcpy(&e->oid, oid);
+	e->path = xmemdupz(path, pathlen);
+	e->pathlen = pathlen;
+	e->mode = mode;
+	e->convert = c->args->convert;
+	e->read = read;
+	e->size = size;
+
+	if (read) {
+		ALLOC_GROW(c->pending_oids, c->pending_oids_nr + 1,
+			   c->pending_oids_alloc);
+		ALLOC_GROW(c->pending_pos, c->pending_oids_nr + 1,
+			   c->pending_pos_alloc);
+		oidcpy(&c->pending_oids[c->pending_oids_nr], oid);
+		c->pending_pos[c->pending_oids_nr] = c->pending_nr - 1;
+		c->pending_oids_nr++;
+		c->pending_size += size;
+	}
+
+	if (c->pending_nr >= MAX_PENDING_ENTRIES ||
+	    c->pending_size >= MAX_PENDING_SIZE)
+		return write_pending_entries(c);
+	return 0;
+}
+
 static const struct attr_check *get_archive_attrs(struct index_state *istate,
 						  const char *path)
 {
@@ -151,11 +282,9 @@ static int write_archive_entry(const struct object_id *oid, const char *base,
 	static struct strbuf path = STRBUF_INIT;
 	struct archiver_context *c = context;
 	struct archiver_args *args = c->args;
-	write_archive_entry_fn_t write_entry = c->write_entry;
 	int err;
 	const char *path_without_prefix;
-	unsigned long size;
-	void *buffer;
+	unsigned long size = 0;
 	enum object_type type;
 
 	args->convert = 0;
@@ -203,24 +332,20 @@ static int write_archive_entry(const struct object_id *oid, const char *base,
 		fprintf(stderr, "%.*s\n", (int)path.len, path.buf);
 
 	if (S_ISDIR(mode) || S_ISGITLINK(mode)) {
-		err = write_entry(args, oid, path.buf, path.len, mode, NULL, 0);
+		err = queue_entry(c, oid, path.buf, path.len, mode, 0, 0);
 		if (err)
 			return err;
 		return (S_ISDIR(mode) ? READ_TREE_RECURSIVE : 0);
 	}
 
 	/* Stream it? */
-	if (S_ISREG(mode) && !args->convert &&
-	    oid_object_info(args->repo, oid, &size) == OBJ_BLOB &&
+	type = oid_object_info(args->repo, oid, &size);
+	if (S_ISREG(mode) && !args->convert && type == OBJ_BLOB &&
 	    size > big_file_threshold)
-		return write_entry(args, oid, path.buf, path.len, mode, NULL, size);
+		return queue_entry(c, oid, path.buf, path.len, mode, 0, size);
 
-	buffer = object_file_to_archive(args, path.buf, oid, mode, &type, &size);
-	if (!buffer)
-		return error(_("cannot read '%s'"), oid_to_hex(oid));
-	err = write_entry(args, oid, path.buf, path.len, mode, buffer, size);
-	free(buffer);
-	return err;
+	return queue_entry(c, oid, path.buf, path.len, mode, 1,
+			   type < 0 ? 0 : size);
 }
 
 static void queue_directory(const struct object_id *oid,
@@ -351,6 +476,12 @@ int write_archive_entries(struct archiver_args *args,
 			&context);
 	if (err == READ_TREE_RECURSIVE)
 		err = 0;
+	if (!err)
+		err = write_pending_entries(&context);
+	clear_pending_entries(&context);
+	free(context.pending);
+	free(context.pending_oids);
+	free(context.pending_pos);
 	while (context.bottom) {
 		struct directory *next = context.bottom->up;
 		free(context.bottom);
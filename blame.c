@@ -18,6 +18,7 @@
 #include "commit-slab.h"
 #include "bloom.h"
 #include "commit-graph.h"
+#include "thread-utils.h"
 
 define_commit_slab(blame_suspects, struct blame_origin *);
 static struct blame_suspects blame_suspects;
@@ -1927,6 +1928,492 @@ static int blame_chunk_cb(long start_a, long count_a,
 	return 0;
 }
 
+/*
+ * Diff prefetching: while the main thread assigns blame, a walker thread
+ * follows the first-parent history of the blamed path from the suspects
+ * we just handled ("chains") and queues each pair of consecutive,
+ * different blobs it finds.  Worker threads read both blobs and record
+ * the hunks between them.  pass_blame_to_parent() replays the recorded
+ * hunks (and takes over the blob contents) when it finds its pair, so
+ * the result is exactly that of the serial algorithm; anything that was
+ * not predicted is simply computed by the main thread as before.
+ */
+#define BLAME_PREFETCH_MAX_CHAINS 4
+
+enum blame_prefetch_state {
+	BLAME_PREFETCH_QUEUED = 0,
+	BLAME_PREFETCH_RUNNING,
+	BLAME_PREFETCH_DONE,
+	BLAME_PREFETCH_FAILED,
+	BLAME_PREFETCH_ABANDONED,
+};
+
+struct blame_hunk {
+	long start_a, count_a;
+	long start_b, count_b;
+};
+
+struct blame_prefetch_job {
+	struct object_id oid_a, oid_b;
+	enum blame_prefetch_state state;
+	int chain;
+	mmfile_t file_a, file_b;
+	struct blame_hunk *hunks;
+	size_t hunks_nr, hunks_alloc;
+};
+
+struct blame_prefetch_chain {
+	/* the blob of "path" in a child of "next" */
+	struct object_id blob;
+	struct object_id next;
+	char *path;
+	int active;
+	unsigned generation;
+	unsigned long last_used;
+};
+
+struct blame_prefetch {
+	struct repository *repo;
+	int xdl_opts;
+
+	struct blame_prefetch_chain chains[BLAME_PREFETCH_MAX_CHAINS];
+	unsigned long tick;
+	intmax_t hits, misses, dropped;
+
+	/* queued and finished jobs, oldest first */
+	struct blame_prefetch_job **jobs;
+	size_t jobs_nr, jobs_alloc;
+	size_t max_jobs_per_chain;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t work_cond;
+	pthread_cond_t walk_cond;
+	pthread_cond_t done_cond;
+	pthread_t walker;
+	pthread_t *workers;
+	int nr_workers;
+	int have_walker;
+	int stop;
+	int owns_obj_read_lock;
+};
+
+static void free_prefetch_job(struct blame_prefetch_job *job)
+{
+	free(job->file_a.ptr);
+	free(job->file_b.ptr);
+	free(job->hunks);
+	free(job);
+}
+
+static size_t count_chain_jobs(struct blame_prefetch *bp, int chain)
+{
+	size_t i, nr = 0;
+
+	for (i = 0; i < bp->jobs_nr; i++)
+		if (bp->jobs[i]->chain == chain)
+			nr++;
+	return nr;
+}
+
+/*
+ * Remove the job at "pos" from the queue, freeing it unless a worker is
+ * still busy with it, in which case the worker frees it when it is done.
+ * Must be called with the mutex held.
+ */
+static void drop_prefetch_job(struct blame_prefetch *bp, size_t pos)
+{
+	struct blame_prefetch_job *job = bp->jobs[pos];
+
+	bp->dropped++;
+	if (job->state == BLAME_PREFETCH_RUNNING)
+		job->state = BLAME_PREFETCH_ABANDONED;
+	else
+		free_prefetch_job(job);
+	MOVE_ARRAY(bp->jobs + pos, bp->jobs + pos + 1, bp->jobs_nr - pos - 1);
+	bp->jobs_nr--;
+}
+
+static void drop_prefetch_chain(struct blame_prefetch *bp, int chain)
+{
+	size_t i = 0;
+
+	while (i < bp->jobs_nr) {
+		if (bp->jobs[i]->chain == chain)
+			drop_prefetch_job(bp, i);
+		else
+			i++;
+	}
+	bp->chains[chain].active = 0;
+	bp->chains[chain].generation++;
+	FREE_AND_NULL(bp->chains[chain].path);
+}
+
+/*
+ * Read the tree and the first parent of "commit" without going through
+ * the (not thread-safe) object hash.  Returns -1 on error, 0 for a root
+ * commit and 1 if "parent" was filled in.
+ */
+static int read_commit_tree_and_parent(struct repository *r,
+				       const struct object_id *commit,
+				       struct object_id *tree,
+				       struct object_id *parent)
+{
+	enum object_type type;
+	unsigned long size;
+	char *buf = repo_read_object_file(r, commit, &type, &size);
+	const char *p;
+	int ret = -1;
+
+	if (!buf)
+		return -1;
+	if (type == OBJ_COMMIT &&
+	    skip_prefix(buf, "tree ", &p) &&
+	    !parse_oid_hex(p, tree, &p) && *p++ == '\n')
+		ret = skip_prefix(p, "parent ", &p) &&
+		      !parse_oid_hex(p, parent, &p) && *p == '\n';
+	free(buf);
+	return ret;
+}
+
+static void *blame_prefetch_walker(void *data)
+{
+	struct blame_prefetch *bp = data;
+	int next_chain = 0;
+
+	pthread_mutex_lock(&bp->mutex);
+	for (;;) {
+		struct blame_prefetch_chain *c = NULL;
+		struct object_id commit, blob, tree, parent, parent_blob;
+		unsigned short mode;
+		unsigned generation;
+		char *path;
+		int i, found_parent, found_blob;
+
+		while (!bp->stop) {
+			for (i = 0; i < BLAME_PREFETCH_MAX_CHAINS; i++) {
+				int n = (next_chain + i) % BLAME_PREFETCH_MAX_CHAINS;
+
+				if (bp->chains[n].active &&
+				    count_chain_jobs(bp, n) < bp->max_jobs_per_chain) {
+					c = &bp->chains[n];
+					next_chain = n + 1;
+					break;
+				}
+			}
+			if (c)
+				break;
+			pthread_cond_wait(&bp->walk_cond, &bp->mutex);
+		}
+		if (bp->stop)
+			break;
+
+		oidcpy(&commit, &c->next);
+		oidcpy(&blob, &c->blob);
+		path = xstrdup(c->path);
+		generation = c->generation;
+		pthread_mutex_unlock(&bp->mutex);
+
+		found_parent = read_commit_tree_and_parent(bp->repo, &commit,
+							   &tree, &parent);
+		found_blob = found_parent >= 0 &&
+			     !get_tree_entry(bp->repo, &tree, path,
+					     &parent_blob, &mode) &&
+			     S_ISREG(mode);
+		free(path);
+
+		pthread_mutex_lock(&bp->mutex);
+		if (c->generation != generation)
+			continue; /* the chain was dropped meanwhile */
+		if (!found_blob) {
+			drop_prefetch_chain(bp, c - bp->chains);
+			continue;
+		}
+		if (!oideq(&parent_blob, &blob)) {
+			struct blame_prefetch_job *job;
+
+			CALLOC_ARRAY(job, 1);
+			oidcpy(&job->oid_a, &parent_blob);
+			oidcpy(&job->oid_b, &blob);
+			job->chain = c - bp->chains;
+			ALLOC_GROW(bp->jobs, bp->jobs_nr + 1, bp->jobs_alloc);
+			bp->jobs[bp->jobs_nr++] = job;
+			pthread_cond_signal(&bp->work_cond);
+		}
+		if (!found_parent) {
+			c->active = 0;
+			continue;
+		}
+		oidcpy(&c->blob, &parent_blob);
+		oidcpy(&c->next, &parent);
+	}
+	pthread_mutex_unlock(&bp->mutex);
+
+	return NULL;
+}
+
+static int record_blame_hunk(long start_a, long count_a,
+			     long start_b, long count_b, void *data)
+{
+	struct blame_prefetch_job *job = data;
+	struct blame_hunk *h;
+
+	ALLOC_GROW(job->hunks, job->hunks_nr + 1, job->hunks_alloc);
+	h = &job->hunks[job->hunks_nr++];
+	h->start_a = start_a;
+	h->count_a = count_a;
+	h->start_b = start_b;
+	h->count_b = count_b;
+	return 0;
+}
+
+static int read_blob_file(struct repository *r, const struct object_id *oid,
+			  mmfile_t *file)
+{
+	enum object_type type;
+	unsigned long size;
+
+	file->ptr = repo_read_object_file(r, oid, &type, &size);
+	if (file->ptr && type != OBJ_BLOB)
+		FREE_AND_NULL(file->ptr);
+	file->size = size;
+	return file->ptr ? 0 : -1;
+}
+
+static void *blame_prefetch_worker(void *data)
+{
+	struct blame_prefetch *bp = data;
+
+	pthread_mutex_lock(&bp->mutex);
+	for (;;) {
+		struct blame_prefetch_job *job = NULL;
+		size_t i;
+		int ok;
+
+		while (!bp->stop) {
+			for (i = 0; i < bp->jobs_nr; i++)
+				if (bp->jobs[i]->state == BLAME_PREFETCH_QUEUED) {
+					job = bp->jobs[i];
+					break;
+				}
+			if (job)
+				break;
+			pthread_cond_wait(&bp->work_cond, &bp->mutex);
+		}
+		if (bp->stop)
+			break;
+
+		job->state = BLAME_PREFETCH_RUNNING;
+		pthread_mutex_unlock(&bp->mutex);
+
+		ok = !read_blob_file(bp->repo, &job->oid_a, &job->file_a) &&
+		     !read_blob_file(bp->repo, &job->oid_b, &job->file_b) &&
+		     !diff_hunks(&job->file_a, &job->file_b, record_blame_hunk,
+				 job, bp->xdl_opts);
+
+		pthread_mutex_lock(&bp->mutex);
+		if (job->state == BLAME_PREFETCH_ABANDONED) {
+			free_prefetch_job(job);
+			continue;
+		}
+		job->state = ok ? BLAME_PREFETCH_DONE : BLAME_PREFETCH_FAILED;
+		pthread_cond_broadcast(&bp->done_cond);
+	}
+	pthread_mutex_unlock(&bp->mutex);
+
+	return NULL;
+}
+
+static int origin_has_textconv(struct blame_scoreboard *sb,
+			       struct blame_origin *o)
+{
+	struct diff_filespec *df;
+	int ret;
+
+	if (!sb->revs->diffopt.flags.allow_textconv)
+		return 0;
+	df = alloc_filespec(o->path);
+	fill_filespec(df, &o->blob_oid, 1, o->mode);
+	ret = !!get_textconv(sb->repo, df);
+	free_filespec(df);
+	return ret;
+}
+
+/*
+ * Start a new chain at the (already parsed) commit of "o", whose child
+ * "child" we are about to diff against it ourselves.  A chain that has
+ * not got past "child" yet is moved ahead instead, otherwise an unused
+ * or the least recently used chain is replaced.
+ */
+static void seed_blame_prefetch(struct blame_scoreboard *sb,
+				struct blame_origin *o,
+				struct blame_origin *child)
+{
+	struct blame_prefetch *bp = sb->prefetch;
+	struct blame_prefetch_chain *c;
+	int i, victim = -1;
+
+	if (!o->commit->parents || !S_ISREG(o->mode) ||
+	    origin_has_textconv(sb, o))
+		return;
+
+	pthread_mutex_lock(&bp->mutex);
+	for (i = 0; child && i < BLAME_PREFETCH_MAX_CHAINS; i++)
+		if (bp->chains[i].active &&
+		    oideq(&bp->chains[i].blob, &child->blob_oid)) {
+			victim = i;
+			break;
+		}
+	for (i = 0; victim < 0 && i < BLAME_PREFETCH_MAX_CHAINS; i++)
+		if (!bp->chains[i].active)
+			victim = i;
+	if (victim < 0) {
+		victim = 0;
+		for (i = 1; i < BLAME_PREFETCH_MAX_CHAINS; i++)
+			if (bp->chains[i].last_used < bp->chains[victim].last_used)
+				victim = i;
+	}
+	drop_prefetch_chain(bp, victim);
+
+	c = &bp->chains[victim];
+	oidcpy(&c->blob, &o->blob_oid);
+	oidcpy(&c->next, &o->commit->parents->item->object.oid);
+	c->path = xstrdup(o->path);
+	c->active = 1;
+	c->last_used = ++bp->tick;
+	pthread_cond_signal(&bp->walk_cond);
+	pthread_mutex_unlock(&bp->mutex);
+}
+
+/*
+ * Find the prefetched diff from "parent" to "target", waiting for it if
+ * a worker is still busy with it, and remove it from the queue along
+ * with the older jobs of its chain, which are not going to be needed
+ * anymore.  Returns NULL if no usable result is available.
+ */
+static struct blame_prefetch_job *take_prefetched_diff(struct blame_prefetch *bp,
+						       struct blame_origin *parent,
+						       struct blame_origin *target)
+{
+	struct blame_prefetch_job *job = NULL;
+	size_t i;
+
+	pthread_mutex_lock(&bp->mutex);
+	for (i = 0; i < bp->jobs_nr; i++) {
+		if (oideq(&bp->jobs[i]->oid_a, &parent->blob_oid) &&
+		    oideq(&bp->jobs[i]->oid_b, &target->blob_oid)) {
+			job = bp->jobs[i];
+			break;
+		}
+	}
+	if (job) {
+		int chain = job->chain;
+		size_t j = 0;
+
+		bp->chains[chain].last_used = ++bp->tick;
+		while (bp->jobs[j] != job) {
+			if (bp->jobs[j]->chain == chain)
+				drop_prefetch_job(bp, j);
+			else
+				j++;
+		}
+		while (job->state == BLAME_PREFETCH_RUNNING)
+			pthread_cond_wait(&bp->done_cond, &bp->mutex);
+		if (job->state == BLAME_PREFETCH_DONE) {
+			MOVE_ARRAY(bp->jobs + j, bp->jobs + j + 1,
+				   bp->jobs_nr - j - 1);
+			bp->jobs_nr--;
+		} else {
+			drop_prefetch_job(bp, j);
+			job = NULL;
+		}
+		pthread_cond_signal(&bp->walk_cond);
+	}
+	if (job)
+		bp->hits++;
+	else
+		bp->misses++;
+	pthread_mutex_unlock(&bp->mutex);
+	return job;
+}
+
+static void start_blame_prefetch(struct blame_scoreboard *sb)
+{
+	struct blame_prefetch *bp;
+	int i;
+
+	if (!HAVE_THREADS || sb->num_threads < 2 || sb->reverse)
+		return;
+
+	CALLOC_ARRAY(bp, 1);
+	bp->repo = sb->repo;
+	bp->xdl_opts = sb->xdl_opts;
+	bp->max_jobs_per_chain = sb->num_threads;
+	pthread_mutex_init(&bp->mutex, NULL);
+	pthread_cond_init(&bp->work_cond, NULL);
+	pthread_cond_init(&bp->walk_cond, NULL);
+	pthread_cond_init(&bp->done_cond, NULL);
+	if (!obj_read_use_lock) {
+		enable_obj_read_lock();
+		bp->owns_obj_read_lock = 1;
+	}
+
+	if (pthread_create(&bp->walker, NULL, blame_prefetch_walker, bp)) {
+		if (bp->owns_obj_read_lock)
+			disable_obj_read_lock();
+		free(bp);
+		return;
+	}
+	bp->have_walker = 1;
+	CALLOC_ARRAY(bp->workers, sb->num_threads - 1);
+	for (i = 0; i < sb->num_threads - 1; i++) {
+		if (pthread_create(&bp->workers[i], NULL,
+				   blame_prefetch_worker, bp))
+			break;
+		bp->nr_workers++;
+	}
+
+	sb->prefetch = bp;
+}
+
+static void stop_blame_prefetch(struct blame_scoreboard *sb)
+{
+	struct blame_prefetch *bp = sb->prefetch;
+	int i;
+
+	if (!bp)
+		return;
+
+	pthread_mutex_lock(&bp->mutex);
+	bp->stop = 1;
+	pthread_cond_broadcast(&bp->work_cond);
+	pthread_cond_broadcast(&bp->walk_cond);
+	pthread_mutex_unlock(&bp->mutex);
+	if (bp->have_walker)
+		pthread_join(bp->walker, NULL);
+	for (i = 0; i < bp->nr_workers; i++)
+		pthread_join(bp->workers[i], NULL);
+	free(bp->workers);
+
+	if (bp->owns_obj_read_lock)
+		disable_obj_read_lock();
+
+	trace2_data_intmax("blame", sb->repo, "prefetch/hits", bp->hits);
+	trace2_data_intmax("blame", sb->repo, "prefetch/misses", bp->misses);
+	trace2_data_intmax("blame", sb->repo, "prefetch/dropped",
+			   bp->dropped + bp->jobs_nr);
+
+	for (i = 0; i < bp->jobs_nr; i++)
+		free_prefetch_job(bp->jobs[i]);
+	free(bp->jobs);
+	for (i = 0; i < BLAME_PREFETCH_MAX_CHAINS; i++)
+		free(bp->chains[i].path);
+	pthread_cond_destroy(&bp->work_cond);
+	pthread_cond_destroy(&bp->walk_cond);
+	pthread_cond_destroy(&bp->done_cond);
+	pthread_mutex_destroy(&bp->mutex);
+	FREE_AND_NULL(sb->prefetch);
+}
+
 /*
  * We are looking at the origin 'target' and aiming to pass blame
  * for the lines it is suspected to its parent.  Run diff to find
@@ -1939,6 +2426,7 @@ static void pass_blame_to_parent(struct blame_scoreboard *sb,
 	mmfile_t file_p, file_o;
 	struct blame_chunk_cb_data d;
 	struct blame_entry *newdest = NULL;
+	struct blame_prefetch_job *job = NULL;
 
 	if (!target->suspects)
 		return; /* nothing remains for this target */
@@ -1949,13 +2437,48 @@ static void pass_blame_to_parent(struct blame_scoreboard *sb,
 	d.ignore_diffs = ignore_diffs;
 	d.dstq = &newdest; d.srcq = &target->suspects;
 
+	/*
+	 * Jobs are matched by blob names alone and their hunks are computed
+	 * on the raw contents, so they are no good for an origin whose path
+	 * fill_origin_blob() would run through a textconv filter; the path
+	 * of either side may differ from the one the chain was seeded with.
+	 */
+	if (sb->prefetch && !ignore_diffs &&
+	    !origin_has_textconv(sb, parent) &&
+	    !origin_has_textconv(sb, target)) {
+		job = take_prefetched_diff(sb->prefetch, parent, target);
+		if (!job)
+			seed_blame_prefetch(sb, parent, target);
+	}
+	if (job) {
+		/* Use the blobs the worker read, if we do not have them yet. */
+		if (!parent->file.ptr) {
+			sb->num_read_blob++;
+			parent->file = job->file_a;
+			job->file_a.ptr = NULL;
+		}
+		if (!target->file.ptr) {
+			sb->num_read_blob++;
+			target->file = job->file_b;
+			job->file_b.ptr = NULL;
+		}
+	}
+
 	fill_origin_blob(&sb->revs->diffopt, parent, &file_p,
 			 &sb->num_read_blob, ignore_diffs);
 	fill_origin_blob(&sb->revs->diffopt, target, &file_o,
 			 &sb->num_read_blob, ignore_diffs);
 	sb->num_get_patch++;
 
-	if (diff_hunks(&file_p, &file_o, blame_chunk_cb, &d, sb->xdl_opts))
+	if (job) {
+		size_t i;
+
+		for (i = 0; i < job->hunks_nr; i++)
+			blame_chunk_cb(job->hunks[i].start_a, job->hunks[i].count_a,
+				       job->hunks[i].start_b, job->hunks[i].count_b,
+				       &d);
+		free_prefetch_job(job);
+	} else if (diff_hunks(&file_p, &file_o, blame_chunk_cb, &d, sb->xdl_opts))
 		die("unable to generate diff (%s -> %s)",
 		    oid_to_hex(&parent->commit->object.oid),
 		    oid_to_hex(&target->commit->object.oid));
@@ -2581,6 +3104,16 @@ void assign_blame(struct blame_scoreboard *sb, int opt)
 	struct rev_info *revs = sb->revs;
 	struct commit *commit = prio_queue_get(&sb->commits);
 
+	start_blame_prefetch(sb);
+	if (sb->prefetch && commit) {
+		struct blame_origin *o = get_blame_suspects(commit);
+
+		while (o && !o->suspects)
+			o = o->next;
+		if (o && !repo_parse_commit(the_repository, commit))
+			seed_blame_prefetch(sb, o, NULL);
+	}
+
 	while (commit) {
 		struct blame_entry *ent;
 		struct blame_origin *suspect = get_blame_suspects(commit);
@@ -2638,6 +3171,8 @@ void assign_blame(struct blame_scoreboard *sb, int opt)
 		if (sb->debug) /* sanity */
 			sanity_check_refcnt(sb);
 	}
+
+	stop_blame_prefetch(sb);
 }
 
 /*
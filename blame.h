@@ -101,6 +101,7 @@ struct blame_entry {
 };
 
 struct blame_bloom_data;
+struct blame_prefetch;
 
 /*
  * The current state of the blame assignment.
@@ -153,6 +154,14 @@ struct blame_scoreboard {
 	int no_whole_file_rename;
 	int debug;
 
+	/*
+	 * With more than one thread, diffs between the blobs of the
+	 * blamed path in consecutive commits are computed ahead of time
+	 * by worker threads; see blame.threads.
+	 */
+	int num_threads;
+	struct blame_prefetch *prefetch;
+
 	/* callbacks */
 	void(*on_sanity_fail)(struct blame_scoreboard *, int);
 	void(*found_guilty_entry)(struct blame_entry *, void *);
@@ -1,16 +1,21 @@
 #include "git-compat-util.h"
 #include "bloom.h"
-#include "diff.h"
-#include "diffcore.h"
-#include "revision.h"
+#include "gettext.h"
 #include "hashmap.h"
 #include "commit-graph.h"
 #include "commit.h"
 #include "commit-slab.h"
+#include "tree.h"
+#include "tree-walk.h"
+#include "pathspec.h"
+#include "strbuf.h"
+#include "string-list.h"
 
 define_commit_slab(bloom_filter_slab, struct bloom_filter);
+define_commit_slab(tree_bloom_filter_slab, struct tree_bloom_filter);
 
 static struct bloom_filter_slab bloom_filters;
+static struct tree_bloom_filter_slab tree_bloom_filters;
 
 struct pathmap_hash_entry {
     struct hashmap_entry entry;
@@ -59,6 +64,43 @@ static int load_bloom_filter_from_graph(struct commit_graph *g,
 	return 1;
 }
 
+static int load_tree_bloom_filter_from_graph(struct commit_graph *g,
+					     struct tree_bloom_filter *tf,
+					     uint32_t graph_pos)
+{
+	uint32_t lex_pos, offset, len;
+	const unsigned char *data;
+
+	while (graph_pos < g->num_commits_in_base)
+		g = g->base_graph;
+
+	/* The commit graph commit 'c' lives in doesn't carry tree filters. */
+	if (!g->chunk_tree_bloom_indexes)
+		return 0;
+
+	lex_pos = graph_pos - g->num_commits_in_base;
+
+	offset = get_be32(g->chunk_tree_bloom_indexes + 8 * lex_pos);
+	len = get_be32(g->chunk_tree_bloom_indexes + 8 * lex_pos + 4);
+
+	/* A filter consists of a flags byte followed by the filter proper. */
+	if (len < 2)
+		return 0;
+	if ((size_t)offset + len >
+	    g->tree_bloom_data_size - BLOOMDATA_CHUNK_HEADER_SIZE) {
+		warning(_("tree-path Bloom filter for commit %"PRIu32" is out of bounds"),
+			graph_pos);
+		return 0;
+	}
+
+	data = g->chunk_tree_bloom_data + BLOOMDATA_CHUNK_HEADER_SIZE + offset;
+	tf->flags = data[0];
+	tf->filter.data = (unsigned char *)(data + 1);
+	tf->filter.len = len - 1;
+
+	return 1;
+}
+
 /*
  * Calculate the murmur3 32-bit hash value for the given data
  * using the given seed.
@@ -144,6 +186,40 @@ void clear_bloom_key(struct bloom_key *key)
 	FREE_AND_NULL(key->hashes);
 }
 
+struct bloom_keyvec *bloom_keyvec_new(const char *path, size_t len,
+				      const struct bloom_filter_settings *settings)
+{
+	struct bloom_keyvec *vec;
+	size_t i, count = 1;
+
+	for (i = 0; i < len; i++)
+		if (path[i] == '/')
+			count++;
+
+	vec = xcalloc(1, st_add(sizeof(*vec),
+				st_mult(count, sizeof(struct bloom_key))));
+	vec->count = count;
+
+	fill_bloom_key(path, len, &vec->key[0], settings);
+	count = 1;
+	for (i = len; i-- > 1; )
+		if (path[i] == '/')
+			fill_bloom_key(path, i, &vec->key[count++], settings);
+
+	return vec;
+}
+
+void bloom_keyvec_free(struct bloom_keyvec *vec)
+{
+	size_t i;
+
+	if (!vec)
+		return;
+	for (i = 0; i < vec->count; i++)
+		clear_bloom_key(&vec->key[i]);
+	free(vec);
+}
+
 void add_key_to_filter(const struct bloom_key *key,
 		       struct bloom_filter *filter,
 		       const struct bloom_filter_settings *settings)
@@ -162,6 +238,7 @@ void add_key_to_filter(const struct bloom_key *key,
 void init_bloom_filters(void)
 {
 	init_bloom_filter_slab(&bloom_filters);
+	init_tree_bloom_filter_slab(&tree_bloom_filters);
 }
 
 static int pathmap_cmp(const void *hashmap_cmp_fn_data UNUSED,
@@ -184,6 +261,197 @@ static void init_truncated_large_filter(struct bloom_filter *filter)
 	filter->len = 1;
 }
 
+struct changed_paths {
+	struct repository *repo;
+	struct hashmap pathmap;
+	size_t nr;
+	size_t max;
+};
+
+static void add_changed_path(struct changed_paths *cp,
+			     struct strbuf *base, const char *name, size_t len)
+{
+	char *path = xstrfmt("%s%.*s", base->buf, (int)len, name);
+
+	cp->nr++;
+
+	/*
+	 * Add each leading directory of the changed file, i.e. for
+	 * 'dir/subdir/file' add 'dir' and 'dir/subdir' as well, so
+	 * the Bloom filter could be used to speed up commands like
+	 * 'git log dir/subdir', too.
+	 *
+	 * Note that directories are added without the trailing '/'.
+	 */
+	do {
+		struct pathmap_hash_entry *e;
+		char *last_slash = strrchr(path, '/');
+
+		FLEX_ALLOC_STR(e, path, path);
+		hashmap_entry_init(&e->entry, strhash(path));
+
+		if (!hashmap_get(&cp->pathmap, &e->entry, NULL))
+			hashmap_add(&cp->pathmap, &e->entry);
+		else
+			free(e);
+
+		if (!last_slash)
+			last_slash = path;
+		*last_slash = '\0';
+
+	} while (*path);
+
+	free(path);
+}
+
+static int collect_changed_paths(struct changed_paths *cp,
+				 const struct object_id *old_oid,
+				 const struct object_id *new_oid,
+				 struct strbuf *base);
+
+static int collect_changed_entry(struct changed_paths *cp,
+				 const struct name_entry *old_entry,
+				 const struct name_entry *new_entry,
+				 struct strbuf *base)
+{
+	const struct name_entry *e = new_entry ? new_entry : old_entry;
+	size_t baselen = base->len;
+	int ret;
+
+	if (!S_ISDIR(e->mode)) {
+		add_changed_path(cp, base, e->path, e->pathlen);
+		return 0;
+	}
+
+	strbuf_add(base, e->path, e->pathlen);
+	strbuf_addch(base, '/');
+	ret = collect_changed_paths(cp,
+				    old_entry ? &old_entry->oid : NULL,
+				    new_entry ? &new_entry->oid : NULL,
+				    base);
+	strbuf_setlen(base, baselen);
+	return ret;
+}
+
+/*
+ * Collect the paths of all files that differ between the two trees,
+ * exactly like a recursive diff_tree_oid() without rename detection
+ * would report them. Unlike the latter, this does not touch any global
+ * state and can be called from multiple threads at once.
+ *
+ * Returns -1 once more than 'cp->max' files were found.
+ */
+static int collect_changed_paths(struct changed_paths *cp,
+				 const struct object_id *old_oid,
+				 const struct object_id *new_oid,
+				 struct strbuf *base)
+{
+	struct tree_desc t1, t2;
+	void *buf1, *buf2;
+	int ret = 0;
+
+	buf1 = fill_tree_descriptor(cp->repo, &t1, old_oid);
+	buf2 = fill_tree_descriptor(cp->repo, &t2, new_oid);
+
+	while (t1.size || t2.size) {
+		int cmp;
+
+		if (cp->nr > cp->max) {
+			ret = -1;
+			break;
+		}
+
+		if (!t1.size)
+			cmp = 1;
+		else if (!t2.size)
+			cmp = -1;
+		else
+			cmp = base_name_compare(t1.entry.path, t1.entry.pathlen,
+						t1.entry.mode,
+						t2.entry.path, t2.entry.pathlen,
+						t2.entry.mode);
+
+		if (!cmp) {
+			if (!oideq(&t1.entry.oid, &t2.entry.oid) ||
+			    t1.entry.mode != t2.entry.mode)
+				ret = collect_changed_entry(cp, &t1.entry,
+							    &t2.entry, base);
+			update_tree_entry(&t1);
+			update_tree_entry(&t2);
+		} else if (cmp < 0) {
+			ret = collect_changed_entry(cp, &t1.entry, NULL, base);
+			update_tree_entry(&t1);
+		} else {
+			ret = collect_changed_entry(cp, NULL, &t2.entry, base);
+			update_tree_entry(&t2);
+		}
+
+		if (ret)
+			break;
+	}
+
+	free(buf1);
+	free(buf2);
+	return ret;
+}
+
+void compute_bloom_filter(struct repository *r,
+			  struct commit *c,
+			  const struct bloom_filter_settings *settings,
+			  struct bloom_filter *filter,
+			  enum bloom_filter_computed *computed)
+{
+	struct changed_paths cp = {
+		.repo = r,
+		.pathmap = HASHMAP_INIT(pathmap_cmp, NULL),
+		.max = settings->max_changed_paths,
+	};
+	struct strbuf base = STRBUF_INIT;
+	const struct object_id *parent_oid = NULL;
+
+	if (computed)
+		*computed = BLOOM_COMPUTED;
+
+	/*
+	 * Commits are peeled to their trees when reading them, which
+	 * keeps us away from the (shared) parsed tree objects.
+	 */
+	if (c->parents)
+		parent_oid = &c->parents->item->object.oid;
+
+	if (collect_changed_paths(&cp, parent_oid, &c->object.oid, &base) ||
+	    hashmap_get_size(&cp.pathmap) > settings->max_changed_paths) {
+		init_truncated_large_filter(filter);
+		if (computed)
+			*computed |= BLOOM_TRUNC_LARGE;
+		goto cleanup;
+	}
+
+	filter->len = (hashmap_get_size(&cp.pathmap) * settings->bits_per_entry + BITS_PER_WORD - 1) / BITS_PER_WORD;
+	if (!filter->len) {
+		if (computed)
+			*computed |= BLOOM_TRUNC_EMPTY;
+		filter->len = 1;
+	}
+	CALLOC_ARRAY(filter->data, filter->len);
+
+	{
+		struct pathmap_hash_entry *e;
+		struct hashmap_iter iter;
+
+		hashmap_for_each_entry(&cp.pathmap, &iter, e, entry) {
+			struct bloom_key key;
+			fill_bloom_key(e->path, strlen(e->path), &key, settings);
+			add_key_to_filter(&key, filter, settings);
+			clear_bloom_key(&key);
+		}
+	}
+
+cleanup:
+	hashmap_clear_and_free(&cp.pathmap, struct pathmap_hash_entry, entry);
+	strbuf_release(&base);
+}
+
 struct bloom_filter *get_or_compute_bloom_filter(struct repository *r,
 						 struct commit *c,
 						 int compute_if_not_present,
@@ -191,8 +459,6 @@ struct bloom_filter *get_or_compute_bloom_filter(struct repository *r,
 						 enum bloom_filter_computed *computed)
 {
 	struct bloom_filter *filter;
-	int i;
-	struct diff_options diffopt;
 
 	if (computed)
 		*computed = BLOOM_NOT_COMPUTED;
@@ -214,115 +480,187 @@ struct bloom_filter *get_or_compute_bloom_filter(struct repository *r,
 	if (!compute_if_not_present)
 		return NULL;
 
-	repo_diff_setup(r, &diffopt);
-	diffopt.flags.recursive = 1;
-	diffopt.detect_rename = 0;
-	diffopt.max_changes = settings->max_changed_paths;
-	diff_setup_done(&diffopt);
-
 	/* ensure commit is parsed so we have parent information */
 	repo_parse_commit(r, c);
 
-	if (c->parents)
-		diff_tree_oid(&c->parents->item->object.oid, &c->object.oid, "", &diffopt);
-	else
-		diff_tree_oid(NULL, &c->object.oid, "", &diffopt);
-	diffcore_std(&diffopt);
+	compute_bloom_filter(r, c, settings, filter, computed);
+	return filter;
+}
 
-	if (diff_queued_diff.nr <= settings->max_changed_paths) {
-		struct hashmap pathmap = HASHMAP_INIT(pathmap_cmp, NULL);
-		struct pathmap_hash_entry *e;
-		struct hashmap_iter iter;
+void set_bloom_filter(struct commit *c, const struct bloom_filter *filter)
+{
+	*bloom_filter_slab_at(&bloom_filters, c) = *filter;
+}
 
-		for (i = 0; i < diff_queued_diff.nr; i++) {
-			const char *path = diff_queued_diff.queue[i]->two->path;
+int bloom_filter_contains(const struct bloom_filter *filter,
+			  const struct bloom_key *key,
+			  const struct bloom_filter_settings *settings)
+{
+	int i;
+	uint64_t mod = filter->len * BITS_PER_WORD;
 
-			/*
-			 * Add each leading directory of the changed file, i.e. for
-			 * 'dir/subdir/file' add 'dir' and 'dir/subdir' as well, so
-			 * the Bloom filter could be used to speed up commands like
-			 * 'git log dir/subdir', too.
-			 *
-			 * Note that directories are added without the trailing '/'.
-			 */
-			do {
-				char *last_slash = strrchr(path, '/');
+	if (!mod)
+		return -1;
 
-				FLEX_ALLOC_STR(e, path, path);
-				hashmap_entry_init(&e->entry, strhash(path));
+	for (i = 0; i < settings->num_hashes; i++) {
+		uint64_t hash_mod = key->hashes[i] % mod;
+		uint64_t block_pos = hash_mod / BITS_PER_WORD;
+		if (!(filter->data[block_pos] & get_bitmask(hash_mod)))
+			return 0;
+	}
 
-				if (!hashmap_get(&pathmap, &e->entry, NULL))
-					hashmap_add(&pathmap, &e->entry);
-				else
-					free(e);
+	return 1;
+}
 
-				if (!last_slash)
-					last_slash = (char*)path;
-				*last_slash = '\0';
+int bloom_filter_contains_vec(const struct bloom_filter *filter,
+			      const struct bloom_keyvec *vec,
+			      const struct bloom_filter_settings *settings)
+{
+	size_t i;
 
-			} while (*path);
+	for (i = 0; i < vec->count; i++)
+		if (!bloom_filter_contains(filter, &vec->key[i], settings))
+			return 0;
+	return 1;
+}
 
-			diff_free_filepair(diff_queued_diff.queue[i]);
-		}
+struct tree_paths {
+	struct string_list dirs;
+	struct string_list files;
+	uint32_t max;
+	unsigned files_dropped : 1;
+};
 
-		if (hashmap_get_size(&pathmap) > settings->max_changed_paths) {
-			init_truncated_large_filter(filter);
-			if (computed)
-				*computed |= BLOOM_TRUNC_LARGE;
-			goto cleanup;
-		}
+static int collect_tree_path(const struct object_id *oid UNUSED,
+			     struct strbuf *base, const char *pathname,
+			     unsigned mode, void *context)
+{
+	struct tree_paths *tp = context;
+
+	if (S_ISDIR(mode)) {
+		/* Not even the directories fit; give up on this tree. */
+		if (tp->dirs.nr >= tp->max)
+			return -1;
+		string_list_append_nodup(&tp->dirs,
+					 xstrfmt("%s%s", base->buf, pathname));
+		return READ_TREE_RECURSIVE;
+	}
 
-		filter->len = (hashmap_get_size(&pathmap) * settings->bits_per_entry + BITS_PER_WORD - 1) / BITS_PER_WORD;
-		if (!filter->len) {
-			if (computed)
-				*computed |= BLOOM_TRUNC_EMPTY;
-			filter->len = 1;
-		}
-		CALLOC_ARRAY(filter->data, filter->len);
+	if (tp->files_dropped)
+		return 0;
+	if (tp->dirs.nr + tp->files.nr >= tp->max) {
+		tp->files_dropped = 1;
+		string_list_clear(&tp->files, 0);
+		return 0;
+	}
+	string_list_append_nodup(&tp->files,
+				 xstrfmt("%s%s", base->buf, pathname));
+	return 0;
+}
 
-		hashmap_for_each_entry(&pathmap, &iter, e, entry) {
-			struct bloom_key key;
-			fill_bloom_key(e->path, strlen(e->path), &key, settings);
-			add_key_to_filter(&key, filter, settings);
-			clear_bloom_key(&key);
-		}
+static void add_paths_to_filter(const struct string_list *paths,
+				struct bloom_filter *filter,
+				const struct bloom_filter_settings *settings)
+{
+	size_t i;
 
-	cleanup:
-		hashmap_clear_and_free(&pathmap, struct pathmap_hash_entry, entry);
-	} else {
-		for (i = 0; i < diff_queued_diff.nr; i++)
-			diff_free_filepair(diff_queued_diff.queue[i]);
-		init_truncated_large_filter(filter);
+	for (i = 0; i < paths->nr; i++) {
+		struct bloom_key key;
+		const char *path = paths->items[i].string;
+
+		fill_bloom_key(path, strlen(path), &key, settings);
+		add_key_to_filter(&key, filter, settings);
+		clear_bloom_key(&key);
+	}
+}
+
+struct tree_bloom_filter *get_or_compute_tree_bloom_filter(struct repository *r,
+							   struct commit *c,
+							   int compute_if_not_present,
+							   const struct bloom_filter_settings *settings,
+							   enum bloom_filter_computed *computed)
+{
+	struct tree_bloom_filter *tf;
+	struct tree_paths tp = {
+		.dirs = STRING_LIST_INIT_DUP,
+		.files = STRING_LIST_INIT_DUP,
+	};
+	struct pathspec match_all;
+	struct tree *tree;
+	size_t nr;
+
+	if (computed)
+		*computed = BLOOM_NOT_COMPUTED;
+
+	if (!tree_bloom_filters.slab_size)
+		return NULL;
+
+	tf = tree_bloom_filter_slab_at(&tree_bloom_filters, c);
+
+	if (!tf->filter.data) {
+		uint32_t graph_pos;
+		if (repo_find_commit_pos_in_graph(r, c, &graph_pos))
+			load_tree_bloom_filter_from_graph(r->objects->commit_graph,
+							  tf, graph_pos);
+	}
+
+	if (tf->filter.data && tf->filter.len)
+		return tf;
+	if (!compute_if_not_present)
+		return NULL;
+
+	tf->flags = 0;
+	tp.max = settings->max_tree_paths;
+	memset(&match_all, 0, sizeof(match_all));
 
+	tree = repo_get_commit_tree(r, c);
+	if (!tree || read_tree(r, tree, &match_all, collect_tree_path, &tp)) {
+		init_truncated_large_filter(&tf->filter);
 		if (computed)
 			*computed |= BLOOM_TRUNC_LARGE;
+		goto cleanup;
 	}
 
-	if (computed)
-		*computed |= BLOOM_COMPUTED;
+	if (tp.files_dropped || tp.dirs.nr + tp.files.nr > tp.max) {
+		tf->flags |= BLOOM_TREE_DIRS_ONLY;
+		string_list_clear(&tp.files, 0);
+	}
 
-	free(diff_queued_diff.queue);
-	DIFF_QUEUE_CLEAR(&diff_queued_diff);
+	nr = tp.dirs.nr + tp.files.nr;
+	tf->filter.len = (nr * settings->bits_per_entry + BITS_PER_WORD - 1) / BITS_PER_WORD;
+	if (!tf->filter.len) {
+		if (computed)
+			*computed |= BLOOM_TRUNC_EMPTY;
+		tf->filter.len = 1;
+	}
+	CALLOC_ARRAY(tf->filter.data, tf->filter.len);
 
-	return filter;
+	add_paths_to_filter(&tp.dirs, &tf->filter, settings);
+	add_paths_to_filter(&tp.files, &tf->filter, settings);
+
+cleanup:
+	if (computed)
+		*computed |= BLOOM_COMPUTED;
+	string_list_clear(&tp.dirs, 0);
+	string_list_clear(&tp.files, 0);
+	return tf;
 }
 
-int bloom_filter_contains(const struct bloom_filter *filter,
-			  const struct bloom_key *key,
-			  const struct bloom_filter_settings *settings)
+int tree_bloom_filter_contains_vec(const struct tree_bloom_filter *tf,
+				   const struct bloom_keyvec *vec,
+				   const struct bloom_filter_settings *settings)
 {
-	int i;
-	uint64_t mod = filter->len * BITS_PER_WORD;
+	size_t i = 0;
 
-	if (!mod)
-		return -1;
+	/*
+	 * A filter that only records directories says nothing about
+	 * the full path unless that is a directory, too.
+	 */
+	if ((tf->flags & BLOOM_TREE_DIRS_ONLY) && !vec->is_dir)
+		i = 1;
 
-	for (i = 0; i < settings->num_hashes; i++) {
-		uint64_t hash_mod = key->hashes[i] % mod;
-		uint64_t block_pos = hash_mod / BITS_PER_WORD;
-		if (!(filter->data[block_pos] & get_bitmask(hash_mod)))
+	for (; i < vec->count; i++)
+		if (!bloom_filter_contains(&tf->filter, &vec->key[i], settings))
 			return 0;
-	}
-
 	return 1;
 }
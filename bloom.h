@@ -36,10 +36,23 @@ struct bloom_filter_settings {
 	 * Not written to the commit-graph file.
 	 */
 	uint32_t max_changed_paths;
+
+	/*
+	 * The maximum number of paths in a commit's tree that
+	 * a tree-path Bloom filter records. Trees with more
+	 * paths than this only have their directories
+	 * recorded, and trees with more directories than this
+	 * are declared to be too-large.
+	 *
+	 * Not written to the commit-graph file.
+	 */
+	uint32_t max_tree_paths;
 };
 
 #define DEFAULT_BLOOM_MAX_CHANGES 512
-#define DEFAULT_BLOOM_FILTER_SETTINGS { 1, 7, 10, DEFAULT_BLOOM_MAX_CHANGES }
+#define DEFAULT_BLOOM_MAX_TREE_PATHS 1024
+#define DEFAULT_BLOOM_FILTER_SETTINGS { 1, 7, 10, DEFAULT_BLOOM_MAX_CHANGES, \
+					DEFAULT_BLOOM_MAX_TREE_PATHS }
 #define BITS_PER_WORD 8
 #define BLOOMDATA_CHUNK_HEADER_SIZE 3 * sizeof(uint32_t)
 
@@ -68,6 +81,21 @@ struct bloom_key {
 	uint32_t *hashes;
 };
 
+/*
+ * A bloom_keyvec holds the keys for a single path and all of its
+ * leading directories, i.e. 'dir/subdir/file' produces keys for
+ * 'dir/subdir/file', 'dir/subdir' and 'dir', in that order.
+ *
+ * Any path below 'dir/subdir/file' can only be present in a filter
+ * that contains all of these keys. When 'is_dir' is set, the first
+ * key is known to name a directory, too.
+ */
+struct bloom_keyvec {
+	size_t count;
+	unsigned is_dir : 1;
+	struct bloom_key key[FLEX_ARRAY];
+};
+
 /*
  * Calculate the murmur3 32-bit hash value for the given data
  * using the given seed.
@@ -83,6 +111,10 @@ void fill_bloom_key(const char *data,
 		    const struct bloom_filter_settings *settings);
 void clear_bloom_key(struct bloom_key *key);
 
+struct bloom_keyvec *bloom_keyvec_new(const char *path, size_t len,
+				      const struct bloom_filter_settings *settings);
+void bloom_keyvec_free(struct bloom_keyvec *vec);
+
 void add_key_to_filter(const struct bloom_key *key,
 		       struct bloom_filter *filter,
 		       const struct bloom_filter_settings *settings);
@@ -105,8 +137,68 @@ struct bloom_filter *get_or_compute_bloom_filter(struct repository *r,
 #define get_bloom_filter(r, c) get_or_compute_bloom_filter( \
 	(r), (c), 0, NULL, NULL)
 
+/*
+ * Compute the changed-path Bloom filter of the parsed commit 'c' into
+ * 'filter', without consulting or updating the filters that are cached
+ * in memory. This may be called from multiple threads at once, as long
+ * as the object read lock is enabled.
+ */
+void compute_bloom_filter(struct repository *r,
+			  struct commit *c,
+			  const struct bloom_filter_settings *settings,
+			  struct bloom_filter *filter,
+			  enum bloom_filter_computed *computed);
+
+/*
+ * Make a filter returned by compute_bloom_filter() the one that
+ * get_bloom_filter() returns for 'c'.
+ */
+void set_bloom_filter(struct commit *c, const struct bloom_filter *filter);
+
 int bloom_filter_contains(const struct bloom_filter *filter,
 			  const struct bloom_key *key,
 			  const struct bloom_filter_settings *settings);
 
+/*
+ * Returns 0 if a changed-path Bloom filter proves that nothing at or
+ * below the path of 'vec' was changed, and 1 otherwise.
+ */
+int bloom_filter_contains_vec(const struct bloom_filter *filter,
+			      const struct bloom_keyvec *vec,
+			      const struct bloom_filter_settings *settings);
+
+/*
+ * A tree-path Bloom filter records the paths present in the root
+ * tree of a commit, as opposed to the paths the commit changed. It
+ * can prove that a path does not exist in a commit at all, without
+ * the trees having to be read.
+ *
+ * When the tree has more than 'max_tree_paths' entries, only its
+ * directories are recorded and BLOOM_TREE_DIRS_ONLY is set.
+ */
+#define BLOOM_TREE_DIRS_ONLY (1 << 0)
+
+struct tree_bloom_filter {
+	struct bloom_filter filter;
+	unsigned flags;
+};
+
+struct tree_bloom_filter *get_or_compute_tree_bloom_filter(struct repository *r,
+							   struct commit *c,
+							   int compute_if_not_present,
+							   const struct bloom_filter_settings *settings,
+							   enum bloom_filter_computed *computed);
+
+#define get_tree_bloom_filter(r, c) get_or_compute_tree_bloom_filter( \
+	(r), (c), 0, NULL, NULL)
+
+/*
+ * Returns 0 if the tree-path Bloom filter proves that neither the
+ * path of 'vec' nor anything below it exists in the tree, and 1
+ * otherwise.
+ */
+int tree_bloom_filter_contains_vec(const struct tree_bloom_filter *tf,
+				   const struct bloom_keyvec *vec,
+				   const struct bloom_filter_settings *settings);
+
 #endif
@@ -34,6 +34,7 @@
 #include "refs.h"
 #include "setup.h"
 #include "tag.h"
+#include "thread-utils.h"
 #include "write-or-die.h"
 
 static char blame_usage[] = N_("git blame [<options>] [<rev-opts>] [<rev>] [--] <file>");
@@ -66,6 +67,7 @@ static int xdl_opts;
 static int abbrev = -1;
 static int no_whole_file_rename;
 static int show_progress;
+static int num_threads;
 static char repeated_meta_color[COLOR_MAXLEN];
 static int coloring_mode;
 static struct string_list ignore_revs_file_list = STRING_LIST_INIT_NODUP;
@@ -736,6 +738,13 @@ static int git_blame_config(const char *var, const char *value,
 		mark_ignored_lines = git_config_bool(var, value);
 		return 0;
 	}
+	if (!strcmp(var, "blame.threads")) {
+		num_threads = git_config_int(var, value, ctx->kvi);
+		if (num_threads < 0)
+			die(_("invalid number of threads specified (%d) for %s"),
+			    num_threads, var);
+		return 0;
+	}
 	if (!strcmp(var, "color.blame.repeatedlines")) {
 		if (color_parse_mem(value, strlen(value), repeated_meta_color))
 			warning(_("invalid value for '%s': '%s'"),
@@ -883,6 +892,7 @@ int cmd_blame(int argc, const char **argv, const char *prefix)
 		OPT_BOOL(0, "root", &show_root, N_("do not treat root commits as boundaries (Default: off)")),
 		OPT_BOOL(0, "show-stats", &show_stats, N_("show work cost statistics")),
 		OPT_BOOL(0, "progress", &show_progress, N_("force progress reporting")),
+		OPT_INTEGER(0, "threads", &num_threads, N_("use <n> threads to compute diffs ahead of time")),
 		OPT_BIT(0, "score-debug", &output_option, N_("show output score for blame entries"), OUTPUT_SHOW_SCORE),
 		OPT_BIT('f', "show-name", &output_option, N_("show original filename (Default: auto)"), OUTPUT_SHOW_NAME),
 		OPT_BIT('n', "show-number", &output_option, N_("show original linenumber (Default: off)"), OUTPUT_SHOW_NUMBER),
@@ -920,7 +930,9 @@ int cmd_blame(int argc, const char **argv, const char *prefix)
 	const char **opt_usage = cmd_is_annotate ? annotate_opt_usage : blame_opt_usage;
 
 	setup_default_color_by_age();
+	num_threads = 1;
 	git_config(git_blame_config, &output_option);
+	num_threads = git_env_ulong("GIT_TEST_BLAME_THREADS", num_threads);
 	repo_init_revisions(the_repository, &revs, NULL);
 	revs.date_mode = blame_date_mode;
 	revs.diffopt.flags.allow_textconv = 1;
@@ -1177,6 +1189,16 @@ int cmd_blame(int argc, const char **argv, const char *prefix)
 	sb.xdl_opts = xdl_opts;
 	sb.no_whole_file_rename = no_whole_file_rename;
 
+	if (num_threads < 0)
+		die(_("invalid number of threads specified (%d)"), num_threads);
+	else if (!num_threads)
+		num_threads = online_cpus();
+	if (!HAVE_THREADS && num_threads > 1) {
+		warning(_("no threads support, ignoring --threads"));
+		num_threads = 1;
+	}
+	sb.num_threads = num_threads;
+
 	read_mailmap(&mailmap);
 
 	sb.found_guilty_entry = &found_guilty_entry;
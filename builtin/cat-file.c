@@ -17,6 +17,7 @@
 #include "streaming.h"
 #include "tree-walk.h"
 #include "oid-array.h"
+#include "bulk-read.h"
 #include "packfile.h"
 #include "object-file.h"
 #include "object-name.h"
@@ -299,6 +300,14 @@ struct expand_data {
 	 * optimized out.
 	 */
 	unsigned skip_object_info : 1;
+
+	/*
+	 * The contents of the object if they have been read already by
+	 * bulk_read_objects(), or NULL.
+	 */
+	void *contents;
+	enum object_type contents_type;
+	unsigned long contents_size;
 };
 
 static int is_atom(const char *atom, const char *s, int slen)
@@ -375,6 +384,15 @@ static void print_object_or_die(struct batch_options *opt, struct expand_data *d
 
 	assert(data->info.typep);
 
+	if (data->contents) {
+		if (data->contents_type != data->type)
+			die("object %s changed type!?", oid_to_hex(oid));
+		if (data->info.sizep && data->contents_size != data->size)
+			die("object %s changed size!?", oid_to_hex(oid));
+		batch_write(opt, data->contents, data->contents_size);
+		return;
+	}
+
 	if (data->type == OBJ_BLOB) {
 		if (opt->buffer_output)
 			fflush(stdout);
@@ -625,6 +643,28 @@ static int batch_unordered_packed(const struct object_id *oid,
 				      data);
 }
 
+static int collect_unique_object(const struct object_id *oid, void *data)
+{
+	oid_array_append(data, oid);
+	return 0;
+}
+
+static int batch_bulk_object(const struct object_id *oid,
+			     enum object_type type, unsigned long size,
+			     void *buf, void *vdata)
+{
+	struct object_cb_data *data = vdata;
+
+	oidcpy(&data->expand->oid, oid);
+	data->expand->contents = buf;
+	data->expand->contents_type = type;
+	data->expand->contents_size = size;
+	batch_object_write(NULL, data->scratch, data->opt, data->expand,
+			   NULL, 0);
+	FREE_AND_NULL(data->expand->contents);
+	return 0;
+}
+
 typedef void (*parse_cmd_fn_t)(struct batch_options *, const char *,
 			       struct strbuf *, struct expand_data *);
 
@@ -805,7 +845,26 @@ static int batch_objects(struct batch_options *opt)
 		cb.expand = &data;
 		cb.scratch = &output;
 
-		if (opt->unordered) {
+		if (opt->unordered && opt->batch_mode == BATCH_MODE_CONTENTS &&
+		    !opt->transform_mode && !use_mailmap) {
+			struct oid_array sa = OID_ARRAY_INIT;
+			struct oid_array unique = OID_ARRAY_INIT;
+
+			/*
+			 * Read the contents in pack order, reconstructing
+			 * shared delta bases only once.
+			 */
+			for_each_loose_object(collect_loose_object, &sa, 0);
+			for_each_packed_object(collect_packed_object, &sa, 0);
+			oid_array_for_each_unique(&sa, collect_unique_object,
+						  &unique);
+			oid_array_clear(&sa);
+
+			bulk_read_objects(the_repository, unique.oid, unique.nr,
+					  batch_bulk_object, &cb);
+
+			oid_array_clear(&unique);
+		} else if (opt->unordered) {
 			struct oidset seen = OIDSET_INIT;
 
 			cb.seen = &seen;
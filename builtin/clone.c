@@ -89,6 +89,7 @@ static int config_filter_submodules = -1;    /* unspecified */
 static struct string_list server_options = STRING_LIST_INIT_NODUP;
 static int option_remote_submodules;
 static const char *bundle_uri;
+static const char *ref_format;
 
 static int recurse_submodules_cb(const struct option *opt,
 				 const char *arg, int unset)
@@ -171,6 +172,8 @@ static struct option builtin_clone_options[] = {
 		    N_("initialize sparse-checkout file to include only files at root")),
 	OPT_STRING(0, "bundle-uri", &bundle_uri,
 		   N_("uri"), N_("a URI for downloading bundles before fetching from origin remote")),
+	OPT_STRING(0, "ref-format", &ref_format, N_("format"),
+		   N_("specify the reference format to use")),
 	OPT_END()
 };
 
@@ -930,6 +933,7 @@ int cmd_clone(int argc, const char **argv, const char *prefix)
 	int submodule_progress;
 	int filter_submodules = 0;
 	int hash_algo;
+	unsigned int ref_storage_format = REF_STORAGE_FORMAT_UNKNOWN;
 	const int do_not_override_repo_unix_permissions = -1;
 
 	struct transport_ls_refs_options transport_ls_refs_options =
@@ -1097,14 +1101,35 @@ int cmd_clone(int argc, const char **argv, const char *prefix)
 		}
 	}
 
-	init_db(git_dir, real_git_dir, option_template, GIT_HASH_UNKNOWN, NULL,
-		do_not_override_repo_unix_permissions, INIT_DB_QUIET);
+	if (ref_format) {
+		ref_storage_format = ref_storage_format_by_name(ref_format);
+		if (ref_storage_format == REF_STORAGE_FORMAT_UNKNOWN)
+			die(_("unknown ref storage format '%s'"), ref_format);
+	}
+
+	/*
+	 * We do not know the object format of the remote repository yet,
+	 * so defer creation of the reference database until we do.
+	 */
+	init_db(git_dir, real_git_dir, option_template, GIT_HASH_UNKNOWN,
+		ref_storage_format, NULL,
+		do_not_override_repo_unix_permissions,
+		INIT_DB_QUIET | INIT_DB_SKIP_REFDB);
 
 	if (real_git_dir) {
 		free((char *)git_dir);
 		git_dir = real_git_dir;
 	}
 
+	/*
+	 * Until the reference database exists the repository cannot be
+	 * discovered, yet helpers that we spawn before that point (e.g. for
+	 * "--sparse") need to find it. Write a HEAD that points to an invalid
+	 * branch so that the repository is recognized; it is replaced once
+	 * we know what the remote HEAD is.
+	 */
+	write_file(git_path("HEAD"), "ref: refs/heads/.invalid");
+
 	/*
 	 * additional config can be injected with -c, make sure it's included
 	 * after init_db, which clears the entire config environment.
@@ -1324,8 +1349,10 @@ int cmd_clone(int argc, const char **argv, const char *prefix)
 		 * let's set ours to the same thing.
 		 */
 	hash_algo = hash_algo_by_ptr(transport_get_hash_algo(transport));
-	initialize_repository_version(hash_algo, 1);
+	initialize_repository_version(hash_algo,
+				      the_repository->ref_storage_format, 1);
 	repo_set_hash_algo(the_repository, hash_algo);
+	create_reference_database(the_repository->ref_storage_format, NULL, 1);
 
 	if (mapped_refs) {
 		/*
@@ -21,7 +21,8 @@
 #define BUILTIN_COMMIT_GRAPH_WRITE_USAGE \
 	N_("git commit-graph write [--object-dir <dir>] [--append]\n" \
 	   "                       [--split[=<strategy>]] [--reachable | --stdin-packs | --stdin-commits]\n" \
-	   "                       [--changed-paths] [--[no-]max-new-filters <n>] [--[no-]progress]\n" \
+	   "                       [--changed-paths] [--tree-paths] [--[no-]max-new-filters <n>]\n" \
+	   "                       [--reach-labels] [--threads=<n>] [--[no-]progress]\n" \
 	   "                       <split options>")
 
 static const char * builtin_commit_graph_verify_usage[] = {
@@ -50,6 +51,8 @@ static struct opts_commit_graph {
 	int shallow;
 	int progress;
 	int enable_changed_paths;
+	int enable_tree_paths;
+	int enable_reach_labels;
 } opts;
 
 static struct option common_opts[] = {
@@ -220,6 +223,10 @@ static int graph_write(int argc, const char **argv, const char *prefix)
 			N_("include all commits already in the commit-graph file")),
 		OPT_BOOL(0, "changed-paths", &opts.enable_changed_paths,
 			N_("enable computation for changed paths")),
+		OPT_BOOL(0, "tree-paths", &opts.enable_tree_paths,
+			N_("enable computation for the paths in each commit's tree")),
+		OPT_BOOL(0, "reach-labels", &opts.enable_reach_labels,
+			N_("enable computation of reachability labels")),
 		OPT_CALLBACK_F(0, "split", &write_opts.split_flags, NULL,
 			N_("allow writing an incremental commit-graph file"),
 			PARSE_OPT_OPTARG | PARSE_OPT_NONEG,
@@ -233,6 +240,8 @@ static int graph_write(int argc, const char **argv, const char *prefix)
 		OPT_CALLBACK_F(0, "max-new-filters", &write_opts.max_new_filters,
 			NULL, N_("maximum number of changed-path Bloom filters to compute"),
 			0, write_option_max_new_filters),
+		OPT_INTEGER(0, "threads", &write_opts.threads,
+			N_("use threads when computing changed-path Bloom filters")),
 		OPT_BOOL(0, "progress", &opts.progress,
 			 N_("force progress reporting")),
 		OPT_END(),
@@ -241,6 +250,8 @@ static int graph_write(int argc, const char **argv, const char *prefix)
 
 	opts.progress = isatty(2);
 	opts.enable_changed_paths = -1;
+	opts.enable_tree_paths = -1;
+	opts.enable_reach_labels = -1;
 	write_opts.size_multiple = 2;
 	write_opts.max_commits = 0;
 	write_opts.expire_time = 0;
@@ -258,6 +269,13 @@ static int graph_write(int argc, const char **argv, const char *prefix)
 
 	if (opts.reachable + opts.stdin_packs + opts.stdin_commits > 1)
 		die(_("use at most one of --reachable, --stdin-commits, or --stdin-packs"));
+	if (write_opts.threads < 0)
+		die(_("invalid number of threads specified (%d)"),
+		    write_opts.threads);
+	if (!HAVE_THREADS && write_opts.threads != 1) {
+		warning(_("no threads support, ignoring --threads"));
+		write_opts.threads = 1;
+	}
 	if (!opts.obj_dir)
 		opts.obj_dir = get_object_directory();
 	if (opts.append)
@@ -271,6 +289,14 @@ static int graph_write(int argc, const char **argv, const char *prefix)
 	if (opts.enable_changed_paths == 1 ||
 	    git_env_bool(GIT_TEST_COMMIT_GRAPH_CHANGED_PATHS, 0))
 		flags |= COMMIT_GRAPH_WRITE_BLOOM_FILTERS;
+	if (!opts.enable_tree_paths)
+		flags |= COMMIT_GRAPH_NO_WRITE_TREE_BLOOM_FILTERS;
+	if (opts.enable_tree_paths == 1)
+		flags |= COMMIT_GRAPH_WRITE_TREE_BLOOM_FILTERS;
+	if (!opts.enable_reach_labels)
+		flags |= COMMIT_GRAPH_NO_WRITE_REACH_LABELS;
+	if (opts.enable_reach_labels == 1)
+		flags |= COMMIT_GRAPH_WRITE_REACH_LABELS;
 
 	odb = find_odb(the_repository, opts.obj_dir);
 
@@ -83,7 +83,7 @@ static int prune_tags = -1; /* unspecified */
 
 static int append, dry_run, force, keep, update_head_ok;
 static int write_fetch_head = 1;
-static int verbosity, deepen_relative, set_upstream, refetch;
+static int verbosity, deepen_relative, set_upstream, refetch, object_fetch;
 static int progress = -1;
 static int tags = TAGS_DEFAULT, update_shallow, deepen;
 static int atomic_fetch;
@@ -1505,6 +1505,8 @@ static struct transport *prepare_transport(struct remote *remote, int deepen)
 		set_option(transport, TRANS_OPT_UPDATE_SHALLOW, "yes");
 	if (refetch)
 		set_option(transport, TRANS_OPT_REFETCH, "yes");
+	if (object_fetch)
+		set_option(transport, TRANS_OPT_OBJECT_FETCH, "yes");
 	if (filter_options.choice) {
 		const char *spec =
 			expand_list_objects_filter_spec(&filter_options);
@@ -2195,6 +2197,8 @@ int cmd_fetch(int argc, const char **argv, const char *prefix)
 		OPT_SET_INT_F(0, "refetch", &refetch,
 			      N_("re-fetch without negotiating common commits"),
 			      1, PARSE_OPT_NONEG),
+		OPT_HIDDEN_BOOL(0, "object-fetch", &object_fetch,
+				N_("fetch exactly the given objects if the server allows")),
 		{ OPTION_STRING, 0, "submodule-prefix", &submodule_prefix, N_("dir"),
 			   N_("prepend this to submodule path output"), PARSE_OPT_HIDDEN },
 		OPT_CALLBACK_F(0, "recurse-submodules-default",
@@ -30,6 +30,7 @@
 #include "worktree.h"
 #include "pack-revindex.h"
 #include "pack-bitmap.h"
+#include "tree-preload.h"
 
 #define REACHABLE 0x0001
 #define SEEN      0x0002
@@ -119,11 +120,13 @@ static int fsck_error_func(struct fsck_options *o UNUSED,
 }
 
 static struct object_array pending;
+static struct tree_preload *tree_preload;
 
 static int mark_object(struct object *obj, enum object_type type,
 		       void *data, struct fsck_options *options UNUSED)
 {
 	struct object *parent = data;
+	int promisor;
 
 	/*
 	 * The only case data is NULL or type is OBJ_ANY is when
@@ -150,7 +153,11 @@ static int mark_object(struct object *obj, enum object_type type,
 		return 0;
 	obj->flags |= REACHABLE;
 
-	if (is_promisor_object(&obj->oid))
+	/* Worker threads may be reading trees; see traverse_reachable(). */
+	obj_read_lock();
+	promisor = is_promisor_object(&obj->oid);
+	obj_read_unlock();
+	if (promisor)
 		/*
 		 * Further recursion does not need to be performed on this
 		 * object since it is a promisor object (so it does not need to
@@ -172,6 +179,8 @@ static int mark_object(struct object *obj, enum object_type type,
 	}
 
 	add_object_array(obj, NULL, &pending);
+	if (obj->type == OBJ_TREE)
+		tree_preload_add(tree_preload, &obj->oid, 1);
 	return 0;
 }
 
@@ -182,7 +191,11 @@ static void mark_object_reachable(struct object *obj)
 
 static int traverse_one_object(struct object *obj)
 {
-	int result = fsck_walk(obj, obj, &fsck_walk_options);
+	int result;
+
+	if (obj->type == OBJ_TREE)
+		tree_preload_fill(tree_preload, (struct tree *)obj);
+	result = fsck_walk(obj, obj, &fsck_walk_options);
 
 	if (obj->type == OBJ_TREE) {
 		struct tree *tree = (struct tree *)obj;
@@ -196,6 +209,20 @@ static int traverse_reachable(void)
 	struct progress *progress = NULL;
 	unsigned int nr = 0;
 	int result = 0;
+	size_t i;
+
+	/*
+	 * Have worker threads read the trees we are about to walk, in
+	 * the order we pop them from "pending". Everything we do in the
+	 * meantime reads objects only through functions that take
+	 * obj_read_lock.
+	 */
+	tree_preload = tree_preload_start(the_repository);
+	for (i = 0; i < pending.nr; i++)
+		if (pending.objects[i].item->type == OBJ_TREE)
+			tree_preload_add(tree_preload,
+					 &pending.objects[i].item->oid, 1);
+
 	if (show_progress)
 		progress = start_delayed_progress(_("Checking connectivity"), 0);
 	while (pending.nr) {
@@ -203,6 +230,9 @@ static int traverse_reachable(void)
 		display_progress(progress, ++nr);
 	}
 	stop_progress(&progress);
+
+	tree_preload_stop(tree_preload);
+	tree_preload = NULL;
 	return !!result;
 }
 
@@ -36,6 +36,7 @@
 #include "promisor-remote.h"
 #include "refs.h"
 #include "remote.h"
+#include "rename-cache.h"
 #include "exec-cmd.h"
 #include "gettext.h"
 #include "hook.h"
@@ -61,6 +62,8 @@ static timestamp_t gc_log_expire_time;
 static const char *gc_log_expire = "1.day.ago";
 static const char *prune_expire = "2.weeks.ago";
 static const char *prune_worktrees_expire = "3.months.ago";
+static const char *rename_cache_expire = "2.weeks.ago";
+static timestamp_t rename_cache_expire_time;
 static unsigned long big_pack_threshold;
 static unsigned long max_delta_cache_size = DEFAULT_DELTA_CACHE_SIZE;
 
@@ -165,6 +168,7 @@ static void gc_config(void)
 	git_config_get_bool("gc.cruftpacks", &cruft_packs);
 	git_config_get_expiry("gc.pruneexpire", &prune_expire);
 	git_config_get_expiry("gc.worktreepruneexpire", &prune_worktrees_expire);
+	git_config_get_expiry("gc.renamecacheexpire", &rename_cache_expire);
 	git_config_get_expiry("gc.logexpiry", &gc_log_expire);
 
 	git_config_get_ulong("gc.bigpackthreshold", &big_pack_threshold);
@@ -599,6 +603,10 @@ int cmd_gc(int argc, const char **argv, const char *prefix)
 	gc_config();
 	if (parse_expiry_date(gc_log_expire, &gc_log_expire_time))
 		die(_("failed to parse gc.logExpiry value %s"), gc_log_expire);
+	if (rename_cache_expire &&
+	    parse_expiry_date(rename_cache_expire, &rename_cache_expire_time))
+		die(_("failed to parse gc.renameCacheExpire value %s"),
+		    rename_cache_expire);
 
 	if (pack_refs < 0)
 		pack_refs = !is_bare_repository();
@@ -729,6 +737,9 @@ int cmd_gc(int argc, const char **argv, const char *prefix)
 	if (run_command(&rerere_cmd))
 		die(FAILED_RUN, rerere.v[0]);
 
+	if (rename_cache_expire)
+		rename_cache_prune(the_repository, rename_cache_expire_time);
+
 	report_garbage = report_pack_garbage;
 	reprepare_packed_git(the_repository);
 	if (pack_garbage.nr > 0) {
@@ -8,6 +8,7 @@
 #include "hex.h"
 #include "repository.h"
 #include "config.h"
+#include "environment.h"
 #include "blob.h"
 #include "tree.h"
 #include "commit.h"
@@ -32,6 +33,7 @@
 #include "path.h"
 #include "read-cache-ll.h"
 #include "write-or-die.h"
+#include "trace2.h"
 
 static const char *grep_prefix;
 
@@ -46,6 +48,26 @@ static int num_threads;
 
 static pthread_t *threads;
 
+/* Should blobs be read ahead of the consumer threads? */
+static int read_ahead = 1;
+static pthread_t read_ahead_thread;
+static int read_ahead_started;
+static intmax_t read_ahead_count;
+
+/*
+ * The read-ahead thread picks up blobs which are waiting in 'todo'
+ * and reads them before a consumer gets to them. A consumer which
+ * picks up an item that has been queued but is not being read yet
+ * reads it itself; one that picks up an item which is being read
+ * waits for it.
+ */
+enum read_ahead_state {
+	READ_AHEAD_NONE = 0,
+	READ_AHEAD_QUEUED,
+	READ_AHEAD_RUNNING,
+	READ_AHEAD_DONE,
+};
+
 /* We use one producer thread and THREADS consumer
  * threads. The producer adds struct work_items to 'todo' and the
  * consumers pick work items from the same array.
@@ -53,6 +75,7 @@ static pthread_t *threads;
 struct work_item {
 	struct grep_source source;
 	char done;
+	enum read_ahead_state read_ahead;
 	struct strbuf out;
 };
 
@@ -101,6 +124,12 @@ static pthread_cond_t cond_write;
 /* Signalled when we are finished with everything. */
 static pthread_cond_t cond_result;
 
+/* Signalled for the read-ahead thread when a new work_item is added. */
+static pthread_cond_t cond_read_ahead;
+
+/* Signalled when the read-ahead thread has read a work_item. */
+static pthread_cond_t cond_read_ahead_done;
+
 static int skip_first_line;
 
 static void add_work(struct grep_opt *opt, struct grep_source *gs)
@@ -116,10 +145,13 @@ static void add_work(struct grep_opt *opt, struct grep_source *gs)
 
 	todo[todo_end].source = *gs;
 	todo[todo_end].done = 0;
+	todo[todo_end].read_ahead = READ_AHEAD_NONE;
 	strbuf_reset(&todo[todo_end].out);
 	todo_end = (todo_end + 1) % ARRAY_SIZE(todo);
 
 	pthread_cond_signal(&cond_add);
+	if (read_ahead_started && gs->type == GREP_SOURCE_OID)
+		pthread_cond_signal(&cond_read_ahead);
 	grep_unlock();
 }
 
@@ -137,6 +169,16 @@ static struct work_item *get_work(void)
 	} else {
 		ret = &todo[todo_start];
 		todo_start = (todo_start + 1) % ARRAY_SIZE(todo);
+
+		/*
+		 * Read the blob ourselves rather than waiting for the
+		 * read-ahead thread to get to it, unless it is busy
+		 * reading it already.
+		 */
+		if (ret->read_ahead == READ_AHEAD_QUEUED)
+			ret->read_ahead = READ_AHEAD_NONE;
+		while (ret->read_ahead == READ_AHEAD_RUNNING)
+			pthread_cond_wait(&cond_read_ahead_done, &grep_mutex);
 	}
 	grep_unlock();
 	return ret;
@@ -214,6 +256,137 @@ static void *run(void *arg)
 	return (void*) (intptr_t) hit;
 }
 
+#define READ_AHEAD_BATCH (TODO_SIZE / 2)
+
+struct read_ahead_entry {
+	struct work_item *w;
+	struct repository *repo;
+	struct object_id oid;
+	struct packed_git *pack;
+	off_t offset;
+};
+
+static int read_ahead_entry_cmp(const void *va, const void *vb)
+{
+	const struct read_ahead_entry *a = va, *b = vb;
+
+	/* Loose objects go last, in the order they were queued. */
+	if (!a->pack || !b->pack) {
+		if (a->pack != b->pack)
+			return a->pack ? -1 : 1;
+		return a->w < b->w ? -1 : a->w > b->w;
+	}
+	if (a->pack != b->pack)
+		return strcmp(a->pack->pack_name, b->pack->pack_name);
+	return a->offset < b->offset ? -1 : a->offset > b->offset;
+}
+
+/*
+ * Queue up to READ_AHEAD_BATCH blobs which no consumer has picked up
+ * yet, waiting for the producer if there are none. Returns 0 once all
+ * work has been added and there is nothing left to read.
+ */
+static int get_read_ahead_batch(struct read_ahead_entry *batch)
+{
+	int nr = 0;
+
+	grep_lock();
+	while (1) {
+		int pos;
+
+		for (pos = todo_start;
+		     pos != todo_end && nr < READ_AHEAD_BATCH;
+		     pos = (pos + 1) % ARRAY_SIZE(todo)) {
+			struct work_item *w = &todo[pos];
+
+			if (w->read_ahead != READ_AHEAD_NONE ||
+			    w->source.type != GREP_SOURCE_OID)
+				continue;
+			w->read_ahead = READ_AHEAD_QUEUED;
+			batch[nr].w = w;
+			batch[nr].repo = w->source.repo;
+			oidcpy(&batch[nr].oid, w->source.identifier);
+			nr++;
+		}
+		if (nr || all_work_added)
+			break;
+		pthread_cond_wait(&cond_read_ahead, &grep_mutex);
+	}
+	grep_unlock();
+	return nr;
+}
+
+/*
+ * Read blobs in the order in which they are stored in their packs,
+ * rather than in the order of their paths, so that packs are read
+ * sequentially and delta bases are found in the cache.
+ */
+static void *run_read_ahead(void *arg UNUSED)
+{
+	struct read_ahead_entry batch[READ_AHEAD_BATCH];
+	int nr;
+
+	while ((nr = get_read_ahead_batch(batch))) {
+		int i;
+
+		for (i = 0; i < nr; i++) {
+			struct object_info oi = OBJECT_INFO_INIT;
+			unsigned long size;
+
+			oi.sizep = &size;
+			batch[i].pack = NULL;
+			if (oid_object_info_extended(batch[i].repo, &batch[i].oid,
+						     &oi, OBJECT_INFO_QUICK |
+						     OBJECT_INFO_SKIP_FETCH_OBJECT) < 0 ||
+			    size > big_file_threshold) {
+				/* Leave it to the consumer. */
+				batch[i].w = NULL;
+				continue;
+			}
+			if (oi.whence == OI_PACKED) {
+				batch[i].pack = oi.u.packed.pack;
+				batch[i].offset = oi.u.packed.offset;
+			}
+		}
+		QSORT(batch, nr, read_ahead_entry_cmp);
+
+		for (i = 0; i < nr; i++) {
+			struct work_item *w = batch[i].w;
+			enum object_type type;
+			unsigned long size;
+			void *data;
+
+			if (!w)
+				continue;
+
+			grep_lock();
+			if (w->read_ahead != READ_AHEAD_QUEUED) {
+				/* A consumer has taken it already. */
+				grep_unlock();
+				continue;
+			}
+			w->read_ahead = READ_AHEAD_RUNNING;
+			read_ahead_count++;
+			grep_unlock();
+
+			data = repo_read_object_file(batch[i].repo,
+						     &batch[i].oid,
+						     &type, &size);
+
+			grep_lock();
+			if (data) {
+				w->source.buf = data;
+				w->source.size = size;
+			}
+			w->read_ahead = READ_AHEAD_DONE;
+			pthread_cond_broadcast(&cond_read_ahead_done);
+			grep_unlock();
+		}
+	}
+
+	return NULL;
+}
+
 static void strbuf_out(struct grep_opt *opt, const void *buf, size_t size)
 {
 	struct work_item *w = opt->output_priv;
@@ -229,6 +402,8 @@ static void start_threads(struct grep_opt *opt)
 	pthread_cond_init(&cond_add, NULL);
 	pthread_cond_init(&cond_write, NULL);
 	pthread_cond_init(&cond_result, NULL);
+	pthread_cond_init(&cond_read_ahead, NULL);
+	pthread_cond_init(&cond_read_ahead_done, NULL);
 	grep_use_locks = 1;
 	enable_obj_read_lock();
 
@@ -248,6 +423,15 @@ static void start_threads(struct grep_opt *opt)
 			die(_("grep: failed to create thread: %s"),
 			    strerror(err));
 	}
+
+	if (read_ahead) {
+		int err = pthread_create(&read_ahead_thread, NULL,
+					 run_read_ahead, NULL);
+		if (err)
+			die(_("grep: failed to create thread: %s"),
+			    strerror(err));
+		read_ahead_started = 1;
+	}
 }
 
 static int wait_all(void)
@@ -269,6 +453,7 @@ static int wait_all(void)
 	 * is no more work to do.
 	 */
 	pthread_cond_broadcast(&cond_add);
+	pthread_cond_broadcast(&cond_read_ahead);
 	grep_unlock();
 
 	for (i = 0; i < num_threads; i++) {
@@ -276,6 +461,12 @@ static int wait_all(void)
 		pthread_join(threads[i], &h);
 		hit |= (int) (intptr_t) h;
 	}
+	if (read_ahead_started) {
+		pthread_join(read_ahead_thread, NULL);
+		read_ahead_started = 0;
+		trace2_data_intmax("grep", the_repository, "read_ahead/count",
+				   read_ahead_count);
+	}
 
 	free(threads);
 
@@ -284,6 +475,8 @@ static int wait_all(void)
 	pthread_cond_destroy(&cond_add);
 	pthread_cond_destroy(&cond_write);
 	pthread_cond_destroy(&cond_result);
+	pthread_cond_destroy(&cond_read_ahead);
+	pthread_cond_destroy(&cond_read_ahead_done);
 	grep_use_locks = 0;
 	disable_obj_read_lock();
 
@@ -316,6 +509,9 @@ static int grep_cmd_config(const char *var, const char *value,
 		}
 	}
 
+	if (!strcmp(var, "grep.readahead"))
+		read_ahead = git_config_bool(var, value);
+
 	if (!strcmp(var, "submodule.recurse"))
 		recurse_submodules = git_config_bool(var, value);
 
@@ -1194,6 +1390,15 @@ int cmd_grep(int argc, const char **argv, const char *prefix)
 		if (startup_info->have_repository)
 			(void)get_packed_git(the_repository);
 
+		/*
+		 * Only blobs from the object database are read ahead, and
+		 * those which are converted with textconv are read by
+		 * fill_textconv() instead.
+		 */
+		if (!use_index || untracked || !(cached || list.nr) ||
+		    opt.allow_textconv)
+			read_ahead = 0;
+
 		start_threads(&opt);
 	} else {
 		/*
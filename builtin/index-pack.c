@@ -579,6 +579,19 @@ static void *unpack_data(struct object_entry *obj,
 	data = xmallocz(consume ? 64*1024 : obj->size);
 	inbuf = xmalloc((len < 64*1024) ? (int)len : 64*1024);
 
+	/*
+	 * Small objects fit into the input buffer as a whole, and we know
+	 * how large they inflate to, so they can be inflated in one go.
+	 */
+	if (!consume && len <= 64*1024) {
+		ssize_t n = pread_in_full(get_thread_data()->pack_fd, inbuf,
+					  len, from);
+		if (n == len && !git_inflate_buffer(inbuf, len, data, obj->size)) {
+			free(inbuf);
+			return data;
+		}
+	}
+
 	memset(&stream, 0, sizeof(stream));
 	git_inflate_init(&stream);
 	stream.next_out = data;
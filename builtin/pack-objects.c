@@ -221,13 +221,18 @@ static int thin;
 static int num_preferred_base;
 static struct progress *progress_state;
 
-static struct packed_git *reuse_packfile;
+static struct bitmapped_pack *reuse_packfiles;
+static size_t reuse_packfiles_nr;
 static uint32_t reuse_packfile_objects;
 static struct bitmap *reuse_packfile_bitmap;
 
 static int use_bitmap_index_default = 1;
 static int use_bitmap_index = -1;
-static int allow_pack_reuse = 1;
+static enum {
+	NO_PACK_REUSE = 0,
+	SINGLE_PACK_REUSE,
+	MULTI_PACK_REUSE,
+} allow_pack_reuse = SINGLE_PACK_REUSE;
 static enum {
 	WRITE_BITMAP_FALSE = 0,
 	WRITE_BITMAP_QUIET,
@@ -963,27 +968,32 @@ static struct object_entry **compute_write_order(void)
  * packfile.
  */
 
-static struct reused_chunk {
+struct reused_chunk {
 	/* The offset of the first object of this chunk in the original
 	 * packfile. */
 	off_t original;
 	/* The difference for "original" minus the offset of the first object of
 	 * this chunk in the generated packfile. */
 	off_t difference;
+};
+
+/* The chunks reused from each of "reuse_packfiles", in the same order. */
+static struct reused_chunks {
+	struct reused_chunk *chunk;
+	int nr;
+	int alloc;
 } *reused_chunks;
-static int reused_chunks_nr;
-static int reused_chunks_alloc;
 
-static void record_reused_object(off_t where, off_t offset)
+static void record_reused_object(struct reused_chunks *chunks,
+				 off_t where, off_t offset)
 {
-	if (reused_chunks_nr && reused_chunks[reused_chunks_nr-1].difference == offset)
+	if (chunks->nr && chunks->chunk[chunks->nr-1].difference == offset)
 		return;
 
-	ALLOC_GROW(reused_chunks, reused_chunks_nr + 1,
-		   reused_chunks_alloc);
-	reused_chunks[reused_chunks_nr].original = where;
-	reused_chunks[reused_chunks_nr].difference = offset;
-	reused_chunks_nr++;
+	ALLOC_GROW(chunks->chunk, chunks->nr + 1, chunks->alloc);
+	chunks->chunk[chunks->nr].original = where;
+	chunks->chunk[chunks->nr].difference = offset;
+	chunks->nr++;
 }
 
 /*
@@ -992,30 +1002,92 @@ static void record_reused_object(off_t where, off_t offset)
  * chunk that contains it (which implicitly ends at the start
  * of the next chunk.
  */
-static off_t find_reused_offset(off_t where)
+static off_t find_reused_offset(struct reused_chunks *chunks, off_t where)
 {
-	int lo = 0, hi = reused_chunks_nr;
+	int lo = 0, hi = chunks->nr;
 	while (lo < hi) {
 		int mi = lo + ((hi - lo) / 2);
-		if (where == reused_chunks[mi].original)
-			return reused_chunks[mi].difference;
-		if (where < reused_chunks[mi].original)
+		if (where == chunks->chunk[mi].original)
+			return chunks->chunk[mi].difference;
+		if (where < chunks->chunk[mi].original)
 			hi = mi;
 		else
 			lo = mi + 1;
 	}
 
 	/*
-	 * The first chunk starts at zero, so we can't have gone below
-	 * there.
+	 * The first chunk starts at the first object we reused from
+	 * the pack, so we can't have gone below there.
 	 */
 	assert(lo);
-	return reused_chunks[lo-1].difference;
+	return chunks->chunk[lo-1].difference;
+}
+
+/*
+ * Whether bit positions within the range of "pack" map directly to
+ * its pack positions, which is the case unless the MIDX selected some
+ * of its objects from other packs.
+ */
+static int reuse_pack_is_contiguous(struct bitmapped_pack *pack)
+{
+	return pack->bitmap_nr == pack->p->num_objects;
+}
+
+/*
+ * Return the offset in the generated packfile of the base of a delta
+ * reused from "reuse_packfiles[pack_idx]", which refers to it as the
+ * object at "base_offset" of that pack.
+ *
+ * When the MIDX selected a copy of the base from another pack, that is
+ * the copy we sent (try_partial_reuse() made sure of it), earlier on.
+ */
+static off_t reused_base_offset(size_t pack_idx, off_t base_offset)
+{
+	struct bitmapped_pack *pack = &reuse_packfiles[pack_idx];
+	struct multi_pack_index *m = pack->from_midx;
+	uint32_t pack_pos, midx_pos, bitmap_pos;
+	struct object_id base_oid;
+	size_t lo = 0, hi = pack_idx;
+
+	if (!m || reuse_pack_is_contiguous(pack) ||
+	    !midx_pair_to_pack_pos(m, pack->pack_int_id, base_offset,
+				   &bitmap_pos))
+		return base_offset -
+			find_reused_offset(&reused_chunks[pack_idx], base_offset);
+
+	if (offset_to_pack_pos(pack->p, base_offset, &pack_pos) < 0)
+		die(_("expected object at offset %"PRIuMAX" in pack %s"),
+		    (uintmax_t)base_offset, pack->p->pack_name);
+	nth_packed_object_id(&base_oid, pack->p,
+			     pack_pos_to_index(pack->p, pack_pos));
+	if (!bsearch_midx(&base_oid, m, &midx_pos) ||
+	    midx_to_pack_pos(m, midx_pos, &bitmap_pos) < 0)
+		BUG("delta base %s is not in the multi-pack-index",
+		    oid_to_hex(&base_oid));
+
+	while (lo < hi) {
+		size_t mi = lo + ((hi - lo) / 2);
+		struct bitmapped_pack *other = &reuse_packfiles[mi];
+
+		if (bitmap_pos < other->bitmap_pos) {
+			hi = mi;
+		} else if (bitmap_pos >= other->bitmap_pos + other->bitmap_nr) {
+			lo = mi + 1;
+		} else {
+			off_t other_offset = nth_midxed_offset(m, midx_pos);
+			return other_offset -
+				find_reused_offset(&reused_chunks[mi], other_offset);
+		}
+	}
+
+	BUG("delta base %s was not reused", oid_to_hex(&base_oid));
 }
 
-static void write_reused_pack_one(size_t pos, struct hashfile *out,
+static void write_reused_pack_one(size_t pack_idx, uint32_t pos,
+				  struct hashfile *out,
 				  struct pack_window **w_curs)
 {
+	struct packed_git *reuse_packfile = reuse_packfiles[pack_idx].p;
 	off_t offset, next, cur;
 	enum object_type type;
 	unsigned long size;
@@ -1023,7 +1095,8 @@ static void write_reused_pack_one(size_t pos, struct hashfile *out,
 	offset = pack_pos_to_offset(reuse_packfile, pos);
 	next = pack_pos_to_offset(reuse_packfile, pos + 1);
 
-	record_reused_object(offset, offset - hashfile_total(out));
+	record_reused_object(&reused_chunks[pack_idx],
+			     offset, offset - hashfile_total(out));
 
 	cur = offset;
 	type = unpack_object_header(reuse_packfile, w_curs, &cur, &size);
@@ -1031,7 +1104,7 @@ static void write_reused_pack_one(size_t pos, struct hashfile *out,
 
 	if (type == OBJ_OFS_DELTA) {
 		off_t base_offset;
-		off_t fixup;
+		off_t ofs;
 
 		unsigned char header[MAX_PACK_OBJECT_HEADER];
 		unsigned len;
@@ -1061,13 +1134,15 @@ static void write_reused_pack_one(size_t pos, struct hashfile *out,
 			return;
 		}
 
-		/* Otherwise see if we need to rewrite the offset... */
-		fixup = find_reused_offset(offset) -
-			find_reused_offset(base_offset);
-		if (fixup) {
+		/*
+		 * Otherwise see if we need to rewrite the offset, because
+		 * objects between us and the base were skipped, or the
+		 * base was sent from another pack...
+		 */
+		ofs = hashfile_total(out) - reused_base_offset(pack_idx, base_offset);
+		if (ofs != offset - base_offset) {
 			unsigned char ofs_header[10];
 			unsigned i, ofs_len;
-			off_t ofs = offset - base_offset - fixup;
 
 			len = encode_in_pack_object_header(header, sizeof(header),
 							   OBJ_OFS_DELTA, size);
@@ -1091,26 +1166,38 @@ static void write_reused_pack_one(size_t pos, struct hashfile *out,
 	copy_pack_data(out, reuse_packfile, w_curs, offset, next - offset);
 }
 
-static size_t write_reused_pack_verbatim(struct hashfile *out,
+static size_t write_reused_pack_verbatim(size_t pack_idx,
+					 struct hashfile *out,
 					 struct pack_window **w_curs)
 {
+	struct bitmapped_pack *reuse_packfile = &reuse_packfiles[pack_idx];
 	size_t pos = 0;
 
+	/*
+	 * Only a pack whose objects start the bitmap, and were all
+	 * selected, has its leading objects at the same place as in
+	 * the generated packfile.
+	 */
+	if (reuse_packfile->bitmap_pos || !reuse_pack_is_contiguous(reuse_packfile))
+		return 0;
+
 	while (pos < reuse_packfile_bitmap->word_alloc &&
-			reuse_packfile_bitmap->words[pos] == (eword_t)~0)
+	       pos < reuse_packfile->bitmap_nr / BITS_IN_EWORD &&
+	       reuse_packfile_bitmap->words[pos] == (eword_t)~0)
 		pos++;
 
 	if (pos) {
 		off_t to_write;
 
 		written = (pos * BITS_IN_EWORD);
-		to_write = pack_pos_to_offset(reuse_packfile, written)
+		to_write = pack_pos_to_offset(reuse_packfile->p, written)
 			- sizeof(struct pack_header);
 
 		/* We're recording one chunk, not one object. */
-		record_reused_object(sizeof(struct pack_header), 0);
+		record_reused_object(&reused_chunks[pack_idx],
+				     sizeof(struct pack_header), 0);
 		hashflush(out);
-		copy_pack_data(out, reuse_packfile, w_curs,
+		copy_pack_data(out, reuse_packfile->p, w_curs,
 			sizeof(struct pack_header), to_write);
 
 		display_progress(progress_state, written);
@@ -1118,32 +1205,55 @@ static size_t write_reused_pack_verbatim(struct hashfile *out,
 	return pos;
 }
 
-static void write_reused_pack(struct hashfile *f)
+static void write_reused_pack(size_t pack_idx, struct hashfile *f)
 {
-	size_t i = 0;
-	uint32_t offset;
+	struct bitmapped_pack *reuse_packfile = &reuse_packfiles[pack_idx];
+	size_t pos = reuse_packfile->bitmap_pos;
+	size_t end = pos + reuse_packfile->bitmap_nr;
 	struct pack_window *w_curs = NULL;
 
 	if (allow_ofs_delta)
-		i = write_reused_pack_verbatim(f, &w_curs);
+		pos += write_reused_pack_verbatim(pack_idx, f, &w_curs) * BITS_IN_EWORD;
 
-	for (; i < reuse_packfile_bitmap->word_alloc; ++i) {
-		eword_t word = reuse_packfile_bitmap->words[i];
-		size_t pos = (i * BITS_IN_EWORD);
+	for (; pos < end; pos++) {
+		size_t i = pos / BITS_IN_EWORD;
+		uint32_t pack_pos;
+		eword_t word;
 
-		for (offset = 0; offset < BITS_IN_EWORD; ++offset) {
-			if ((word >> offset) == 0)
-				break;
+		if (i >= reuse_packfile_bitmap->word_alloc)
+			break;
 
-			offset += ewah_bit_ctz64(word >> offset);
-			/*
-			 * Can use bit positions directly, even for MIDX
-			 * bitmaps. See comment in try_partial_reuse()
-			 * for why.
-			 */
-			write_reused_pack_one(pos + offset, f, &w_curs);
-			display_progress(progress_state, ++written);
+		word = reuse_packfile_bitmap->words[i] >> (pos % BITS_IN_EWORD);
+		if (!word) {
+			/* move on to the first bit of the next word */
+			pos = (i + 1) * BITS_IN_EWORD - 1;
+			continue;
 		}
+		pos += ewah_bit_ctz64(word);
+		if (pos >= end)
+			break;
+
+		/*
+		 * Bit positions can be used directly as pack positions,
+		 * unless the MIDX selected some of the pack's objects
+		 * from elsewhere. See reuse_pack_is_contiguous().
+		 */
+		if (reuse_pack_is_contiguous(reuse_packfile)) {
+			pack_pos = pos - reuse_packfile->bitmap_pos;
+		} else {
+			struct multi_pack_index *m = reuse_packfile->from_midx;
+			off_t pack_ofs = nth_midxed_offset(m, pack_pos_to_midx(m, pos));
+
+			if (offset_to_pack_pos(reuse_packfile->p, pack_ofs,
+					       &pack_pos) < 0)
+				die(_("expected object at offset %"PRIuMAX" "
+				      "in pack %s"),
+				    (uintmax_t)pack_ofs,
+				    reuse_packfile->p->pack_name);
+		}
+
+		write_reused_pack_one(pack_idx, pack_pos, f, &w_curs);
+		display_progress(progress_state, ++written);
 	}
 
 	unuse_pack(&w_curs);
@@ -1197,9 +1307,11 @@ static void write_pack_file(void)
 
 		offset = write_pack_header(f, nr_remaining);
 
-		if (reuse_packfile) {
+		if (reuse_packfiles_nr) {
 			assert(pack_to_stdout);
-			write_reused_pack(f);
+			CALLOC_ARRAY(reused_chunks, reuse_packfiles_nr);
+			for (j = 0; j < reuse_packfiles_nr; j++)
+				write_reused_pack(j, f);
 			offset = hashfile_total(f);
 		}
 
@@ -3175,7 +3287,17 @@ static int git_pack_config(const char *k, const char *v,
 		return 0;
 	}
 	if (!strcmp(k, "pack.allowpackreuse")) {
-		allow_pack_reuse = git_config_bool(k, v);
+		int res = git_parse_maybe_bool(v);
+		if (res < 0) {
+			if (!strcasecmp(v, "single"))
+				allow_pack_reuse = SINGLE_PACK_REUSE;
+			else if (!strcasecmp(v, "multi"))
+				allow_pack_reuse = MULTI_PACK_REUSE;
+			else
+				die(_("invalid pack.allowPackReuse value: '%s'"), v);
+		} else {
+			allow_pack_reuse = res ? SINGLE_PACK_REUSE : NO_PACK_REUSE;
+		}
 		return 0;
 	}
 	if (!strcmp(k, "pack.threads")) {
@@ -3946,9 +4068,11 @@ static int get_object_list_from_bitmap(struct rev_info *revs)
 	if (pack_options_allow_reuse() &&
 	    !reuse_partial_packfile_from_bitmap(
 			bitmap_git,
-			&reuse_packfile,
+			&reuse_packfiles,
+			&reuse_packfiles_nr,
 			&reuse_packfile_objects,
-			&reuse_packfile_bitmap)) {
+			&reuse_packfile_bitmap,
+			allow_pack_reuse == MULTI_PACK_REUSE)) {
 		assert(reuse_packfile_objects);
 		nr_result += reuse_packfile_objects;
 		nr_seen += reuse_packfile_objects;
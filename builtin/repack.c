@@ -35,6 +35,7 @@ static int pack_kept_objects = -1;
 static int write_bitmaps = -1;
 static int use_delta_islands;
 static int run_update_server_info = 1;
+static int midx_incremental;
 static char *packdir, *packtmp_name, *packtmp;
 
 static const char *const git_repack_usage[] = {
@@ -84,6 +85,10 @@ static int repack_config(const char *var, const char *value,
 		run_update_server_info = git_config_bool(var, value);
 		return 0;
 	}
+	if (!strcmp(var, "repack.midxincremental")) {
+		midx_incremental = git_config_bool(var, value);
+		return 0;
+	}
 	if (!strcmp(var, "repack.cruftwindow"))
 		return git_config_string(&cruft_po_args->window, var, value);
 	if (!strcmp(var, "repack.cruftwindowmemory"))
@@ -647,6 +652,9 @@ static int write_midx_included_packs(struct string_list *include,
 	if (write_bitmaps)
 		strvec_push(&cmd.args, "--bitmap");
 
+	if (midx_incremental)
+		strvec_push(&cmd.args, "--incremental");
+
 	if (preferred)
 		strvec_pushf(&cmd.args, "--preferred-pack=%s",
 			     pack_basename(preferred));
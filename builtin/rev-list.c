@@ -753,6 +753,13 @@ int cmd_rev_list(int argc, const char **argv, const char *prefix)
 	if (arg_missing_action == MA_PRINT)
 		oidset_init(&missing_objects, DEFAULT_OIDSET_SIZE);
 
+	/*
+	 * Our callbacks only read objects through functions that take
+	 * obj_read_lock, except when dealing with missing objects.
+	 */
+	if (arg_missing_action == MA_ERROR)
+		revs.preload_trees = 1;
+
 	traverse_commit_list_filtered(
 		&revs, show_commit, show_object, &info,
 		(arg_print_omitted ? &omitted_objects : NULL));
@@ -19,9 +19,12 @@
 #include "progress.h"
 #include "decorate.h"
 #include "fsck.h"
+#include "thread-utils.h"
 
 static int dry_run, quiet, recover, has_errors, strict;
-static const char unpack_usage[] = "git unpack-objects [-n] [-q] [-r] [--strict]";
+static int nr_threads = 1;
+static const char unpack_usage[] =
+"git unpack-objects [-n] [-q] [-r] [--strict] [--threads=<n>]";
 
 /* We always read in 4kB chunks. */
 static unsigned char buffer[4096];
@@ -195,6 +198,56 @@ struct obj_info {
 static struct obj_info *obj_list;
 static unsigned nr_objects;
 
+/*
+ * In threaded mode, objects are only inflated while reading the pack.
+ * Once the whole pack has been consumed, delta chains are resolved and
+ * written out by worker threads, each one starting from an object whose
+ * contents do not depend on any other object of the pack.
+ *
+ * If the inflated objects held this way grow beyond pending_limit bytes,
+ * the objects read so far are resolved right away, and the rest of the
+ * pack is unpacked one object at a time as without threads.
+ */
+struct pending_object {
+	enum object_type type;
+	void *data;
+	unsigned long size;
+
+	/* for deltas: the base, either by name or by position in the pack */
+	struct object_id base_oid;
+	off_t base_offset;
+
+	/* first OFS_DELTA child and next sibling, or -1 */
+	int first_child;
+	int next_sibling;
+
+	unsigned streamed : 1,
+		 external_base : 1,
+		 claimed : 1,
+		 written : 1;
+};
+
+/* REF_DELTA entries whose base is contained in the pack, sorted by base */
+struct ref_delta_entry {
+	struct object_id oid;
+	int nr;
+};
+
+#define DEFAULT_PENDING_LIMIT (256 * 1024 * 1024)
+
+static struct pending_object *pending;
+static unsigned nr_pending;
+static size_t pending_bytes, pending_limit;
+static struct ref_delta_entry *ref_deltas;
+static int nr_ref_deltas;
+static int *roots;
+static int nr_roots, nr_dispatched;
+static unsigned nr_resolved;
+
+static pthread_mutex_t work_mutex;
+#define work_lock()		pthread_mutex_lock(&work_mutex)
+#define work_unlock()		pthread_mutex_unlock(&work_mutex)
+
 /*
  * Called only from check_object() after it verified this object
  * is Ok.
@@ -353,8 +406,29 @@ static void unpack_non_delta_entry(enum object_type type, unsigned long size,
 {
 	void *buf = get_data(size);
 
-	if (buf)
-		write_object(nr, type, buf, size);
+	if (!buf)
+		return;
+	if (pending) {
+		pending[nr].type = type;
+		pending[nr].data = buf;
+		pending[nr].size = size;
+		pending_bytes += size;
+		return;
+	}
+	write_object(nr, type, buf, size);
+}
+
+static void queue_pending_delta(unsigned nr, enum object_type type,
+				const struct object_id *base_oid,
+				off_t base_offset,
+				void *delta, unsigned long delta_size)
+{
+	pending[nr].type = type;
+	pending[nr].data = delta;
+	pending[nr].size = delta_size;
+	pending_bytes += delta_size;
+	oidcpy(&pending[nr].base_oid, base_oid);
+	pending[nr].base_offset = base_offset;
 }
 
 struct input_zstream_data {
@@ -409,6 +483,9 @@ static void stream_blob(unsigned long size, unsigned nr)
 		die(_("inflate returned (%d)"), data.status);
 	git_inflate_end(&zstream);
 
+	if (pending)
+		pending[nr].streamed = 1;
+
 	if (strict) {
 		struct blob *blob = lookup_blob(the_repository, &info->oid);
 
@@ -448,6 +525,11 @@ static void unpack_delta_entry(enum object_type type, unsigned long delta_size,
 		delta_data = get_data(delta_size);
 		if (!delta_data)
 			return;
+		if (pending) {
+			queue_pending_delta(nr, type, &base_oid, 0,
+					    delta_data, delta_size);
+			return;
+		}
 		if (repo_has_object_file(the_repository, &base_oid))
 			; /* Ok we have this one */
 		else if (resolve_against_held(nr, &base_oid,
@@ -485,6 +567,11 @@ static void unpack_delta_entry(enum object_type type, unsigned long delta_size,
 		delta_data = get_data(delta_size);
 		if (!delta_data)
 			return;
+		if (pending) {
+			queue_pending_delta(nr, type, null_oid(), base_offset,
+					    delta_data, delta_size);
+			return;
+		}
 		lo = 0;
 		hi = nr;
 		while (lo < hi) {
@@ -576,6 +663,338 @@ static void unpack_one(unsigned nr)
 	}
 }
 
+static int find_object_by_offset(off_t offset)
+{
+	unsigned lo = 0, hi = nr_pending;
+
+	while (lo < hi) {
+		unsigned mid = lo + (hi - lo) / 2;
+		if (offset < obj_list[mid].offset)
+			hi = mid;
+		else if (offset > obj_list[mid].offset)
+			lo = mid + 1;
+		else
+			return mid;
+	}
+	return -1;
+}
+
+static int compare_ref_delta_entry(const void *a, const void *b)
+{
+	const struct ref_delta_entry *ea = a, *eb = b;
+	return oidcmp(&ea->oid, &eb->oid);
+}
+
+static int find_ref_delta(const struct object_id *oid)
+{
+	int lo = 0, hi = nr_ref_deltas;
+
+	while (lo < hi) {
+		int mid = lo + (hi - lo) / 2;
+		int cmp = oidcmp(oid, &ref_deltas[mid].oid);
+		if (!cmp) {
+			while (mid > 0 && oideq(oid, &ref_deltas[mid - 1].oid))
+				mid--;
+			return mid;
+		}
+		if (cmp < 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+	return -1;
+}
+
+static int claim_pending(int nr)
+{
+	int claimed;
+
+	work_lock();
+	claimed = !pending[nr].claimed;
+	pending[nr].claimed = 1;
+	work_unlock();
+	return claimed;
+}
+
+/*
+ * An object whose contents are known and written out, and whose delta
+ * children are being resolved. "next_child" and "next_ref" are where to
+ * continue looking for them among its OFS_DELTA children and ref_deltas.
+ */
+struct pending_base {
+	int nr;
+	enum object_type type;
+	void *data;
+	unsigned long size;
+	int next_child;
+	int next_ref;
+};
+
+static void write_pending_object(int nr, enum object_type type,
+				 const void *data, unsigned long size)
+{
+	if (write_object_file(data, size, type, &obj_list[nr].oid) < 0)
+		die(_("failed to write object"));
+
+	work_lock();
+	pending[nr].written = 1;
+	display_progress(progress, ++nr_resolved);
+	work_unlock();
+}
+
+static void push_pending_base(struct pending_base **stack, size_t *nr,
+			      size_t *alloc, int obj, enum object_type type,
+			      void *data, unsigned long size)
+{
+	struct pending_base *b;
+
+	write_pending_object(obj, type, data, size);
+
+	ALLOC_GROW(*stack, *nr + 1, *alloc);
+	b = &(*stack)[(*nr)++];
+	b->nr = obj;
+	b->type = type;
+	b->data = data;
+	b->size = size;
+	b->next_child = pending[obj].first_child;
+	b->next_ref = find_ref_delta(&obj_list[obj].oid);
+}
+
+/*
+ * Claim the next unresolved delta based on "b", or return -1 if there
+ * are none left.
+ */
+static int next_pending_child(struct pending_base *b)
+{
+	while (b->next_child >= 0) {
+		int child = b->next_child;
+
+		b->next_child = pending[child].next_sibling;
+		if (claim_pending(child))
+			return child;
+	}
+	while (b->next_ref >= 0 && b->next_ref < nr_ref_deltas &&
+	       oideq(&ref_deltas[b->next_ref].oid, &obj_list[b->nr].oid)) {
+		int child = ref_deltas[b->next_ref++].nr;
+
+		if (claim_pending(child))
+			return child;
+	}
+	return -1;
+}
+
+static void *apply_pending_delta(int nr, const void *base,
+				 unsigned long base_size,
+				 unsigned long *result_size)
+{
+	void *result = patch_delta(base, base_size,
+				   pending[nr].data, pending[nr].size,
+				   result_size);
+
+	if (!result)
+		die(_("failed to apply delta"));
+	FREE_AND_NULL(pending[nr].data);
+	return result;
+}
+
+/*
+ * Write out the nr-th object and everything that is deltified against
+ * it, directly or not. Delta chains in a pack can be as long as the pack
+ * itself, so walk them with an explicit stack (as index-pack does)
+ * rather than by recursion, which would overflow the stack of a thread.
+ */
+static void resolve_pending_root(int nr)
+{
+	struct pending_object *p = &pending[nr];
+	struct pending_base *stack = NULL;
+	size_t stack_nr = 0, stack_alloc = 0;
+	enum object_type type;
+	unsigned long size;
+	void *data;
+
+	if (!p->external_base) {
+		type = p->type;
+		data = p->data;
+		size = p->size;
+		p->data = NULL;
+	} else {
+		unsigned long base_size;
+		void *base = repo_read_object_file(the_repository, &p->base_oid,
+						   &type, &base_size);
+		if (!base)
+			die(_("failed to read delta-pack base object %s"),
+			    oid_to_hex(&p->base_oid));
+		data = apply_pending_delta(nr, base, base_size, &size);
+		free(base);
+	}
+	push_pending_base(&stack, &stack_nr, &stack_alloc, nr, type, data, size);
+
+	while (stack_nr) {
+		struct pending_base *b = &stack[stack_nr - 1];
+		int child = next_pending_child(b);
+
+		if (child < 0) {
+			free(b->data);
+			stack_nr--;
+			continue;
+		}
+		type = b->type;
+		data = apply_pending_delta(child, b->data, b->size, &size);
+		push_pending_base(&stack, &stack_nr, &stack_alloc, child,
+				  type, data, size);
+	}
+	free(stack);
+}
+
+static void *resolve_pending_worker(void *data UNUSED)
+{
+	for (;;) {
+		int nr;
+
+		work_lock();
+		if (nr_dispatched >= nr_roots) {
+			work_unlock();
+			break;
+		}
+		nr = roots[nr_dispatched++];
+		work_unlock();
+
+		resolve_pending_root(nr);
+	}
+	return NULL;
+}
+
+/*
+ * Link every delta to its base and collect the objects that can be
+ * resolved without waiting for anything else in the pack: non-delta
+ * objects, and deltas whose base is already in the repository.
+ */
+static void prepare_pending_roots(void)
+{
+	unsigned i;
+
+	ALLOC_ARRAY(roots, nr_pending);
+	ALLOC_ARRAY(ref_deltas, nr_pending);
+
+	for (i = 0; i < nr_pending; i++)
+		pending[i].first_child = pending[i].next_sibling = -1;
+
+	for (i = 0; i < nr_pending; i++) {
+		struct pending_object *p = &pending[i];
+
+		if (p->streamed)
+			continue;
+
+		switch (p->type) {
+		case OBJ_OFS_DELTA: {
+			int base = find_object_by_offset(p->base_offset);
+
+			if (base < 0)
+				break;
+			if (pending[base].streamed) {
+				oidcpy(&p->base_oid, &obj_list[base].oid);
+				p->external_base = 1;
+				roots[nr_roots++] = i;
+			} else {
+				p->next_sibling = pending[base].first_child;
+				pending[base].first_child = i;
+			}
+			break;
+		}
+		case OBJ_REF_DELTA:
+			if (repo_has_object_file(the_repository, &p->base_oid)) {
+				p->external_base = 1;
+				roots[nr_roots++] = i;
+			} else {
+				oidcpy(&ref_deltas[nr_ref_deltas].oid, &p->base_oid);
+				ref_deltas[nr_ref_deltas].nr = i;
+				nr_ref_deltas++;
+			}
+			break;
+		default:
+			roots[nr_roots++] = i;
+			break;
+		}
+	}
+
+	QSORT(ref_deltas, nr_ref_deltas, compare_ref_delta_entry);
+}
+
+/*
+ * Deltas whose base was not among the pending objects are left to the
+ * serial code, which resolves them once their base shows up in the rest
+ * of the pack, or complains that it never did.
+ */
+static void queue_unresolved_pending(void)
+{
+	unsigned i;
+
+	for (i = 0; i < nr_pending; i++) {
+		struct pending_object *p = &pending[i];
+
+		if (p->streamed || p->written)
+			continue;
+		oidclr(&obj_list[i].oid);
+		if (p->type == OBJ_REF_DELTA)
+			add_delta_to_list(i, &p->base_oid, 0, p->data, p->size);
+		else
+			add_delta_to_list(i, null_oid(), p->base_offset,
+					  p->data, p->size);
+		p->data = NULL;
+	}
+}
+
+static void resolve_pending_objects(void)
+{
+	pthread_t *threads;
+	unsigned i;
+	int t;
+
+	prepare_pending_roots();
+	for (i = 0; i < nr_pending; i++)
+		if (pending[i].streamed)
+			nr_resolved++;
+
+	/*
+	 * Make sure that the temporary object directory of the ODB
+	 * transaction exists before the workers start writing into it.
+	 */
+	prepare_loose_object_bulk_checkin();
+
+	pthread_mutex_init(&work_mutex, NULL);
+	enable_obj_read_lock();
+
+	ALLOC_ARRAY(threads, nr_threads);
+	for (t = 0; t < nr_threads; t++) {
+		int ret = pthread_create(&threads[t], NULL,
+					 resolve_pending_worker, NULL);
+		if (ret)
+			die(_("unable to create thread: %s"), strerror(ret));
+	}
+	for (t = 0; t < nr_threads; t++)
+		pthread_join(threads[t], NULL);
+	free(threads);
+
+	disable_obj_read_lock();
+	pthread_mutex_destroy(&work_mutex);
+
+	if (nr_resolved != nr_pending)
+		queue_unresolved_pending();
+
+	FREE_AND_NULL(roots);
+	FREE_AND_NULL(ref_deltas);
+	FREE_AND_NULL(pending);
+}
+
+/*
+ * Threaded mode needs all inflated objects of the pack at hand, which
+ * is at odds with the modes that check or salvage objects one by one.
+ */
+static int pending_mode(void)
+{
+	return nr_threads > 1 && !dry_run && !strict && !recover;
+}
+
 static void unpack_all(void)
 {
 	int i;
@@ -593,11 +1012,24 @@ static void unpack_all(void)
 	if (!quiet)
 		progress = start_progress(_("Unpacking objects"), nr_objects);
 	CALLOC_ARRAY(obj_list, nr_objects);
+	if (pending_mode()) {
+		CALLOC_ARRAY(pending, nr_objects);
+		pending_limit = git_env_ulong("GIT_TEST_UNPACK_OBJECTS_PENDING_LIMIT",
+					      DEFAULT_PENDING_LIMIT);
+	}
 	begin_odb_transaction();
 	for (i = 0; i < nr_objects; i++) {
 		unpack_one(i);
-		display_progress(progress, i + 1);
+		if (!pending) {
+			display_progress(progress, i + 1);
+			continue;
+		}
+		nr_pending = i + 1;
+		if (pending_bytes > pending_limit)
+			resolve_pending_objects();
 	}
+	if (pending)
+		resolve_pending_objects();
 	end_odb_transaction();
 	stop_progress(&progress);
 
@@ -605,6 +1037,23 @@ static void unpack_all(void)
 		die("unresolved deltas left after unpacking");
 }
 
+static int unpack_objects_config(const char *k, const char *v,
+				 const struct config_context *ctx, void *cb)
+{
+	if (!strcmp(k, "unpack.threads")) {
+		nr_threads = git_config_int(k, v, ctx->kvi);
+		if (nr_threads < 0)
+			die(_("invalid number of threads specified (%d)"),
+			    nr_threads);
+		if (!HAVE_THREADS && nr_threads != 1) {
+			warning(_("no threads support, ignoring %s"), k);
+			nr_threads = 1;
+		}
+		return 0;
+	}
+	return git_default_config(k, v, ctx, cb);
+}
+
 int cmd_unpack_objects(int argc, const char **argv, const char *prefix UNUSED)
 {
 	int i;
@@ -613,7 +1062,7 @@ int cmd_unpack_objects(int argc, const char **argv, const char *prefix UNUSED)
 
 	disable_replace_refs();
 
-	git_config(git_default_config, NULL);
+	git_config(unpack_objects_config, NULL);
 
 	quiet = !isatty(2);
 
@@ -661,12 +1110,26 @@ int cmd_unpack_objects(int argc, const char **argv, const char *prefix UNUSED)
 				max_input_size = strtoumax(arg, NULL, 10);
 				continue;
 			}
+			if (skip_prefix(arg, "--threads=", &arg)) {
+				char *end;
+				nr_threads = strtoul(arg, &end, 0);
+				if (!*arg || *end || nr_threads < 0)
+					usage(unpack_usage);
+				if (!HAVE_THREADS && nr_threads != 1) {
+					warning(_("no threads support, ignoring %s"),
+						"--threads");
+					nr_threads = 1;
+				}
+				continue;
+			}
 			usage(unpack_usage);
 		}
 
 		/* We don't take any non-flag arguments now.. Maybe some day */
 		usage(unpack_usage);
 	}
+	if (HAVE_THREADS && !nr_threads)
+		nr_threads = online_cpus();
 	the_hash_algo->init_fn(&ctx);
 	unpack_all();
 	the_hash_algo->update_fn(&ctx, buffer, offset);
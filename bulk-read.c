@@ -0,0 +1,364 @@
+#include "git-compat-util.h"
+#include "bulk-read.h"
+#include "delta.h"
+#include "environment.h"
+#include "khash.h"
+#include "object-store-ll.h"
+#include "packfile.h"
+#include "replace-object.h"
+#include "trace2.h"
+
+struct bulk_read_request {
+	const struct object_id *oid;
+	size_t nr;
+	struct packed_git *pack;
+	off_t offset;
+};
+
+/*
+ * An object in a pack which is either requested, or a delta base of
+ * another node (or both).
+ */
+struct bulk_read_node {
+	off_t offset;
+	/* offset of the (compressed) data, after the headers */
+	off_t data_offset;
+	/* offset of the delta base, or 0 */
+	off_t base_offset;
+	/* the in-pack type; OBJ_BAD if the headers could not be read */
+	enum object_type in_pack_type;
+	/* the size of the object or, for deltas, of the delta data */
+	unsigned long in_pack_size;
+	/* the number of nodes using this one as their delta base */
+	unsigned int refs;
+
+	/* the contents, kept until all nodes using it as a base are done */
+	void *buf;
+	enum object_type type;
+	unsigned long size;
+};
+
+#define off_hash(key) ((khint32_t)((key) >> 33 ^ (key) ^ (key) << 11))
+#define off_equal(a, b) ((a) == (b))
+KHASH_INIT(off_pos, off_t, size_t, 1, off_hash, off_equal)
+
+struct bulk_read_pack {
+	struct repository *r;
+	struct packed_git *p;
+	struct pack_window *w_curs;
+
+	struct bulk_read_node *nodes;
+	size_t nodes_nr, nodes_alloc;
+	kh_off_pos_t *pos;
+
+	/* the bytes held by nodes that are still needed as bases */
+	size_t held;
+
+	/* statistics */
+	intmax_t shared, fallback;
+};
+
+static int request_cmp(const void *va, const void *vb)
+{
+	const struct bulk_read_request *a = va, *b = vb;
+
+	/* Objects which are not packed go last, in the order given. */
+	if (!a->pack || !b->pack) {
+		if (a->pack != b->pack)
+			return a->pack ? -1 : 1;
+		return a->nr < b->nr ? -1 : a->nr > b->nr;
+	}
+	if (a->pack != b->pack)
+		return strcmp(a->pack->pack_name, b->pack->pack_name);
+	if (a->offset != b->offset)
+		return a->offset < b->offset ? -1 : 1;
+	return a->nr < b->nr ? -1 : a->nr > b->nr;
+}
+
+static int node_cmp(const void *va, const void *vb)
+{
+	const struct bulk_read_node *a = va, *b = vb;
+
+	if (a->offset == b->offset)
+		return 0;
+	return a->offset < b->offset ? -1 : 1;
+}
+
+/*
+ * Return the position of the node at "offset" in bp->nodes, reading
+ * its headers if there is none yet.
+ */
+static size_t add_node(struct bulk_read_pack *bp, off_t offset, int *added)
+{
+	struct bulk_read_node *node;
+	khiter_t it;
+	int hash_ret;
+	off_t curpos = offset;
+	size_t pos;
+
+	it = kh_put_off_pos(bp->pos, offset, &hash_ret);
+	if (!hash_ret) {
+		*added = 0;
+		return kh_value(bp->pos, it);
+	}
+	*added = 1;
+
+	pos = bp->nodes_nr;
+	kh_value(bp->pos, it) = pos;
+	ALLOC_GROW(bp->nodes, bp->nodes_nr + 1, bp->nodes_alloc);
+	node = &bp->nodes[bp->nodes_nr++];
+	memset(node, 0, sizeof(*node));
+	node->offset = offset;
+
+	node->in_pack_type = unpack_object_header(bp->p, &bp->w_curs, &curpos,
+						  &node->in_pack_size);
+	switch (node->in_pack_type) {
+	case OBJ_COMMIT:
+	case OBJ_TREE:
+	case OBJ_BLOB:
+	case OBJ_TAG:
+		break;
+	case OBJ_OFS_DELTA:
+	case OBJ_REF_DELTA:
+		/*
+		 * A REF_DELTA with its base in another pack gets no
+		 * base_offset and is read with unpack_entry() below.
+		 */
+		node->base_offset = get_delta_base(bp->p, &bp->w_curs, &curpos,
+						   node->in_pack_type, offset);
+		break;
+	default:
+		node->in_pack_type = OBJ_BAD;
+		break;
+	}
+	node->data_offset = curpos;
+	return pos;
+}
+
+/*
+ * Add the node at "offset" and all of its delta bases which are not
+ * there yet.
+ */
+static void add_delta_chain(struct bulk_read_pack *bp, off_t offset)
+{
+	int added;
+	size_t pos = add_node(bp, offset, &added);
+
+	while (added) {
+		off_t base_offset = bp->nodes[pos].base_offset;
+
+		if (!base_offset)
+			break;
+		pos = add_node(bp, base_offset, &added);
+		bp->nodes[pos].refs++;
+	}
+}
+
+static struct bulk_read_node *find_node(struct bulk_read_pack *bp,
+					off_t offset)
+{
+	struct bulk_read_node key;
+
+	key.offset = offset;
+	return bsearch(&key, bp->nodes, bp->nodes_nr, sizeof(key), node_cmp);
+}
+
+static void release_base(struct bulk_read_pack *bp,
+			 struct bulk_read_node *base)
+{
+	if (!base || --base->refs || !base->buf)
+		return;
+	bp->held -= base->size;
+	FREE_AND_NULL(base->buf);
+}
+
+/*
+ * Reconstruct "node" from its delta base if we still hold that, and
+ * fall back to unpack_entry() otherwise.
+ */
+static void unpack_node(struct bulk_read_pack *bp,
+			struct bulk_read_node *node)
+{
+	struct bulk_read_node *base = NULL;
+
+	switch (node->in_pack_type) {
+	case OBJ_COMMIT:
+	case OBJ_TREE:
+	case OBJ_BLOB:
+	case OBJ_TAG:
+		node->buf = unpack_compressed_entry(bp->p, &bp->w_curs,
+						    node->data_offset,
+						    node->in_pack_size);
+		node->type = node->in_pack_type;
+		node->size = node->in_pack_size;
+		break;
+	case OBJ_OFS_DELTA:
+	case OBJ_REF_DELTA:
+		if (node->base_offset)
+			base = find_node(bp, node->base_offset);
+		if (base && base->buf) {
+			void *delta = unpack_compressed_entry(bp->p, &bp->w_curs,
+							      node->data_offset,
+							      node->in_pack_size);
+			if (delta) {
+				node->buf = patch_delta(base->buf, base->size,
+							delta, node->in_pack_size,
+							&node->size);
+				node->type = base->type;
+				bp->shared++;
+			}
+			free(delta);
+		}
+		break;
+	default:
+		break;
+	}
+
+	release_base(bp, base);
+
+	if (!node->buf && node->in_pack_type != OBJ_BAD) {
+		node->buf = unpack_entry(bp->r, bp->p, node->offset,
+					 &node->type, &node->size);
+		bp->fallback++;
+	}
+}
+
+/*
+ * Would we rather have the caller stream this object than read it?
+ */
+static int too_big(struct bulk_read_pack *bp, struct bulk_read_node *node)
+{
+	unsigned long size = node->in_pack_size;
+
+	if (node->refs)
+		return 0;
+	if (node->in_pack_type == OBJ_OFS_DELTA ||
+	    node->in_pack_type == OBJ_REF_DELTA)
+		size = get_size_from_delta(bp->p, &bp->w_curs,
+					   node->data_offset);
+	return size > big_file_threshold;
+}
+
+static int read_pack(struct bulk_read_pack *bp,
+		     struct bulk_read_request *req, size_t req_nr,
+		     bulk_read_fn fn, void *data)
+{
+	size_t i, j = 0;
+	int ret = 0;
+
+	obj_read_lock();
+	for (i = 0; i < req_nr; i++)
+		add_delta_chain(bp, req[i].offset);
+	QSORT(bp->nodes, bp->nodes_nr, node_cmp);
+
+	for (i = 0; i < bp->nodes_nr && !ret; i++) {
+		struct bulk_read_node *node = &bp->nodes[i];
+		int requested = j < req_nr && req[j].offset == node->offset;
+
+		if (!requested && !node->refs) {
+			/* all deltas based on it were read without it */
+			if (node->base_offset)
+				release_base(bp, find_node(bp, node->base_offset));
+			continue;
+		}
+
+		if (requested && too_big(bp, node)) {
+			if (node->base_offset)
+				release_base(bp, find_node(bp, node->base_offset));
+			obj_read_unlock();
+			for (; j < req_nr && req[j].offset == node->offset && !ret; j++)
+				ret = fn(req[j].oid, OBJ_BAD, 0, NULL, data);
+			obj_read_lock();
+			continue;
+		}
+
+		unpack_node(bp, node);
+
+		if (requested) {
+			obj_read_unlock();
+			for (; j < req_nr && req[j].offset == node->offset && !ret; j++) {
+				void *buf = NULL;
+
+				if (node->buf) {
+					/* Hand over our copy if nobody needs it anymore. */
+					if (!node->refs &&
+					    (j + 1 == req_nr ||
+					     req[j + 1].offset != node->offset)) {
+						buf = node->buf;
+						node->buf = NULL;
+					} else {
+						buf = xmemdupz(node->buf, node->size);
+					}
+				}
+				ret = fn(req[j].oid, node->type, node->size, buf, data);
+			}
+			obj_read_lock();
+		}
+
+		if (!node->refs || !node->buf ||
+		    bp->held + node->size > delta_base_cache_limit)
+			/* deltas based on it will use unpack_entry() */
+			FREE_AND_NULL(node->buf);
+		else
+			bp->held += node->size;
+	}
+
+	for (i = 0; i < bp->nodes_nr; i++)
+		free(bp->nodes[i].buf);
+	unuse_pack(&bp->w_curs);
+	obj_read_unlock();
+	return ret;
+}
+
+int bulk_read_objects(struct repository *r,
+		      const struct object_id *oids, size_t nr,
+		      bulk_read_fn fn, void *data)
+{
+	struct bulk_read_request *req;
+	intmax_t shared = 0, fallback = 0;
+	size_t i, j;
+	int ret = 0;
+
+	ALLOC_ARRAY(req, nr);
+	for (i = 0; i < nr; i++) {
+		struct pack_entry e;
+
+		req[i].oid = &oids[i];
+		req[i].nr = i;
+		if (find_pack_entry(r, lookup_replace_object(r, &oids[i]), &e)) {
+			req[i].pack = e.p;
+			req[i].offset = e.offset;
+		} else {
+			req[i].pack = NULL;
+			req[i].offset = 0;
+		}
+	}
+	QSORT(req, nr, request_cmp);
+
+	trace2_region_enter("bulk-read", "read_objects", r);
+	for (i = 0; i < nr && req[i].pack && !ret; i = j) {
+		struct bulk_read_pack bp = { 0 };
+
+		for (j = i + 1; j < nr && req[j].pack == req[i].pack; j++)
+			; /* nothing */
+
+		bp.r = r;
+		bp.p = req[i].pack;
+		bp.pos = kh_init_off_pos();
+		ret = read_pack(&bp, req + i, j - i, fn, data);
+		shared += bp.shared;
+		fallback += bp.fallback;
+
+		kh_destroy_off_pos(bp.pos);
+		free(bp.nodes);
+	}
+	for (; i < nr && !ret; i++)
+		ret = fn(req[i].oid, OBJ_BAD, 0, NULL, data);
+
+	trace2_data_intmax("bulk-read", r, "shared_bases", shared);
+	trace2_data_intmax("bulk-read", r, "fallback", fallback);
+	trace2_region_leave("bulk-read", "read_objects", r);
+
+	free(req);
+	return ret;
+}
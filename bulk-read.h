@@ -0,0 +1,53 @@
+#ifndef BULK_READ_H
+#define BULK_READ_H
+
+#include "object.h"
+
+/*
+ * Reading many objects at once.
+ *
+ * Commands which read a large set of objects, but either do not care
+ * about the order in which they read them or can restore it themselves,
+ * can hand them to bulk_read_objects(). It reads packed objects in the
+ * order in which they are stored in their pack rather than in the order
+ * they were given, so that packs are read front to back instead of
+ * jumping around in them. As delta bases are stored before the deltas
+ * using them, each base that is shared by several of the objects is
+ * reconstructed once and kept until the last delta using it has been
+ * applied, instead of relying on it to still be in the delta base
+ * cache.
+ */
+
+struct repository;
+
+/*
+ * Called once for each object given to bulk_read_objects(), with a
+ * pointer to its object id in the array given.
+ *
+ * "buf" holds the contents of the object, of "type" and "size", and is
+ * owned by the callback, which has to free() it. It is NULL if the
+ * object was not read: because it is not packed, is missing or corrupt,
+ * or because it is larger than core.bigFileThreshold and not needed
+ * for other objects. The callback then has to read (or stream) the
+ * object itself as it would otherwise, and "type" and "size" are
+ * meaningless.
+ *
+ * Returning non-zero stops the iteration, and bulk_read_objects()
+ * returns that value.
+ */
+typedef int bulk_read_fn(const struct object_id *oid,
+			 enum object_type type, unsigned long size,
+			 void *buf, void *data);
+
+/*
+ * Read the "nr" objects in "oids" and pass them to "fn". Packed objects
+ * are passed first, in pack order, followed by the other objects in the
+ * order given. Objects that appear in "oids" more than once are passed
+ * to "fn" as often. Replace refs are respected as by
+ * repo_read_object_file().
+ */
+int bulk_read_objects(struct repository *r,
+		      const struct object_id *oids, size_t nr,
+		      bulk_read_fn fn, void *data);
+
+#endif /* BULK_READ_H */
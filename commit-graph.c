@@ -26,6 +26,7 @@
 #include "trace2.h"
 #include "tree.h"
 #include "chunk-format.h"
+#include "thread-utils.h"
 
 void git_test_write_commit_graph_or_die(void)
 {
@@ -50,9 +51,13 @@ void git_test_write_commit_graph_or_die(void)
 #define GRAPH_CHUNKID_EXTRAEDGES 0x45444745 /* "EDGE" */
 #define GRAPH_CHUNKID_BLOOMINDEXES 0x42494458 /* "BIDX" */
 #define GRAPH_CHUNKID_BLOOMDATA 0x42444154 /* "BDAT" */
+#define GRAPH_CHUNKID_TREEBLOOMINDEXES 0x54504958 /* "TPIX" */
+#define GRAPH_CHUNKID_TREEBLOOMDATA 0x54504441 /* "TPDA" */
+#define GRAPH_CHUNKID_REACHLABELS 0x524c424c /* "RLBL" */
 #define GRAPH_CHUNKID_BASE 0x42415345 /* "BASE" */
 
 #define GRAPH_DATA_WIDTH (the_hash_algo->rawsz + 16)
+#define GRAPH_REACH_LABEL_WIDTH (3 * sizeof(uint32_t))
 
 #define GRAPH_VERSION_1 0x1
 #define GRAPH_VERSION GRAPH_VERSION_1
@@ -330,10 +335,48 @@ static int graph_read_bloom_data(const unsigned char *chunk_start,
 	g->bloom_filter_settings->num_hashes = get_be32(chunk_start + 4);
 	g->bloom_filter_settings->bits_per_entry = get_be32(chunk_start + 8);
 	g->bloom_filter_settings->max_changed_paths = DEFAULT_BLOOM_MAX_CHANGES;
+	g->bloom_filter_settings->max_tree_paths = DEFAULT_BLOOM_MAX_TREE_PATHS;
 
 	return 0;
 }
 
+static int graph_read_reach_labels(const unsigned char *chunk_start,
+				   size_t chunk_size, void *data)
+{
+	struct commit_graph *g = data;
+	if (chunk_size != st_mult(g->num_commits, GRAPH_REACH_LABEL_WIDTH)) {
+		warning(_("commit-graph reachability label chunk is the wrong size"));
+		return 0;
+	}
+	g->chunk_reach_labels = chunk_start;
+	return 0;
+}
+
+static int graph_read_tree_bloom_indexes(const unsigned char *chunk_start,
+					 size_t chunk_size, void *data)
+{
+	struct commit_graph *g = data;
+	if (chunk_size != st_mult(g->num_commits, 2 * sizeof(uint32_t))) {
+		warning(_("commit-graph tree-path Bloom index chunk is the wrong size"));
+		return 0;
+	}
+	g->chunk_tree_bloom_indexes = chunk_start;
+	return 0;
+}
+
+static int graph_read_tree_bloom_data(const unsigned char *chunk_start,
+				      size_t chunk_size, void *data)
+{
+	struct commit_graph *g = data;
+	if (chunk_size < BLOOMDATA_CHUNK_HEADER_SIZE) {
+		warning(_("commit-graph tree-path Bloom data chunk is too small"));
+		return 0;
+	}
+	g->chunk_tree_bloom_data = chunk_start;
+	g->tree_bloom_data_size = chunk_size;
+	return 0;
+}
+
 struct commit_graph *parse_commit_graph(struct repo_settings *s,
 					void *graph_map, size_t graph_size)
 {
@@ -401,6 +444,14 @@ struct commit_graph *parse_commit_graph(struct repo_settings *s,
 	pair_chunk(cf, GRAPH_CHUNKID_EXTRAEDGES, &graph->chunk_extra_edges);
 	pair_chunk(cf, GRAPH_CHUNKID_BASE, &graph->chunk_base_graphs);
 
+	/*
+	 * Labels are only written for graphs without a base, as they
+	 * must cover all commits reachable from those they label.
+	 */
+	if (!graph->chunk_base_graphs)
+		read_chunk(cf, GRAPH_CHUNKID_REACHLABELS,
+			   graph_read_reach_labels, graph);
+
 	if (s->commit_graph_generation_version >= 2) {
 		pair_chunk(cf, GRAPH_CHUNKID_GENERATION_DATA,
 			&graph->chunk_generation_data);
@@ -416,6 +467,10 @@ struct commit_graph *parse_commit_graph(struct repo_settings *s,
 			   &graph->chunk_bloom_indexes);
 		read_chunk(cf, GRAPH_CHUNKID_BLOOMDATA,
 			   graph_read_bloom_data, graph);
+		read_chunk(cf, GRAPH_CHUNKID_TREEBLOOMINDEXES,
+			   graph_read_tree_bloom_indexes, graph);
+		read_chunk(cf, GRAPH_CHUNKID_TREEBLOOMDATA,
+			   graph_read_tree_bloom_data, graph);
 	}
 
 	if (graph->chunk_bloom_indexes && graph->chunk_bloom_data) {
@@ -427,6 +482,20 @@ struct commit_graph *parse_commit_graph(struct repo_settings *s,
 		FREE_AND_NULL(graph->bloom_filter_settings);
 	}
 
+	/*
+	 * Tree-path filters share the settings of the changed-path
+	 * filters, so they are only usable alongside them.
+	 */
+	if (!graph->bloom_filter_settings ||
+	    !graph->chunk_tree_bloom_indexes || !graph->chunk_tree_bloom_data ||
+	    get_be32(graph->chunk_tree_bloom_data) != graph->bloom_filter_settings->hash_version ||
+	    get_be32(graph->chunk_tree_bloom_data + 4) != graph->bloom_filter_settings->num_hashes ||
+	    get_be32(graph->chunk_tree_bloom_data + 8) != graph->bloom_filter_settings->bits_per_entry) {
+		graph->chunk_tree_bloom_indexes = NULL;
+		graph->chunk_tree_bloom_data = NULL;
+		graph->tree_bloom_data_size = 0;
+	}
+
 	oidread(&graph->oid, graph->data + graph->data_len - graph->hash_len);
 
 	if (verify_commit_graph_lite(graph))
@@ -915,6 +984,34 @@ int repo_find_commit_pos_in_graph(struct repository *r, struct commit *c,
 	return find_commit_pos_in_graph(c, r->objects->commit_graph, pos);
 }
 
+static int read_reach_label(struct commit_graph *g, uint32_t pos,
+			    struct commit_graph_reach_label *label)
+{
+	const unsigned char *data;
+
+	while (pos < g->num_commits_in_base)
+		g = g->base_graph;
+	if (!g->chunk_reach_labels)
+		return -1;
+
+	data = g->chunk_reach_labels +
+		st_mult(GRAPH_REACH_LABEL_WIDTH, pos - g->num_commits_in_base);
+	label->post = get_be32(data);
+	label->tree_low = get_be32(data + 4);
+	label->low = get_be32(data + 8);
+	return 0;
+}
+
+int commit_graph_reach_label(struct repository *r, struct commit *c,
+			     struct commit_graph_reach_label *label)
+{
+	uint32_t pos;
+
+	if (!repo_find_commit_pos_in_graph(r, c, &pos))
+		return -1;
+	return read_reach_label(r->objects->commit_graph, pos, label);
+}
+
 struct commit *lookup_commit_in_graph(struct repository *repo, const struct object_id *id)
 {
 	struct commit *commit;
@@ -1045,9 +1142,11 @@ struct write_commit_graph_context {
 		 report_progress:1,
 		 split:1,
 		 changed_paths:1,
+		 tree_paths:1,
 		 order_by_pack:1,
 		 write_generation_data:1,
-		 trust_generation_numbers:1;
+		 trust_generation_numbers:1,
+		 reach_labels:1;
 
 	struct topo_level_slab *topo_levels;
 	const struct commit_graph_opts *opts;
@@ -1058,6 +1157,16 @@ struct write_commit_graph_context {
 	int count_bloom_filter_not_computed;
 	int count_bloom_filter_trunc_empty;
 	int count_bloom_filter_trunc_large;
+	int bloom_threads;
+
+	size_t total_tree_bloom_data_size;
+	uint32_t *tree_bloom_offsets;
+	int count_tree_bloom_filter_computed;
+	int count_tree_bloom_filter_dirs_only;
+	int count_tree_bloom_filter_trunc_large;
+	int count_tree_bloom_filter_shared;
+
+	struct commit_graph_reach_label *reach_labels_list;
 };
 
 static int write_graph_chunk_fanout(struct hashfile *f,
@@ -1337,6 +1446,7 @@ static void trace2_bloom_filter_settings(struct write_commit_graph_context *ctx)
 	jw_object_intmax(&jw, "num_hashes", ctx->bloom_settings->num_hashes);
 	jw_object_intmax(&jw, "bits_per_entry", ctx->bloom_settings->bits_per_entry);
 	jw_object_intmax(&jw, "max_changed_paths", ctx->bloom_settings->max_changed_paths);
+	jw_object_intmax(&jw, "max_tree_paths", ctx->bloom_settings->max_tree_paths);
 	jw_end(&jw);
 
 	trace2_data_json("bloom", ctx->r, "settings", &jw);
@@ -1370,6 +1480,74 @@ static int write_graph_chunk_bloom_data(struct hashfile *f,
 	return 0;
 }
 
+static int write_graph_chunk_reach_labels(struct hashfile *f,
+					  void *data)
+{
+	struct write_commit_graph_context *ctx = data;
+	uint32_t i;
+
+	for (i = 0; i < ctx->commits.nr; i++) {
+		struct commit_graph_reach_label *label = &ctx->reach_labels_list[i];
+
+		display_progress(ctx->progress, ++ctx->progress_cnt);
+		hashwrite_be32(f, label->post);
+		hashwrite_be32(f, label->tree_low);
+		hashwrite_be32(f, label->low);
+	}
+	return 0;
+}
+
+static int write_graph_chunk_tree_bloom_indexes(struct hashfile *f,
+						void *data)
+{
+	struct write_commit_graph_context *ctx = data;
+	size_t i;
+
+	for (i = 0; i < ctx->commits.nr; i++) {
+		struct tree_bloom_filter *tf =
+			get_tree_bloom_filter(ctx->r, ctx->commits.list[i]);
+
+		display_progress(ctx->progress, ++ctx->progress_cnt);
+		if (tf) {
+			hashwrite_be32(f, ctx->tree_bloom_offsets[i]);
+			hashwrite_be32(f, tf->filter.len + 1);
+		} else {
+			hashwrite_be32(f, 0);
+			hashwrite_be32(f, 0);
+		}
+	}
+
+	return 0;
+}
+
+static int write_graph_chunk_tree_bloom_data(struct hashfile *f,
+					     void *data)
+{
+	struct write_commit_graph_context *ctx = data;
+	size_t i, written = 0;
+
+	hashwrite_be32(f, ctx->bloom_settings->hash_version);
+	hashwrite_be32(f, ctx->bloom_settings->num_hashes);
+	hashwrite_be32(f, ctx->bloom_settings->bits_per_entry);
+
+	for (i = 0; i < ctx->commits.nr; i++) {
+		struct tree_bloom_filter *tf =
+			get_tree_bloom_filter(ctx->r, ctx->commits.list[i]);
+
+		display_progress(ctx->progress, ++ctx->progress_cnt);
+
+		/* Filters shared with an earlier commit are written once. */
+		if (!tf || ctx->tree_bloom_offsets[i] != written)
+			continue;
+
+		hashwrite_u8(f, tf->flags);
+		hashwrite(f, tf->filter.data, tf->filter.len);
+		written += tf->filter.len + 1;
+	}
+
+	return 0;
+}
+
 static int add_packed_commits(const struct object_id *oid,
 			      struct packed_git *pack,
 			      uint32_t pos,
@@ -1667,12 +1845,106 @@ static void trace2_bloom_filter_write_statistics(struct write_commit_graph_conte
 			   ctx->count_bloom_filter_trunc_large);
 }
 
+struct bloom_work {
+	struct commit *commit;
+	struct bloom_filter filter;
+	enum bloom_filter_computed computed;
+};
+
+struct bloom_worker_data {
+	struct write_commit_graph_context *ctx;
+	struct bloom_work *work;
+	size_t work_nr;
+	size_t next;
+	struct progress *progress;
+	uint64_t done;
+	pthread_mutex_t mutex;
+};
+
+/* Each worker grabs this many commits at a time. */
+#define BLOOM_WORK_BATCH 16
+
+static void *compute_bloom_filters_worker(void *data)
+{
+	struct bloom_worker_data *wd = data;
+
+	for (;;) {
+		size_t i, start, end;
+
+		pthread_mutex_lock(&wd->mutex);
+		start = wd->next;
+		end = start + BLOOM_WORK_BATCH < wd->work_nr ?
+			start + BLOOM_WORK_BATCH : wd->work_nr;
+		wd->next = end;
+		pthread_mutex_unlock(&wd->mutex);
+
+		if (start >= end)
+			break;
+
+		for (i = start; i < end; i++)
+			compute_bloom_filter(wd->ctx->r, wd->work[i].commit,
+					     wd->ctx->bloom_settings,
+					     &wd->work[i].filter,
+					     &wd->work[i].computed);
+
+		pthread_mutex_lock(&wd->mutex);
+		wd->done += end - start;
+		display_progress(wd->progress, wd->done);
+		pthread_mutex_unlock(&wd->mutex);
+	}
+
+	return NULL;
+}
+
+/*
+ * Compute the filters of all commits in 'wd', using up to 'nr_threads'
+ * threads. Each commit is handled independently and its result stored
+ * in its own slot, so the outcome does not depend on the number of
+ * threads or on how the work was scheduled.
+ */
+static void run_bloom_filter_workers(struct bloom_worker_data *wd,
+				     int nr_threads)
+{
+	pthread_t *threads;
+	int i;
+
+	if (nr_threads > wd->work_nr / BLOOM_WORK_BATCH)
+		nr_threads = wd->work_nr / BLOOM_WORK_BATCH;
+	if (!HAVE_THREADS || nr_threads < 1)
+		nr_threads = 1;
+
+	pthread_mutex_init(&wd->mutex, NULL);
+	if (nr_threads == 1) {
+		compute_bloom_filters_worker(wd);
+		pthread_mutex_destroy(&wd->mutex);
+		return;
+	}
+
+	enable_obj_read_lock();
+
+	CALLOC_ARRAY(threads, nr_threads);
+	for (i = 0; i < nr_threads; i++) {
+		int err = pthread_create(&threads[i], NULL,
+					 compute_bloom_filters_worker, wd);
+		if (err)
+			die(_("unable to create thread: %s"), strerror(err));
+	}
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+
+	disable_obj_read_lock();
+	pthread_mutex_destroy(&wd->mutex);
+}
+
 static void compute_bloom_filters(struct write_commit_graph_context *ctx)
 {
 	int i;
 	struct progress *progress = NULL;
 	struct commit **sorted_commits;
 	int max_new_filters;
+	struct bloom_worker_data wd = { .ctx = ctx };
+	size_t work_alloc = 0;
 
 	init_bloom_filters();
 
@@ -1691,32 +1963,238 @@ static void compute_bloom_filters(struct write_commit_graph_context *ctx)
 	max_new_filters = ctx->opts && ctx->opts->max_new_filters >= 0 ?
 		ctx->opts->max_new_filters : ctx->commits.nr;
 
+	/*
+	 * Pick up the filters we already have, and decide which ones
+	 * to compute, before farming out the actual work.
+	 */
 	for (i = 0; i < ctx->commits.nr; i++) {
-		enum bloom_filter_computed computed = 0;
 		struct commit *c = sorted_commits[i];
-		struct bloom_filter *filter = get_or_compute_bloom_filter(
+		struct bloom_filter *filter = get_bloom_filter(ctx->r, c);
+
+		if (!filter && wd.work_nr < max_new_filters) {
+			repo_parse_commit(ctx->r, c);
+			ALLOC_GROW(wd.work, wd.work_nr + 1, work_alloc);
+			memset(&wd.work[wd.work_nr], 0, sizeof(*wd.work));
+			wd.work[wd.work_nr++].commit = c;
+			continue;
+		}
+
+		ctx->count_bloom_filter_not_computed++;
+		ctx->total_bloom_filter_data_size += filter
+			? sizeof(unsigned char) * filter->len : 0;
+		display_progress(progress, ++wd.done);
+	}
+
+	wd.progress = progress;
+	run_bloom_filter_workers(&wd, ctx->bloom_threads);
+
+	for (i = 0; i < wd.work_nr; i++) {
+		struct bloom_work *w = &wd.work[i];
+
+		set_bloom_filter(w->commit, &w->filter);
+		ctx->count_bloom_filter_computed++;
+		if (w->computed & BLOOM_TRUNC_EMPTY)
+			ctx->count_bloom_filter_trunc_empty++;
+		if (w->computed & BLOOM_TRUNC_LARGE)
+			ctx->count_bloom_filter_trunc_large++;
+		ctx->total_bloom_filter_data_size +=
+			sizeof(unsigned char) * w->filter.len;
+	}
+
+	if (trace2_is_enabled())
+		trace2_bloom_filter_write_statistics(ctx);
+
+	free(wd.work);
+	free(sorted_commits);
+	stop_progress(&progress);
+}
+
+/*
+ * Label every commit by a depth-first traversal that starts from the
+ * commits without children and visits parents in order; see the
+ * comment above "struct commit_graph_reach_label" for what the labels
+ * mean. Gives up (and writes no labels) if some parent is missing from
+ * the set of commits being written.
+ */
+static void compute_reach_labels(struct write_commit_graph_context *ctx)
+{
+	uint32_t nr = ctx->commits.nr;
+	uint32_t *parent_pos, *parent_start, *stack, *next;
+	unsigned char *has_child, *visited;
+	struct commit_graph_reach_label *labels;
+	uint32_t i, nr_parents = 0, counter = 0, stack_nr = 0;
+
+	ALLOC_ARRAY(parent_start, st_add(nr, 1));
+	for (i = 0; i < nr; i++) {
+		parent_start[i] = nr_parents;
+		nr_parents += commit_list_count(ctx->commits.list[i]->parents);
+	}
+	parent_start[nr] = nr_parents;
+
+	ALLOC_ARRAY(parent_pos, nr_parents);
+	CALLOC_ARRAY(has_child, nr);
+	for (i = 0; i < nr; i++) {
+		struct commit_list *p = ctx->commits.list[i]->parents;
+		uint32_t *dst = parent_pos + parent_start[i];
+
+		for (; p; p = p->next) {
+			int pos = oid_pos(&p->item->object.oid, ctx->commits.list,
+					  ctx->commits.nr, commit_to_oid);
+			if (pos < 0) {
+				ctx->reach_labels = 0;
+				goto cleanup_parents;
+			}
+			*dst++ = pos;
+			has_child[pos] = 1;
+		}
+	}
+
+	CALLOC_ARRAY(labels, nr);
+	CALLOC_ARRAY(visited, nr);
+	ALLOC_ARRAY(stack, nr);
+	ALLOC_ARRAY(next, nr);
+
+	for (i = 0; i < nr; i++) {
+		if (has_child[i])
+			continue;
+
+		visited[i] = 1;
+		labels[i].tree_low = counter;
+		next[i] = parent_start[i];
+		stack[stack_nr++] = i;
+
+		while (stack_nr) {
+			uint32_t v = stack[stack_nr - 1];
+			uint32_t j;
+
+			while (next[v] < parent_start[v + 1] &&
+			       visited[parent_pos[next[v]]])
+				next[v]++;
+
+			if (next[v] < parent_start[v + 1]) {
+				uint32_t p = parent_pos[next[v]++];
+
+				visited[p] = 1;
+				labels[p].tree_low = counter;
+				next[p] = parent_start[p];
+				stack[stack_nr++] = p;
+				continue;
+			}
+
+			labels[v].post = counter++;
+			labels[v].low = labels[v].post;
+			for (j = parent_start[v]; j < parent_start[v + 1]; j++)
+				if (labels[parent_pos[j]].low < labels[v].low)
+					labels[v].low = labels[parent_pos[j]].low;
+			stack_nr--;
+		}
+	}
+
+	ctx->reach_labels_list = labels;
+
+	free(visited);
+	free(stack);
+	free(next);
+cleanup_parents:
+	free(has_child);
+	free(parent_pos);
+	free(parent_start);
+}
+
+struct tree_bloom_entry {
+	struct hashmap_entry ent;
+	const struct tree_bloom_filter *tf;
+	uint32_t offset;
+};
+
+static int tree_bloom_entry_cmp(const void *cmp_data UNUSED,
+				const struct hashmap_entry *eptr,
+				const struct hashmap_entry *entry_or_key,
+				const void *keydata UNUSED)
+{
+	const struct tree_bloom_entry *a, *b;
+
+	a = container_of(eptr, const struct tree_bloom_entry, ent);
+	b = container_of(entry_or_key, const struct tree_bloom_entry, ent);
+
+	return a->tf->flags != b->tf->flags ||
+	       a->tf->filter.len != b->tf->filter.len ||
+	       memcmp(a->tf->filter.data, b->tf->filter.data, a->tf->filter.len);
+}
+
+static void trace2_tree_bloom_filter_write_statistics(struct write_commit_graph_context *ctx)
+{
+	trace2_data_intmax("commit-graph", ctx->r, "tree-filter-computed",
+			   ctx->count_tree_bloom_filter_computed);
+	trace2_data_intmax("commit-graph", ctx->r, "tree-filter-dirs-only",
+			   ctx->count_tree_bloom_filter_dirs_only);
+	trace2_data_intmax("commit-graph", ctx->r, "tree-filter-trunc-large",
+			   ctx->count_tree_bloom_filter_trunc_large);
+	trace2_data_intmax("commit-graph", ctx->r, "tree-filter-shared",
+			   ctx->count_tree_bloom_filter_shared);
+}
+
+/*
+ * Compute the tree-path Bloom filters of all commits and lay them
+ * out in the data chunk. Consecutive commits frequently have the
+ * same set of paths (and hence identical filters), so each distinct
+ * filter is only stored once.
+ */
+static void compute_tree_bloom_filters(struct write_commit_graph_context *ctx)
+{
+	struct hashmap filters = HASHMAP_INIT(tree_bloom_entry_cmp, NULL);
+	struct progress *progress = NULL;
+	size_t i;
+
+	if (ctx->report_progress)
+		progress = start_delayed_progress(
+			_("Computing commit tree-path Bloom filters"),
+			ctx->commits.nr);
+
+	ALLOC_ARRAY(ctx->tree_bloom_offsets, ctx->commits.nr);
+
+	for (i = 0; i < ctx->commits.nr; i++) {
+		enum bloom_filter_computed computed = 0;
+		struct tree_bloom_entry *e, *existing;
+		struct tree_bloom_filter *tf = get_or_compute_tree_bloom_filter(
 			ctx->r,
-			c,
-			ctx->count_bloom_filter_computed < max_new_filters,
+			ctx->commits.list[i],
+			1,
 			ctx->bloom_settings,
 			&computed);
+
 		if (computed & BLOOM_COMPUTED) {
-			ctx->count_bloom_filter_computed++;
-			if (computed & BLOOM_TRUNC_EMPTY)
-				ctx->count_bloom_filter_trunc_empty++;
+			ctx->count_tree_bloom_filter_computed++;
 			if (computed & BLOOM_TRUNC_LARGE)
-				ctx->count_bloom_filter_trunc_large++;
-		} else if (computed & BLOOM_NOT_COMPUTED)
-			ctx->count_bloom_filter_not_computed++;
-		ctx->total_bloom_filter_data_size += filter
-			? sizeof(unsigned char) * filter->len : 0;
+				ctx->count_tree_bloom_filter_trunc_large++;
+			else if (tf->flags & BLOOM_TREE_DIRS_ONLY)
+				ctx->count_tree_bloom_filter_dirs_only++;
+		}
+
+		CALLOC_ARRAY(e, 1);
+		e->tf = tf;
+		hashmap_entry_init(&e->ent, memhash(tf->filter.data, tf->filter.len));
+
+		existing = hashmap_get_entry(&filters, e, ent, NULL);
+		if (existing) {
+			ctx->tree_bloom_offsets[i] = existing->offset;
+			ctx->count_tree_bloom_filter_shared++;
+			free(e);
+		} else {
+			if (ctx->total_tree_bloom_data_size + tf->filter.len + 1 > UINT32_MAX)
+				die(_("tree-path Bloom filters exceed the maximum size of the commit-graph chunk"));
+			e->offset = ctx->total_tree_bloom_data_size;
+			ctx->tree_bloom_offsets[i] = e->offset;
+			ctx->total_tree_bloom_data_size += tf->filter.len + 1;
+			hashmap_add(&filters, &e->ent);
+		}
 		display_progress(progress, i + 1);
 	}
 
 	if (trace2_is_enabled())
-		trace2_bloom_filter_write_statistics(ctx);
+		trace2_tree_bloom_filter_write_statistics(ctx);
 
-	free(sorted_commits);
+	hashmap_clear_and_free(&filters, struct tree_bloom_entry, ent);
 	stop_progress(&progress);
 }
 
@@ -1995,6 +2473,19 @@ static int write_commit_graph_file(struct write_commit_graph_context *ctx)
 				 ctx->total_bloom_filter_data_size),
 			  write_graph_chunk_bloom_data);
 	}
+	if (ctx->tree_paths) {
+		add_chunk(cf, GRAPH_CHUNKID_TREEBLOOMINDEXES,
+			  st_mult(2 * sizeof(uint32_t), ctx->commits.nr),
+			  write_graph_chunk_tree_bloom_indexes);
+		add_chunk(cf, GRAPH_CHUNKID_TREEBLOOMDATA,
+			  st_add(sizeof(uint32_t) * 3,
+				 ctx->total_tree_bloom_data_size),
+			  write_graph_chunk_tree_bloom_data);
+	}
+	if (ctx->reach_labels)
+		add_chunk(cf, GRAPH_CHUNKID_REACHLABELS,
+			  st_mult(GRAPH_REACH_LABEL_WIDTH, ctx->commits.nr),
+			  write_graph_chunk_reach_labels);
 	if (ctx->num_commit_graphs_after > 1)
 		add_chunk(cf, GRAPH_CHUNKID_BASE,
 			  st_mult(hashsz, ctx->num_commit_graphs_after - 1),
@@ -2405,8 +2896,14 @@ int write_commit_graph(struct object_directory *odb,
 						  bloom_settings.num_hashes);
 	bloom_settings.max_changed_paths = git_env_ulong("GIT_TEST_BLOOM_SETTINGS_MAX_CHANGED_PATHS",
 							 bloom_settings.max_changed_paths);
+	bloom_settings.max_tree_paths = git_env_ulong("GIT_TEST_BLOOM_SETTINGS_MAX_TREE_PATHS",
+						      bloom_settings.max_tree_paths);
 	ctx->bloom_settings = &bloom_settings;
 
+	ctx->bloom_threads = opts ? opts->threads : 0;
+	if (!ctx->bloom_threads)	/* threads=0 means autodetect */
+		ctx->bloom_threads = online_cpus();
+
 	init_topo_level_slab(&topo_levels);
 	ctx->topo_levels = &topo_levels;
 
@@ -2434,6 +2931,30 @@ int write_commit_graph(struct object_directory *odb,
 		}
 	}
 
+	if (flags & COMMIT_GRAPH_WRITE_TREE_BLOOM_FILTERS)
+		ctx->tree_paths = 1;
+	if (!(flags & COMMIT_GRAPH_NO_WRITE_TREE_BLOOM_FILTERS)) {
+		struct commit_graph *g = ctx->r->objects->commit_graph;
+
+		/* Likewise for tree-path filters. */
+		if (g && g->chunk_tree_bloom_data)
+			ctx->tree_paths = 1;
+	}
+	/* Tree-path filters are read alongside the changed-path ones. */
+	if (!ctx->changed_paths)
+		ctx->tree_paths = 0;
+
+	if (flags & COMMIT_GRAPH_WRITE_REACH_LABELS)
+		ctx->reach_labels = 1;
+	if (!(flags & COMMIT_GRAPH_NO_WRITE_REACH_LABELS)) {
+		struct commit_graph *g = ctx->r->objects->commit_graph;
+
+		while (g && g->base_graph)
+			g = g->base_graph;
+		if (g && g->chunk_reach_labels)
+			ctx->reach_labels = 1;
+	}
+
 	if (ctx->split) {
 		struct commit_graph *g = ctx->r->objects->commit_graph;
 
@@ -2513,6 +3034,17 @@ int write_commit_graph(struct object_directory *odb,
 
 	if (ctx->changed_paths)
 		compute_bloom_filters(ctx);
+	if (ctx->tree_paths)
+		compute_tree_bloom_filters(ctx);
+
+	/*
+	 * Labels of a layer must cover everything its commits can
+	 * reach, so they are only written when there is no base.
+	 */
+	if (ctx->num_commit_graphs_after > 1)
+		ctx->reach_labels = 0;
+	if (ctx->reach_labels)
+		compute_reach_labels(ctx);
 
 	res = write_commit_graph_file(ctx);
 
@@ -2524,6 +3056,8 @@ int write_commit_graph(struct object_directory *odb,
 cleanup:
 	free(ctx->graph_name);
 	free(ctx->commits.list);
+	free(ctx->tree_bloom_offsets);
+	free(ctx->reach_labels_list);
 	oid_array_clear(&ctx->oids);
 	clear_topo_level_slab(&topo_levels);
 
@@ -2628,6 +3162,7 @@ static int verify_one_commit_graph(struct repository *r,
 	for (i = 0; i < g->num_commits; i++) {
 		struct commit *graph_commit, *odb_commit;
 		struct commit_list *graph_parents, *odb_parents;
+		struct commit_graph_reach_label label;
 		timestamp_t max_generation = 0;
 		timestamp_t generation;
 
@@ -2652,6 +3187,10 @@ static int verify_one_commit_graph(struct repository *r,
 		graph_parents = graph_commit->parents;
 		odb_parents = odb_commit->parents;
 
+		if (g->chunk_reach_labels)
+			read_reach_label(g, commit_graph_position(graph_commit),
+					 &label);
+
 		while (graph_parents) {
 			if (!odb_parents) {
 				graph_report(_("commit-graph parent list for commit %s is too long"),
@@ -2668,6 +3207,18 @@ static int verify_one_commit_graph(struct repository *r,
 					     oid_to_hex(&graph_parents->item->object.oid),
 					     oid_to_hex(&odb_parents->item->object.oid));
 
+			if (g->chunk_reach_labels) {
+				struct commit_graph_reach_label parent_label;
+
+				read_reach_label(g, commit_graph_position(graph_parents->item),
+						 &parent_label);
+				if (parent_label.post >= label.post ||
+				    parent_label.low < label.low)
+					graph_report(_("commit-graph reachability label for commit %s is inconsistent with parent %s"),
+						     oid_to_hex(&cur_oid),
+						     oid_to_hex(&graph_parents->item->object.oid));
+			}
+
 			generation = commit_graph_generation_from_graph(graph_parents->item);
 			if (generation > max_generation)
 				max_generation = generation;
@@ -97,6 +97,10 @@ struct commit_graph {
 	const unsigned char *chunk_base_graphs;
 	const unsigned char *chunk_bloom_indexes;
 	const unsigned char *chunk_bloom_data;
+	const unsigned char *chunk_tree_bloom_indexes;
+	const unsigned char *chunk_tree_bloom_data;
+	size_t tree_bloom_data_size;
+	const unsigned char *chunk_reach_labels;
 
 	struct topo_level_slab *topo_levels;
 	struct bloom_filter_settings *bloom_filter_settings;
@@ -135,6 +139,10 @@ enum commit_graph_write_flags {
 	COMMIT_GRAPH_WRITE_SPLIT      = (1 << 2),
 	COMMIT_GRAPH_WRITE_BLOOM_FILTERS = (1 << 3),
 	COMMIT_GRAPH_NO_WRITE_BLOOM_FILTERS = (1 << 4),
+	COMMIT_GRAPH_WRITE_TREE_BLOOM_FILTERS = (1 << 5),
+	COMMIT_GRAPH_NO_WRITE_TREE_BLOOM_FILTERS = (1 << 6),
+	COMMIT_GRAPH_WRITE_REACH_LABELS = (1 << 7),
+	COMMIT_GRAPH_NO_WRITE_REACH_LABELS = (1 << 8),
 };
 
 enum commit_graph_split_flags {
@@ -149,6 +157,12 @@ struct commit_graph_opts {
 	timestamp_t expire_time;
 	enum commit_graph_split_flags split_flags;
 	int max_new_filters;
+
+	/*
+	 * Number of threads computing changed-path Bloom filters;
+	 * zero means to use as many as there are CPUs.
+	 */
+	int threads;
 };
 
 /*
@@ -190,6 +204,31 @@ struct commit_graph_data {
 timestamp_t commit_graph_generation(const struct commit *);
 uint32_t commit_graph_position(const struct commit *);
 
+/*
+ * A reachability label assigns each commit its position 'post' in a
+ * depth-first post-order traversal of the commit graph, the smallest
+ * position 'tree_low' within its subtree of the traversal's spanning
+ * tree, and the smallest position 'low' of any commit it can reach.
+ *
+ * If A can reach B, then B's interval [low, post] is contained in A's;
+ * and if B's position lies within [tree_low, post] of A, then B was
+ * discovered through A and is reachable from it.
+ */
+struct commit_graph_reach_label {
+	uint32_t post;
+	uint32_t tree_low;
+	uint32_t low;
+};
+
+/*
+ * Look up the reachability label of the parsed commit 'c'. Returns 0
+ * on success, or -1 if the commit-graph does not have a label for it.
+ * Labels of different commits are only comparable with each other if
+ * both lookups succeed.
+ */
+int commit_graph_reach_label(struct repository *r, struct commit *c,
+			     struct commit_graph_reach_label *label);
+
 /*
  * After this method, all commits reachable from those in the given
  * list will have non-zero, non-infinite generation numbers.
@@ -10,6 +10,8 @@
 #include "tag.h"
 #include "commit-reach.h"
 #include "ewah/ewok.h"
+#include "config.h"
+#include "thread-utils.h"
 
 /* Remember to update object flag allocation in object.h */
 #define PARENT1		(1u<<16)
@@ -470,6 +472,89 @@ int repo_is_descendant_of(struct repository *r,
 	}
 }
 
+/*
+ * Can "from" reach "to", judging from their reachability labels alone?
+ * Returns 1 if it can, 0 if it cannot, and -1 if the labels do not
+ * tell.
+ */
+static int reach_label_cmp(const struct commit_graph_reach_label *from,
+			   const struct commit_graph_reach_label *to)
+{
+	if (to->post > from->post || to->low < from->low)
+		return 0;
+	if (to->post >= from->tree_low)
+		return 1;
+	return -1;
+}
+
+/*
+ * Can "from" reach "to"? Walks down from "from", but only through
+ * commits whose labels do not already rule out or confirm "to".
+ * Returns -1 if a commit along the way has no label.
+ */
+static int reach_by_labels(struct repository *r,
+			   struct commit *from, struct commit *to)
+{
+	struct commit_graph_reach_label label, to_label;
+	struct commit_list *stack = NULL;
+	struct bitmap *seen;
+	timestamp_t to_gen;
+	int ret;
+
+	if (commit_graph_reach_label(r, from, &label) ||
+	    commit_graph_reach_label(r, to, &to_label))
+		return -1;
+
+	ret = reach_label_cmp(&label, &to_label);
+	if (ret >= 0)
+		return ret;
+
+	to_gen = commit_graph_generation(to);
+	seen = bitmap_new();
+	bitmap_set(seen, label.post);
+	commit_list_insert(from, &stack);
+	ret = 0;
+
+	while (stack) {
+		struct commit *c = pop_commit(&stack);
+		struct commit_list *p;
+
+		for (p = c->parents; p; p = p->next) {
+			if (repo_parse_commit(r, p->item)) {
+				ret = -1;
+				goto done;
+			}
+
+			/* Commits with lower generations cannot reach "to" */
+			if (commit_graph_generation(p->item) < to_gen)
+				continue;
+
+			if (commit_graph_reach_label(r, p->item, &label)) {
+				ret = -1;
+				goto done;
+			}
+
+			if (bitmap_get(seen, label.post))
+				continue;
+			bitmap_set(seen, label.post);
+
+			switch (reach_label_cmp(&label, &to_label)) {
+			case 1:
+				ret = 1;
+				goto done;
+			case -1:
+				commit_list_insert(p->item, &stack);
+				break;
+			}
+		}
+	}
+
+done:
+	free_commit_list(stack);
+	bitmap_free(seen);
+	return ret;
+}
+
 /*
  * Is "commit" an ancestor of one of the "references"?
  */
@@ -495,6 +580,16 @@ int repo_in_merge_bases_many(struct repository *r, struct commit *commit,
 	if (generation > max_generation)
 		return ret;
 
+	for (i = 0; i < nr_reference; i++) {
+		int res = reach_by_labels(r, reference[i], commit);
+		if (res < 0)
+			break;
+		if (res)
+			return 1;
+	}
+	if (i == nr_reference)
+		return 0;
+
 	bases = paint_down_to_common(r, commit,
 				     nr_reference, reference,
 				     generation);
@@ -979,12 +1074,266 @@ static void free_bit_array(struct commit *c)
 	*bitmap = NULL;
 }
 
+/*
+ * With many refs to compare, ahead_behind() splits the counts into
+ * groups of tips with neighbouring generation numbers and walks for
+ * each group in its own thread. This keeps the per-commit bitmaps and
+ * the loop over the counts small, at the price of walking the history
+ * shared by different groups more than once.
+ *
+ * The threads keep their state in their own commit slab rather than in
+ * object flags, and only parse commits under 'ahead_behind_mutex'.
+ */
+#define AHEAD_BEHIND_MIN_PER_THREAD 64
+
+struct ahead_behind_state {
+	struct bitmap *bitmap;
+	timestamp_t generation;
+	unsigned queued:1,
+		 stale:1;
+};
+
+define_commit_slab(ahead_behind_slab, struct ahead_behind_state);
+
+struct ahead_behind_group {
+	struct repository *r;
+	struct commit **commits;
+	size_t commits_nr;
+	struct ahead_behind_count **counts;
+	size_t *tip_bit, *base_bit;
+	size_t counts_nr;
+};
+
+static pthread_mutex_t ahead_behind_mutex;
+
+static int compare_ahead_behind_state(const void *a_, const void *b_,
+				      void *data)
+{
+	struct ahead_behind_slab *slab = data;
+	const struct commit *a = a_, *b = b_;
+	timestamp_t generation_a = ahead_behind_slab_peek(slab, a)->generation;
+	timestamp_t generation_b = ahead_behind_slab_peek(slab, b)->generation;
+
+	if (generation_a < generation_b)
+		return 1;
+	if (generation_a > generation_b)
+		return -1;
+	return compare_commits_by_commit_date(a_, b_, NULL);
+}
+
+static struct ahead_behind_state *ahead_behind_queue(struct ahead_behind_group *g,
+						     struct ahead_behind_slab *slab,
+						     struct prio_queue *queue,
+						     struct commit *c,
+						     size_t width)
+{
+	struct ahead_behind_state *state = ahead_behind_slab_at(slab, c);
+
+	if (!state->queued) {
+		pthread_mutex_lock(&ahead_behind_mutex);
+		repo_parse_commit(g->r, c);
+		state->generation = commit_graph_generation(c);
+		pthread_mutex_unlock(&ahead_behind_mutex);
+
+		state->bitmap = bitmap_word_alloc(width);
+		state->queued = 1;
+		prio_queue_put(queue, c);
+	}
+	return state;
+}
+
+static void *ahead_behind_worker(void *arg)
+{
+	struct ahead_behind_group *g = arg;
+	struct ahead_behind_slab slab;
+	struct prio_queue queue = { .compare = compare_ahead_behind_state };
+	size_t width = DIV_ROUND_UP(g->commits_nr, BITS_IN_EWORD);
+	size_t nonstale_nr = 0;
+
+	init_ahead_behind_slab(&slab);
+	queue.cb_data = &slab;
+
+	for (size_t i = 0; i < g->commits_nr; i++) {
+		struct ahead_behind_state *state;
+
+		state = ahead_behind_queue(g, &slab, &queue, g->commits[i], width);
+		if (!bitmap_popcount(state->bitmap))
+			nonstale_nr++;
+		bitmap_set(state->bitmap, i);
+	}
+
+	while (nonstale_nr) {
+		struct commit *c = prio_queue_get(&queue);
+		struct ahead_behind_state *state = ahead_behind_slab_at(&slab, c);
+		struct bitmap *bitmap_c = state->bitmap;
+		struct commit_list *p;
+
+		if (!state->stale)
+			nonstale_nr--;
+
+		for (size_t i = 0; i < g->counts_nr; i++) {
+			int reach_from_tip = !!bitmap_get(bitmap_c, g->tip_bit[i]);
+			int reach_from_base = !!bitmap_get(bitmap_c, g->base_bit[i]);
+
+			if (reach_from_tip ^ reach_from_base) {
+				if (reach_from_base)
+					g->counts[i]->behind++;
+				else
+					g->counts[i]->ahead++;
+			}
+		}
+
+		for (p = c->parents; p; p = p->next) {
+			struct ahead_behind_state *parent;
+			int queued = !!ahead_behind_slab_at(&slab, p->item)->queued;
+
+			parent = ahead_behind_queue(g, &slab, &queue, p->item, width);
+			bitmap_or(parent->bitmap, bitmap_c);
+
+			/* See the comment in ahead_behind() on staleness. */
+			if (!parent->stale &&
+			    bitmap_popcount(parent->bitmap) == g->commits_nr) {
+				parent->stale = 1;
+				if (queued)
+					nonstale_nr--;
+			} else if (!queued && !parent->stale) {
+				nonstale_nr++;
+			}
+		}
+
+		/*
+		 * The slab entry stays behind with 'queued' set, which
+		 * keeps the commit from being queued a second time.
+		 */
+		bitmap_free(bitmap_c);
+		state->bitmap = NULL;
+	}
+
+	while (queue.nr) {
+		struct commit *c = prio_queue_get(&queue);
+		bitmap_free(ahead_behind_slab_at(&slab, c)->bitmap);
+	}
+	clear_prio_queue(&queue);
+	clear_ahead_behind_slab(&slab);
+	return NULL;
+}
+
+static int ahead_behind_nr_threads(size_t counts_nr)
+{
+	int nr_threads;
+
+	if (!HAVE_THREADS)
+		return 1;
+
+	nr_threads = git_env_ulong("GIT_TEST_AHEAD_BEHIND_THREADS", 0);
+	if (nr_threads)
+		return nr_threads;
+
+	nr_threads = online_cpus();
+	if (counts_nr / AHEAD_BEHIND_MIN_PER_THREAD < nr_threads)
+		nr_threads = counts_nr / AHEAD_BEHIND_MIN_PER_THREAD;
+	return nr_threads;
+}
+
+static int compare_counts_by_tip_generation(const void *a_, const void *b_,
+					    void *data)
+{
+	struct commit **commits = data;
+	const struct ahead_behind_count *a = *(const struct ahead_behind_count **)a_;
+	const struct ahead_behind_count *b = *(const struct ahead_behind_count **)b_;
+	timestamp_t generation_a = commit_graph_generation(commits[a->tip_index]);
+	timestamp_t generation_b = commit_graph_generation(commits[b->tip_index]);
+
+	if (generation_a != generation_b)
+		return generation_a < generation_b ? -1 : 1;
+	if (a->tip_index != b->tip_index)
+		return a->tip_index < b->tip_index ? -1 : 1;
+	return 0;
+}
+
+static void ahead_behind_threaded(struct repository *r,
+				  struct commit **commits, size_t commits_nr,
+				  struct ahead_behind_count *counts, size_t counts_nr,
+				  int nr_threads)
+{
+	struct ahead_behind_count **sorted;
+	struct ahead_behind_group *groups;
+	pthread_t *threads;
+	size_t *bit;
+	size_t start = 0;
+
+	/* Sorting by generation needs all the tips parsed. */
+	for (size_t i = 0; i < commits_nr; i++)
+		repo_parse_commit(r, commits[i]);
+
+	ALLOC_ARRAY(sorted, counts_nr);
+	for (size_t i = 0; i < counts_nr; i++)
+		sorted[i] = &counts[i];
+	QSORT_S(sorted, counts_nr, compare_counts_by_tip_generation, commits);
+
+	CALLOC_ARRAY(groups, nr_threads);
+	CALLOC_ARRAY(threads, nr_threads);
+	ALLOC_ARRAY(bit, commits_nr);
+
+	for (int t = 0; t < nr_threads; t++) {
+		struct ahead_behind_group *g = &groups[t];
+		size_t end = st_mult(counts_nr, t + 1) / nr_threads;
+
+		g->r = r;
+		g->counts = sorted + start;
+		g->counts_nr = end - start;
+		ALLOC_ARRAY(g->commits, st_mult(2, g->counts_nr));
+		ALLOC_ARRAY(g->tip_bit, g->counts_nr);
+		ALLOC_ARRAY(g->base_bit, g->counts_nr);
+
+		/* Give each commit of the group its own bit. */
+		for (size_t i = 0; i < commits_nr; i++)
+			bit[i] = SIZE_MAX;
+		for (size_t i = 0; i < g->counts_nr; i++) {
+			size_t tip = g->counts[i]->tip_index;
+			size_t base = g->counts[i]->base_index;
+
+			if (bit[tip] == SIZE_MAX) {
+				bit[tip] = g->commits_nr;
+				g->commits[g->commits_nr++] = commits[tip];
+			}
+			if (bit[base] == SIZE_MAX) {
+				bit[base] = g->commits_nr;
+				g->commits[g->commits_nr++] = commits[base];
+			}
+			g->tip_bit[i] = bit[tip];
+			g->base_bit[i] = bit[base];
+		}
+		start = end;
+	}
+
+	pthread_mutex_init(&ahead_behind_mutex, NULL);
+	for (int t = 0; t < nr_threads; t++)
+		if (pthread_create(&threads[t], NULL,
+				   ahead_behind_worker, &groups[t]))
+			die(_("unable to create thread"));
+	for (int t = 0; t < nr_threads; t++)
+		pthread_join(threads[t], NULL);
+	pthread_mutex_destroy(&ahead_behind_mutex);
+
+	for (int t = 0; t < nr_threads; t++) {
+		free(groups[t].commits);
+		free(groups[t].tip_bit);
+		free(groups[t].base_bit);
+	}
+	free(groups);
+	free(threads);
+	free(bit);
+	free(sorted);
+}
+
 void ahead_behind(struct repository *r,
 		  struct commit **commits, size_t commits_nr,
 		  struct ahead_behind_count *counts, size_t counts_nr)
 {
 	struct prio_queue queue = { .compare = compare_commits_by_gen_then_commit_date };
 	size_t width = DIV_ROUND_UP(commits_nr, BITS_IN_EWORD);
+	int nr_threads;
 
 	if (!commits_nr || !counts_nr)
 		return;
@@ -996,6 +1345,13 @@ void ahead_behind(struct repository *r,
 
 	ensure_generations_valid(r, commits, commits_nr);
 
+	nr_threads = ahead_behind_nr_threads(counts_nr);
+	if (nr_threads > 1) {
+		ahead_behind_threaded(r, commits, commits_nr,
+				      counts, counts_nr, nr_threads);
+		return;
+	}
+
 	init_bit_arrays(&bit_arrays);
 
 	for (size_t i = 0; i < commits_nr; i++) {
@@ -1079,7 +1435,10 @@ void tips_reachable_from_bases(struct repository *r,
 	struct commit_and_index *commits;
 	size_t min_generation_index = 0;
 	timestamp_t min_generation;
-	struct commit_list *stack = NULL;
+	struct commit_list *stack = NULL, *b;
+	struct commit_graph_reach_label *base_labels;
+	size_t i, nr = 0, nr_bases = 0;
+	int have_base_labels;
 
 	if (!bases || !tips || !tips_nr)
 		return;
@@ -1093,11 +1452,53 @@ void tips_reachable_from_bases(struct repository *r,
 
 	CALLOC_ARRAY(commits, tips_nr);
 
-	for (size_t i = 0; i < tips_nr; i++) {
-		commits[i].commit = tips[i];
-		commits[i].index = i;
-		commits[i].generation = commit_graph_generation(tips[i]);
+	/*
+	 * Settle whatever tips we can from the reachability labels and
+	 * only search for the rest.
+	 */
+	for (b = bases; b; b = b->next)
+		nr_bases++;
+	ALLOC_ARRAY(base_labels, nr_bases);
+	for (b = bases, i = 0; b; b = b->next, i++) {
+		if (repo_parse_commit(r, b->item) ||
+		    commit_graph_reach_label(r, b->item, &base_labels[i]))
+			break;
+	}
+	have_base_labels = !b;
+
+	for (size_t j = 0; j < tips_nr; j++) {
+		struct commit_graph_reach_label label;
+		int reachable = -1;
+
+		if (have_base_labels &&
+		    !commit_graph_reach_label(r, tips[j], &label)) {
+			reachable = 0;
+			for (i = 0; i < nr_bases; i++) {
+				int res = reach_label_cmp(&base_labels[i], &label);
+				if (res > 0) {
+					reachable = 1;
+					break;
+				}
+				if (res < 0)
+					reachable = -1;
+			}
+		}
+
+		if (reachable > 0)
+			tips[j]->object.flags |= mark;
+		if (reachable >= 0)
+			continue;
+
+		commits[nr].commit = tips[j];
+		commits[nr].index = j;
+		commits[nr].generation = commit_graph_generation(tips[j]);
+		nr++;
 	}
+	free(base_labels);
+
+	if (!nr)
+		goto done;
+	tips_nr = nr;
 
 	/* Sort with generation number ascending. */
 	QSORT(commits, tips_nr, compare_commit_and_index_by_generation);
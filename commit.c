@@ -75,10 +75,7 @@ struct commit *lookup_commit_object(struct repository *r,
 
 struct commit *lookup_commit(struct repository *r, const struct object_id *oid)
 {
-	struct object *obj = lookup_object(r, oid);
-	if (!obj)
-		return create_object(r, oid, alloc_commit_node(r));
-	return object_as_type(obj, OBJ_COMMIT, 0);
+	return lookup_or_create_object(r, oid, OBJ_COMMIT, alloc_commit_node);
 }
 
 struct commit *lookup_commit_reference_by_name(const char *name)
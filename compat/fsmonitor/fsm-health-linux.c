@@ -0,0 +1,131 @@
+#include "git-compat-util.h"
+#include "config.h"
+#include "fsmonitor-ll.h"
+#include "fsm-health.h"
+#include "fsmonitor--daemon.h"
+#include "gettext.h"
+#include "trace.h"
+
+/*
+ * Every minute wake up and test our health.
+ */
+#define WAIT_FREQ_MS (60 * 1000)
+
+struct fsm_health_data
+{
+	int fd_shutdown[2]; /* written by stop_async, polled by the loop */
+
+	/*
+	 * inotify tells us when the watched root itself is moved or
+	 * deleted, but not when one of its parent directories is.  In
+	 * that case the daemon is still watching the right inodes, but
+	 * clients using the old pathname will no longer find our socket
+	 * and new clients will start a second daemon.  Remember the
+	 * identity of the root at startup and shutdown if the pathname
+	 * stops referring to it.
+	 */
+	dev_t wt_dev;
+	ino_t wt_ino;
+};
+
+int fsm_health__ctor(struct fsmonitor_daemon_state *state)
+{
+	struct fsm_health_data *data;
+	struct stat st;
+
+	if (stat(state->path_worktree_watch.buf, &st))
+		return error_errno(_("could not stat '%s'"),
+				   state->path_worktree_watch.buf);
+
+	CALLOC_ARRAY(data, 1);
+
+	if (pipe(data->fd_shutdown)) {
+		error_errno(_("could not create health thread pipe"));
+		free(data);
+		return -1;
+	}
+
+	data->wt_dev = st.st_dev;
+	data->wt_ino = st.st_ino;
+
+	state->health_data = data;
+	return 0;
+}
+
+void fsm_health__dtor(struct fsmonitor_daemon_state *state)
+{
+	struct fsm_health_data *data;
+
+	if (!state || !state->health_data)
+		return;
+
+	data = state->health_data;
+
+	close(data->fd_shutdown[0]);
+	close(data->fd_shutdown[1]);
+
+	FREE_AND_NULL(state->health_data);
+}
+
+/*
+ * Return 1 if the worktree root has been moved or replaced since the
+ * daemon started.
+ */
+static int has_worktree_moved(struct fsmonitor_daemon_state *state)
+{
+	struct fsm_health_data *data = state->health_data;
+	struct stat st;
+
+	if (stat(state->path_worktree_watch.buf, &st)) {
+		trace_printf_key(&trace_fsmonitor,
+				 "health: could not stat worktree '%s'",
+				 state->path_worktree_watch.buf);
+		return 1;
+	}
+
+	if (st.st_dev != data->wt_dev || st.st_ino != data->wt_ino) {
+		trace_printf_key(&trace_fsmonitor,
+				 "health: worktree '%s' was moved",
+				 state->path_worktree_watch.buf);
+		return 1;
+	}
+
+	return 0;
+}
+
+void fsm_health__loop(struct fsmonitor_daemon_state *state)
+{
+	struct fsm_health_data *data = state->health_data;
+	struct pollfd pfd;
+
+	pfd.fd = data->fd_shutdown[0];
+	pfd.events = POLLIN;
+
+	for (;;) {
+		int result = poll(&pfd, 1, WAIT_FREQ_MS);
+
+		if (result < 0) {
+			if (errno == EINTR)
+				continue;
+			error_errno(_("health thread poll failed"));
+			state->health_error_code = -1;
+			break;
+		}
+
+		if (result > 0)
+			return; /* normal shutdown requested */
+
+		if (has_worktree_moved(state))
+			break;
+	}
+
+	ipc_server_stop_async(state->ipc_server_data);
+}
+
+void fsm_health__stop_async(struct fsmonitor_daemon_state *state)
+{
+	struct fsm_health_data *data = state->health_data;
+
+	if (write(data->fd_shutdown[1], "x", 1) < 0)
+		error_errno(_("could not signal health thread"));
+}
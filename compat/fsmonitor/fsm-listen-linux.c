@@ -0,0 +1,686 @@
+#include "git-compat-util.h"
+#include "dir.h"
+#include "fsmonitor-ll.h"
+#include "fsm-listen.h"
+#include "fsmonitor--daemon.h"
+#include "gettext.h"
+#include "hashmap.h"
+#include "string-list.h"
+#include "strmap.h"
+#include "trace.h"
+#include <sys/inotify.h>
+
+/*
+ * inotify only watches a single directory (non-recursively), so we
+ * have to create a watch on every directory in the working tree and
+ * keep the set of watches in sync as directories are created, moved
+ * and deleted.  The kernel identifies each watch with a small integer
+ * (the "watch descriptor" or wd) and only gives us the leaf name of
+ * the affected entry, so we keep a map from wd to the absolute
+ * pathname of the watched directory.  We also keep the reverse map so
+ * that we can find all of the watches below a directory when it is
+ * renamed away.
+ */
+struct watch_entry {
+	struct hashmap_entry ent;
+	int wd;
+	unsigned is_root:1; /* <worktree-root> or external <gitdir> */
+	char *dir; /* absolute path, without a trailing slash */
+};
+
+struct fsm_listen_data
+{
+	int fd_inotify;
+	int fd_shutdown[2]; /* written by stop_async, polled by the loop */
+
+	struct hashmap watches; /* wd -> struct watch_entry */
+	struct strmap revwatches; /* dir -> struct watch_entry */
+
+	enum shutdown_style {
+		SHUTDOWN_EVENT = 0,
+		FORCE_SHUTDOWN,
+		FORCE_ERROR_STOP,
+	} shutdown_style;
+};
+
+/*
+ * Events that we want for each directory in the working tree.  We do
+ * not follow symlinks to directories (Git does not either) and we
+ * never get events for paths that were unlinked while still open.
+ */
+#define WATCH_MASK_WORKDIR (IN_MODIFY | IN_ATTRIB | IN_CREATE | IN_DELETE | \
+			    IN_MOVED_FROM | IN_MOVED_TO | \
+			    IN_DELETE_SELF | IN_MOVE_SELF | \
+			    IN_ONLYDIR | IN_DONT_FOLLOW | IN_EXCL_UNLINK)
+
+/*
+ * For the cookie directory we only need to see new cookie files.
+ */
+#define WATCH_MASK_COOKIES (IN_CREATE | IN_MOVED_TO | \
+			    IN_ONLYDIR | IN_DONT_FOLLOW)
+
+/*
+ * For an external <gitdir> we only need to know if it goes away.
+ */
+#define WATCH_MASK_GITDIR (IN_DELETE_SELF | IN_MOVE_SELF | \
+			   IN_ONLYDIR | IN_DONT_FOLLOW)
+
+static int watch_entry_cmp(const void *cmp_data UNUSED,
+			   const struct hashmap_entry *he1,
+			   const struct hashmap_entry *he2,
+			   const void *keydata UNUSED)
+{
+	const struct watch_entry *a =
+		container_of(he1, const struct watch_entry, ent);
+	const struct watch_entry *b =
+		container_of(he2, const struct watch_entry, ent);
+
+	return a->wd != b->wd;
+}
+
+static struct watch_entry *find_watch(struct fsm_listen_data *data, int wd)
+{
+	struct watch_entry key;
+
+	hashmap_entry_init(&key.ent, memhash(&wd, sizeof(wd)));
+	key.wd = wd;
+
+	return hashmap_get_entry(&data->watches, &key, ent, NULL);
+}
+
+static void forget_watch(struct fsm_listen_data *data,
+			 struct watch_entry *w)
+{
+	hashmap_remove(&data->watches, &w->ent, NULL);
+	if (strmap_get(&data->revwatches, w->dir) == w)
+		strmap_remove(&data->revwatches, w->dir, 0);
+	free(w->dir);
+	free(w);
+}
+
+static void log_mask_set(const char *path, uint32_t mask)
+{
+	struct strbuf msg = STRBUF_INIT;
+
+	if (mask & IN_ACCESS)
+		strbuf_addstr(&msg, "IN_ACCESS|");
+	if (mask & IN_MODIFY)
+		strbuf_addstr(&msg, "IN_MODIFY|");
+	if (mask & IN_ATTRIB)
+		strbuf_addstr(&msg, "IN_ATTRIB|");
+	if (mask & IN_CLOSE_WRITE)
+		strbuf_addstr(&msg, "IN_CLOSE_WRITE|");
+	if (mask & IN_CLOSE_NOWRITE)
+		strbuf_addstr(&msg, "IN_CLOSE_NOWRITE|");
+	if (mask & IN_OPEN)
+		strbuf_addstr(&msg, "IN_OPEN|");
+	if (mask & IN_MOVED_FROM)
+		strbuf_addstr(&msg, "IN_MOVED_FROM|");
+	if (mask & IN_MOVED_TO)
+		strbuf_addstr(&msg, "IN_MOVED_TO|");
+	if (mask & IN_CREATE)
+		strbuf_addstr(&msg, "IN_CREATE|");
+	if (mask & IN_DELETE)
+		strbuf_addstr(&msg, "IN_DELETE|");
+	if (mask & IN_DELETE_SELF)
+		strbuf_addstr(&msg, "IN_DELETE_SELF|");
+	if (mask & IN_MOVE_SELF)
+		strbuf_addstr(&msg, "IN_MOVE_SELF|");
+	if (mask & IN_UNMOUNT)
+		strbuf_addstr(&msg, "IN_UNMOUNT|");
+	if (mask & IN_Q_OVERFLOW)
+		strbuf_addstr(&msg, "IN_Q_OVERFLOW|");
+	if (mask & IN_IGNORED)
+		strbuf_addstr(&msg, "IN_IGNORED|");
+	if (mask & IN_ISDIR)
+		strbuf_addstr(&msg, "IN_ISDIR|");
+
+	trace_printf_key(&trace_fsmonitor, "inotify: '%s', mask=0x%x %s",
+			 path, mask, msg.buf);
+
+	strbuf_release(&msg);
+}
+
+/*
+ * Create (or refresh) the watch on a single directory.
+ *
+ * inotify_add_watch() returns the existing watch descriptor if the
+ * inode is already being watched, so this is safe to call again on a
+ * directory that we already know about (for example when rescanning
+ * after an overflow); we just update the pathname that we associate
+ * with it.
+ *
+ * Returns 0 on success, 1 if the directory vanished before we could
+ * watch it, and -1 on a hard error.
+ */
+static int add_watch(struct fsm_listen_data *data, const char *dir,
+		     uint32_t mask, int is_root)
+{
+	struct watch_entry *w;
+	int wd;
+
+	wd = inotify_add_watch(data->fd_inotify, dir, mask);
+	if (wd < 0) {
+		/*
+		 * The directory may have been deleted (or replaced by
+		 * a non-directory) between the time that we saw it
+		 * and now.  We'll get (or already got) an event on the
+		 * parent for that, so it is not an error.
+		 */
+		if (errno == ENOENT || errno == ENOTDIR)
+			return 1;
+		if (errno == ENOSPC)
+			return error(_("inotify watch limit reached while "
+				       "watching '%s' (see "
+				       "'/proc/sys/fs/inotify/max_user_watches')"),
+				     dir);
+		return error_errno(_("inotify_add_watch('%s') failed"), dir);
+	}
+
+	w = find_watch(data, wd);
+	if (w) {
+		if (!strcmp(w->dir, dir))
+			return 0;
+		if (strmap_get(&data->revwatches, w->dir) == w)
+			strmap_remove(&data->revwatches, w->dir, 0);
+		free(w->dir);
+	} else {
+		CALLOC_ARRAY(w, 1);
+		w->wd = wd;
+		hashmap_entry_init(&w->ent, memhash(&wd, sizeof(wd)));
+		hashmap_add(&data->watches, &w->ent);
+	}
+
+	w->dir = xstrdup(dir);
+	w->is_root = !!is_root;
+	strmap_put(&data->revwatches, w->dir, w);
+
+	return 0;
+}
+
+/*
+ * Watch the directory `path` and (recursively) all of the directories
+ * below it.  Nested ".git" directories are not descended into: their
+ * contents are not part of the working tree and changes within them
+ * are not interesting to the client.  The top-level ".git" directory
+ * is handled by the caller.
+ */
+static int add_watch_recursive(struct fsmonitor_daemon_state *state,
+			       struct strbuf *path, int is_root)
+{
+	struct fsm_listen_data *data = state->listen_data;
+	DIR *dir;
+	struct dirent *de;
+	size_t baselen;
+	int ret;
+
+	ret = add_watch(data, path->buf, WATCH_MASK_WORKDIR, is_root);
+	if (ret)
+		return ret < 0 ? -1 : 0;
+
+	dir = opendir(path->buf);
+	if (!dir) {
+		if (errno == ENOENT || errno == ENOTDIR)
+			return 0;
+		return error_errno(_("could not open directory '%s'"),
+				   path->buf);
+	}
+
+	strbuf_addch(path, '/');
+	baselen = path->len;
+
+	while ((de = readdir_skip_dot_and_dotdot(dir))) {
+		int dtype = DTYPE(de);
+
+		if (dtype != DT_DIR && dtype != DT_UNKNOWN)
+			continue;
+		if (!strcmp(de->d_name, ".git"))
+			continue;
+
+		strbuf_setlen(path, baselen);
+		strbuf_addstr(path, de->d_name);
+
+		if (dtype == DT_UNKNOWN) {
+			struct stat st;
+
+			if (lstat(path->buf, &st) || !S_ISDIR(st.st_mode))
+				continue;
+		}
+
+		if (add_watch_recursive(state, path, 0)) {
+			ret = -1;
+			break;
+		}
+	}
+
+	strbuf_setlen(path, baselen - 1);
+	closedir(dir);
+	return ret;
+}
+
+/*
+ * Watch everything that we need: the working tree (recursively), the
+ * directory where the cookie files are created and, if the <gitdir>
+ * lives outside of the working tree, the <gitdir> itself so that we
+ * can notice when it is removed.
+ */
+static int add_all_watches(struct fsmonitor_daemon_state *state)
+{
+	struct fsm_listen_data *data = state->listen_data;
+	struct strbuf path = STRBUF_INIT;
+	int ret;
+
+	strbuf_addbuf(&path, &state->path_worktree_watch);
+	ret = add_watch_recursive(state, &path, 1);
+
+	if (!ret && state->nr_paths_watching > 1)
+		ret = add_watch(data, state->path_gitdir_watch.buf,
+				WATCH_MASK_GITDIR, 1) < 0 ? -1 : 0;
+
+	if (!ret) {
+		/* path_cookie_prefix has a trailing slash */
+		strbuf_reset(&path);
+		strbuf_addbuf(&path, &state->path_cookie_prefix);
+		strbuf_strip_suffix(&path, "/");
+		if (add_watch(data, path.buf, WATCH_MASK_COOKIES, 0))
+			ret = error(_("could not watch cookie directory '%s'"),
+				    path.buf);
+	}
+
+	strbuf_release(&path);
+	return ret;
+}
+
+/*
+ * A directory was renamed away (or deleted).  The kernel keeps the
+ * watches on the moved inodes, but the pathnames we have recorded for
+ * them are now wrong.  Drop the watches for the directory and
+ * everything below it; if it was moved to somewhere else within the
+ * working tree we will see an IN_MOVED_TO for the new location and
+ * watch it again there.
+ */
+static void remove_watches_below(struct fsm_listen_data *data,
+				 const char *dir)
+{
+	struct hashmap_iter iter;
+	struct strmap_entry *e;
+	struct string_list to_remove = STRING_LIST_INIT_NODUP;
+	struct string_list_item *item;
+	size_t len = strlen(dir);
+
+	strmap_for_each_entry(&data->revwatches, &iter, e) {
+		struct watch_entry *w = e->value;
+
+		if (!strncmp(w->dir, dir, len) &&
+		    (!w->dir[len] || w->dir[len] == '/'))
+			string_list_append(&to_remove, w->dir)->util = w;
+	}
+
+	for_each_string_list_item(item, &to_remove) {
+		struct watch_entry *w = item->util;
+
+		inotify_rm_watch(data->fd_inotify, w->wd);
+		forget_watch(data, w);
+	}
+
+	string_list_clear(&to_remove, 0);
+}
+
+/*
+ * We lost events (the kernel queue overflowed).  Any new directories
+ * that were created in the meantime are not being watched yet, so
+ * walk the working tree again and add watches for them.  (The caller
+ * takes care of invalidating the cached data.)
+ */
+static int rescan_after_overflow(struct fsmonitor_daemon_state *state)
+{
+	trace_printf_key(&trace_fsmonitor, "inotify: rescanning after overflow");
+
+	return add_all_watches(state);
+}
+
+enum event_result {
+	EVENT_OK = 0,
+	EVENT_SHUTDOWN,
+	EVENT_ERROR,
+};
+
+static enum event_result process_event(struct fsmonitor_daemon_state *state,
+				       const struct inotify_event *ev,
+				       struct fsmonitor_batch **batch,
+				       struct string_list *cookie_list,
+				       struct strbuf *path)
+{
+	struct fsm_listen_data *data = state->listen_data;
+	struct watch_entry *w;
+	const char *rel;
+	const char *slash;
+
+	w = find_watch(data, ev->wd);
+	if (!w)
+		return EVENT_OK; /* a stale event for a removed watch */
+
+	if (ev->mask & IN_IGNORED) {
+		/* the kernel removed the watch (the directory was deleted) */
+		forget_watch(data, w);
+		return EVENT_OK;
+	}
+
+	strbuf_reset(path);
+	strbuf_addstr(path, w->dir);
+	if (ev->len) {
+		strbuf_addch(path, '/');
+		strbuf_addstr(path, ev->name);
+	}
+
+	if (trace_pass_fl(&trace_fsmonitor))
+		log_mask_set(path->buf, ev->mask);
+
+	if (w->is_root && (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF))) {
+		/*
+		 * The <worktree-root> or the external <gitdir> was
+		 * deleted or renamed.  Clients will not be able to find
+		 * our socket (and we would not notice new files), so
+		 * we have to quit.
+		 */
+		trace_printf_key(&trace_fsmonitor,
+				 "event: root '%s' removed or renamed", w->dir);
+		return EVENT_SHUTDOWN;
+	}
+
+	if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF))
+		return EVENT_OK; /* already reported via the parent */
+
+	if (ev->mask & IN_UNMOUNT)
+		return EVENT_OK; /* followed by IN_IGNORED */
+
+	if (!ev->len)
+		return EVENT_OK; /* e.g. an attribute change on the root */
+
+	switch (fsmonitor_classify_path_absolute(state, path->buf)) {
+
+	case IS_INSIDE_DOT_GIT_WITH_COOKIE_PREFIX:
+	case IS_INSIDE_GITDIR_WITH_COOKIE_PREFIX:
+		/* special case cookie files within .git or gitdir */
+
+		/* Use just the filename of the cookie file. */
+		slash = find_last_dir_sep(path->buf);
+		string_list_append(cookie_list,
+				   slash ? slash + 1 : path->buf);
+		break;
+
+	case IS_INSIDE_DOT_GIT:
+	case IS_INSIDE_GITDIR:
+		/* ignore all other paths inside of .git or gitdir */
+		break;
+
+	case IS_DOT_GIT:
+	case IS_GITDIR:
+		/*
+		 * If .git directory is deleted or renamed away,
+		 * we have to quit.
+		 */
+		if (ev->mask & (IN_DELETE | IN_MOVED_FROM)) {
+			trace_printf_key(&trace_fsmonitor,
+					 "event: gitdir removed or renamed");
+			return EVENT_SHUTDOWN;
+		}
+		break;
+
+	case IS_WORKDIR_PATH:
+		/* try to queue normal pathnames */
+
+		rel = path->buf + state->path_worktree_watch.len + 1;
+
+		if (!*batch)
+			*batch = fsmonitor_batch__new();
+
+		if (!(ev->mask & IN_ISDIR)) {
+			fsmonitor_batch__add_path(*batch, rel);
+			break;
+		}
+
+		/*
+		 * Report directories with a trailing slash so that the
+		 * client invalidates everything below it.  This also
+		 * covers any files that were created in a new directory
+		 * before we had a chance to watch it.
+		 */
+		{
+			struct strbuf tmp = STRBUF_INIT;
+
+			strbuf_addstr(&tmp, rel);
+			strbuf_addch(&tmp, '/');
+			fsmonitor_batch__add_path(*batch, tmp.buf);
+			strbuf_release(&tmp);
+		}
+
+		if (ev->mask & IN_MOVED_FROM)
+			remove_watches_below(data, path->buf);
+
+		if ((ev->mask & (IN_CREATE | IN_MOVED_TO)) &&
+		    strcmp(ev->name, ".git") &&
+		    add_watch_recursive(state, path, 0))
+			return EVENT_ERROR;
+
+		break;
+
+	case IS_OUTSIDE_CONE:
+	default:
+		trace_printf_key(&trace_fsmonitor,
+				 "ignoring '%s'", path->buf);
+		break;
+	}
+
+	return EVENT_OK;
+}
+
+int fsm_listen__ctor(struct fsmonitor_daemon_state *state)
+{
+	struct fsm_listen_data *data;
+
+	CALLOC_ARRAY(data, 1);
+	state->listen_data = data;
+
+	data->fd_shutdown[0] = -1;
+	data->fd_shutdown[1] = -1;
+	hashmap_init(&data->watches, watch_entry_cmp, NULL, 0);
+	strmap_init_with_options(&data->revwatches, NULL, 0);
+
+	data->fd_inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (data->fd_inotify < 0) {
+		error_errno(_("inotify_init1() failed"));
+		goto failed;
+	}
+
+	if (pipe(data->fd_shutdown)) {
+		error_errno(_("could not create listener thread pipe"));
+		goto failed;
+	}
+
+	if (add_all_watches(state))
+		goto failed;
+
+	trace_printf_key(&trace_fsmonitor, "inotify: watching %u directories",
+			 hashmap_get_size(&data->watches));
+	return 0;
+
+failed:
+	error(_("Unable to create inotify watches."));
+
+	fsm_listen__dtor(state);
+	return -1;
+}
+
+void fsm_listen__dtor(struct fsmonitor_daemon_state *state)
+{
+	struct fsm_listen_data *data;
+	struct hashmap_iter iter;
+	struct watch_entry *w;
+
+	if (!state || !state->listen_data)
+		return;
+
+	data = state->listen_data;
+
+	hashmap_for_each_entry(&data->watches, &iter, w, ent)
+		free(w->dir);
+	hashmap_clear_and_free(&data->watches, struct watch_entry, ent);
+	strmap_clear(&data->revwatches, 0);
+
+	if (data->fd_inotify >= 0)
+		close(data->fd_inotify);
+	if (data->fd_shutdown[0] >= 0)
+		close(data->fd_shutdown[0]);
+	if (data->fd_shutdown[1] >= 0)
+		close(data->fd_shutdown[1]);
+
+	FREE_AND_NULL(state->listen_data);
+}
+
+void fsm_listen__stop_async(struct fsmonitor_daemon_state *state)
+{
+	struct fsm_listen_data *data;
+
+	data = state->listen_data;
+
+	data->shutdown_style = SHUTDOWN_EVENT;
+	if (write(data->fd_shutdown[1], "x", 1) < 0)
+		error_errno(_("could not signal listener thread"));
+}
+
+/*
+ * Drain all of the events currently queued on the inotify fd and
+ * publish them as a single batch.
+ *
+ * Returns 0 to keep listening, or -1 if the loop should stop (in
+ * which case `data->shutdown_style` says why).
+ */
+static int read_events(struct fsmonitor_daemon_state *state)
+{
+	struct fsm_listen_data *data = state->listen_data;
+	char buf[64 * 1024]
+		__attribute__ ((aligned(__alignof__(struct inotify_event))));
+	struct fsmonitor_batch *batch = NULL;
+	struct string_list cookie_list = STRING_LIST_INIT_DUP;
+	struct strbuf path = STRBUF_INIT;
+	int ret = 0;
+
+	for (;;) {
+		ssize_t len = read(data->fd_inotify, buf, sizeof(buf));
+		char *p;
+
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			error_errno(_("could not read inotify events"));
+			data->shutdown_style = FORCE_ERROR_STOP;
+			ret = -1;
+			goto done;
+		}
+
+		for (p = buf; p < buf + len; ) {
+			const struct inotify_event *ev = (void *)p;
+
+			p += sizeof(*ev) + ev->len;
+
+			if (ev->mask & IN_Q_OVERFLOW) {
+				/*
+				 * The kernel dropped events.  We have lost
+				 * sync with the filesystem, so flush the
+				 * cached data and start over with a new
+				 * token (and discard the batch we were
+				 * building, since it is relative to the
+				 * flushed token).  Then make sure that we
+				 * are watching any directories that we
+				 * missed.
+				 */
+				trace_printf_key(&trace_fsmonitor,
+						 "inotify: IN_Q_OVERFLOW");
+				fsmonitor_force_resync(state);
+				fsmonitor_batch__free_list(batch);
+				string_list_clear(&cookie_list, 0);
+				batch = NULL;
+
+				if (rescan_after_overflow(state)) {
+					data->shutdown_style = FORCE_ERROR_STOP;
+					ret = -1;
+					goto done;
+				}
+				continue;
+			}
+
+			switch (process_event(state, ev, &batch,
+					      &cookie_list, &path)) {
+			case EVENT_OK:
+				break;
+			case EVENT_SHUTDOWN:
+				data->shutdown_style = FORCE_SHUTDOWN;
+				ret = -1;
+				goto done;
+			case EVENT_ERROR:
+				data->shutdown_style = FORCE_ERROR_STOP;
+				ret = -1;
+				goto done;
+			}
+		}
+	}
+
+	fsmonitor_publish(state, batch, &cookie_list);
+	batch = NULL;
+
+done:
+	fsmonitor_batch__free_list(batch);
+	string_list_clear(&cookie_list, 0);
+	strbuf_release(&path);
+	return ret;
+}
+
+void fsm_listen__loop(struct fsmonitor_daemon_state *state)
+{
+	struct fsm_listen_data *data = state->listen_data;
+	struct pollfd pfd[2];
+
+	pfd[0].fd = data->fd_inotify;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = data->fd_shutdown[0];
+	pfd[1].events = POLLIN;
+
+	for (;;) {
+		if (poll(pfd, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			error_errno(_("listener thread poll failed"));
+			data->shutdown_style = FORCE_ERROR_STOP;
+			break;
+		}
+
+		if (pfd[1].revents) {
+			data->shutdown_style = SHUTDOWN_EVENT;
+			break;
+		}
+
+		if (pfd[0].revents & POLLIN) {
+			if (read_events(state))
+				break;
+		} else if (pfd[0].revents) {
+			error(_("inotify fd reported an error"));
+			data->shutdown_style = FORCE_ERROR_STOP;
+			break;
+		}
+	}
+
+	switch (data->shutdown_style) {
+	case FORCE_ERROR_STOP:
+		state->listen_error_code = -1;
+		/* fall thru */
+	case FORCE_SHUTDOWN:
+		ipc_server_stop_async(state->ipc_server_data);
+		/* fall thru */
+	case SHUTDOWN_EVENT:
+	default:
+		break;
+	}
+}
@@ -0,0 +1,98 @@
+#include "git-compat-util.h"
+#include "fsmonitor-ll.h"
+#include "fsmonitor-path-utils.h"
+#include "gettext.h"
+#include "trace.h"
+#include <sys/vfs.h>
+
+/*
+ * Linux does not export the filesystem type as a string in
+ * `struct statfs`, only as a magic number.  Map the ones that we
+ * care about (either because they are remote or because they cannot
+ * hold a Unix domain socket) to the names used in /proc/mounts.
+ *
+ * These values come from <linux/magic.h> and statfs(2); we spell
+ * them out here rather than relying on that header being installed.
+ */
+static const struct fs_magic {
+	unsigned long magic;
+	const char *typename;
+	int is_remote;
+} fs_magic_table[] = {
+	{ 0x00006969, "nfs",   1 },
+	{ 0x0000517b, "smb",   1 },
+	{ 0xfe534d42, "smb2",  1 },
+	{ 0xff534d42, "cifs",  1 },
+	{ 0x5346414f, "afs",   1 },
+	{ 0x00000073, "coda",  1 },
+	{ 0x01021997, "9p",    1 },
+	{ 0x0000564c, "ncp",   1 },
+	{ 0x00004d44, "msdos", 0 },
+	{ 0x5346544e, "ntfs",  0 },
+	{ 0x65735546, "fuse",  0 },
+};
+
+int fsmonitor__get_fs_info(const char *path, struct fs_info *fs_info)
+{
+	struct statfs fs;
+	size_t k;
+
+	if (statfs(path, &fs) == -1) {
+		int saved_errno = errno;
+		trace_printf_key(&trace_fsmonitor, "statfs('%s') failed: %s",
+				 path, strerror(saved_errno));
+		errno = saved_errno;
+		return -1;
+	}
+
+	fs_info->is_remote = 0;
+	fs_info->typename = NULL;
+
+	for (k = 0; k < ARRAY_SIZE(fs_magic_table); k++) {
+		if ((unsigned long)fs.f_type == fs_magic_table[k].magic) {
+			fs_info->is_remote = fs_magic_table[k].is_remote;
+			fs_info->typename = xstrdup(fs_magic_table[k].typename);
+			break;
+		}
+	}
+	if (!fs_info->typename)
+		fs_info->typename = xstrfmt("0x%08lx",
+					    (unsigned long)fs.f_type);
+
+	trace_printf_key(&trace_fsmonitor,
+			 "statfs('%s') [type 0x%08lx] '%s'",
+			 path, (unsigned long)fs.f_type, fs_info->typename);
+
+	trace_printf_key(&trace_fsmonitor,
+				"'%s' is_remote: %d",
+				path, fs_info->is_remote);
+	return 0;
+}
+
+int fsmonitor__is_fs_remote(const char *path)
+{
+	struct fs_info fs;
+	if (fsmonitor__get_fs_info(path, &fs))
+		return -1;
+
+	free(fs.typename);
+
+	return fs.is_remote;
+}
+
+/*
+ * Linux has no equivalent of the macOS synthetic firmlinks, so
+ * the paths that inotify reports are always spelled the way that
+ * we asked to watch them.
+ */
+int fsmonitor__get_alias(const char *path UNUSED,
+			 struct alias_info *info UNUSED)
+{
+	return 0;
+}
+
+char *fsmonitor__resolve_alias(const char *path UNUSED,
+	const struct alias_info *info UNUSED)
+{
+	return NULL;
+}
@@ -666,6 +666,43 @@ static void initialize_dir_rename_info(struct dir_rename_info *info,
 	}
 }
 
+void count_cached_dir_renames(struct strintmap *dirs_removed,
+			      struct strmap *dir_rename_count,
+			      struct strmap *cached_pairs)
+{
+	struct dir_rename_info info = {
+		.dir_rename_count = dir_rename_count,
+		.relevant_source_dirs = dirs_removed,
+		.setup = 1,
+	};
+	struct string_list to_remove = STRING_LIST_INIT_NODUP;
+	struct hashmap_iter iter;
+	struct strmap_entry *entry;
+	int i;
+
+	strmap_for_each_entry(cached_pairs, &iter, entry) {
+		if (!entry->value)
+			/* known delete; ignore it */
+			continue;
+		update_dir_rename_counts(&info, dirs_removed,
+					 entry->key, entry->value);
+	}
+
+	/*
+	 * Drop the hints recorded for directories that were not removed,
+	 * as cleanup_dir_rename_info() does.
+	 */
+	strmap_for_each_entry(dir_rename_count, &iter, entry) {
+		if (strintmap_get(dirs_removed, entry->key))
+			continue;
+		strintmap_clear(entry->value);
+		string_list_append(&to_remove, entry->key);
+	}
+	for (i = 0; i < to_remove.nr; i++)
+		strmap_remove(dir_rename_count, to_remove.items[i].string, 1);
+	string_list_clear(&to_remove, 0);
+}
+
 void partial_clear_dir_rename_count(struct strmap *dir_rename_count)
 {
 	struct hashmap_iter iter;
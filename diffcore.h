@@ -181,6 +181,15 @@ enum file_rename_relevance {
 
 void partial_clear_dir_rename_count(struct strmap *dir_rename_count);
 
+/*
+ * Add the renames in cached_pairs to dir_rename_count, the same way
+ * diffcore_rename_extended() does, for callers that already know all
+ * the renames they need and therefore do not call it.
+ */
+void count_cached_dir_renames(struct strintmap *dirs_removed,
+			      struct strmap *dir_rename_count,
+			      struct strmap *cached_pairs);
+
 void diffcore_break(struct repository *, int);
 void diffcore_rename(struct diff_options *);
 void diffcore_rename_extended(struct diff_options *options,
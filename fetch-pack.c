@@ -1318,13 +1318,14 @@ static int add_haves(struct fetch_negotiator *negotiator,
 	return haves_added;
 }
 
-static void write_fetch_command_and_capabilities(struct strbuf *req_buf,
-						 const struct string_list *server_options)
+static void write_command_and_capabilities(struct strbuf *req_buf,
+					   const char *command,
+					   const struct string_list *server_options)
 {
 	const char *hash_name;
 
-	ensure_server_supports_v2("fetch");
-	packet_buf_write(req_buf, "command=fetch");
+	ensure_server_supports_v2(command);
+	packet_buf_write(req_buf, "command=%s", command);
 	if (server_supports_v2("agent"))
 		packet_buf_write(req_buf, "agent=%s", git_user_agent_sanitized());
 	if (advertise_sid && server_supports_v2("session-id"))
@@ -1360,7 +1361,7 @@ static int send_fetch_request(struct fetch_negotiator *negotiator, int fd_out,
 	int done_sent = 0;
 	struct strbuf req_buf = STRBUF_INIT;
 
-	write_fetch_command_and_capabilities(&req_buf, args->server_options);
+	write_command_and_capabilities(&req_buf, "fetch", args->server_options);
 
 	if (args->use_thin_pack)
 		packet_buf_write(&req_buf, "thin-pack");
@@ -1428,6 +1429,54 @@ static int send_fetch_request(struct fetch_negotiator *negotiator, int fd_out,
 	return done_sent;
 }
 
+/*
+ * Returns true if the objects in `wants` can be requested with the
+ * "object-fetch" command instead of "fetch", i.e. if we were asked to,
+ * all of them are given by object ID, and the server can apply our
+ * filter (if any) to them like "fetch" would.
+ */
+static int can_use_object_fetch(const struct fetch_pack_args *args,
+				const struct ref *wants)
+{
+	if (!args->object_fetch || !server_supports_v2("object-fetch"))
+		return 0;
+	if (args->filter_options.choice &&
+	    !server_supports_feature("object-fetch", "filter", 0))
+		return 0;
+	for (; wants; wants = wants->next)
+		if (!wants->exact_oid)
+			return 0;
+	return 1;
+}
+
+/*
+ * Asks for the objects in `wants` with the "object-fetch" command. Its
+ * response consists of the "packfile" section alone, like that of a
+ * "fetch" request after "done".
+ */
+static void send_object_fetch_request(int fd_out,
+				      struct fetch_pack_args *args,
+				      const struct ref *wants)
+{
+	struct strbuf req_buf = STRBUF_INIT;
+
+	write_command_and_capabilities(&req_buf, "object-fetch",
+				       args->server_options);
+	if (args->no_progress)
+		packet_buf_write(&req_buf, "no-progress");
+	if (prefer_ofs_delta)
+		packet_buf_write(&req_buf, "ofs-delta");
+	send_filter(args, &req_buf, 1);
+	for (; wants; wants = wants->next)
+		packet_buf_write(&req_buf, "oid %s\n",
+				 oid_to_hex(&wants->old_oid));
+	packet_buf_flush(&req_buf);
+
+	if (write_in_full(fd_out, req_buf.buf, req_buf.len) < 0)
+		die_errno(_("unable to write request to remote"));
+	strbuf_release(&req_buf);
+}
+
 /*
  * Processes a section header in a server's response and checks if it matches
  * `section`.  If the value of `peek` is 1, the header line will be peeked (and
@@ -1629,6 +1678,7 @@ static void receive_packfile_uris(struct packet_reader *reader,
 enum fetch_state {
 	FETCH_CHECK_LOCAL = 0,
 	FETCH_SEND_REQUEST,
+	FETCH_SEND_OBJECT_REQUEST,
 	FETCH_PROCESS_ACKS,
 	FETCH_GET_PACK,
 	FETCH_DONE,
@@ -1698,6 +1748,8 @@ static struct ref *do_fetch_pack_v2(struct fetch_pack_args *args,
 			filter_refs(args, &ref, sought, nr_sought);
 			if (!args->refetch && everything_local(args, &ref))
 				state = FETCH_DONE;
+			else if (can_use_object_fetch(args, ref))
+				state = FETCH_SEND_OBJECT_REQUEST;
 			else
 				state = FETCH_SEND_REQUEST;
 
@@ -1729,6 +1781,14 @@ static struct ref *do_fetch_pack_v2(struct fetch_pack_args *args,
 			else
 				state = FETCH_PROCESS_ACKS;
 			break;
+		case FETCH_SEND_OBJECT_REQUEST:
+			trace2_region_enter("fetch-pack", "object_fetch",
+					    the_repository);
+			send_object_fetch_request(fd[1], args, ref);
+			trace2_region_leave("fetch-pack", "object_fetch",
+					    the_repository);
+			state = FETCH_GET_PACK;
+			break;
 		case FETCH_PROCESS_ACKS:
 			/* Process ACKs/NAKs */
 			process_section_header(&reader, "acknowledgments", 0);
@@ -1753,11 +1813,13 @@ static struct ref *do_fetch_pack_v2(struct fetch_pack_args *args,
 			}
 			break;
 		case FETCH_GET_PACK:
-			trace2_region_leave("fetch-pack",
-					    "negotiation_v2",
-					    the_repository);
-			trace2_data_intmax("negotiation_v2", the_repository,
-					   "total_rounds", negotiation_round);
+			if (negotiation_started) {
+				trace2_region_leave("fetch-pack",
+						    "negotiation_v2",
+						    the_repository);
+				trace2_data_intmax("negotiation_v2", the_repository,
+						   "total_rounds", negotiation_round);
+			}
 			/* Check for shallow-info section */
 			if (process_section_header(&reader, "shallow-info", 1))
 				receive_shallow_info(args, &reader, shallows, si);
@@ -2164,7 +2226,7 @@ void negotiate_using_fetch(const struct oid_array *negotiation_tips,
 					   the_repository, "%d",
 					   negotiation_round);
 		strbuf_reset(&req_buf);
-		write_fetch_command_and_capabilities(&req_buf, server_options);
+		write_command_and_capabilities(&req_buf, "fetch", server_options);
 
 		packet_buf_write(&req_buf, "wait-for-done");
 
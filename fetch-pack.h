@@ -44,6 +44,14 @@ struct fetch_pack_args {
 	unsigned deepen:1;
 	unsigned refetch:1;
 
+	/*
+	 * If the server supports it and all objects are requested by
+	 * object ID, fetch exactly those objects with the "object-fetch"
+	 * command, without negotiation and without the objects they
+	 * refer to. Used for lazy fetches of missing objects.
+	 */
+	unsigned object_fetch:1;
+
 	/*
 	 * Indicate that the remote of this request is a promisor remote. The
 	 * pack received does not need all referred-to objects to be present in
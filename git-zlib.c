@@ -5,6 +5,10 @@
 #include "git-compat-util.h"
 #include "git-zlib.h"
 
+#ifdef USE_LIBDEFLATE
+#include <libdeflate.h>
+#endif
+
 static const char *zerr_to_string(int status)
 {
 	switch (status) {
@@ -147,6 +151,56 @@ int git_inflate(git_zstream *strm, int flush)
 	return status;
 }
 
+#ifdef USE_LIBDEFLATE
+int git_inflate_buffer(const void *in, unsigned long in_len,
+		       void *out, unsigned long out_len)
+{
+	struct libdeflate_decompressor *d;
+	enum libdeflate_result ret;
+	size_t in_used, out_used;
+
+	/*
+	 * A decompressor is small and cheap to set up, and using a fresh
+	 * one each time keeps us safe to be called from several threads.
+	 */
+	d = libdeflate_alloc_decompressor();
+	if (!d)
+		die("libdeflate: out of memory");
+	ret = libdeflate_zlib_decompress_ex(d, in, in_len, out, out_len,
+					    &in_used, &out_used);
+	libdeflate_free_decompressor(d);
+
+	if (ret != LIBDEFLATE_SUCCESS || out_used != out_len)
+		return -1;
+	return 0;
+}
+#else
+int git_inflate_buffer(const void *in, unsigned long in_len,
+		       void *out, unsigned long out_len)
+{
+	z_stream z;
+	int status;
+
+	/* leave what does not fit in a single call to git_inflate() */
+	if (in_len > ZLIB_BUF_MAX || out_len > ZLIB_BUF_MAX)
+		return -1;
+
+	memset(&z, 0, sizeof(z));
+	z.next_in = (unsigned char *)in;
+	z.avail_in = in_len;
+	z.next_out = out;
+	z.avail_out = out_len;
+	if (inflateInit(&z) != Z_OK)
+		return -1;
+	status = inflate(&z, Z_FINISH);
+	inflateEnd(&z);
+
+	if (status != Z_STREAM_END || z.total_out != out_len)
+		return -1;
+	return 0;
+}
+#endif
+
 #if defined(NO_DEFLATE_BOUND) || ZLIB_VERNUM < 0x1200
 #define deflateBound(c,s)  ((s) + (((s) + 7) >> 3) + (((s) + 63) >> 6) + 11)
 #endif
@@ -16,6 +16,19 @@ void git_inflate_init_gzip_only(git_zstream *);
 void git_inflate_end(git_zstream *);
 int git_inflate(git_zstream *, int flush);
 
+/*
+ * Inflate the complete zlib stream at the beginning of "in" into "out"
+ * in one go, when the size of the inflated data is known to be exactly
+ * "out_len" bytes. "in" may extend past the end of the stream.
+ *
+ * Returns 0 on success, and -1 without complaining if the stream is
+ * corrupt, is not contained in the "in_len" bytes given, or does not
+ * inflate to "out_len" bytes; the caller can then fall back to
+ * git_inflate() to find out (and report) what is wrong with it.
+ */
+int git_inflate_buffer(const void *in, unsigned long in_len,
+		       void *out, unsigned long out_len);
+
 void git_deflate_init(git_zstream *, int level);
 void git_deflate_init_gzip(git_zstream *, int level);
 void git_deflate_init_raw(git_zstream *, int level);
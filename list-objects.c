@@ -15,6 +15,7 @@
 #include "object-store-ll.h"
 #include "trace.h"
 #include "environment.h"
+#include "tree-preload.h"
 
 struct traversal_context {
 	struct rev_info *revs;
@@ -22,6 +23,7 @@ struct traversal_context {
 	show_commit_fn show_commit;
 	void *show_data;
 	struct filter *filter;
+	struct tree_preload *tree_preload;
 	int depth;
 };
 
@@ -139,6 +141,39 @@ static void process_tree_contents(struct traversal_context *ctx,
 	}
 }
 
+/*
+ * Queue the subtrees of "tree" that process_tree_contents() is going
+ * to descend into for preloading.
+ */
+static void preload_subtrees(struct traversal_context *ctx, struct tree *tree)
+{
+	struct tree_desc desc;
+	struct name_entry entry;
+	struct object_id *subtrees = NULL;
+	size_t nr = 0, alloc = 0;
+
+	if (!ctx->tree_preload)
+		return;
+
+	init_tree_desc(&desc, tree->buffer, tree->size);
+	while (tree_entry(&desc, &entry)) {
+		struct object *obj;
+
+		if (!S_ISDIR(entry.mode))
+			continue;
+		obj = lookup_object(ctx->revs->repo, &entry.oid);
+		if (obj && (obj->flags & (UNINTERESTING | SEEN)))
+			continue;
+		ALLOC_GROW(subtrees, nr + 1, alloc);
+		oidcpy(&subtrees[nr++], &entry.oid);
+	}
+
+	/* The walk is depth-first; have the first subtree read first. */
+	while (nr)
+		tree_preload_add(ctx->tree_preload, &subtrees[--nr], 1);
+	free(subtrees);
+}
+
 static void process_tree(struct traversal_context *ctx,
 			 struct tree *tree,
 			 struct strbuf *base,
@@ -154,15 +189,20 @@ static void process_tree(struct traversal_context *ctx,
 		return;
 	if (!obj)
 		die("bad tree object");
-	if (obj->flags & (UNINTERESTING | SEEN))
+	if (obj->flags & (UNINTERESTING | SEEN)) {
+		tree_preload_discard(ctx->tree_preload, &obj->oid);
 		return;
+	}
 	if (revs->include_check_obj &&
-	    !revs->include_check_obj(&tree->object, revs->include_check_data))
+	    !revs->include_check_obj(&tree->object, revs->include_check_data)) {
+		tree_preload_discard(ctx->tree_preload, &obj->oid);
 		return;
+	}
 
 	if (ctx->depth > max_allowed_tree_depth)
 		die("exceeded maximum allowed tree depth");
 
+	tree_preload_fill(ctx->tree_preload, tree);
 	failed_parse = parse_tree_gently(tree, 1);
 	if (failed_parse) {
 		if (revs->ignore_missing_links)
@@ -195,8 +235,10 @@ static void process_tree(struct traversal_context *ctx,
 
 	if (r & LOFR_SKIP_TREE)
 		trace_printf("Skipping contents of tree %s...\n", base->buf);
-	else if (!failed_parse)
+	else if (!failed_parse) {
+		preload_subtrees(ctx, tree);
 		process_tree_contents(ctx, tree, base);
+	}
 
 	r = list_objects_filter__filter_object(ctx->revs->repo,
 					       LOFS_END_TREE, obj,
@@ -347,8 +389,12 @@ static void traverse_non_commits(struct traversal_context *ctx,
 		struct object *obj = pending->item;
 		const char *name = pending->name;
 		const char *path = pending->path;
-		if (obj->flags & (UNINTERESTING | SEEN))
+		if (obj->flags & (UNINTERESTING | SEEN)) {
+			if (obj->type == OBJ_TREE)
+				tree_preload_discard(ctx->tree_preload,
+						     &obj->oid);
 			continue;
+		}
 		if (obj->type == OBJ_TAG) {
 			process_tag(ctx, (struct tag *)obj, name);
 			continue;
@@ -394,6 +440,9 @@ static void do_traverse(struct traversal_context *ctx)
 								 commit);
 			tree->object.flags |= NOT_USER_GIVEN;
 			add_pending_tree(ctx->revs, tree);
+			if (!(tree->object.flags & (UNINTERESTING | SEEN)))
+				tree_preload_add(ctx->tree_preload,
+						 &tree->object.oid, 0);
 		} else if (commit->object.parsed) {
 			die(_("unable to load root tree for commit %s"),
 			      oid_to_hex(&commit->object.oid));
@@ -433,8 +482,19 @@ void traverse_commit_list_filtered(
 	if (revs->filter.choice)
 		ctx.filter = list_objects_filter__init(omitted, &revs->filter);
 
+	/*
+	 * Filters and pathspecs may skip subtrees we would have queued,
+	 * and the remaining options look into packs from this thread
+	 * without taking obj_read_lock.
+	 */
+	if (revs->preload_trees && revs->tree_objects && !ctx.filter &&
+	    !revs->diffopt.pathspec.nr && !revs->exclude_promisor_objects &&
+	    !revs->verify_objects && !revs->unpacked && !revs->no_kept_objects)
+		ctx.tree_preload = tree_preload_start(revs->repo);
+
 	do_traverse(&ctx);
 
+	tree_preload_stop(ctx.tree_preload);
 	if (ctx.filter)
 		list_objects_filter__free(ctx.filter);
 }
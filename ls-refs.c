@@ -1,8 +1,13 @@
 #include "git-compat-util.h"
+#include "abspath.h"
+#include "dir.h"
 #include "environment.h"
 #include "gettext.h"
 #include "hash.h"
 #include "hex.h"
+#include "lockfile.h"
+#include "object-file.h"
+#include "path.h"
 #include "repository.h"
 #include "refs.h"
 #include "remote.h"
@@ -11,6 +16,10 @@
 #include "pkt-line.h"
 #include "config.h"
 #include "string-list.h"
+#include "tempfile.h"
+#include "trace.h"
+#include "trace2.h"
+#include "write-or-die.h"
 
 static enum {
 	UNBORN_IGNORE = 0,
@@ -74,6 +83,9 @@ struct ls_refs_data {
 	struct strbuf buf;
 	struct strvec hidden_refs;
 	unsigned unborn : 1;
+
+	/* If non-NULL, collects the response for the ls-refs cache. */
+	struct strbuf *cache;
 };
 
 static int send_ref(const char *refname, const struct object_id *oid,
@@ -115,6 +127,8 @@ static int send_ref(const char *refname, const struct object_id *oid,
 
 	strbuf_addch(&data->buf, '\n');
 	packet_fwrite(stdout, data->buf.buf, data->buf.len);
+	if (data->cache)
+		packet_buf_write(data->cache, "%s", data->buf.buf);
 
 	return 0;
 }
@@ -149,9 +163,184 @@ static int ls_refs_config(const char *var, const char *value,
 	return parse_hide_refs_config(var, value, "uploadpack", &data->hidden_refs);
 }
 
+/*
+ * The ls-refs cache lives in "ls-refs-cache" of the common directory.
+ * It holds one file per distinct request, named after a hash of the
+ * request, with the packet lines of the response. Each file starts
+ * with the token that was current when the response was computed.
+ *
+ * Any update of a reference removes the whole directory (see
+ * ls_refs_cache_invalidate()); the next request creates it again with
+ * a new token. A response computed from references that were updated
+ * while it was computed is thus either removed with the directory or
+ * carries a token that does not match anymore.
+ *
+ * Only reference updates made through the refs API of this Git remove
+ * the directory. Other Git versions and implementations, or anything
+ * else that writes to the reference store, leave the cached responses
+ * in place, and they are sent until the next update made through us.
+ *
+ * Clients choose the ref-prefixes of their requests, so there are as
+ * many possible entries as prefix sets. Past "lsrefs.cacheMaxEntries"
+ * entries, responses are not stored anymore until the next update.
+ */
+#define LS_REFS_CACHE_DIR "ls-refs-cache"
+#define LS_REFS_CACHE_MAX_ENTRIES 256
+
+/*
+ * Read the token of the cache in `dir` into `token`, creating the
+ * cache if needed. Return -1 if the cache cannot be used right now,
+ * e.g. because somebody else is creating it.
+ */
+static int ls_refs_cache_token(const char *dir, struct strbuf *token)
+{
+	struct strbuf path = STRBUF_INIT;
+	struct lock_file lk = LOCK_INIT;
+	int ret = 0;
+
+	strbuf_addf(&path, "%s/token", dir);
+	if (strbuf_read_file(token, path.buf, 0) > 0)
+		goto out;
+
+	strbuf_reset(token);
+	if (safe_create_leading_directories(path.buf) ||
+	    hold_lock_file_for_update(&lk, path.buf, 0) < 0) {
+		ret = -1;
+		goto out;
+	}
+	strbuf_addf(token, "%"PRIuMAX" %"PRIuMAX"\n",
+		    (uintmax_t)getnanotime(), (uintmax_t)getpid());
+	if (write_in_full(get_lock_file_fd(&lk), token->buf, token->len) < 0 ||
+	    commit_lock_file(&lk)) {
+		rollback_lock_file(&lk);
+		ret = -1;
+	}
+
+out:
+	strbuf_release(&path);
+	return ret;
+}
+
+/*
+ * Name the cache entry of the request in `data`. Everything that can
+ * change the response has to go in here.
+ */
+static void ls_refs_cache_key(struct ls_refs_data *data, struct strbuf *key)
+{
+	struct string_list prefixes = STRING_LIST_INIT_NODUP;
+	struct strbuf request = STRBUF_INIT;
+	unsigned char hash[GIT_MAX_RAWSZ];
+	git_hash_ctx ctx;
+	size_t i;
+
+	strbuf_addf(&request, "namespace %s\npeel %u\nsymrefs %u\nunborn %u\n",
+		    get_git_namespace(), data->peel, data->symrefs,
+		    data->unborn);
+
+	/*
+	 * The order of the prefixes does not matter, as the refs are
+	 * iterated over in order anyway.
+	 */
+	for (i = 0; i < data->prefixes.nr; i++)
+		string_list_append(&prefixes, data->prefixes.v[i]);
+	string_list_sort(&prefixes);
+	string_list_remove_duplicates(&prefixes, 0);
+	for (i = 0; i < prefixes.nr; i++)
+		strbuf_addf(&request, "ref-prefix %s\n", prefixes.items[i].string);
+
+	/* But that of the hidden refs does, because of negation. */
+	for (i = 0; i < data->hidden_refs.nr; i++)
+		strbuf_addf(&request, "hide %s\n", data->hidden_refs.v[i]);
+
+	the_hash_algo->init_fn(&ctx);
+	the_hash_algo->update_fn(&ctx, request.buf, request.len);
+	the_hash_algo->final_fn(hash, &ctx);
+	strbuf_addstr(key, hash_to_hex(hash));
+
+	string_list_clear(&prefixes, 0);
+	strbuf_release(&request);
+}
+
+/*
+ * Write the cached response from `path` to stdout if it was computed
+ * under `token`. Return 1 if it was, 0 otherwise.
+ */
+static int ls_refs_cache_lookup(const char *path, const struct strbuf *token)
+{
+	struct strbuf buf = STRBUF_INIT;
+	int found = 0;
+
+	if (strbuf_read_file(&buf, path, 0) >= 0 &&
+	    starts_with(buf.buf, token->buf)) {
+		fwrite_or_die(stdout, buf.buf + token->len,
+			      buf.len - token->len);
+		found = 1;
+	}
+
+	strbuf_release(&buf);
+	return found;
+}
+
+/*
+ * Return 1 if the cache in `dir` already holds `max_entries` entries.
+ */
+static int ls_refs_cache_full(const char *dir, int max_entries)
+{
+	DIR *d = opendir(dir);
+	struct dirent *de;
+	int nr = 0;
+
+	if (!d)
+		return 1;
+	while (nr < max_entries && (de = readdir_skip_dot_and_dotdot(d)))
+		if (strcmp(de->d_name, "token"))
+			nr++;
+	closedir(d);
+	return nr >= max_entries;
+}
+
+/*
+ * Store `response`, computed under `token`, at `path`. Failures are
+ * ignored; the next request simply computes the response again.
+ */
+static void ls_refs_cache_store(const char *path, const struct strbuf *token,
+				const struct strbuf *response)
+{
+	struct strbuf template = STRBUF_INIT;
+	struct tempfile *tmp;
+
+	/*
+	 * The tempfile is not created if the cache was removed in the
+	 * meantime. That is fine, as the response may be stale already.
+	 */
+	strbuf_addf(&template, "%s-XXXXXX", path);
+	tmp = mks_tempfile_m(template.buf, 0444);
+	if (tmp) {
+		if (write_in_full(get_tempfile_fd(tmp), token->buf, token->len) < 0 ||
+		    write_in_full(get_tempfile_fd(tmp), response->buf, response->len) < 0)
+			delete_tempfile(&tmp);
+		else
+			rename_tempfile(&tmp, path);
+	}
+	strbuf_release(&template);
+}
+
+void ls_refs_cache_invalidate(struct repository *r)
+{
+	struct strbuf path = STRBUF_INIT;
+
+	strbuf_git_common_path(&path, r, LS_REFS_CACHE_DIR);
+	if (is_directory(path.buf))
+		remove_dir_recursively(&path, 0);
+	strbuf_release(&path);
+}
+
 int ls_refs(struct repository *r, struct packet_reader *request)
 {
 	struct ls_refs_data data;
+	struct strbuf cache_dir = STRBUF_INIT, cache_path = STRBUF_INIT;
+	struct strbuf token = STRBUF_INIT, response = STRBUF_INIT;
+	int use_cache = 0, max_entries = LS_REFS_CACHE_MAX_ENTRIES;
 
 	memset(&data, 0, sizeof(data));
 	strvec_init(&data.prefixes);
@@ -189,17 +378,46 @@ int ls_refs(struct repository *r, struct packet_reader *request)
 	if (data.prefixes.nr >= TOO_MANY_PREFIXES)
 		strvec_clear(&data.prefixes);
 
-	send_possibly_unborn_head(&data);
 	if (!data.prefixes.nr)
 		strvec_push(&data.prefixes, "");
-	refs_for_each_fullref_in_prefixes(get_main_ref_store(r),
-					  get_git_namespace(), data.prefixes.v,
-					  hidden_refs_to_excludes(&data.hidden_refs),
-					  send_ref, &data);
+
+	repo_config_get_bool(r, "lsrefs.cache", &use_cache);
+	if (use_cache) {
+		strbuf_git_common_path(&cache_dir, r, LS_REFS_CACHE_DIR);
+		if (ls_refs_cache_token(cache_dir.buf, &token) < 0) {
+			use_cache = 0;
+		} else {
+			strbuf_addf(&cache_path, "%s/", cache_dir.buf);
+			ls_refs_cache_key(&data, &cache_path);
+		}
+	}
+
+	if (use_cache && ls_refs_cache_lookup(cache_path.buf, &token)) {
+		trace2_data_string("ls-refs", r, "cache", "hit");
+	} else {
+		if (use_cache) {
+			trace2_data_string("ls-refs", r, "cache", "miss");
+			data.cache = &response;
+		}
+
+		send_possibly_unborn_head(&data);
+		refs_for_each_fullref_in_prefixes(get_main_ref_store(r),
+						  get_git_namespace(), data.prefixes.v,
+						  hidden_refs_to_excludes(&data.hidden_refs),
+						  send_ref, &data);
+
+		repo_config_get_int(r, "lsrefs.cachemaxentries", &max_entries);
+		if (use_cache && !ls_refs_cache_full(cache_dir.buf, max_entries))
+			ls_refs_cache_store(cache_path.buf, &token, &response);
+	}
 	packet_fflush(stdout);
 	strvec_clear(&data.prefixes);
 	strbuf_release(&data.buf);
 	strvec_clear(&data.hidden_refs);
+	strbuf_release(&cache_dir);
+	strbuf_release(&cache_path);
+	strbuf_release(&token);
+	strbuf_release(&response);
 	return 0;
 }
 
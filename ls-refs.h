@@ -6,4 +6,10 @@ struct packet_reader;
 int ls_refs(struct repository *r, struct packet_reader *request);
 int ls_refs_advertise(struct repository *r, struct strbuf *value);
 
+/*
+ * Drop the cached ls-refs responses of the repository, if any. Called
+ * whenever references are updated.
+ */
+void ls_refs_cache_invalidate(struct repository *r);
+
 #endif /* LS_REFS_H */
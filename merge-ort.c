@@ -39,6 +39,7 @@
 #include "path.h"
 #include "promisor-remote.h"
 #include "read-cache-ll.h"
+#include "rename-cache.h"
 #include "revision.h"
 #include "sparse-index.h"
 #include "strmap.h"
@@ -3215,6 +3216,159 @@ static void possibly_cache_new_pair(struct rename_info *renames,
 	}
 }
 
+/*
+ * Compute the key of the rename cache entry for the renames between
+ * "base" and "side".  Entries hold the result of detecting renames
+ * between the two trees as a whole, which depends on nothing else but
+ * the rename options; the merge picks what it needs out of them (see
+ * use_persistent_pairs()).  So merges of different topics against the
+ * same upstream changes share their entries.
+ */
+static void rename_cache_key(struct merge_options *opt,
+			     struct tree *base, struct tree *side,
+			     struct object_id *key)
+{
+	struct strbuf sb = STRBUF_INIT;
+	git_hash_ctx ctx;
+
+	strbuf_addf(&sb, "score %d limit %d\n%s ",
+		    opt->rename_score, opt->rename_limit,
+		    oid_to_hex(&base->object.oid));
+	strbuf_addf(&sb, "%s\n", oid_to_hex(&side->object.oid));
+
+	the_hash_algo->init_fn(&ctx);
+	the_hash_algo->update_fn(&ctx, sb.buf, sb.len);
+	the_hash_algo->final_oid_fn(key, &ctx);
+	strbuf_release(&sb);
+}
+
+/*
+ * Detect the renames between "base" and "side" without any of the
+ * filtering merge-ort usually does, and record each renamed or deleted
+ * path in "persistent".  Returns -1 (leaving "persistent" empty) if
+ * the rename limit was hit, as the result would then depend on which
+ * paths were collected.
+ */
+static int detect_full_renames(struct merge_options *opt,
+			       struct tree *base, struct tree *side,
+			       struct strmap *persistent)
+{
+	struct diff_options diff_opts;
+	int i, ret = 0;
+
+	repo_diff_setup(opt->repo, &diff_opts);
+	diff_opts.flags.recursive = 1;
+	diff_opts.flags.rename_empty = 0;
+	diff_opts.detect_rename = DIFF_DETECT_RENAME;
+	diff_opts.rename_limit = opt->rename_limit;
+	if (opt->rename_limit <= 0)
+		diff_opts.rename_limit = 7000;
+	diff_opts.rename_score = opt->rename_score;
+	diff_opts.output_format = DIFF_FORMAT_NO_OUTPUT;
+	diff_setup_done(&diff_opts);
+
+	trace2_region_enter("merge", "rename_cache/detect", opt->repo);
+	diff_tree_oid(&base->object.oid, &side->object.oid, "", &diff_opts);
+	diffcore_std(&diff_opts);
+	trace2_region_leave("merge", "rename_cache/detect", opt->repo);
+
+	if (diff_opts.needed_rename_limit) {
+		ret = -1;
+		goto out;
+	}
+	for (i = 0; i < diff_queued_diff.nr; i++) {
+		struct diff_filepair *p = diff_queued_diff.queue[i];
+
+		if (p->status == DIFF_STATUS_RENAMED)
+			strmap_put(persistent, p->one->path,
+				   xstrdup(p->two->path));
+		else if (p->status == DIFF_STATUS_DELETED)
+			strmap_put(persistent, p->one->path, NULL);
+	}
+
+out:
+	diff_flush(&diff_opts);
+	return ret;
+}
+
+/*
+ * Resolve the relevant sources of renames->pairs[side] whose fate is
+ * recorded in "persistent" (read from the rename cache), so that
+ * diffcore_rename_extended() does not have to look for them:
+ *
+ *   - known renames are turned into rename pairs the same way that
+ *     diffcore-rename does it, and their sources are added to "known"
+ *     so that they still count towards directory renames;
+ *   - known deletions are taken out of relevant_sources (and recorded
+ *     in "deleted" so that the caller can put them back afterwards).
+ *
+ * Returns the number of sources resolved.
+ */
+static int use_persistent_pairs(struct merge_options *opt,
+				unsigned side,
+				struct strmap *persistent,
+				struct strmap *known,
+				struct strintmap *deleted)
+{
+	struct rename_info *renames = &opt->priv->renames;
+	struct diff_queue_struct *q = &renames->pairs[side];
+	struct strmap adds = STRMAP_INIT;
+	int i, nr_resolved = 0, dst;
+
+	if (strmap_empty(persistent))
+		return 0;
+
+	for (i = 0; i < q->nr; i++) {
+		struct diff_filepair *p = q->queue[i];
+		if (!DIFF_FILE_VALID(p->one) && DIFF_FILE_VALID(p->two))
+			strmap_put(&adds, p->two->path, p);
+	}
+
+	for (i = 0, dst = 0; i < q->nr; i++) {
+		struct diff_filepair *p = q->queue[i], *add;
+		struct strmap_entry *e;
+		int val;
+
+		q->queue[dst++] = p;
+		if (!DIFF_FILE_VALID(p->one) || DIFF_FILE_VALID(p->two))
+			continue;
+		val = strintmap_get(&renames->relevant_sources[side],
+				    p->one->path);
+		if (val <= 0)
+			continue;
+		e = strmap_get_entry(persistent, p->one->path);
+		if (!e)
+			continue;
+
+		if (!e->value) {
+			strintmap_remove(&renames->relevant_sources[side],
+					 p->one->path);
+			strintmap_set(deleted, p->one->path, val);
+			nr_resolved++;
+			continue;
+		}
+
+		/* Rename target not collected this time; detect as usual */
+		add = strmap_get(&adds, e->value);
+		if (!add)
+			continue;
+		strmap_remove(&adds, e->value, 0);
+
+		add->one = p->one;
+		add->one->rename_used++;
+		add->renamed_pair = 1;
+		add->score = MAX_SCORE;
+		strmap_put(known, e->key, e->value);
+		pool_diff_free_filepair(&opt->priv->pool, p);
+		dst--;
+		nr_resolved++;
+	}
+	q->nr = dst;
+
+	strmap_clear(&adds, 0);
+	return nr_resolved;
+}
+
 static int compare_pairs(const void *a_, const void *b_)
 {
 	const struct diff_filepair *a = *((const struct diff_filepair **)a_);
@@ -3225,12 +3379,53 @@ static int compare_pairs(const void *a_, const void *b_)
 
 /* Call diffcore_rename() to update deleted/added pairs into rename pairs */
 static int detect_regular_renames(struct merge_options *opt,
-				  unsigned side_index)
+				  unsigned side_index,
+				  struct tree *merge_base,
+				  struct tree *side)
 {
 	struct diff_options diff_opts;
 	struct rename_info *renames = &opt->priv->renames;
+	struct strmap *cached_pairs = &renames->cached_pairs[side_index];
+	struct strmap known, persistent;
+	struct strintmap deleted;
+	struct hashmap_iter iter;
+	struct strmap_entry *entry;
+	int ret = 0;
+
+	strmap_init_with_options(&known, NULL, 0);
+	strmap_init_with_options(&persistent, NULL, 1);
+	strintmap_init_with_options(&deleted, 0, NULL, 0);
 
 	prune_cached_from_relevant(renames, side_index);
+	if (opt->use_rename_cache && possible_side_renames(renames, side_index)) {
+		struct object_id cache_key;
+		int nr;
+
+		rename_cache_key(opt, merge_base, side, &cache_key);
+		nr = rename_cache_read(opt->repo, &cache_key, &persistent);
+		if (nr >= 0)
+			trace2_data_intmax("merge", opt->repo,
+					   "rename_cache/loaded", nr);
+		else if (!detect_full_renames(opt, merge_base, side,
+					      &persistent))
+			rename_cache_write(opt->repo, &cache_key, &persistent);
+	}
+	if (use_persistent_pairs(opt, side_index, &persistent,
+				 &known, &deleted)) {
+		/*
+		 * Renames resolved from the rename cache need to count
+		 * towards directory renames just like cached_pairs do.
+		 */
+		strmap_for_each_entry(cached_pairs, &iter, entry)
+			strmap_put(&known, entry->key, entry->value);
+		cached_pairs = &known;
+
+		/*
+		 * They also count as detected for deciding whether to
+		 * redo the merge after trivial directory resolutions.
+		 */
+		ret = 1;
+	}
 	if (!possible_side_renames(renames, side_index)) {
 		/*
 		 * No rename detection needed for this side, but we still need
@@ -3238,7 +3433,13 @@ static int detect_regular_renames(struct merge_options *opt,
 		 * side had directory renames.
 		 */
 		resolve_diffpair_statuses(&renames->pairs[side_index]);
-		return 0;
+		if (cached_pairs == &known) {
+			partial_clear_dir_rename_count(&renames->dir_rename_count[side_index]);
+			count_cached_dir_renames(&renames->dirs_removed[side_index],
+						 &renames->dir_rename_count[side_index],
+						 &known);
+		}
+		goto out;
 	}
 
 	partial_clear_dir_rename_count(&renames->dir_rename_count[side_index]);
@@ -3261,7 +3462,7 @@ static int detect_regular_renames(struct merge_options *opt,
 				 &renames->relevant_sources[side_index],
 				 &renames->dirs_removed[side_index],
 				 &renames->dir_rename_count[side_index],
-				 &renames->cached_pairs[side_index]);
+				 cached_pairs);
 	trace2_region_leave("diff", "diffcore_rename", opt->repo);
 	resolve_diffpair_statuses(&diff_queued_diff);
 
@@ -3272,12 +3473,34 @@ static int detect_regular_renames(struct merge_options *opt,
 
 	renames->pairs[side_index] = diff_queued_diff;
 
+	/*
+	 * diffcore_rename_extended() skips its directory rename counting
+	 * when it runs out of sources or destinations early, which it is
+	 * more likely to do now that the rename cache handled some of them.
+	 */
+	if (cached_pairs == &known &&
+	    strmap_empty(&renames->dir_rename_count[side_index]))
+		count_cached_dir_renames(&renames->dirs_removed[side_index],
+					 &renames->dir_rename_count[side_index],
+					 &known);
+
 	diff_opts.output_format = DIFF_FORMAT_NO_OUTPUT;
 	diff_queued_diff.nr = 0;
 	diff_queued_diff.queue = NULL;
 	diff_flush(&diff_opts);
 
-	return 1;
+	ret = 1;
+
+out:
+	/* Known deletions are still relevant for the rest of the merge */
+	strintmap_for_each_entry(&deleted, &iter, entry)
+		strintmap_set(&renames->relevant_sources[side_index],
+			      entry->key, (intptr_t)entry->value);
+
+	strintmap_clear(&deleted);
+	strmap_clear(&known, 0);
+	strmap_clear(&persistent, 1);
+	return ret;
 }
 
 /*
@@ -3357,8 +3580,10 @@ static int detect_and_process_renames(struct merge_options *opt,
 		goto cleanup;
 
 	trace2_region_enter("merge", "regular renames", opt->repo);
-	detection_run |= detect_regular_renames(opt, MERGE_SIDE1);
-	detection_run |= detect_regular_renames(opt, MERGE_SIDE2);
+	detection_run |= detect_regular_renames(opt, MERGE_SIDE1,
+						merge_base, side1);
+	detection_run |= detect_regular_renames(opt, MERGE_SIDE2,
+						merge_base, side2);
 	if (renames->needed_limit) {
 		renames->cached_pairs_valid_side = 0;
 		renames->redo_after_renames = 0;
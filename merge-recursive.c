@@ -3862,6 +3862,7 @@ static void merge_recursive_config(struct merge_options *opt)
 	git_config_get_int("diff.renamelimit", &opt->rename_limit);
 	git_config_get_int("merge.renamelimit", &opt->rename_limit);
 	git_config_get_bool("merge.renormalize", &renormalize);
+	git_config_get_bool("merge.renamecache", &opt->use_rename_cache);
 	opt->renormalize = renormalize;
 	if (!git_config_get_string("diff.renames", &value)) {
 		opt->detect_renames = git_config_rename("diff.renames", value);
@@ -28,6 +28,7 @@ struct merge_options {
 	int rename_limit;
 	int rename_score;
 	int show_rename_progress;
+	int use_rename_cache;	/* ort only: see merge.renameCache */
 
 	/* xdiff-related options (patience, ignore whitespace, ours/theirs) */
 	long xdl_opts;
@@ -18,6 +18,7 @@
 #include "chunk-format.h"
 #include "pack.h"
 #include "pack-bitmap.h"
+#include "pack-revindex.h"
 #include "refs.h"
 #include "revision.h"
 #include "list-objects.h"
@@ -27,6 +28,7 @@
 #define MIDX_BYTE_FILE_VERSION 4
 #define MIDX_BYTE_HASH_VERSION 5
 #define MIDX_BYTE_NUM_CHUNKS 6
+#define MIDX_BYTE_NUM_BASES 7
 #define MIDX_BYTE_NUM_PACKS 8
 #define MIDX_HEADER_SIZE 12
 #define MIDX_MIN_SIZE (MIDX_HEADER_SIZE + the_hash_algo->rawsz)
@@ -38,9 +40,12 @@
 #define MIDX_CHUNKID_OBJECTOFFSETS 0x4f4f4646 /* "OOFF" */
 #define MIDX_CHUNKID_LARGEOFFSETS 0x4c4f4646 /* "LOFF" */
 #define MIDX_CHUNKID_REVINDEX 0x52494458 /* "RIDX" */
+#define MIDX_CHUNKID_BASE 0x42415345 /* "BASE" */
+#define MIDX_CHUNKID_BITMAPPEDPACKS 0x42544d50 /* "BTMP" */
 #define MIDX_CHUNK_FANOUT_SIZE (sizeof(uint32_t) * 256)
 #define MIDX_CHUNK_OFFSET_WIDTH (2 * sizeof(uint32_t))
 #define MIDX_CHUNK_LARGE_OFFSET_WIDTH (sizeof(uint64_t))
+#define MIDX_CHUNK_BITMAPPED_PACKS_WIDTH (2 * sizeof(uint32_t))
 #define MIDX_LARGE_OFFSET_NEEDED 0x80000000
 
 #define PACK_EXPIRED UINT_MAX
@@ -55,10 +60,40 @@ void get_midx_filename(struct strbuf *out, const char *object_dir)
 	strbuf_addf(out, "%s/pack/multi-pack-index", object_dir);
 }
 
+void get_midx_chain_dirname(struct strbuf *out, const char *object_dir)
+{
+	strbuf_addf(out, "%s/pack/multi-pack-index.d", object_dir);
+}
+
+void get_midx_chain_filename(struct strbuf *out, const char *object_dir)
+{
+	get_midx_chain_dirname(out, object_dir);
+	strbuf_addstr(out, "/multi-pack-index-chain");
+}
+
+void get_split_midx_filename_ext(struct strbuf *out, const char *object_dir,
+				 const unsigned char *hash, const char *ext)
+{
+	get_midx_chain_dirname(out, object_dir);
+	strbuf_addf(out, "/multi-pack-index-%s%s", hash_to_hex(hash), ext);
+}
+
+void get_midx_filename_ext(struct strbuf *out, struct multi_pack_index *m,
+			   const char *ext)
+{
+	if (m->incremental) {
+		get_split_midx_filename_ext(out, m->object_dir,
+					    get_midx_checksum(m), ext);
+	} else {
+		get_midx_filename(out, m->object_dir);
+		strbuf_addf(out, "-%s%s", hash_to_hex(get_midx_checksum(m)),
+			    ext);
+	}
+}
+
 void get_midx_rev_filename(struct strbuf *out, struct multi_pack_index *m)
 {
-	get_midx_filename(out, m->object_dir);
-	strbuf_addf(out, "-%s.rev", hash_to_hex(get_midx_checksum(m)));
+	get_midx_filename_ext(out, m, ".rev");
 }
 
 static int midx_read_oid_fanout(const unsigned char *chunk_start,
@@ -74,7 +109,36 @@ static int midx_read_oid_fanout(const unsigned char *chunk_start,
 	return 0;
 }
 
-struct multi_pack_index *load_multi_pack_index(const char *object_dir, int local)
+static int midx_read_base(const unsigned char *chunk_start,
+			  size_t chunk_size, void *data)
+{
+	struct multi_pack_index *m = data;
+
+	if (chunk_size % the_hash_algo->rawsz) {
+		error(_("multi-pack-index base chunk is of the wrong size"));
+		return 1;
+	}
+	m->chunk_base = chunk_start;
+	m->num_bases = chunk_size / the_hash_algo->rawsz;
+	return 0;
+}
+
+static int midx_read_bitmapped_packs(const unsigned char *chunk_start,
+				     size_t chunk_size, void *data)
+{
+	struct multi_pack_index *m = data;
+
+	if (chunk_size != st_mult(m->num_packs, MIDX_CHUNK_BITMAPPED_PACKS_WIDTH)) {
+		warning(_("multi-pack-index bitmapped packs chunk is of the wrong size"));
+		return 1;
+	}
+	m->chunk_bitmapped_packs = chunk_start;
+	return 0;
+}
+
+static struct multi_pack_index *load_multi_pack_index_one(const char *object_dir,
+							  const char *midx_name,
+							  int local)
 {
 	struct multi_pack_index *m = NULL;
 	int fd;
@@ -82,31 +146,26 @@ struct multi_pack_index *load_multi_pack_index(const char *object_dir, int local
 	size_t midx_size;
 	void *midx_map = NULL;
 	uint32_t hash_version;
-	struct strbuf midx_name = STRBUF_INIT;
 	uint32_t i;
 	const char *cur_pack_name;
 	struct chunkfile *cf = NULL;
 
-	get_midx_filename(&midx_name, object_dir);
-
-	fd = git_open(midx_name.buf);
+	fd = git_open(midx_name);
 
 	if (fd < 0)
 		goto cleanup_fail;
 	if (fstat(fd, &st)) {
-		error_errno(_("failed to read %s"), midx_name.buf);
+		error_errno(_("failed to read %s"), midx_name);
 		goto cleanup_fail;
 	}
 
 	midx_size = xsize_t(st.st_size);
 
 	if (midx_size < MIDX_MIN_SIZE) {
-		error(_("multi-pack-index file %s is too small"), midx_name.buf);
+		error(_("multi-pack-index file %s is too small"), midx_name);
 		goto cleanup_fail;
 	}
 
-	strbuf_release(&midx_name);
-
 	midx_map = xmmap(NULL, midx_size, PROT_READ, MAP_PRIVATE, fd, 0);
 	close(fd);
 
@@ -156,6 +215,16 @@ struct multi_pack_index *load_multi_pack_index(const char *object_dir, int local
 
 	if (git_env_bool("GIT_TEST_MIDX_READ_RIDX", 1))
 		pair_chunk(cf, MIDX_CHUNKID_REVINDEX, &m->chunk_revindex);
+	if (read_chunk(cf, MIDX_CHUNKID_BITMAPPEDPACKS,
+		       midx_read_bitmapped_packs, m) == 1)
+		m->chunk_bitmapped_packs = NULL;
+	if (read_chunk(cf, MIDX_CHUNKID_BASE, midx_read_base, m) == 1)
+		goto cleanup_fail;
+	if (m->num_bases != m->data[MIDX_BYTE_NUM_BASES]) {
+		error(_("multi-pack-index has %u base files, but its base chunk lists %u"),
+		      m->data[MIDX_BYTE_NUM_BASES], m->num_bases);
+		goto cleanup_fail;
+	}
 
 	m->num_objects = ntohl(m->chunk_oid_fanout[255]);
 
@@ -182,7 +251,6 @@ struct multi_pack_index *load_multi_pack_index(const char *object_dir, int local
 
 cleanup_fail:
 	free(m);
-	strbuf_release(&midx_name);
 	free_chunkfile(cf);
 	if (midx_map)
 		munmap(midx_map, midx_size);
@@ -191,6 +259,144 @@ struct multi_pack_index *load_multi_pack_index(const char *object_dir, int local
 	return NULL;
 }
 
+static int add_midx_to_chain(struct multi_pack_index *m,
+			     struct multi_pack_index *chain,
+			     struct object_id *oids,
+			     int n)
+{
+	struct multi_pack_index *cur = chain;
+
+	if (m->num_bases != n) {
+		warning(_("multi-pack-index chain does not match"));
+		return 0;
+	}
+
+	while (n) {
+		n--;
+
+		if (!cur ||
+		    !hasheq(oids[n].hash, get_midx_checksum(cur)) ||
+		    !hasheq(oids[n].hash, m->chunk_base + st_mult(m->hash_len, n))) {
+			warning(_("multi-pack-index chain does not match"));
+			return 0;
+		}
+
+		cur = cur->base_midx;
+	}
+
+	m->base_midx = chain;
+	m->incremental = 1;
+
+	if (chain) {
+		if (unsigned_add_overflows(chain->num_objects,
+					   chain->num_objects_in_base) ||
+		    unsigned_add_overflows(chain->num_packs,
+					   chain->num_packs_in_base)) {
+			warning(_("multi-pack-index chain is too large"));
+			return 0;
+		}
+		m->num_objects_in_base = chain->num_objects + chain->num_objects_in_base;
+		m->num_packs_in_base = chain->num_packs + chain->num_packs_in_base;
+	}
+
+	return 1;
+}
+
+/*
+ * Load the layers "oids" (bottom-most first) of a MIDX chain. Layers
+ * that are missing or do not match the ones below them are ignored,
+ * together with all layers above them.
+ */
+static struct multi_pack_index *load_midx_chain_oids(const char *object_dir,
+						     struct object_id *oids,
+						     size_t nr, int local)
+{
+	struct multi_pack_index *chain = NULL;
+	struct strbuf name = STRBUF_INIT;
+	size_t i;
+
+	for (i = 0; i < nr; i++) {
+		struct multi_pack_index *m;
+
+		strbuf_reset(&name);
+		get_split_midx_filename_ext(&name, object_dir, oids[i].hash,
+					    ".midx");
+		m = load_multi_pack_index_one(object_dir, name.buf, local);
+		if (!m) {
+			warning(_("unable to find all multi-pack-index files"));
+			break;
+		}
+		if (!add_midx_to_chain(m, chain, oids, i)) {
+			close_midx(m);
+			break;
+		}
+		chain = m;
+	}
+
+	strbuf_release(&name);
+	return chain;
+}
+
+static int read_midx_chain_file(const char *object_dir,
+				struct object_id **oids, size_t *nr)
+{
+	struct strbuf buf = STRBUF_INIT;
+	size_t alloc = 0;
+	FILE *fp;
+
+	*oids = NULL;
+	*nr = 0;
+
+	get_midx_chain_filename(&buf, object_dir);
+	fp = fopen(buf.buf, "r");
+	if (!fp) {
+		strbuf_release(&buf);
+		return -1;
+	}
+
+	while (strbuf_getline_lf(&buf, fp) != EOF) {
+		ALLOC_GROW(*oids, *nr + 1, alloc);
+		if (get_oid_hex(buf.buf, &(*oids)[*nr])) {
+			warning(_("invalid multi-pack-index chain: line '%s' not a hash"),
+				buf.buf);
+			break;
+		}
+		(*nr)++;
+	}
+
+	fclose(fp);
+	strbuf_release(&buf);
+	return 0;
+}
+
+static struct multi_pack_index *load_multi_pack_index_chain(const char *object_dir,
+							    int local)
+{
+	struct multi_pack_index *chain;
+	struct object_id *oids;
+	size_t nr;
+
+	if (read_midx_chain_file(object_dir, &oids, &nr) < 0)
+		return NULL;
+	chain = load_midx_chain_oids(object_dir, oids, nr, local);
+	free(oids);
+	return chain;
+}
+
+struct multi_pack_index *load_multi_pack_index(const char *object_dir, int local)
+{
+	struct strbuf midx_name = STRBUF_INIT;
+	struct multi_pack_index *m;
+
+	get_midx_filename(&midx_name, object_dir);
+	m = load_multi_pack_index_one(object_dir, midx_name.buf, local);
+	strbuf_release(&midx_name);
+
+	if (!m)
+		m = load_multi_pack_index_chain(object_dir, local);
+	return m;
+}
+
 void close_midx(struct multi_pack_index *m)
 {
 	uint32_t i;
@@ -199,6 +405,7 @@ void close_midx(struct multi_pack_index *m)
 		return;
 
 	close_midx(m->next);
+	close_midx(m->base_midx);
 
 	munmap((unsigned char *)m->data, m->data_len);
 
@@ -211,46 +418,130 @@ void close_midx(struct multi_pack_index *m)
 	free(m);
 }
 
+static struct multi_pack_index *midx_for_object(struct multi_pack_index *m,
+						uint32_t *pos)
+{
+	while (m && *pos < m->num_objects_in_base)
+		m = m->base_midx;
+	if (!m || *pos - m->num_objects_in_base >= m->num_objects)
+		return NULL;
+	*pos -= m->num_objects_in_base;
+	return m;
+}
+
+static struct multi_pack_index *midx_for_pack(struct multi_pack_index *m,
+					      uint32_t *pack_int_id)
+{
+	uint32_t id = *pack_int_id;
+
+	while (m && id < m->num_packs_in_base)
+		m = m->base_midx;
+	if (!m || id - m->num_packs_in_base >= m->num_packs)
+		return NULL;
+	*pack_int_id = id - m->num_packs_in_base;
+	return m;
+}
+
 int prepare_midx_pack(struct repository *r, struct multi_pack_index *m, uint32_t pack_int_id)
 {
 	struct strbuf pack_name = STRBUF_INIT;
+	struct multi_pack_index *layer = m;
 	struct packed_git *p;
 
-	if (pack_int_id >= m->num_packs)
+	if (!(layer = midx_for_pack(m, &pack_int_id)))
 		die(_("bad pack-int-id: %u (%u total packs)"),
-		    pack_int_id, m->num_packs);
+		    pack_int_id, m->num_packs_in_base + m->num_packs);
 
-	if (m->packs[pack_int_id])
+	if (layer->packs[pack_int_id])
 		return 0;
 
-	strbuf_addf(&pack_name, "%s/pack/%s", m->object_dir,
-		    m->pack_names[pack_int_id]);
+	strbuf_addf(&pack_name, "%s/pack/%s", layer->object_dir,
+		    layer->pack_names[pack_int_id]);
 
-	p = add_packed_git(pack_name.buf, pack_name.len, m->local);
+	p = add_packed_git(pack_name.buf, pack_name.len, layer->local);
 	strbuf_release(&pack_name);
 
 	if (!p)
 		return 1;
 
 	p->multi_pack_index = 1;
-	m->packs[pack_int_id] = p;
+	layer->packs[pack_int_id] = p;
 	install_packed_git(r, p);
 	list_add_tail(&p->mru, &r->objects->packed_git_mru);
 
 	return 0;
 }
 
+uint32_t midx_num_packs(struct multi_pack_index *m)
+{
+	return m->num_packs_in_base + m->num_packs;
+}
+
+struct packed_git *nth_midxed_pack(struct multi_pack_index *m, uint32_t pack_int_id)
+{
+	struct multi_pack_index *layer = midx_for_pack(m, &pack_int_id);
+
+	if (!layer)
+		BUG("bad pack-int-id: %"PRIu32, pack_int_id);
+	return layer->packs[pack_int_id];
+}
+
+const char *nth_midxed_pack_name(struct multi_pack_index *m, uint32_t pack_int_id)
+{
+	struct multi_pack_index *layer = midx_for_pack(m, &pack_int_id);
+
+	if (!layer)
+		BUG("bad pack-int-id: %"PRIu32, pack_int_id);
+	return layer->pack_names[pack_int_id];
+}
+
+int bsearch_one_midx(const struct object_id *oid, struct multi_pack_index *m, uint32_t *result)
+{
+	int ret = bsearch_hash(oid->hash, m->chunk_oid_fanout, m->chunk_oid_lookup,
+			       the_hash_algo->rawsz, result);
+	if (result)
+		*result += m->num_objects_in_base;
+	return ret;
+}
+
 int bsearch_midx(const struct object_id *oid, struct multi_pack_index *m, uint32_t *result)
 {
-	return bsearch_hash(oid->hash, m->chunk_oid_fanout, m->chunk_oid_lookup,
-			    the_hash_algo->rawsz, result);
+	for (; m; m = m->base_midx)
+		if (bsearch_one_midx(oid, m, result))
+			return 1;
+	return 0;
+}
+
+int nth_bitmapped_pack(struct repository *r, struct multi_pack_index *m,
+		       struct bitmapped_pack *bp, uint32_t pack_int_id)
+{
+	struct multi_pack_index *layer = midx_for_pack(m, &pack_int_id);
+	const unsigned char *data;
+
+	if (!layer)
+		BUG("bad pack-int-id: %"PRIu32, pack_int_id);
+	if (!layer->chunk_bitmapped_packs)
+		return -1;
+	if (prepare_midx_pack(r, layer, layer->num_packs_in_base + pack_int_id))
+		return error(_("could not load pack %s"),
+			     layer->pack_names[pack_int_id]);
+
+	data = layer->chunk_bitmapped_packs +
+		st_mult(pack_int_id, MIDX_CHUNK_BITMAPPED_PACKS_WIDTH);
+
+	bp->p = layer->packs[pack_int_id];
+	bp->bitmap_pos = layer->num_objects_in_base + get_be32(data);
+	bp->bitmap_nr = get_be32(data + sizeof(uint32_t));
+	bp->from_midx = m;
+	bp->pack_int_id = layer->num_packs_in_base + pack_int_id;
+	return 0;
 }
 
 struct object_id *nth_midxed_object_oid(struct object_id *oid,
 					struct multi_pack_index *m,
 					uint32_t n)
 {
-	if (n >= m->num_objects)
+	if (!(m = midx_for_object(m, &n)))
 		return NULL;
 
 	oidread(oid, m->chunk_oid_lookup + st_mult(m->hash_len, n));
@@ -262,6 +553,9 @@ off_t nth_midxed_offset(struct multi_pack_index *m, uint32_t pos)
 	const unsigned char *offset_data;
 	uint32_t offset32;
 
+	if (!(m = midx_for_object(m, &pos)))
+		BUG("bad MIDX position: %"PRIu32, pos);
+
 	offset_data = m->chunk_object_offsets + (off_t)pos * MIDX_CHUNK_OFFSET_WIDTH;
 	offset32 = get_be32(offset_data + sizeof(uint32_t));
 
@@ -279,8 +573,12 @@ off_t nth_midxed_offset(struct multi_pack_index *m, uint32_t pos)
 
 uint32_t nth_midxed_pack_int_id(struct multi_pack_index *m, uint32_t pos)
 {
-	return get_be32(m->chunk_object_offsets +
-			(off_t)pos * MIDX_CHUNK_OFFSET_WIDTH);
+	if (!(m = midx_for_object(m, &pos)))
+		BUG("bad MIDX position: %"PRIu32, pos);
+
+	return m->num_packs_in_base +
+		get_be32(m->chunk_object_offsets +
+			 (off_t)pos * MIDX_CHUNK_OFFSET_WIDTH);
 }
 
 int fill_midx_entry(struct repository *r,
@@ -295,14 +593,14 @@ int fill_midx_entry(struct repository *r,
 	if (!bsearch_midx(oid, m, &pos))
 		return 0;
 
-	if (pos >= m->num_objects)
+	if (pos >= m->num_objects_in_base + m->num_objects)
 		return 0;
 
 	pack_int_id = nth_midxed_pack_int_id(m, pos);
 
 	if (prepare_midx_pack(r, m, pack_int_id))
 		return 0;
-	p = m->packs[pack_int_id];
+	p = nth_midxed_pack(m, pack_int_id);
 
 	/*
 	* We are about to tell the caller where they can locate the
@@ -356,7 +654,8 @@ static int cmp_idx_or_pack_name(const char *idx_or_pack_name,
 	return strcmp(idx_or_pack_name, idx_name);
 }
 
-int midx_contains_pack(struct multi_pack_index *m, const char *idx_or_pack_name)
+static int midx_layer_contains_pack(struct multi_pack_index *m,
+				    const char *idx_or_pack_name)
 {
 	uint32_t first = 0, last = m->num_packs;
 
@@ -379,6 +678,14 @@ int midx_contains_pack(struct multi_pack_index *m, const char *idx_or_pack_name)
 	return 0;
 }
 
+int midx_contains_pack(struct multi_pack_index *m, const char *idx_or_pack_name)
+{
+	for (; m; m = m->base_midx)
+		if (midx_layer_contains_pack(m, idx_or_pack_name))
+			return 1;
+	return 0;
+}
+
 int prepare_multi_pack_index_one(struct repository *r, const char *object_dir, int local)
 {
 	struct multi_pack_index *m;
@@ -409,13 +716,14 @@ int prepare_multi_pack_index_one(struct repository *r, const char *object_dir, i
 
 static size_t write_midx_header(struct hashfile *f,
 				unsigned char num_chunks,
+				unsigned char num_bases,
 				uint32_t num_packs)
 {
 	hashwrite_be32(f, MIDX_SIGNATURE);
 	hashwrite_u8(f, MIDX_VERSION);
 	hashwrite_u8(f, oid_version(the_hash_algo));
 	hashwrite_u8(f, num_chunks);
-	hashwrite_u8(f, 0); /* unused */
+	hashwrite_u8(f, num_bases);
 	hashwrite_be32(f, num_packs);
 
 	return MIDX_HEADER_SIZE;
@@ -425,6 +733,11 @@ struct pack_info {
 	uint32_t orig_pack_int_id;
 	char *pack_name;
 	struct packed_git *p;
+
+	/* the objects selected from this pack in pseudo-pack order */
+	uint32_t bitmap_pos;
+	uint32_t bitmap_nr;
+
 	unsigned expired : 1;
 };
 
@@ -462,6 +775,23 @@ struct write_midx_context {
 	int preferred_pack_idx;
 
 	struct string_list *to_include;
+
+	/*
+	 * When writing a layer of an incremental MIDX chain, the layers
+	 * below it, and the checksums of all layers of the resulting
+	 * chain (bottom-most first).
+	 */
+	struct multi_pack_index *base_midx;
+	struct object_id *chain;
+	size_t chain_nr;
+
+	/*
+	 * The chain whose objects a MIDX bitmap is written for, and the
+	 * number of its objects that are covered by the bitmaps of its
+	 * base layers already.
+	 */
+	struct multi_pack_index *bitmap_midx;
+	uint32_t bitmapped_objects_in_base;
 };
 
 static void add_pack_to_midx(const char *full_path, size_t full_path_len,
@@ -488,6 +818,9 @@ static void add_pack_to_midx(const char *full_path, size_t full_path_len,
 		 */
 		if (ctx->m && midx_contains_pack(ctx->m, file_name))
 			return;
+		else if (ctx->base_midx &&
+			 midx_contains_pack(ctx->base_midx, file_name))
+			return;
 		else if (ctx->to_include &&
 			 !string_list_has_string(ctx->to_include, file_name))
 			return;
@@ -668,6 +1001,7 @@ static void midx_fanout_add_pack_fanout(struct midx_fanout *fanout,
  * of a packfile containing the object).
  */
 static struct pack_midx_entry *get_sorted_entries(struct multi_pack_index *m,
+						  struct multi_pack_index *base,
 						  struct pack_info *info,
 						  uint32_t nr_packs,
 						  size_t *nr_objects,
@@ -723,6 +1057,10 @@ static struct pack_midx_entry *get_sorted_entries(struct multi_pack_index *m,
 			if (cur_object && oideq(&fanout.entries[cur_object - 1].oid,
 						&fanout.entries[cur_object].oid))
 				continue;
+			/* the layers below already cover this object */
+			if (base && bsearch_midx(&fanout.entries[cur_object].oid,
+						 base, NULL))
+				continue;
 
 			ALLOC_GROW(deduplicated_entries, st_add(*nr_objects, 1),
 				   alloc_objects);
@@ -770,6 +1108,18 @@ static int write_midx_pack_names(struct hashfile *f, void *data)
 	return 0;
 }
 
+static int write_midx_base(struct hashfile *f, void *data)
+{
+	struct write_midx_context *ctx = data;
+	size_t i;
+
+	/* all but the last entry of the chain, which is being written */
+	for (i = 0; i + 1 < ctx->chain_nr; i++)
+		hashwrite(f, ctx->chain[i].hash, the_hash_algo->rawsz);
+
+	return 0;
+}
+
 static int write_midx_oid_fanout(struct hashfile *f,
 				 void *data)
 {
@@ -883,6 +1233,24 @@ static int write_midx_large_offsets(struct hashfile *f,
 	return 0;
 }
 
+static int write_midx_bitmapped_packs(struct hashfile *f,
+				      void *data)
+{
+	struct write_midx_context *ctx = data;
+	size_t i;
+
+	for (i = 0; i < ctx->nr; i++) {
+		struct pack_info *pack = &ctx->info[i];
+		if (pack->expired)
+			continue;
+
+		hashwrite_be32(f, pack->bitmap_nr ? pack->bitmap_pos : 0);
+		hashwrite_be32(f, pack->bitmap_nr);
+	}
+
+	return 0;
+}
+
 static int write_midx_revindex(struct hashfile *f,
 			       void *data)
 {
@@ -924,6 +1292,9 @@ static uint32_t *midx_pack_order(struct write_midx_context *ctx)
 
 	trace2_region_enter("midx", "midx_pack_order", the_repository);
 
+	for (i = 0; i < ctx->nr; i++)
+		ctx->info[i].bitmap_pos = ctx->info[i].bitmap_nr = 0;
+
 	ALLOC_ARRAY(data, ctx->entries_nr);
 	for (i = 0; i < ctx->entries_nr; i++) {
 		struct pack_midx_entry *e = &ctx->entries[i];
@@ -936,9 +1307,20 @@ static uint32_t *midx_pack_order(struct write_midx_context *ctx)
 
 	QSORT(data, ctx->entries_nr, midx_pack_order_cmp);
 
+	/*
+	 * The objects selected from each pack are contiguous in
+	 * pseudo-pack order; remember where each pack's range starts.
+	 */
 	ALLOC_ARRAY(pack_order, ctx->entries_nr);
-	for (i = 0; i < ctx->entries_nr; i++)
+	for (i = 0; i < ctx->entries_nr; i++) {
+		struct pack_midx_entry *e = &ctx->entries[data[i].nr];
+		struct pack_info *pack = &ctx->info[ctx->pack_perm[e->pack_int_id]];
+
+		if (!pack->bitmap_nr)
+			pack->bitmap_pos = i;
+		pack->bitmap_nr++;
 		pack_order[i] = data[i].nr;
+	}
 	free(data);
 
 	trace2_region_leave("midx", "midx_pack_order", the_repository);
@@ -996,6 +1378,58 @@ static void prepare_midx_packing_data(struct packing_data *pdata,
 	trace2_region_leave("midx", "prepare_midx_packing_data", the_repository);
 }
 
+/*
+ * Like prepare_midx_packing_data(), but for all objects of the chain
+ * "ctx->bitmap_midx", in its pseudo-pack order. The packs are opened
+ * privately and returned in "packs_out" for the caller to free. Returns
+ * the MIDX position of each object in pseudo-pack order.
+ */
+static uint32_t *prepare_midx_chain_packing_data(struct packing_data *pdata,
+						 struct write_midx_context *ctx,
+						 struct packed_git ***packs_out)
+{
+	struct multi_pack_index *m = ctx->bitmap_midx;
+	uint32_t nr = m->num_objects_in_base + m->num_objects;
+	uint32_t nr_packs = midx_num_packs(m);
+	struct packed_git **packs;
+	struct strbuf buf = STRBUF_INIT;
+	uint32_t *pack_order;
+	uint32_t i;
+
+	trace2_region_enter("midx", "prepare_midx_packing_data", the_repository);
+
+	CALLOC_ARRAY(packs, nr_packs);
+	for (i = 0; i < nr_packs; i++) {
+		strbuf_reset(&buf);
+		strbuf_addf(&buf, "%s/pack/%s", m->object_dir,
+			    nth_midxed_pack_name(m, i));
+		packs[i] = add_packed_git(buf.buf, buf.len, 1);
+		if (!packs[i])
+			die(_("could not load pack %s"), buf.buf);
+	}
+	strbuf_release(&buf);
+
+	memset(pdata, 0, sizeof(struct packing_data));
+	prepare_packing_data(the_repository, pdata);
+
+	ALLOC_ARRAY(pack_order, nr);
+	for (i = 0; i < nr; i++) {
+		struct object_id oid;
+		struct object_entry *to;
+
+		pack_order[i] = pack_pos_to_midx(m, i);
+		nth_midxed_object_oid(&oid, m, pack_order[i]);
+		to = packlist_alloc(pdata, &oid);
+		oe_set_in_pack(pdata, to,
+			       packs[nth_midxed_pack_int_id(m, pack_order[i])]);
+	}
+
+	trace2_region_leave("midx", "prepare_midx_packing_data", the_repository);
+
+	*packs_out = packs;
+	return pack_order;
+}
+
 static int add_ref_to_pending(const char *refname,
 			      const struct object_id *oid,
 			      int flag, void *cb_data)
@@ -1039,11 +1473,22 @@ static const struct object_id *bitmap_oid_access(size_t index,
 static void bitmap_show_commit(struct commit *commit, void *_data)
 {
 	struct bitmap_commit_cb *data = _data;
-	int pos = oid_pos(&commit->object.oid, data->ctx->entries,
-			  data->ctx->entries_nr,
-			  bitmap_oid_access);
-	if (pos < 0)
+
+	if (data->ctx->bitmap_midx) {
+		uint32_t pos;
+
+		/*
+		 * Commits whose bitmaps would belong to the base layers
+		 * are left to those.
+		 */
+		if (!bsearch_midx(&commit->object.oid, data->ctx->bitmap_midx,
+				  &pos) ||
+		    pos < data->ctx->bitmapped_objects_in_base)
+			return;
+	} else if (oid_pos(&commit->object.oid, data->ctx->entries,
+			   data->ctx->entries_nr, bitmap_oid_access) < 0) {
 		return;
+	}
 
 	ALLOC_GROW(data->commits, data->commits_nr + 1, data->commits_alloc);
 	data->commits[data->commits_nr++] = commit;
@@ -1226,9 +1671,229 @@ static struct multi_pack_index *lookup_multi_pack_index(struct repository *r,
 	return result;
 }
 
+/*
+ * A new layer of an incremental MIDX chain absorbs the layers below it
+ * for as long as they are no more than this many times as large as the
+ * layer being written, so that the number of layers stays logarithmic
+ * in the number of objects.
+ */
+#define MIDX_SPLIT_SIZE_MULT 2
+
+/* the number of bases a layer has is stored in a single byte */
+#define MIDX_MAX_BASES 255
+
+static int midx_layer_usable(struct multi_pack_index *m,
+			     struct string_list *to_include)
+{
+	struct strbuf buf = STRBUF_INIT;
+	uint32_t i;
+	int ret = 1;
+
+	for (i = 0; ret && i < m->num_packs; i++) {
+		if (to_include) {
+			ret = string_list_has_string(to_include,
+						     m->pack_names[i]);
+		} else {
+			strbuf_reset(&buf);
+			strbuf_addf(&buf, "%s/pack/%s", m->object_dir,
+				    m->pack_names[i]);
+			ret = file_exists(buf.buf);
+		}
+	}
+
+	strbuf_release(&buf);
+	return ret;
+}
+
+/*
+ * Return the topmost layer of "m" such that it and all layers below it
+ * only refer to packs that still exist (and that are in "to_include",
+ * if given). A new layer can be written on top of it.
+ */
+static struct multi_pack_index *usable_midx_base(struct multi_pack_index *m,
+						 struct string_list *to_include)
+{
+	struct multi_pack_index **layers = NULL;
+	struct multi_pack_index *base = NULL;
+	size_t nr = 0, alloc = 0;
+
+	for (; m; m = m->base_midx) {
+		ALLOC_GROW(layers, nr + 1, alloc);
+		layers[nr++] = m;
+	}
+	while (nr && midx_layer_usable(layers[nr - 1], to_include))
+		base = layers[--nr];
+
+	free(layers);
+	return base;
+}
+
+/*
+ * Remove the topmost layer from "ctx->base_midx" and add its packs to
+ * the layer being written instead.
+ */
+static void midx_absorb_base_layer(struct write_midx_context *ctx)
+{
+	struct multi_pack_index *layer = ctx->base_midx;
+	struct strbuf buf = STRBUF_INIT;
+	uint32_t i;
+
+	ctx->base_midx = layer->base_midx;
+
+	for (i = 0; i < layer->num_packs; i++) {
+		strbuf_reset(&buf);
+		strbuf_addf(&buf, "%s/pack/%s", layer->object_dir,
+			    layer->pack_names[i]);
+		add_pack_to_midx(buf.buf, buf.len, layer->pack_names[i], ctx);
+	}
+
+	strbuf_release(&buf);
+}
+
+static int midx_has_bitmap(struct multi_pack_index *m)
+{
+	struct strbuf buf = STRBUF_INIT;
+	int ret;
+
+	get_midx_filename_ext(&buf, m, ".bitmap");
+	ret = file_exists(buf.buf);
+	strbuf_release(&buf);
+	return ret;
+}
+
+/*
+ * Remove the files of incremental MIDX layers other than those in
+ * "keep".
+ */
+static void clear_incremental_midx_files(const char *object_dir,
+					 struct object_id *keep, size_t keep_nr)
+{
+	struct strbuf path = STRBUF_INIT;
+	size_t dirlen;
+	DIR *dir;
+	struct dirent *de;
+
+	get_midx_chain_dirname(&path, object_dir);
+	dir = opendir(path.buf);
+	if (!dir) {
+		strbuf_release(&path);
+		return;
+	}
+	strbuf_addch(&path, '/');
+	dirlen = path.len;
+
+	while ((de = readdir(dir))) {
+		struct object_id oid;
+		const char *hex, *ext;
+		size_t i;
+		int wanted = 0;
+
+		if (!skip_prefix(de->d_name, "multi-pack-index-", &hex) ||
+		    parse_oid_hex(hex, &oid, &ext))
+			continue;
+
+		if (strcmp(ext, ".midx") && strcmp(ext, ".rev") &&
+		    strcmp(ext, ".bitmap"))
+			continue;
+		for (i = 0; i < keep_nr; i++)
+			if (oideq(&oid, &keep[i]))
+				wanted = 1;
+		if (wanted)
+			continue;
+
+		strbuf_setlen(&path, dirlen);
+		strbuf_addstr(&path, de->d_name);
+		unlink_or_warn(path.buf);
+	}
+
+	closedir(dir);
+	strbuf_release(&path);
+}
+
+/*
+ * Return the layer below the lowest layer of "m" that holds any of
+ * "packs", or "m" if none of its layers does.
+ */
+static struct multi_pack_index *midx_base_below_packs(struct multi_pack_index *m,
+						      struct string_list *packs)
+{
+	struct multi_pack_index *base = m;
+	uint32_t i;
+
+	for (; m; m = m->base_midx) {
+		for (i = 0; i < m->num_packs; i++) {
+			if (string_list_has_string(packs, m->pack_names[i])) {
+				base = m->base_midx;
+				break;
+			}
+		}
+	}
+	return base;
+}
+
+static void write_midx_chain_file(struct lock_file *lk,
+				  struct object_id *chain, size_t chain_nr)
+{
+	FILE *fp = fdopen_lock_file(lk, "w");
+	size_t i;
+
+	if (!fp)
+		die_errno(_("unable to open multi-pack-index chain file"));
+	for (i = 0; i < chain_nr; i++)
+		fprintf(fp, "%s\n", oid_to_hex(&chain[i]));
+}
+
+/*
+ * Drop the layers above "base" from "chain", without rewriting any,
+ * and close "chain".
+ */
+static void truncate_midx_chain(const char *object_dir,
+				struct multi_pack_index *chain,
+				struct multi_pack_index *base)
+{
+	struct lock_file lk;
+	struct strbuf chain_name = STRBUF_INIT;
+	size_t nr = base->num_bases + 1, i = nr;
+	struct object_id *oids;
+
+	ALLOC_ARRAY(oids, nr);
+	for (; base; base = base->base_midx)
+		oidread(&oids[--i], get_midx_checksum(base));
+
+	get_midx_chain_filename(&chain_name, object_dir);
+	hold_lock_file_for_update(&lk, chain_name.buf, LOCK_DIE_ON_ERROR);
+	write_midx_chain_file(&lk, oids, nr);
+	close_midx(chain);
+	close_object_store(the_repository->objects);
+	if (commit_lock_file(&lk) < 0)
+		die_errno(_("could not write multi-pack-index"));
+	clear_incremental_midx_files(object_dir, oids, nr);
+
+	free(oids);
+	strbuf_release(&chain_name);
+}
+
+static void clear_midx_chain(const char *object_dir)
+{
+	struct strbuf path = STRBUF_INIT;
+
+	clear_incremental_midx_files(object_dir, NULL, 0);
+
+	get_midx_chain_filename(&path, object_dir);
+	if (unlink(path.buf) && errno != ENOENT)
+		die_errno(_("failed to remove %s"), path.buf);
+
+	strbuf_reset(&path);
+	get_midx_chain_dirname(&path, object_dir);
+	rmdir(path.buf);
+
+	strbuf_release(&path);
+}
+
 static int write_midx_internal(const char *object_dir,
 			       struct string_list *packs_to_include,
 			       struct string_list *packs_to_drop,
+			       struct string_list *packs_to_rewrite,
 			       const char *preferred_pack_name,
 			       const char *refs_snapshot,
 			       unsigned flags)
@@ -1243,21 +1908,45 @@ static int write_midx_internal(const char *object_dir,
 	int dropped_packs = 0;
 	int result = 0;
 	struct chunkfile *cf;
+	struct multi_pack_index *chain = NULL;
+	struct strbuf tmp_layer = STRBUF_INIT;
+	struct packed_git **bitmap_packs = NULL;
+	uint32_t *bitmap_pack_order = NULL;
+	int incremental = !!(flags & MIDX_WRITE_INCREMENTAL);
 
 	trace2_region_enter("midx", "write_midx_internal", the_repository);
 
-	get_midx_filename(&midx_name, object_dir);
+	if (incremental) {
+		if (packs_to_drop && packs_to_drop->nr)
+			BUG("cannot expire packs from an incremental multi-pack-index");
+		get_midx_chain_filename(&midx_name, object_dir);
+	} else {
+		get_midx_filename(&midx_name, object_dir);
+	}
 	if (safe_create_leading_directories(midx_name.buf))
 		die_errno(_("unable to create leading directories of %s"),
 			  midx_name.buf);
 
-	if (!packs_to_include) {
+	if (incremental) {
+		/*
+		 * Every layer of a chain has a reverse index, so that the
+		 * pseudo-pack order of the whole chain is known.
+		 */
+		flags |= MIDX_WRITE_REV_INDEX;
+		chain = load_multi_pack_index_chain(object_dir, 1);
+		ctx.base_midx = usable_midx_base(chain, packs_to_include);
+		if (packs_to_rewrite)
+			ctx.base_midx = midx_base_below_packs(ctx.base_midx,
+							      packs_to_rewrite);
+	} else if (!packs_to_include) {
 		/*
 		 * Only reference an existing MIDX when not filtering which
 		 * packs to include, since all packs and objects are copied
 		 * blindly from an existing MIDX if one is present.
 		 */
 		ctx.m = lookup_multi_pack_index(the_repository, object_dir);
+		if (ctx.m && ctx.m->incremental)
+			ctx.m = NULL;
 	}
 
 	if (ctx.m && !midx_checksum_valid(ctx.m)) {
@@ -1312,6 +2001,47 @@ static int write_midx_internal(const char *object_dir,
 	for_each_file_in_pack_dir(object_dir, add_pack_to_midx, &ctx);
 	stop_progress(&ctx.progress);
 
+	if (incremental && ctx.base_midx) {
+		size_t new_objects = 0;
+
+		if (!ctx.nr) {
+			/*
+			 * There is nothing to add. Unless the base lacks a
+			 * bitmap that was asked for (in which case its
+			 * topmost layer is rewritten), it is enough to drop
+			 * the layers above it, if any.
+			 */
+			if (!(flags & MIDX_WRITE_BITMAP) ||
+			    midx_has_bitmap(ctx.base_midx)) {
+				if (ctx.base_midx != chain) {
+					truncate_midx_chain(object_dir, chain,
+							    ctx.base_midx);
+					chain = NULL;
+				}
+				goto cleanup;
+			}
+			midx_absorb_base_layer(&ctx);
+		}
+
+		for (i = 0; i < ctx.nr; i++)
+			new_objects += ctx.info[i].p->num_objects;
+		while (ctx.base_midx &&
+		       (ctx.base_midx->num_objects <= MIDX_SPLIT_SIZE_MULT * new_objects ||
+			ctx.base_midx->num_bases >= MIDX_MAX_BASES)) {
+			new_objects += ctx.base_midx->num_objects;
+			midx_absorb_base_layer(&ctx);
+		}
+	}
+
+	if (incremental) {
+		struct multi_pack_index *m;
+
+		ctx.chain_nr = ctx.base_midx ? ctx.base_midx->num_bases + 2 : 1;
+		CALLOC_ARRAY(ctx.chain, ctx.chain_nr);
+		for (m = ctx.base_midx, i = ctx.chain_nr - 1; m; m = m->base_midx)
+			oidread(&ctx.chain[--i], get_midx_checksum(m));
+	}
+
 	if ((ctx.m && ctx.nr == ctx.m->num_packs) &&
 	    !(packs_to_include || packs_to_drop)) {
 		struct bitmap_index *bitmap_git;
@@ -1398,8 +2128,8 @@ static int write_midx_internal(const char *object_dir,
 		}
 	}
 
-	ctx.entries = get_sorted_entries(ctx.m, ctx.info, ctx.nr, &ctx.entries_nr,
-					 ctx.preferred_pack_idx);
+	ctx.entries = get_sorted_entries(ctx.m, ctx.base_midx, ctx.info, ctx.nr,
+					 &ctx.entries_nr, ctx.preferred_pack_idx);
 
 	ctx.large_offsets_needed = 0;
 	for (i = 0; i < ctx.entries_nr; i++) {
@@ -1479,7 +2209,18 @@ static int write_midx_internal(const char *object_dir,
 					(pack_name_concat_len % MIDX_CHUNK_ALIGNMENT);
 
 	hold_lock_file_for_update(&lk, midx_name.buf, LOCK_DIE_ON_ERROR);
-	f = hashfd(get_lock_file_fd(&lk), get_lock_file_path(&lk));
+	if (incremental) {
+		int fd;
+
+		get_midx_chain_dirname(&tmp_layer, object_dir);
+		strbuf_addstr(&tmp_layer, "/tmp_midx_XXXXXX");
+		fd = git_mkstemp_mode(tmp_layer.buf, 0444);
+		if (fd < 0)
+			die_errno(_("unable to create temporary multi-pack-index layer"));
+		f = hashfd(fd, tmp_layer.buf);
+	} else {
+		f = hashfd(get_lock_file_fd(&lk), get_lock_file_path(&lk));
+	}
 
 	if (ctx.nr - dropped_packs == 0) {
 		error(_("no pack files to index."));
@@ -1487,7 +2228,7 @@ static int write_midx_internal(const char *object_dir,
 		goto cleanup;
 	}
 
-	if (!ctx.entries_nr) {
+	if (!ctx.entries_nr && !ctx.base_midx) {
 		if (flags & MIDX_WRITE_BITMAP)
 			warning(_("refusing to write multi-pack .bitmap without any objects"));
 		flags &= ~(MIDX_WRITE_REV_INDEX | MIDX_WRITE_BITMAP);
@@ -1517,15 +2258,47 @@ static int write_midx_internal(const char *object_dir,
 		add_chunk(cf, MIDX_CHUNKID_REVINDEX,
 			  st_mult(ctx.entries_nr, sizeof(uint32_t)),
 			  write_midx_revindex);
+		if (git_env_bool("GIT_TEST_MIDX_WRITE_BTMP", 1))
+			add_chunk(cf, MIDX_CHUNKID_BITMAPPEDPACKS,
+				  st_mult(ctx.nr - dropped_packs,
+					  MIDX_CHUNK_BITMAPPED_PACKS_WIDTH),
+				  write_midx_bitmapped_packs);
 	}
 
-	write_midx_header(f, get_num_chunks(cf), ctx.nr - dropped_packs);
+	if (ctx.base_midx)
+		add_chunk(cf, MIDX_CHUNKID_BASE,
+			  st_mult(ctx.chain_nr - 1, the_hash_algo->rawsz),
+			  write_midx_base);
+
+	write_midx_header(f, get_num_chunks(cf), ctx.chain_nr ? ctx.chain_nr - 1 : 0,
+			  ctx.nr - dropped_packs);
 	write_chunkfile(cf, &ctx);
 
 	finalize_hashfile(f, midx_hash, FSYNC_COMPONENT_PACK_METADATA,
-			  CSUM_FSYNC | CSUM_HASH_IN_STREAM);
+			  CSUM_FSYNC | CSUM_HASH_IN_STREAM |
+			  (incremental ? CSUM_CLOSE : 0));
 	free_chunkfile(cf);
 
+	if (incremental) {
+		struct strbuf layer_name = STRBUF_INIT;
+
+		oidread(&ctx.chain[ctx.chain_nr - 1], midx_hash);
+		get_split_midx_filename_ext(&layer_name, object_dir, midx_hash,
+					    ".midx");
+		if (finalize_object_file(tmp_layer.buf, layer_name.buf))
+			die(_("unable to store multi-pack-index layer"));
+		strbuf_reset(&tmp_layer);
+		strbuf_release(&layer_name);
+
+		/*
+		 * The reverse index and bitmap of a layer are named
+		 * after it like those of a single MIDX are.
+		 */
+		strbuf_reset(&midx_name);
+		get_midx_chain_dirname(&midx_name, object_dir);
+		strbuf_addstr(&midx_name, "/multi-pack-index");
+	}
+
 	if (flags & MIDX_WRITE_REV_INDEX &&
 	    git_env_bool("GIT_TEST_MIDX_WRITE_REV", 0))
 		write_midx_reverse_index(midx_name.buf, midx_hash, &ctx);
@@ -1535,10 +2308,40 @@ static int write_midx_internal(const char *object_dir,
 		struct commit **commits;
 		uint32_t commits_nr;
 
-		if (!ctx.entries_nr)
-			BUG("cannot write a bitmap without any objects");
+		if (incremental) {
+			struct multi_pack_index *m;
+			struct bitmap_index *base_bitmap = NULL;
 
-		prepare_midx_packing_data(&pdata, &ctx);
+			/*
+			 * The bitmap of a layer indexes the objects of the
+			 * whole chain, but only holds bitmaps for commits
+			 * above the topmost base layer with a bitmap. Those
+			 * of the base layers are reused while building it,
+			 * and are looked up in their own files by readers.
+			 */
+			ctx.bitmap_midx = load_midx_chain_oids(object_dir, ctx.chain,
+							       ctx.chain_nr, 1);
+			if (!ctx.bitmap_midx ||
+			    !hasheq(get_midx_checksum(ctx.bitmap_midx), midx_hash) ||
+			    load_midx_revindex(ctx.bitmap_midx))
+				die(_("could not load multi-pack-index chain"));
+			for (m = ctx.bitmap_midx->base_midx; m; m = m->base_midx)
+				if ((base_bitmap = prepare_midx_bitmap_git(m)))
+					break;
+			if (base_bitmap) {
+				ctx.bitmapped_objects_in_base =
+					m->num_objects_in_base + m->num_objects;
+				bitmap_writer_reuse_bitmaps(base_bitmap);
+			}
+			bitmap_pack_order =
+				prepare_midx_chain_packing_data(&pdata, &ctx,
+								&bitmap_packs);
+		} else {
+			if (!ctx.entries_nr)
+				BUG("cannot write a bitmap without any objects");
+
+			prepare_midx_packing_data(&pdata, &ctx);
+		}
 
 		commits = find_commits_for_midx_bitmap(&commits_nr, refs_snapshot, &ctx);
 
@@ -1552,7 +2355,8 @@ static int write_midx_internal(const char *object_dir,
 		ctx.entries_nr = 0;
 
 		if (write_midx_bitmap(midx_name.buf, midx_hash, &pdata,
-				      commits, commits_nr, ctx.pack_order,
+				      commits, commits_nr,
+				      incremental ? bitmap_pack_order : ctx.pack_order,
 				      flags) < 0) {
 			error(_("could not write multi-pack bitmap"));
 			result = 1;
@@ -1564,14 +2368,34 @@ static int write_midx_internal(const char *object_dir,
 	 * have been freed in the previous if block.
 	 */
 
-	if (ctx.m)
+	if (ctx.m || incremental)
 		close_object_store(the_repository->objects);
 
+	if (incremental)
+		write_midx_chain_file(&lk, ctx.chain, ctx.chain_nr);
+
 	if (commit_lock_file(&lk) < 0)
 		die_errno(_("could not write multi-pack-index"));
 
-	clear_midx_files_ext(object_dir, ".bitmap", midx_hash);
-	clear_midx_files_ext(object_dir, ".rev", midx_hash);
+	if (incremental) {
+		struct strbuf single = STRBUF_INIT;
+
+		close_midx(chain);
+		chain = NULL;
+
+		get_midx_filename(&single, object_dir);
+		if (unlink(single.buf) && errno != ENOENT)
+			die_errno(_("failed to remove %s"), single.buf);
+		strbuf_release(&single);
+
+		clear_midx_files_ext(object_dir, ".bitmap", NULL);
+		clear_midx_files_ext(object_dir, ".rev", NULL);
+		clear_incremental_midx_files(object_dir, ctx.chain, ctx.chain_nr);
+	} else {
+		clear_midx_files_ext(object_dir, ".bitmap", midx_hash);
+		clear_midx_files_ext(object_dir, ".rev", midx_hash);
+		clear_midx_chain(object_dir);
+	}
 
 cleanup:
 	for (i = 0; i < ctx.nr; i++) {
@@ -1582,10 +2406,25 @@ static int write_midx_internal(const char *object_dir,
 		free(ctx.info[i].pack_name);
 	}
 
+	if (bitmap_packs) {
+		for (i = 0; i < midx_num_packs(ctx.bitmap_midx); i++) {
+			close_pack(bitmap_packs[i]);
+			free(bitmap_packs[i]);
+		}
+		free(bitmap_packs);
+	}
+	close_midx(ctx.bitmap_midx);
+	close_midx(chain);
+	if (tmp_layer.len)
+		unlink_or_warn(tmp_layer.buf);
+
 	free(ctx.info);
 	free(ctx.entries);
 	free(ctx.pack_perm);
 	free(ctx.pack_order);
+	free(ctx.chain);
+	free(bitmap_pack_order);
+	strbuf_release(&tmp_layer);
 	strbuf_release(&midx_name);
 
 	trace2_region_leave("midx", "write_midx_internal", the_repository);
@@ -1598,7 +2437,7 @@ int write_midx_file(const char *object_dir,
 		    const char *refs_snapshot,
 		    unsigned flags)
 {
-	return write_midx_internal(object_dir, NULL, NULL, preferred_pack_name,
+	return write_midx_internal(object_dir, NULL, NULL, NULL, preferred_pack_name,
 				   refs_snapshot, flags);
 }
 
@@ -1608,7 +2447,7 @@ int write_midx_file_only(const char *object_dir,
 			 const char *refs_snapshot,
 			 unsigned flags)
 {
-	return write_midx_internal(object_dir, packs_to_include, NULL,
+	return write_midx_internal(object_dir, packs_to_include, NULL, NULL,
 				   preferred_pack_name, refs_snapshot, flags);
 }
 
@@ -1666,6 +2505,7 @@ void clear_midx_file(struct repository *r)
 
 	clear_midx_files_ext(r->objects->odb->path, ".bitmap", NULL);
 	clear_midx_files_ext(r->objects->odb->path, ".rev", NULL);
+	clear_midx_chain(r->objects->odb->path);
 
 	strbuf_release(&midx);
 }
@@ -1709,28 +2549,14 @@ static int compare_pair_pos_vs_id(const void *_a, const void *_b)
 			display_progress(progress, _n); \
 	} while (0)
 
-int verify_midx_file(struct repository *r, const char *object_dir, unsigned flags)
+static void verify_midx_layer(struct repository *r, struct multi_pack_index *m,
+			      unsigned flags)
 {
 	struct pair_pos_vs_id *pairs = NULL;
 	uint32_t i;
 	struct progress *progress = NULL;
-	struct multi_pack_index *m = load_multi_pack_index(object_dir, 1);
-	verify_midx_error = 0;
-
-	if (!m) {
-		int result = 0;
-		struct stat sb;
-		struct strbuf filename = STRBUF_INIT;
-
-		get_midx_filename(&filename, object_dir);
-
-		if (!stat(filename.buf, &sb)) {
-			error(_("multi-pack-index file exists, but failed to parse"));
-			result = 1;
-		}
-		strbuf_release(&filename);
-		return result;
-	}
+	uint32_t pos_base = m->num_objects_in_base;
+	uint32_t pack_base = m->num_packs_in_base;
 
 	if (!midx_checksum_valid(m))
 		midx_report(_("incorrect checksum"));
@@ -1739,7 +2565,7 @@ int verify_midx_file(struct repository *r, const char *object_dir, unsigned flag
 		progress = start_delayed_progress(_("Looking for referenced packfiles"),
 					  m->num_packs);
 	for (i = 0; i < m->num_packs; i++) {
-		if (prepare_midx_pack(r, m, i))
+		if (prepare_midx_pack(r, m, pack_base + i))
 			midx_report("failed to load pack in position %d", i);
 
 		display_progress(progress, i + 1);
@@ -1756,7 +2582,9 @@ int verify_midx_file(struct repository *r, const char *object_dir, unsigned flag
 	}
 
 	if (m->num_objects == 0) {
-		midx_report(_("the midx contains no oid"));
+		/* a layer of a chain may only have objects its base has */
+		if (!m->base_midx)
+			midx_report(_("the midx contains no oid"));
 		/*
 		 * Remaining tests assume that we have objects, so we can
 		 * return here.
@@ -1770,8 +2598,8 @@ int verify_midx_file(struct repository *r, const char *object_dir, unsigned flag
 	for (i = 0; i < m->num_objects - 1; i++) {
 		struct object_id oid1, oid2;
 
-		nth_midxed_object_oid(&oid1, m, i);
-		nth_midxed_object_oid(&oid2, m, i + 1);
+		nth_midxed_object_oid(&oid1, m, pos_base + i);
+		nth_midxed_object_oid(&oid2, m, pos_base + i + 1);
 
 		if (oidcmp(&oid1, &oid2) >= 0)
 			midx_report(_("oid lookup out of order: oid[%d] = %s >= %s = oid[%d]"),
@@ -1789,8 +2617,8 @@ int verify_midx_file(struct repository *r, const char *object_dir, unsigned flag
 	 */
 	ALLOC_ARRAY(pairs, m->num_objects);
 	for (i = 0; i < m->num_objects; i++) {
-		pairs[i].pos = i;
-		pairs[i].pack_int_id = nth_midxed_pack_int_id(m, i);
+		pairs[i].pos = pos_base + i;
+		pairs[i].pack_int_id = nth_midxed_pack_int_id(m, pos_base + i);
 	}
 
 	if (flags & MIDX_PROGRESS)
@@ -1808,10 +2636,10 @@ int verify_midx_file(struct repository *r, const char *object_dir, unsigned flag
 		off_t m_offset, p_offset;
 
 		if (i > 0 && pairs[i-1].pack_int_id != pairs[i].pack_int_id &&
-		    m->packs[pairs[i-1].pack_int_id])
+		    nth_midxed_pack(m, pairs[i-1].pack_int_id))
 		{
-			close_pack_fd(m->packs[pairs[i-1].pack_int_id]);
-			close_pack_index(m->packs[pairs[i-1].pack_int_id]);
+			close_pack_fd(nth_midxed_pack(m, pairs[i-1].pack_int_id));
+			close_pack_index(nth_midxed_pack(m, pairs[i-1].pack_int_id));
 		}
 
 		nth_midxed_object_oid(&oid, m, pairs[i].pos);
@@ -1841,14 +2669,61 @@ int verify_midx_file(struct repository *r, const char *object_dir, unsigned flag
 
 cleanup:
 	free(pairs);
+}
+
+int verify_midx_file(struct repository *r, const char *object_dir, unsigned flags)
+{
+	struct multi_pack_index *m = load_multi_pack_index(object_dir, 1);
+	struct multi_pack_index *layer;
+	verify_midx_error = 0;
+
+	if (!m) {
+		int result = 0;
+		struct stat sb;
+		struct strbuf filename = STRBUF_INIT;
+
+		get_midx_filename(&filename, object_dir);
+
+		if (!stat(filename.buf, &sb)) {
+			error(_("multi-pack-index file exists, but failed to parse"));
+			result = 1;
+		}
+
+		strbuf_reset(&filename);
+		get_midx_chain_filename(&filename, object_dir);
+		if (!stat(filename.buf, &sb)) {
+			error(_("multi-pack-index chain exists, but failed to parse"));
+			result = 1;
+		}
+		strbuf_release(&filename);
+		return result;
+	}
+
+	for (layer = m; layer; layer = layer->base_midx)
+		verify_midx_layer(r, layer, flags);
+
 	close_midx(m);
 
 	return verify_midx_error;
 }
 
+/*
+ * The flags for rewriting the layers of the incremental chain "m" that
+ * "expire" or "repack" touched, keeping a bitmap if the chain has one.
+ */
+static unsigned midx_chain_rewrite_flags(struct multi_pack_index *m,
+					 unsigned flags)
+{
+	flags |= MIDX_WRITE_INCREMENTAL;
+	if (midx_has_bitmap(m))
+		flags |= MIDX_WRITE_BITMAP;
+	return flags;
+}
+
 int expire_midx_packs(struct repository *r, const char *object_dir, unsigned flags)
 {
 	uint32_t i, *count, result = 0;
+	uint32_t num_packs, num_objects;
 	struct string_list packs_to_drop = STRING_LIST_INIT_DUP;
 	struct multi_pack_index *m = lookup_multi_pack_index(r, object_dir);
 	struct progress *progress = NULL;
@@ -1856,12 +2731,14 @@ int expire_midx_packs(struct repository *r, const char *object_dir, unsigned fla
 	if (!m)
 		return 0;
 
-	CALLOC_ARRAY(count, m->num_packs);
+	num_packs = midx_num_packs(m);
+	num_objects = m->num_objects_in_base + m->num_objects;
+	CALLOC_ARRAY(count, num_packs);
 
 	if (flags & MIDX_PROGRESS)
 		progress = start_delayed_progress(_("Counting referenced objects"),
-					  m->num_objects);
-	for (i = 0; i < m->num_objects; i++) {
+					  num_objects);
+	for (i = 0; i < num_objects; i++) {
 		int pack_int_id = nth_midxed_pack_int_id(m, i);
 		count[pack_int_id]++;
 		display_progress(progress, i + 1);
@@ -1870,8 +2747,9 @@ int expire_midx_packs(struct repository *r, const char *object_dir, unsigned fla
 
 	if (flags & MIDX_PROGRESS)
 		progress = start_delayed_progress(_("Finding and deleting unreferenced packfiles"),
-					  m->num_packs);
-	for (i = 0; i < m->num_packs; i++) {
+					  num_packs);
+	for (i = 0; i < num_packs; i++) {
+		struct packed_git *p;
 		char *pack_name;
 		display_progress(progress, i + 1);
 
@@ -1881,13 +2759,14 @@ int expire_midx_packs(struct repository *r, const char *object_dir, unsigned fla
 		if (prepare_midx_pack(r, m, i))
 			continue;
 
-		if (m->packs[i]->pack_keep || m->packs[i]->is_cruft)
+		p = nth_midxed_pack(m, i);
+		if (p->pack_keep || p->is_cruft)
 			continue;
 
-		pack_name = xstrdup(m->packs[i]->pack_name);
-		close_pack(m->packs[i]);
+		pack_name = xstrdup(p->pack_name);
+		close_pack(p);
 
-		string_list_insert(&packs_to_drop, m->pack_names[i]);
+		string_list_insert(&packs_to_drop, nth_midxed_pack_name(m, i));
 		unlink_pack_path(pack_name, 0);
 		free(pack_name);
 	}
@@ -1895,8 +2774,16 @@ int expire_midx_packs(struct repository *r, const char *object_dir, unsigned fla
 
 	free(count);
 
-	if (packs_to_drop.nr)
-		result = write_midx_internal(object_dir, NULL, &packs_to_drop, NULL, NULL, flags);
+	/*
+	 * In an incremental chain, the layers that lost packs are rewritten
+	 * along with those above them, as they are no longer usable.
+	 */
+	if (packs_to_drop.nr && m->incremental)
+		result = write_midx_internal(object_dir, NULL, NULL, NULL, NULL,
+					     NULL, midx_chain_rewrite_flags(m, flags));
+	else if (packs_to_drop.nr)
+		result = write_midx_internal(object_dir, NULL, &packs_to_drop, NULL,
+					     NULL, NULL, flags);
 
 	string_list_clear(&packs_to_drop, 0);
 
@@ -1932,12 +2819,12 @@ static int fill_included_packs_all(struct repository *r,
 
 	repo_config_get_bool(r, "repack.packkeptobjects", &pack_kept_objects);
 
-	for (i = 0; i < m->num_packs; i++) {
+	for (i = 0; i < midx_num_packs(m); i++) {
 		if (prepare_midx_pack(r, m, i))
 			continue;
-		if (!pack_kept_objects && m->packs[i]->pack_keep)
+		if (!pack_kept_objects && nth_midxed_pack(m, i)->pack_keep)
 			continue;
-		if (m->packs[i]->is_cruft)
+		if (nth_midxed_pack(m, i)->is_cruft)
 			continue;
 
 		include_pack[i] = 1;
@@ -1953,35 +2840,36 @@ static int fill_included_packs_batch(struct repository *r,
 				     size_t batch_size)
 {
 	uint32_t i, packs_to_repack;
+	uint32_t num_packs = midx_num_packs(m);
 	size_t total_size;
 	struct repack_info *pack_info;
 	int pack_kept_objects = 0;
 
-	CALLOC_ARRAY(pack_info, m->num_packs);
+	CALLOC_ARRAY(pack_info, num_packs);
 
 	repo_config_get_bool(r, "repack.packkeptobjects", &pack_kept_objects);
 
-	for (i = 0; i < m->num_packs; i++) {
+	for (i = 0; i < num_packs; i++) {
 		pack_info[i].pack_int_id = i;
 
 		if (prepare_midx_pack(r, m, i))
 			continue;
 
-		pack_info[i].mtime = m->packs[i]->mtime;
+		pack_info[i].mtime = nth_midxed_pack(m, i)->mtime;
 	}
 
-	for (i = 0; i < m->num_objects; i++) {
+	for (i = 0; i < m->num_objects_in_base + m->num_objects; i++) {
 		uint32_t pack_int_id = nth_midxed_pack_int_id(m, i);
 		pack_info[pack_int_id].referenced_objects++;
 	}
 
-	QSORT(pack_info, m->num_packs, compare_by_mtime);
+	QSORT(pack_info, num_packs, compare_by_mtime);
 
 	total_size = 0;
 	packs_to_repack = 0;
-	for (i = 0; total_size < batch_size && i < m->num_packs; i++) {
+	for (i = 0; total_size < batch_size && i < num_packs; i++) {
 		int pack_int_id = pack_info[i].pack_int_id;
-		struct packed_git *p = m->packs[pack_int_id];
+		struct packed_git *p = nth_midxed_pack(m, pack_int_id);
 		size_t expected_size;
 
 		if (!p)
@@ -2021,6 +2909,7 @@ int midx_repack(struct repository *r, const char *object_dir, size_t batch_size,
 	struct child_process cmd = CHILD_PROCESS_INIT;
 	FILE *cmd_in;
 	struct strbuf base_name = STRBUF_INIT;
+	struct strbuf new_pack = STRBUF_INIT;
 	struct multi_pack_index *m = lookup_multi_pack_index(r, object_dir);
 
 	/*
@@ -2034,7 +2923,7 @@ int midx_repack(struct repository *r, const char *object_dir, size_t batch_size,
 	if (!m)
 		return 0;
 
-	CALLOC_ARRAY(include_pack, m->num_packs);
+	CALLOC_ARRAY(include_pack, midx_num_packs(m));
 
 	if (batch_size) {
 		if (fill_included_packs_batch(r, m, include_pack, batch_size))
@@ -2074,7 +2963,7 @@ int midx_repack(struct repository *r, const char *object_dir, size_t batch_size,
 
 	cmd_in = xfdopen(cmd.in, "w");
 
-	for (i = 0; i < m->num_objects; i++) {
+	for (i = 0; i < m->num_objects_in_base + m->num_objects; i++) {
 		struct object_id oid;
 		uint32_t pack_int_id = nth_midxed_pack_int_id(m, i);
 
@@ -2086,15 +2975,46 @@ int midx_repack(struct repository *r, const char *object_dir, size_t batch_size,
 	}
 	fclose(cmd_in);
 
+	if (strbuf_read(&new_pack, cmd.out, 0) < 0)
+		error_errno(_("could not read pack-objects output"));
+	close(cmd.out);
+	strbuf_trim_trailing_newline(&new_pack);
+
 	if (finish_command(&cmd)) {
 		error(_("could not finish pack-objects"));
 		result = 1;
 		goto cleanup;
 	}
 
-	result = write_midx_internal(object_dir, NULL, NULL, NULL, NULL, flags);
+	if (m->incremental) {
+		struct string_list repacked = STRING_LIST_INIT_DUP;
+		char *preferred = NULL;
+
+		/*
+		 * The new pack only takes the place of the repacked ones if
+		 * it is in the same layer, and is preferred over them, so
+		 * that they end up unreferenced for "expire". Rewrite the
+		 * layers that hold them (and those above), but leave the
+		 * others alone.
+		 */
+		for (i = 0; i < midx_num_packs(m); i++)
+			if (include_pack[i])
+				string_list_insert(&repacked,
+						   nth_midxed_pack_name(m, i));
+		if (new_pack.len)
+			preferred = xstrfmt("pack-%s.idx", new_pack.buf);
+		result = write_midx_internal(object_dir, NULL, NULL, &repacked,
+					     preferred, NULL,
+					     midx_chain_rewrite_flags(m, flags));
+		string_list_clear(&repacked, 0);
+		free(preferred);
+	} else {
+		result = write_midx_internal(object_dir, NULL, NULL, NULL,
+					     NULL, NULL, flags);
+	}
 
 cleanup:
 	free(include_pack);
+	strbuf_release(&new_pack);
 	return result;
 }
@@ -7,6 +7,7 @@
 struct object_id;
 struct pack_entry;
 struct repository;
+struct bitmapped_pack;
 
 #define GIT_TEST_MULTI_PACK_INDEX "GIT_TEST_MULTI_PACK_INDEX"
 #define GIT_TEST_MULTI_PACK_INDEX_WRITE_BITMAP \
@@ -37,9 +38,24 @@ struct multi_pack_index {
 	const unsigned char *chunk_object_offsets;
 	const unsigned char *chunk_large_offsets;
 	const unsigned char *chunk_revindex;
+	const unsigned char *chunk_base;
+	const unsigned char *chunk_bitmapped_packs;
 
 	const char **pack_names;
 	struct packed_git **packs;
+
+	/*
+	 * A layer of an incremental MIDX chain covers only the packs and
+	 * objects that none of the layers below it ("base_midx" and its
+	 * own bases) do. Pack ids and object positions are numbered across
+	 * the whole chain, with those of the base layers coming first.
+	 */
+	struct multi_pack_index *base_midx;
+	uint32_t num_bases;
+	uint32_t num_packs_in_base;
+	uint32_t num_objects_in_base;
+	unsigned incremental:1;
+
 	char object_dir[FLEX_ARRAY];
 };
 
@@ -48,16 +64,48 @@ struct multi_pack_index {
 #define MIDX_WRITE_BITMAP (1 << 2)
 #define MIDX_WRITE_BITMAP_HASH_CACHE (1 << 3)
 #define MIDX_WRITE_BITMAP_LOOKUP_TABLE (1 << 4)
+#define MIDX_WRITE_INCREMENTAL (1 << 5)
 
 const unsigned char *get_midx_checksum(struct multi_pack_index *m);
 void get_midx_filename(struct strbuf *out, const char *object_dir);
+void get_midx_chain_dirname(struct strbuf *out, const char *object_dir);
+void get_midx_chain_filename(struct strbuf *out, const char *object_dir);
+void get_split_midx_filename_ext(struct strbuf *out, const char *object_dir,
+				 const unsigned char *hash, const char *ext);
+/*
+ * The name of the file with extension "ext" (".bitmap", ".rev") that
+ * belongs to the MIDX (or MIDX layer) "m".
+ */
+void get_midx_filename_ext(struct strbuf *out, struct multi_pack_index *m,
+			   const char *ext);
 void get_midx_rev_filename(struct strbuf *out, struct multi_pack_index *m);
 
 struct multi_pack_index *load_multi_pack_index(const char *object_dir, int local);
 int prepare_midx_pack(struct repository *r, struct multi_pack_index *m, uint32_t pack_int_id);
+/*
+ * Look up "oid" in "m" and all of its base layers. If "result" is not
+ * NULL, it is set to the position of "oid" across the chain.
+ */
 int bsearch_midx(const struct object_id *oid, struct multi_pack_index *m, uint32_t *result);
+/*
+ * Like bsearch_midx(), but only looks at the layer "m" itself. If "oid"
+ * is not found, "result" is set to the position at which it would be
+ * inserted into that layer.
+ */
+int bsearch_one_midx(const struct object_id *oid, struct multi_pack_index *m, uint32_t *result);
 off_t nth_midxed_offset(struct multi_pack_index *m, uint32_t pos);
 uint32_t nth_midxed_pack_int_id(struct multi_pack_index *m, uint32_t pos);
+/* The number of packs in "m" and all of its base layers. */
+uint32_t midx_num_packs(struct multi_pack_index *m);
+struct packed_git *nth_midxed_pack(struct multi_pack_index *m, uint32_t pack_int_id);
+const char *nth_midxed_pack_name(struct multi_pack_index *m, uint32_t pack_int_id);
+/*
+ * Fill "bp" with the pack "pack_int_id" and the range of bit positions
+ * its objects occupy in the pseudo-pack order of "m". Returns -1 if "m"
+ * does not record those ranges (i.e., has no 'BTMP' chunk).
+ */
+int nth_bitmapped_pack(struct repository *r, struct multi_pack_index *m,
+		       struct bitmapped_pack *bp, uint32_t pack_int_id);
 struct object_id *nth_midxed_object_oid(struct object_id *oid,
 					struct multi_pack_index *m,
 					uint32_t n);
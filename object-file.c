@@ -985,9 +985,13 @@ static int check_and_freshen_odb(struct object_directory *odb,
 				 const struct object_id *oid,
 				 int freshen)
 {
-	static struct strbuf path = STRBUF_INIT;
+	struct strbuf path = STRBUF_INIT;
+	int ret;
+
 	odb_loose_path(odb, &path, oid);
-	return check_and_freshen_file(path.buf, freshen);
+	ret = check_and_freshen_file(path.buf, freshen);
+	strbuf_release(&path);
+	return ret;
 }
 
 static int check_and_freshen_local(const struct object_id *oid, int freshen)
@@ -2036,19 +2040,24 @@ static int write_loose_object(const struct object_id *oid, char *hdr,
 	git_zstream stream;
 	git_hash_ctx c;
 	struct object_id parano_oid;
-	static struct strbuf tmp_file = STRBUF_INIT;
-	static struct strbuf filename = STRBUF_INIT;
+	struct strbuf tmp_file = STRBUF_INIT;
+	struct strbuf filename = STRBUF_INIT;
 
-	if (batch_fsync_enabled(FSYNC_COMPONENT_LOOSE_OBJECT))
+	if (batch_fsync_enabled(FSYNC_COMPONENT_LOOSE_OBJECT)) {
+		obj_read_lock();
 		prepare_loose_object_bulk_checkin();
+		obj_read_unlock();
+	}
 
 	loose_object_path(the_repository, &filename, oid);
 
 	fd = start_loose_object_common(&tmp_file, filename.buf, flags,
 				       &stream, compressed, sizeof(compressed),
 				       &c, hdr, hdrlen);
-	if (fd < 0)
-		return -1;
+	if (fd < 0) {
+		ret = -1;
+		goto cleanup;
+	}
 
 	/* Then the data itself.. */
 	stream.next_in = (void *)buf;
@@ -2082,7 +2091,11 @@ static int write_loose_object(const struct object_id *oid, char *hdr,
 			warning_errno(_("failed utime() on %s"), tmp_file.buf);
 	}
 
-	return finalize_object_file(tmp_file.buf, filename.buf);
+	ret = finalize_object_file(tmp_file.buf, filename.buf);
+cleanup:
+	strbuf_release(&tmp_file);
+	strbuf_release(&filename);
+	return ret;
 }
 
 static int freshen_loose_object(const struct object_id *oid)
@@ -2215,13 +2228,23 @@ int write_object_file_flags(const void *buf, unsigned long len,
 {
 	char hdr[MAX_HEADER_LEN];
 	int hdrlen = sizeof(hdr);
+	int exists;
 
 	/* Normally if we have it in the pack then we do not bother writing
 	 * it out into .git/objects/??/?{38} file.
 	 */
 	write_object_file_prepare(the_hash_algo, buf, len, type, oid, hdr,
 				  &hdrlen);
-	if (freshen_packed_object(oid) || freshen_loose_object(oid))
+
+	/*
+	 * Looking up packs is not thread-safe; serialize it with object
+	 * reads so that writers can run in parallel when the object read
+	 * lock is enabled.
+	 */
+	obj_read_lock();
+	exists = freshen_packed_object(oid) || freshen_loose_object(oid);
+	obj_read_unlock();
+	if (exists)
 		return 0;
 	return write_loose_object(oid, hdr, hdrlen, buf, len, 0, flags);
 }
@@ -112,6 +112,8 @@ struct packed_git {
 	time_t mtime;
 	int pack_fd;
 	int index;              /* for builtin/pack-objects.c */
+	/* lookups of delta bases in the delta base cache */
+	unsigned long delta_base_hits, delta_base_misses;
 	unsigned pack_local:1,
 		 pack_keep:1,
 		 pack_keep_in_core:1,
@@ -14,14 +14,44 @@
 #include "packfile.h"
 #include "commit-graph.h"
 
+/*
+ * Number the buckets of all shards one after the other, in shard order.
+ */
+static unsigned int number_obj_shards(struct parsed_object_pool *o)
+{
+	unsigned int i, nr = 0;
+
+	for (i = 0; i < OBJ_HASH_SHARDS; i++) {
+		o->obj_shards[i].index = nr;
+		nr += o->obj_shards[i].size;
+	}
+	o->index_stale = 0;
+	return nr;
+}
+
 unsigned int get_max_object_index(void)
 {
-	return the_repository->parsed_objects->obj_hash_size;
+	return number_obj_shards(the_repository->parsed_objects);
 }
 
 struct object *get_indexed_object(unsigned int idx)
 {
-	return the_repository->parsed_objects->obj_hash[idx];
+	struct parsed_object_pool *o = the_repository->parsed_objects;
+	unsigned int lo = 0, hi = OBJ_HASH_SHARDS;
+
+	/* a shard has grown since the buckets were last numbered */
+	if (o->index_stale)
+		number_obj_shards(o);
+
+	/* find the last shard starting at or before "idx" */
+	while (hi - lo > 1) {
+		unsigned int mi = lo + (hi - lo) / 2;
+		if (o->obj_shards[mi].index <= idx)
+			lo = mi;
+		else
+			hi = mi;
+	}
+	return o->obj_shards[lo].hash[idx - o->obj_shards[lo].index];
 }
 
 static const char *object_type_strings[] = {
@@ -59,12 +89,50 @@ int type_from_string_gently(const char *str, ssize_t len, int gentle)
 
 /*
  * Return a numerical hash value between 0 and n-1 for the object with
- * the specified sha1.  n must be a power of 2.  Please note that the
- * return value is *not* consistent across computer architectures.
+ * the specified sha1.  n must be a power of 2.  The first byte of the
+ * object name is skipped, as it selects the shard; see obj_shard().
  */
 static unsigned int hash_obj(const struct object_id *oid, unsigned int n)
 {
-	return oidhash(oid) & (n - 1);
+	return get_be32(oid->hash + 1) & (n - 1);
+}
+
+static struct obj_hash_shard *obj_shard(struct parsed_object_pool *o,
+					const struct object_id *oid)
+{
+	return &o->obj_shards[oid->hash[0]];
+}
+
+int parsed_object_use_lock;
+
+void enable_parsed_object_lock(void)
+{
+	if (parsed_object_use_lock)
+		return;
+
+	parsed_object_use_lock = 1;
+	enable_alloc_lock();
+}
+
+void disable_parsed_object_lock(void)
+{
+	if (!parsed_object_use_lock)
+		return;
+
+	parsed_object_use_lock = 0;
+	disable_alloc_lock();
+}
+
+static inline void lock_shard(struct obj_hash_shard *shard)
+{
+	if (parsed_object_use_lock)
+		pthread_mutex_lock(&shard->mutex);
+}
+
+static inline void unlock_shard(struct obj_hash_shard *shard)
+{
+	if (parsed_object_use_lock)
+		pthread_mutex_unlock(&shard->mutex);
 }
 
 /*
@@ -85,23 +153,24 @@ static void insert_obj_hash(struct object *obj, struct object **hash, unsigned i
 }
 
 /*
- * Look up the record for the given sha1 in the hash map stored in
- * obj_hash.  Return NULL if it was not found.
+ * Look up the record for the given sha1 in the shard.  Return NULL if
+ * it was not found.  The caller must hold the lock of the shard.
  */
-struct object *lookup_object(struct repository *r, const struct object_id *oid)
+static struct object *lookup_obj_shard(struct obj_hash_shard *shard,
+				       const struct object_id *oid)
 {
 	unsigned int i, first;
 	struct object *obj;
 
-	if (!r->parsed_objects->obj_hash)
+	if (!shard->hash)
 		return NULL;
 
-	first = i = hash_obj(oid, r->parsed_objects->obj_hash_size);
-	while ((obj = r->parsed_objects->obj_hash[i]) != NULL) {
+	first = i = hash_obj(oid, shard->size);
+	while ((obj = shard->hash[i]) != NULL) {
 		if (oideq(oid, &obj->oid))
 			break;
 		i++;
-		if (i == r->parsed_objects->obj_hash_size)
+		if (i == shard->size)
 			i = 0;
 	}
 	if (obj && i != first) {
@@ -110,54 +179,107 @@ struct object *lookup_object(struct repository *r, const struct object_id *oid)
 		 * that we do not need to walk the hash table the next
 		 * time we look for it.
 		 */
-		SWAP(r->parsed_objects->obj_hash[i],
-		     r->parsed_objects->obj_hash[first]);
+		SWAP(shard->hash[i], shard->hash[first]);
 	}
 	return obj;
 }
 
+struct object *lookup_object(struct repository *r, const struct object_id *oid)
+{
+	struct obj_hash_shard *shard = obj_shard(r->parsed_objects, oid);
+	struct object *obj;
+
+	lock_shard(shard);
+	obj = lookup_obj_shard(shard, oid);
+	unlock_shard(shard);
+	return obj;
+}
+
 /*
- * Increase the size of the hash map stored in obj_hash to the next
- * power of 2 (but at least 32).  Copy the existing values to the new
- * hash map.
+ * Increase the size of the hash map of the shard to the next power
+ * of 2 (but at least 32).  Copy the existing values to the new hash
+ * map.
  */
-static void grow_object_hash(struct repository *r)
+static void grow_obj_shard(struct obj_hash_shard *shard)
 {
-	int i;
+	unsigned int i;
 	/*
 	 * Note that this size must always be power-of-2 to match hash_obj
 	 * above.
 	 */
-	int new_hash_size = r->parsed_objects->obj_hash_size < 32 ? 32 : 2 * r->parsed_objects->obj_hash_size;
+	unsigned int new_hash_size = shard->size < 32 ? 32 : 2 * shard->size;
 	struct object **new_hash;
 
 	CALLOC_ARRAY(new_hash, new_hash_size);
-	for (i = 0; i < r->parsed_objects->obj_hash_size; i++) {
-		struct object *obj = r->parsed_objects->obj_hash[i];
+	for (i = 0; i < shard->size; i++) {
+		struct object *obj = shard->hash[i];
 
 		if (!obj)
 			continue;
 		insert_obj_hash(obj, new_hash, new_hash_size);
 	}
-	free(r->parsed_objects->obj_hash);
-	r->parsed_objects->obj_hash = new_hash;
-	r->parsed_objects->obj_hash_size = new_hash_size;
+	free(shard->hash);
+	shard->hash = new_hash;
+	shard->size = new_hash_size;
 }
 
-void *create_object(struct repository *r, const struct object_id *oid, void *o)
+/* Insert "obj" into "shard" of the pool "o"; the shard must be locked. */
+static void add_obj_shard(struct parsed_object_pool *o,
+			  struct obj_hash_shard *shard,
+			  const struct object_id *oid, struct object *obj)
 {
-	struct object *obj = o;
-
 	obj->parsed = 0;
 	obj->flags = 0;
 	oidcpy(&obj->oid, oid);
 
-	if (r->parsed_objects->obj_hash_size - 1 <= r->parsed_objects->nr_objs * 2)
-		grow_object_hash(r);
+	if (shard->size <= shard->nr * 2 + 1) {
+		grow_obj_shard(shard);
+
+		/* the buckets of the later shards move up */
+		if (parsed_object_use_lock)
+			pthread_mutex_lock(&o->index_mutex);
+		o->index_stale = 1;
+		if (parsed_object_use_lock)
+			pthread_mutex_unlock(&o->index_mutex);
+	}
+
+	insert_obj_hash(obj, shard->hash, shard->size);
+	shard->nr++;
+}
+
+void *create_object(struct repository *r, const struct object_id *oid, void *o)
+{
+	struct obj_hash_shard *shard = obj_shard(r->parsed_objects, oid);
+
+	lock_shard(shard);
+	add_obj_shard(r->parsed_objects, shard, oid, o);
+	unlock_shard(shard);
+	return o;
+}
 
-	insert_obj_hash(obj, r->parsed_objects->obj_hash,
-			r->parsed_objects->obj_hash_size);
-	r->parsed_objects->nr_objs++;
+void *lookup_or_create_object(struct repository *r,
+			      const struct object_id *oid,
+			      enum object_type type,
+			      void *(*alloc_node)(struct repository *))
+{
+	struct obj_hash_shard *shard = obj_shard(r->parsed_objects, oid);
+	struct object *obj;
+
+	/*
+	 * Look up, type check and create the object all under the lock,
+	 * so that racing threads neither create it twice nor see it
+	 * half-way through being turned from OBJ_NONE into its type.
+	 */
+	lock_shard(shard);
+	obj = lookup_obj_shard(shard, oid);
+	if (obj) {
+		if (type != OBJ_NONE)
+			obj = object_as_type(obj, type, 0);
+	} else {
+		obj = alloc_node(r);
+		add_obj_shard(r->parsed_objects, shard, oid, obj);
+	}
+	unlock_shard(shard);
 	return obj;
 }
 
@@ -183,10 +305,7 @@ void *object_as_type(struct object *obj, enum object_type type, int quiet)
 
 struct object *lookup_unknown_object(struct repository *r, const struct object_id *oid)
 {
-	struct object *obj = lookup_object(r, oid);
-	if (!obj)
-		obj = create_object(r, oid, alloc_object_node(r));
-	return obj;
+	return lookup_or_create_object(r, oid, OBJ_NONE, alloc_object_node);
 }
 
 struct object *lookup_object_by_type(struct repository *r,
@@ -486,31 +605,44 @@ void object_array_remove_duplicates(struct object_array *array)
 
 void clear_object_flags(unsigned flags)
 {
-	int i;
+	struct parsed_object_pool *o = the_repository->parsed_objects;
+	unsigned int i, j;
 
-	for (i=0; i < the_repository->parsed_objects->obj_hash_size; i++) {
-		struct object *obj = the_repository->parsed_objects->obj_hash[i];
-		if (obj)
-			obj->flags &= ~flags;
+	for (i = 0; i < OBJ_HASH_SHARDS; i++) {
+		for (j = 0; j < o->obj_shards[i].size; j++) {
+			struct object *obj = o->obj_shards[i].hash[j];
+			if (obj)
+				obj->flags &= ~flags;
+		}
 	}
 }
 
 void repo_clear_commit_marks(struct repository *r, unsigned int flags)
 {
-	int i;
+	struct parsed_object_pool *o = r->parsed_objects;
+	unsigned int i, j;
 
-	for (i = 0; i < r->parsed_objects->obj_hash_size; i++) {
-		struct object *obj = r->parsed_objects->obj_hash[i];
-		if (obj && obj->type == OBJ_COMMIT)
-			obj->flags &= ~flags;
+	for (i = 0; i < OBJ_HASH_SHARDS; i++) {
+		for (j = 0; j < o->obj_shards[i].size; j++) {
+			struct object *obj = o->obj_shards[i].hash[j];
+			if (obj && obj->type == OBJ_COMMIT)
+				obj->flags &= ~flags;
+		}
 	}
 }
 
 struct parsed_object_pool *parsed_object_pool_new(void)
 {
 	struct parsed_object_pool *o = xmalloc(sizeof(*o));
+	int i;
+
 	memset(o, 0, sizeof(*o));
 
+	CALLOC_ARRAY(o->obj_shards, OBJ_HASH_SHARDS);
+	for (i = 0; i < OBJ_HASH_SHARDS; i++)
+		pthread_mutex_init(&o->obj_shards[i].mutex, NULL);
+	pthread_mutex_init(&o->index_mutex, NULL);
+
 	o->blob_state = allocate_alloc_state();
 	o->tree_state = allocate_alloc_state();
 	o->commit_state = allocate_alloc_state();
@@ -588,24 +720,31 @@ void parsed_object_pool_clear(struct parsed_object_pool *o)
 	 * Before doing so, we need to free any additional memory
 	 * the objects may hold.
 	 */
-	unsigned i;
+	unsigned i, j;
 
-	for (i = 0; i < o->obj_hash_size; i++) {
-		struct object *obj = o->obj_hash[i];
+	for (i = 0; i < OBJ_HASH_SHARDS; i++) {
+		struct obj_hash_shard *shard = &o->obj_shards[i];
 
-		if (!obj)
-			continue;
+		for (j = 0; j < shard->size; j++) {
+			struct object *obj = shard->hash[j];
 
-		if (obj->type == OBJ_TREE)
-			free_tree_buffer((struct tree*)obj);
-		else if (obj->type == OBJ_COMMIT)
-			release_commit_memory(o, (struct commit*)obj);
-		else if (obj->type == OBJ_TAG)
-			release_tag_memory((struct tag*)obj);
-	}
+			if (!obj)
+				continue;
+
+			if (obj->type == OBJ_TREE)
+				free_tree_buffer((struct tree*)obj);
+			else if (obj->type == OBJ_COMMIT)
+				release_commit_memory(o, (struct commit*)obj);
+			else if (obj->type == OBJ_TAG)
+				release_tag_memory((struct tag*)obj);
+		}
 
-	FREE_AND_NULL(o->obj_hash);
-	o->obj_hash_size = 0;
+		FREE_AND_NULL(shard->hash);
+		shard->size = shard->nr = 0;
+		pthread_mutex_destroy(&shard->mutex);
+	}
+	FREE_AND_NULL(o->obj_shards);
+	pthread_mutex_destroy(&o->index_mutex);
 
 	free_commit_buffer_slab(o->buffer_slab);
 	o->buffer_slab = NULL;
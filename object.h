@@ -2,13 +2,32 @@
 #define OBJECT_H
 
 #include "hash-ll.h"
+#include "thread-utils.h"
 
 struct buffer_slab;
 struct repository;
 
+/*
+ * The objects of a pool are kept in OBJ_HASH_SHARDS hash tables
+ * selected by the first byte of their names, each growing on its own,
+ * so that threads using the pool at the same time rarely wait for each
+ * other (see enable_parsed_object_lock()).
+ */
+#define OBJ_HASH_SHARDS 256
+
+struct obj_hash_shard {
+	struct object **hash;
+	unsigned int size, nr;
+	/* first index of this shard for get_indexed_object() */
+	unsigned int index;
+	pthread_mutex_t mutex;
+};
+
 struct parsed_object_pool {
-	struct object **obj_hash;
-	int nr_objs, obj_hash_size;
+	struct obj_hash_shard *obj_shards;
+	/* a shard grew since get_max_object_index() numbered them */
+	int index_stale;
+	pthread_mutex_t index_mutex;
 
 	/* TODO: migrate alloc_states to mem-pool? */
 	struct alloc_state *blob_state;
@@ -169,9 +188,31 @@ unsigned int get_max_object_index(void);
 
 /*
  * Return the object from the specified bucket in the object hashmap.
+ * The buckets are renumbered first if objects were added since the
+ * last call to get_max_object_index(), as they may have moved.
  */
 struct object *get_indexed_object(unsigned int);
 
+/*
+ * By default, the parsed object pools may only be used by one thread at
+ * a time. After enable_parsed_object_lock(), lookup_object(),
+ * lookup_or_create_object() and the lookup_<type>() and
+ * alloc_<type>_node() functions built on them may be called from
+ * several threads at once; a thread that loses the race to create an
+ * object gets the one the other thread created. Each shard has its own
+ * lock, so threads only wait for each other when they happen to use the
+ * same shard.
+ *
+ * This only protects the tables themselves: the callers still have to
+ * make sure that the same object is not parsed or its flags modified by
+ * several threads at once. Iterating over the pool with
+ * get_max_object_index() and get_indexed_object() must only be done
+ * while no other thread is using it.
+ */
+extern int parsed_object_use_lock;
+void enable_parsed_object_lock(void);
+void disable_parsed_object_lock(void);
+
 /*
  * This can be used to see if we have heard of the object before, but
  * it can return "yes we have, and here is a half-initialised object"
@@ -186,8 +227,24 @@ struct object *get_indexed_object(unsigned int);
  */
 struct object *lookup_object(struct repository *r, const struct object_id *oid);
 
+/*
+ * Add the freshly allocated "obj" to the pool as "oid", even if there
+ * already is an object of that name. Use lookup_or_create_object()
+ * unless you really want such a separate copy.
+ */
 void *create_object(struct repository *r, const struct object_id *oid, void *obj);
 
+/*
+ * Return the object "oid" from the pool as "type", or NULL (with an
+ * error) if it is there already as another type. If it is not there
+ * yet, it is created with a node from "alloc_node". With OBJ_NONE, the
+ * object is returned whatever its type.
+ */
+void *lookup_or_create_object(struct repository *r,
+			      const struct object_id *oid,
+			      enum object_type type,
+			      void *(*alloc_node)(struct repository *));
+
 void *object_as_type(struct object *obj, enum object_type type, int quiet);
 
 /*
@@ -1,4 +1,5 @@
 #include "git-compat-util.h"
+#include "config.h"
 #include "environment.h"
 #include "gettext.h"
 #include "hex.h"
@@ -10,6 +11,7 @@
 #include "list-objects.h"
 #include "progress.h"
 #include "pack-revindex.h"
+#include "refs.h"
 #include "pack.h"
 #include "pack-bitmap.h"
 #include "hash-lookup.h"
@@ -30,6 +32,18 @@ struct bitmapped_commit {
 	uint32_t commit_pos;
 };
 
+/*
+ * A group of ref tips whose reachability bitmaps are stored as one
+ * union, so that queries for all of them can skip OR-ing (or walking)
+ * each of them.
+ */
+struct tip_union {
+	struct commit **tips;
+	size_t tips_nr;
+	struct ewah_bitmap *commits;
+	struct ewah_bitmap *bitmap;
+};
+
 struct bitmap_writer {
 	struct ewah_bitmap *commits;
 	struct ewah_bitmap *trees;
@@ -42,9 +56,15 @@ struct bitmap_writer {
 	struct bitmapped_commit *selected;
 	unsigned int selected_nr, selected_alloc;
 
+	struct tip_union *tip_unions;
+	unsigned int tip_unions_nr;
+
 	struct progress *progress;
 	int show_progress;
 	unsigned char pack_checksum[GIT_MAX_RAWSZ];
+
+	/* if set, the bitmaps to reuse instead of the repository's */
+	struct bitmap_index *reuse;
 };
 
 static struct bitmap_writer writer;
@@ -469,6 +489,190 @@ static void store_selected(struct bb_commit *ent, struct commit *commit)
 	kh_value(writer.bitmaps, hash_pos) = stored;
 }
 
+struct tip_union_tips {
+	struct repository *repo;
+	timestamp_t threshold;
+	struct commit **tips;
+	size_t nr, alloc;
+};
+
+static int add_tip_union_tip(const char *refname UNUSED,
+			     const struct object_id *oid,
+			     int flags UNUSED, void *data)
+{
+	struct tip_union_tips *tut = data;
+	struct object_id peeled;
+	struct commit *commit;
+
+	if (!peel_iterated_oid(oid, &peeled))
+		oid = &peeled;
+	if (!packlist_find(writer.to_pack, oid))
+		return 0;
+	commit = lookup_commit_reference_gently(tut->repo, oid, 1);
+	if (!commit || commit->date > tut->threshold)
+		return 0;
+
+	ALLOC_GROW(tut->tips, tut->nr + 1, tut->alloc);
+	tut->tips[tut->nr++] = commit;
+	return 0;
+}
+
+static int tip_union_tip_cmp(const void *_a, const void *_b)
+{
+	struct commit *a = *(struct commit **)_a;
+	struct commit *b = *(struct commit **)_b;
+
+	if (a->date != b->date)
+		return a->date < b->date ? -1 : 1;
+	return oidcmp(&a->object.oid, &b->object.oid);
+}
+
+/*
+ * Group the ref tips that are older than pack.bitmapTipUnionThreshold
+ * by age, pack.bitmapTipUnionSize tips at a time (or more, to stay
+ * within pack.bitmapTipUnions groups). Recently updated refs are
+ * left out, as they would make the groups go stale with every push.
+ */
+static void select_tip_unions(struct repository *r)
+{
+	struct tip_union_tips tut = { .repo = r };
+	const char *threshold = "1.week.ago";
+	int max = 0, size = 64;
+	size_t i, j, per_group;
+
+	repo_config_get_int(r, "pack.bitmaptipunions", &max);
+	repo_config_get_int(r, "pack.bitmaptipunionsize", &size);
+	repo_config_get_string_tmp(r, "pack.bitmaptipunionthreshold",
+				   &threshold);
+	if (max <= 0)
+		return;
+	if (size < 2)
+		size = 2;
+	if (parse_expiry_date(threshold, &tut.threshold))
+		die(_("invalid value for '%s': '%s'"),
+		    "pack.bitmapTipUnionThreshold", threshold);
+
+	refs_for_each_ref(get_main_ref_store(r), add_tip_union_tip, &tut);
+
+	QSORT(tut.tips, tut.nr, tip_union_tip_cmp);
+	for (i = j = 0; i < tut.nr; i++)
+		if (!j || tut.tips[j - 1] != tut.tips[i])
+			tut.tips[j++] = tut.tips[i];
+	tut.nr = j;
+	if (tut.nr < 2)
+		goto out;
+
+	per_group = DIV_ROUND_UP(tut.nr, max);
+	if (per_group < size)
+		per_group = size;
+
+	CALLOC_ARRAY(writer.tip_unions, DIV_ROUND_UP(tut.nr, per_group));
+	for (i = 0; i < tut.nr; i += per_group) {
+		struct tip_union *tu = &writer.tip_unions[writer.tip_unions_nr++];
+
+		tu->tips_nr = tut.nr - i < per_group ? tut.nr - i : per_group;
+		ALLOC_ARRAY(tu->tips, tu->tips_nr);
+		COPY_ARRAY(tu->tips, tut.tips + i, tu->tips_nr);
+	}
+
+out:
+	free(tut.tips);
+}
+
+/*
+ * Like fill_bitmap_commit(), but for several tips at once, and using the
+ * bitmaps of the selected commits where the walk reaches them.
+ */
+static int fill_tip_union(struct tip_union *tu,
+			  struct bitmap *commits,
+			  struct bitmap *bitmap,
+			  struct prio_queue *queue,
+			  struct prio_queue *tree_queue)
+{
+	int found;
+	uint32_t pos;
+	size_t i;
+
+	for (i = 0; i < tu->tips_nr; i++) {
+		pos = find_object_pos(&tu->tips[i]->object.oid, &found);
+		if (!found)
+			return -1;
+		bitmap_set(commits, pos);
+		if (!bitmap_get(bitmap, pos)) {
+			bitmap_set(bitmap, pos);
+			prio_queue_put(queue, tu->tips[i]);
+		}
+	}
+
+	while (queue->nr) {
+		struct commit_list *p;
+		struct commit *c = prio_queue_get(queue);
+		khiter_t hash_pos = kh_get_oid_map(writer.bitmaps, c->object.oid);
+
+		if (hash_pos < kh_end(writer.bitmaps)) {
+			struct bitmapped_commit *stored = kh_value(writer.bitmaps, hash_pos);
+			bitmap_or_ewah(bitmap, stored->bitmap);
+			continue;
+		}
+
+		parse_commit_or_die(c);
+		prio_queue_put(tree_queue,
+			       repo_get_commit_tree(the_repository, c));
+
+		for (p = c->parents; p; p = p->next) {
+			pos = find_object_pos(&p->item->object.oid, &found);
+			if (!found)
+				return -1;
+			if (!bitmap_get(bitmap, pos)) {
+				bitmap_set(bitmap, pos);
+				prio_queue_put(queue, p->item);
+			}
+		}
+	}
+
+	while (tree_queue->nr) {
+		if (fill_bitmap_tree(bitmap, prio_queue_get(tree_queue)) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+static int build_tip_unions(struct repository *r)
+{
+	struct prio_queue queue = { compare_commits_by_gen_then_commit_date };
+	struct prio_queue tree_queue = { NULL };
+	unsigned int i;
+	int ret = 0;
+
+	select_tip_unions(r);
+	if (!writer.tip_unions_nr)
+		return 0;
+
+	trace2_region_enter("pack-bitmap-write", "building_tip_unions", r);
+	for (i = 0; i < writer.tip_unions_nr; i++) {
+		struct tip_union *tu = &writer.tip_unions[i];
+		struct bitmap *commits = bitmap_new();
+		struct bitmap *bitmap = bitmap_new();
+
+		ret = fill_tip_union(tu, commits, bitmap, &queue, &tree_queue);
+		if (!ret) {
+			tu->commits = bitmap_to_ewah(commits);
+			tu->bitmap = bitmap_to_ewah(bitmap);
+		}
+		bitmap_free(commits);
+		bitmap_free(bitmap);
+		if (ret < 0)
+			break;
+	}
+	clear_prio_queue(&queue);
+	clear_prio_queue(&tree_queue);
+	trace2_data_intmax("pack-bitmap-write", r,
+			   "num_tip_unions", writer.tip_unions_nr);
+	trace2_region_leave("pack-bitmap-write", "building_tip_unions", r);
+
+	return ret;
+}
+
 int bitmap_writer_build(struct packing_data *to_pack)
 {
 	struct bitmap_builder bb;
@@ -488,7 +692,12 @@ int bitmap_writer_build(struct packing_data *to_pack)
 	trace2_region_enter("pack-bitmap-write", "building_bitmaps_total",
 			    the_repository);
 
-	old_bitmap = prepare_bitmap_git(to_pack->repo);
+	if (writer.reuse) {
+		old_bitmap = writer.reuse;
+		writer.reuse = NULL;
+	} else {
+		old_bitmap = prepare_bitmap_git(to_pack->repo);
+	}
 	if (old_bitmap)
 		mapping = create_bitmap_mapping(old_bitmap, to_pack);
 	else
@@ -543,11 +752,20 @@ int bitmap_writer_build(struct packing_data *to_pack)
 
 	stop_progress(&writer.progress);
 
-	if (closed)
+	if (closed) {
 		compute_xor_offsets();
+		if (build_tip_unions(to_pack->repo) < 0)
+			closed = 0;
+	}
 	return closed ? 0 : -1;
 }
 
+void bitmap_writer_reuse_bitmaps(struct bitmap_index *bitmap_git)
+{
+	free_bitmap_index(writer.reuse);
+	writer.reuse = bitmap_git;
+}
+
 /**
  * Select the commits that will be bitmapped
  */
@@ -662,6 +880,48 @@ static const struct object_id *oid_access(size_t pos, const void *table)
 	return &index[pos]->oid;
 }
 
+/*
+ * The index of an incremental MIDX chain is sorted by object name only
+ * within each of its layers. To look up commits in it, we go through a
+ * permutation that sorts the whole index.
+ */
+struct index_order {
+	struct pack_idx_entry **index;
+	uint32_t *order;
+};
+
+static const struct object_id *ordered_oid_access(size_t pos, const void *table)
+{
+	const struct index_order *o = table;
+	return &o->index[o->order[pos]]->oid;
+}
+
+static int index_order_cmp(const void *va, const void *vb, void *data)
+{
+	struct pack_idx_entry **index = data;
+	return oidcmp(&index[*(const uint32_t *)va]->oid,
+		      &index[*(const uint32_t *)vb]->oid);
+}
+
+static uint32_t *sorted_index_order(struct pack_idx_entry **index,
+				    uint32_t index_nr)
+{
+	uint32_t *order;
+	uint32_t i;
+
+	for (i = 1; i < index_nr; i++)
+		if (oidcmp(&index[i - 1]->oid, &index[i]->oid) > 0)
+			break;
+	if (i >= index_nr)
+		return NULL;
+
+	ALLOC_ARRAY(order, index_nr);
+	for (i = 0; i < index_nr; i++)
+		order[i] = i;
+	QSORT_S(order, index_nr, index_order_cmp, index);
+	return order;
+}
+
 static void write_selected_commits_v1(struct hashfile *f,
 				      uint32_t *commit_positions,
 				      off_t *offsets)
@@ -755,6 +1015,27 @@ static void write_lookup_table(struct hashfile *f,
 	free(table_inv);
 }
 
+static void write_tip_unions(struct hashfile *f)
+{
+	off_t start = hashfile_total(f);
+	off_t *offsets;
+	unsigned int i;
+
+	ALLOC_ARRAY(offsets, writer.tip_unions_nr);
+	for (i = 0; i < writer.tip_unions_nr; i++) {
+		offsets[i] = hashfile_total(f);
+		dump_bitmap(f, writer.tip_unions[i].commits);
+		dump_bitmap(f, writer.tip_unions[i].bitmap);
+	}
+	for (i = 0; i < writer.tip_unions_nr; i++)
+		hashwrite_be64(f, (uint64_t)offsets[i]);
+	hashwrite_be32(f, writer.tip_unions_nr);
+	hashwrite_be32(f, BITMAP_TIP_UNIONS_VERSION);
+	hashwrite_be64(f, (uint64_t)(hashfile_total(f) + sizeof(uint64_t) - start));
+
+	free(offsets);
+}
+
 static void write_hash_cache(struct hashfile *f,
 			     struct pack_idx_entry **index,
 			     uint32_t index_nr)
@@ -783,12 +1064,16 @@ void bitmap_writer_finish(struct pack_idx_entry **index,
 	struct hashfile *f;
 	uint32_t *commit_positions = NULL;
 	off_t *offsets = NULL;
+	struct index_order order = { index, NULL };
 	uint32_t i;
 
 	struct bitmap_disk_header header;
 
 	int fd = odb_mkstemp(&tmp_file, "pack/tmp_bitmap_XXXXXX");
 
+	if (writer.tip_unions_nr)
+		options |= BITMAP_OPT_TIP_UNIONS;
+
 	f = hashfd(fd, tmp_file.buf);
 
 	memcpy(header.magic, BITMAP_IDX_SIGNATURE, sizeof(BITMAP_IDX_SIGNATURE));
@@ -807,19 +1092,34 @@ void bitmap_writer_finish(struct pack_idx_entry **index,
 		CALLOC_ARRAY(offsets, index_nr);
 
 	ALLOC_ARRAY(commit_positions, writer.selected_nr);
+	order.order = sorted_index_order(index, index_nr);
 
 	for (i = 0; i < writer.selected_nr; i++) {
 		struct bitmapped_commit *stored = &writer.selected[i];
-		int commit_pos = oid_pos(&stored->commit->object.oid, index, index_nr, oid_access);
+		int commit_pos;
+
+		if (order.order) {
+			commit_pos = oid_pos(&stored->commit->object.oid, &order,
+					     index_nr, ordered_oid_access);
+			if (commit_pos >= 0)
+				commit_pos = order.order[commit_pos];
+		} else {
+			commit_pos = oid_pos(&stored->commit->object.oid, index,
+					     index_nr, oid_access);
+		}
 
 		if (commit_pos < 0)
 			BUG(_("trying to write commit not in index"));
 
 		commit_positions[i] = commit_pos;
 	}
+	free(order.order);
 
 	write_selected_commits_v1(f, commit_positions, offsets);
 
+	if (options & BITMAP_OPT_TIP_UNIONS)
+		write_tip_unions(f);
+
 	if (options & BITMAP_OPT_LOOKUP_TABLE)
 		write_lookup_table(f, commit_positions, offsets);
 
@@ -32,6 +32,19 @@ struct stored_bitmap {
 	int flags;
 };
 
+/*
+ * A tip union: the union of the reachability bitmaps of a group of
+ * ref tips (see the tip union extension in gitformat-bitmap(5)).
+ */
+struct tip_union {
+	/* the tips themselves */
+	struct bitmap *commits;
+
+	/* everything reachable from them; read when first needed */
+	struct ewah_bitmap *bitmap;
+	size_t bitmap_pos;
+};
+
 /*
  * The active bitmap index for a repository. By design, repositories only have
  * a single bitmap index available (the index for the biggest packfile in
@@ -93,6 +106,14 @@ struct bitmap_index {
 	 */
 	unsigned char *table_lookup;
 
+	/*
+	 * If not NULL, this points to the offsets of the tip unions
+	 * (within the memory mapped region `map`).
+	 */
+	unsigned char *tip_union_table;
+	struct tip_union *tip_unions;
+	uint32_t tip_unions_nr;
+
 	/*
 	 * Extended index.
 	 *
@@ -115,6 +136,13 @@ struct bitmap_index {
 
 	/* Version of the bitmap index */
 	unsigned int version;
+
+	/*
+	 * For a layer of an incremental MIDX chain, the bitmap of the
+	 * topmost layer below it that has one. Commits without a bitmap
+	 * in this layer are looked up there.
+	 */
+	struct bitmap_index *base;
 };
 
 static struct ewah_bitmap *lookup_stored_bitmap(struct stored_bitmap *st)
@@ -161,7 +189,8 @@ static struct ewah_bitmap *read_bitmap_1(struct bitmap_index *index)
 static uint32_t bitmap_num_objects(struct bitmap_index *index)
 {
 	if (index->midx)
-		return index->midx->num_objects;
+		return index->midx->num_objects_in_base +
+			index->midx->num_objects;
 	return index->pack->num_objects;
 }
 
@@ -206,6 +235,28 @@ static int load_bitmap_header(struct bitmap_index *index)
 				index->table_lookup = (void *)(index_end - table_size);
 			index_end -= table_size;
 		}
+
+		if (flags & BITMAP_OPT_TIP_UNIONS) {
+			const size_t trailer_size = 2 * sizeof(uint32_t) + sizeof(uint64_t);
+			size_t ext_size, table_size;
+			uint32_t nr, version;
+
+			if (trailer_size > index_end - index->map - header_size)
+				return error(_("corrupted bitmap index file (too short to fit tip unions)"));
+			ext_size = get_be64(index_end - sizeof(uint64_t));
+			version = get_be32(index_end - sizeof(uint64_t) - sizeof(uint32_t));
+			nr = get_be32(index_end - trailer_size);
+			table_size = st_mult(nr, sizeof(uint64_t));
+			if (ext_size > index_end - index->map - header_size ||
+			    st_add(table_size, trailer_size) > ext_size)
+				return error(_("corrupted bitmap index file (too short to fit tip unions)"));
+			/* The extension is optional; skip versions we do not know. */
+			if (version == BITMAP_TIP_UNIONS_VERSION) {
+				index->tip_unions_nr = nr;
+				index->tip_union_table = index_end - trailer_size - table_size;
+			}
+			index_end -= ext_size;
+		}
 	}
 
 	index->entry_count = ntohl(header->entry_count);
@@ -317,8 +368,7 @@ char *midx_bitmap_filename(struct multi_pack_index *midx)
 {
 	struct strbuf buf = STRBUF_INIT;
 
-	get_midx_filename(&buf, midx->object_dir);
-	strbuf_addf(&buf, "-%s.bitmap", hash_to_hex(get_midx_checksum(midx)));
+	get_midx_filename_ext(&buf, midx, ".bitmap");
 
 	return strbuf_detach(&buf, NULL);
 }
@@ -385,15 +435,16 @@ static int open_midx_bitmap_1(struct bitmap_index *bitmap_git,
 		goto cleanup;
 	}
 
-	for (i = 0; i < bitmap_git->midx->num_packs; i++) {
+	for (i = 0; i < midx_num_packs(bitmap_git->midx); i++) {
 		if (prepare_midx_pack(the_repository, bitmap_git->midx, i)) {
 			warning(_("could not open pack %s"),
-				bitmap_git->midx->pack_names[i]);
+				nth_midxed_pack_name(bitmap_git->midx, i));
 			goto cleanup;
 		}
 	}
 
-	preferred = bitmap_git->midx->packs[midx_preferred_pack(bitmap_git)];
+	preferred = nth_midxed_pack(bitmap_git->midx,
+				    midx_preferred_pack(bitmap_git));
 	if (!is_pack_valid(preferred)) {
 		warning(_("preferred pack (%s) is invalid"),
 			preferred->pack_name);
@@ -466,6 +517,60 @@ static int open_pack_bitmap_1(struct bitmap_index *bitmap_git, struct packed_git
 	return 0;
 }
 
+/*
+ * Read the bitmap at "*pos" and advance "*pos" past it, without
+ * disturbing the sequential reading of the bitmap entries.
+ */
+static struct ewah_bitmap *read_bitmap_at(struct bitmap_index *index,
+					  size_t *pos)
+{
+	size_t saved_pos = index->map_pos;
+	struct ewah_bitmap *bitmap;
+
+	if (*pos >= index->map_size) {
+		error(_("corrupt ewah bitmap: offset %"PRIuMAX" out of range"),
+		      (uintmax_t)*pos);
+		return NULL;
+	}
+	index->map_pos = *pos;
+	bitmap = read_bitmap_1(index);
+	*pos = index->map_pos;
+	index->map_pos = saved_pos;
+	return bitmap;
+}
+
+static int load_tip_unions(struct bitmap_index *index)
+{
+	uint32_t i;
+
+	if (!index->tip_union_table)
+		return 0;
+
+	CALLOC_ARRAY(index->tip_unions, index->tip_unions_nr);
+	for (i = 0; i < index->tip_unions_nr; i++) {
+		struct tip_union *tu = &index->tip_unions[i];
+		size_t pos = get_be64(index->tip_union_table +
+				      st_mult(i, sizeof(uint64_t)));
+		struct ewah_bitmap *commits = read_bitmap_at(index, &pos);
+
+		if (!commits)
+			return -1;
+		tu->commits = ewah_to_bitmap(commits);
+		/* the merged bitmap directly follows the commits */
+		tu->bitmap_pos = pos;
+		ewah_pool_free(commits);
+	}
+	return 0;
+}
+
+static struct ewah_bitmap *tip_union_bitmap(struct bitmap_index *index,
+					    struct tip_union *tu)
+{
+	if (!tu->bitmap)
+		tu->bitmap = read_bitmap_at(index, &tu->bitmap_pos);
+	return tu->bitmap;
+}
+
 static int load_reverse_index(struct repository *r, struct bitmap_index *bitmap_git)
 {
 	if (bitmap_is_midx(bitmap_git)) {
@@ -479,8 +584,8 @@ static int load_reverse_index(struct repository *r, struct bitmap_index *bitmap_
 		 * But we still need to open the individual pack .rev files,
 		 * since we will need to make use of them in pack-objects.
 		 */
-		for (i = 0; i < bitmap_git->midx->num_packs; i++) {
-			ret = load_pack_revindex(r, bitmap_git->midx->packs[i]);
+		for (i = 0; i < midx_num_packs(bitmap_git->midx); i++) {
+			ret = load_pack_revindex(r, nth_midxed_pack(bitmap_git->midx, i));
 			if (ret)
 				return ret;
 		}
@@ -505,9 +610,20 @@ static int load_bitmap(struct repository *r, struct bitmap_index *bitmap_git)
 		!(bitmap_git->tags = read_bitmap_1(bitmap_git)))
 		goto failed;
 
+	if (load_tip_unions(bitmap_git) < 0)
+		goto failed;
+
 	if (!bitmap_git->table_lookup && load_bitmap_entries_v1(bitmap_git) < 0)
 		goto failed;
 
+	if (bitmap_git->midx) {
+		struct multi_pack_index *m;
+
+		for (m = bitmap_git->midx->base_midx;
+		     m && !bitmap_git->base; m = m->base_midx)
+			bitmap_git->base = prepare_midx_bitmap_git(m);
+	}
+
 	return 0;
 
 failed:
@@ -847,15 +963,16 @@ struct ewah_bitmap *bitmap_for_commit(struct bitmap_index *bitmap_git,
 					   commit->object.oid);
 	if (hash_pos >= kh_end(bitmap_git->bitmaps)) {
 		struct stored_bitmap *bitmap = NULL;
-		if (!bitmap_git->table_lookup)
-			return NULL;
-
-		/* this is a fairly hot codepath - no trace2_region please */
-		/* NEEDSWORK: cache misses aren't recorded */
-		bitmap = lazy_bitmap_for_commit(bitmap_git, commit);
-		if (!bitmap)
-			return NULL;
-		return lookup_stored_bitmap(bitmap);
+		if (bitmap_git->table_lookup) {
+			/* this is a fairly hot codepath - no trace2_region please */
+			/* NEEDSWORK: cache misses aren't recorded */
+			bitmap = lazy_bitmap_for_commit(bitmap_git, commit);
+		}
+		if (bitmap)
+			return lookup_stored_bitmap(bitmap);
+		if (bitmap_git->base)
+			return bitmap_for_commit(bitmap_git->base, commit);
+		return NULL;
 	}
 	return lookup_stored_bitmap(kh_value(bitmap_git->bitmaps, hash_pos));
 }
@@ -1199,6 +1316,63 @@ static struct bitmap *find_boundary_objects(struct bitmap_index *bitmap_git,
 	return cb.base;
 }
 
+/*
+ * OR into "base" the tip unions all of whose tips are among "roots"
+ * or already reachable from "base". This is repeated as long as it
+ * makes more tip unions apply.
+ */
+static struct bitmap *apply_tip_unions(struct bitmap_index *bitmap_git,
+				       struct bitmap *base,
+				       struct object_list *roots)
+{
+	struct bitmap *tips;
+	unsigned char *applied;
+	uint32_t i, nr_applied = 0;
+	int changed;
+
+	if (!bitmap_git->tip_unions_nr)
+		return base;
+
+	tips = base ? bitmap_dup(base) : bitmap_new();
+	for (; roots; roots = roots->next) {
+		int pos = bitmap_position(bitmap_git, &roots->item->oid);
+		if (pos >= 0)
+			bitmap_set(tips, pos);
+	}
+
+	CALLOC_ARRAY(applied, bitmap_git->tip_unions_nr);
+	do {
+		changed = 0;
+		for (i = 0; i < bitmap_git->tip_unions_nr; i++) {
+			struct tip_union *tu = &bitmap_git->tip_unions[i];
+			struct ewah_bitmap *merged;
+
+			/* bitmap_is_subset() returns 0 for subsets */
+			if (applied[i] || bitmap_is_subset(tu->commits, tips))
+				continue;
+			applied[i] = 1;
+
+			merged = tip_union_bitmap(bitmap_git, tu);
+			if (!merged)
+				continue;
+			if (!base)
+				base = ewah_to_bitmap(merged);
+			else
+				bitmap_or_ewah(base, merged);
+			bitmap_or_ewah(tips, merged);
+			nr_applied++;
+			changed = 1;
+		}
+	} while (changed);
+
+	trace2_data_intmax("bitmap", the_repository, "tip_unions_applied",
+			   nr_applied);
+
+	free(applied);
+	bitmap_free(tips);
+	return base;
+}
+
 static struct bitmap *find_objects(struct bitmap_index *bitmap_git,
 				   struct rev_info *revs,
 				   struct object_list *roots,
@@ -1237,6 +1411,12 @@ static struct bitmap *find_objects(struct bitmap_index *bitmap_git,
 	if (!not_mapped)
 		return base;
 
+	/*
+	 * Many of the remaining roots may be covered by tip unions,
+	 * which saves walking from each of them.
+	 */
+	base = apply_tip_unions(bitmap_git, base, not_mapped);
+
 	roots = not_mapped;
 
 	/*
@@ -1377,7 +1557,7 @@ static void show_objects_for_type(
 				nth_midxed_object_oid(&oid, m, index_pos);
 
 				pack_id = nth_midxed_pack_int_id(m, index_pos);
-				pack = bitmap_git->midx->packs[pack_id];
+				pack = nth_midxed_pack(bitmap_git->midx, pack_id);
 			} else {
 				index_pos = pack_pos_to_index(bitmap_git->pack, pos + offset);
 				ofs = pack_pos_to_offset(bitmap_git->pack, pos + offset);
@@ -1507,7 +1687,7 @@ static unsigned long get_size_by_pos(struct bitmap_index *bitmap_git,
 			uint32_t midx_pos = pack_pos_to_midx(bitmap_git->midx, pos);
 			uint32_t pack_id = nth_midxed_pack_int_id(bitmap_git->midx, midx_pos);
 
-			pack = bitmap_git->midx->packs[pack_id];
+			pack = nth_midxed_pack(bitmap_git->midx, pack_id);
 			ofs = nth_midxed_offset(bitmap_git->midx, midx_pos);
 		} else {
 			pack = bitmap_git->pack;
@@ -1804,52 +1984,33 @@ struct bitmap_index *prepare_bitmap_walk(struct rev_info *revs,
 }
 
 /*
- * -1 means "stop trying further objects"; 0 means we may or may not have
- * reused, but you can keep feeding bits.
+ * -1 means "stop trying further objects from this pack"; 0 means we may
+ * or may not have reused, but you can keep feeding bits.
  */
-static int try_partial_reuse(struct packed_git *pack,
-			     size_t pos,
+static int try_partial_reuse(struct bitmap_index *bitmap_git,
+			     struct bitmapped_pack *pack,
+			     size_t bitmap_pos,
+			     uint32_t pack_pos,
+			     off_t offset,
 			     struct bitmap *reuse,
 			     struct pack_window **w_curs)
 {
-	off_t offset, delta_obj_offset;
+	off_t delta_obj_offset;
 	enum object_type type;
 	unsigned long size;
 
-	/*
-	 * try_partial_reuse() is called either on (a) objects in the
-	 * bitmapped pack (in the case of a single-pack bitmap) or (b)
-	 * objects in the preferred pack of a multi-pack bitmap.
-	 * Importantly, the latter can pretend as if only a single pack
-	 * exists because:
-	 *
-	 *   - The first pack->num_objects bits of a MIDX bitmap are
-	 *     reserved for the preferred pack, and
-	 *
-	 *   - Ties due to duplicate objects are always resolved in
-	 *     favor of the preferred pack.
-	 *
-	 * Therefore we do not need to ever ask the MIDX for its copy of
-	 * an object by OID, since it will always select it from the
-	 * preferred pack. Likewise, the selected copy of the base
-	 * object for any deltas will reside in the same pack.
-	 *
-	 * This means that we can reuse pos when looking up the bit in
-	 * the reuse bitmap, too, since bits corresponding to the
-	 * preferred pack precede all bits from other packs.
-	 */
-
-	if (pos >= pack->num_objects)
-		return -1; /* not actually in the pack or MIDX preferred pack */
+	if (pack_pos >= pack->p->num_objects)
+		return -1; /* not actually in the pack */
 
-	offset = delta_obj_offset = pack_pos_to_offset(pack, pos);
-	type = unpack_object_header(pack, w_curs, &offset, &size);
+	delta_obj_offset = offset;
+	type = unpack_object_header(pack->p, w_curs, &offset, &size);
 	if (type < 0)
 		return -1; /* broken packfile, punt */
 
 	if (type == OBJ_REF_DELTA || type == OBJ_OFS_DELTA) {
 		off_t base_offset;
 		uint32_t base_pos;
+		uint32_t base_bitmap_pos;
 
 		/*
 		 * Find the position of the base object so we can look it up
@@ -1859,13 +2020,38 @@ static int try_partial_reuse(struct packed_git *pack,
 		 * and the normal slow path will complain about it in
 		 * more detail.
 		 */
-		base_offset = get_delta_base(pack, w_curs, &offset, type,
+		base_offset = get_delta_base(pack->p, w_curs, &offset, type,
 					     delta_obj_offset);
 		if (!base_offset)
 			return 0;
-		if (offset_to_pack_pos(pack, base_offset, &base_pos) < 0)
+		if (offset_to_pack_pos(pack->p, base_offset, &base_pos) < 0)
 			return 0;
 
+		if (!bitmap_is_midx(bitmap_git) ||
+		    pack->bitmap_nr == pack->p->num_objects) {
+			base_bitmap_pos = pack->bitmap_pos + base_pos;
+		} else if (midx_pair_to_pack_pos(bitmap_git->midx,
+						 pack->pack_int_id,
+						 base_offset,
+						 &base_bitmap_pos) < 0) {
+			/*
+			 * The MIDX selected a copy of the base from
+			 * another pack. That is fine as long as that copy
+			 * is sent before us: the writer then points the
+			 * delta at it (see write_reused_pack_one() in
+			 * pack-objects).
+			 */
+			struct object_id base_oid;
+			int found;
+
+			nth_packed_object_id(&base_oid, pack->p,
+					     pack_pos_to_index(pack->p, base_pos));
+			found = bitmap_position_midx(bitmap_git, &base_oid);
+			if (found < 0)
+				return 0;
+			base_bitmap_pos = found;
+		}
+
 		/*
 		 * We assume delta dependencies always point backwards. This
 		 * lets us do a single pass, and is basically always true
@@ -1875,7 +2061,7 @@ static int try_partial_reuse(struct packed_git *pack,
 		 * let's double check to make sure the pack wasn't written with
 		 * odd parameters.
 		 */
-		if (base_pos >= pos)
+		if (base_bitmap_pos >= bitmap_pos)
 			return 0;
 
 		/*
@@ -1886,14 +2072,102 @@ static int try_partial_reuse(struct packed_git *pack,
 		 * to REF_DELTA on the fly. Better to just let the normal
 		 * object_entry code path handle it.
 		 */
-		if (!bitmap_get(reuse, base_pos))
+		if (!bitmap_get(reuse, base_bitmap_pos))
 			return 0;
 	}
 
 	/*
 	 * If we got here, then the object is OK to reuse. Mark it.
 	 */
-	bitmap_set(reuse, pos);
+	bitmap_set(reuse, bitmap_pos);
+	return 0;
+}
+
+static void reuse_partial_packfile_from_bitmap_1(struct bitmap_index *bitmap_git,
+						 struct bitmapped_pack *pack,
+						 struct bitmap *reuse)
+{
+	struct bitmap *result = bitmap_git->result;
+	struct pack_window *w_curs = NULL;
+	size_t pos = pack->bitmap_pos;
+	size_t end = st_add(pack->bitmap_pos, pack->bitmap_nr);
+
+	/*
+	 * A pack whose objects were all selected (a single-pack bitmap,
+	 * or the preferred pack of a MIDX) starts at bit zero and has
+	 * the bases of all of its deltas. Any leading run of objects
+	 * that are all wanted can be reused without looking at them.
+	 */
+	if (!pack->bitmap_pos && pack->bitmap_nr == pack->p->num_objects) {
+		size_t i = 0, limit = pack->bitmap_nr / BITS_IN_EWORD;
+
+		while (i < result->word_alloc && i < limit &&
+		       result->words[i] == (eword_t)~0)
+			reuse->words[i++] = (eword_t)~0;
+		pos = i * BITS_IN_EWORD;
+	}
+
+	for (; pos < end; pos++) {
+		size_t i = pos / BITS_IN_EWORD;
+		uint32_t pack_pos;
+		off_t offset;
+		eword_t word;
+
+		if (i >= result->word_alloc)
+			break;
+
+		word = result->words[i] >> (pos % BITS_IN_EWORD);
+		if (!word) {
+			/* move on to the first bit of the next word */
+			pos = (i + 1) * BITS_IN_EWORD - 1;
+			continue;
+		}
+		pos += ewah_bit_ctz64(word);
+		if (pos >= end)
+			break;
+
+		/*
+		 * Unless the MIDX selected all objects of the pack, bit
+		 * positions have to be translated back to pack positions.
+		 */
+		if (bitmap_is_midx(bitmap_git) &&
+		    pack->bitmap_nr != pack->p->num_objects) {
+			uint32_t midx_pos = pack_pos_to_midx(bitmap_git->midx, pos);
+
+			offset = nth_midxed_offset(bitmap_git->midx, midx_pos);
+			if (offset_to_pack_pos(pack->p, offset, &pack_pos) < 0)
+				BUG("could not find expected object at offset %"PRIuMAX" in pack %s",
+				    (uintmax_t)offset, pack->p->pack_name);
+		} else {
+			pack_pos = pos - pack->bitmap_pos;
+			if (pack_pos >= pack->p->num_objects)
+				break;
+			offset = pack_pos_to_offset(pack->p, pack_pos);
+		}
+
+		if (try_partial_reuse(bitmap_git, pack, pos, pack_pos, offset,
+				      reuse, &w_curs) < 0) {
+			/*
+			 * try_partial_reuse indicated we couldn't reuse
+			 * any bits, so there is no point in trying more
+			 * bits from this pack.
+			 */
+			break;
+		}
+	}
+
+	unuse_pack(&w_curs);
+}
+
+static int bitmapped_pack_cmp(const void *va, const void *vb)
+{
+	const struct bitmapped_pack *a = va;
+	const struct bitmapped_pack *b = vb;
+
+	if (a->bitmap_pos < b->bitmap_pos)
+		return -1;
+	if (a->bitmap_pos > b->bitmap_pos)
+		return 1;
 	return 0;
 }
 
@@ -1906,86 +2180,96 @@ uint32_t midx_preferred_pack(struct bitmap_index *bitmap_git)
 }
 
 int reuse_partial_packfile_from_bitmap(struct bitmap_index *bitmap_git,
-				       struct packed_git **packfile_out,
+				       struct bitmapped_pack **packs_out,
+				       size_t *packs_nr_out,
 				       uint32_t *entries,
-				       struct bitmap **reuse_out)
+				       struct bitmap **reuse_out,
+				       int multi_pack_reuse)
 {
 	struct repository *r = the_repository;
-	struct packed_git *pack;
+	struct bitmapped_pack *packs = NULL;
+	size_t packs_nr = 0, packs_alloc = 0;
 	struct bitmap *result = bitmap_git->result;
 	struct bitmap *reuse;
-	struct pack_window *w_curs = NULL;
-	size_t i = 0;
-	uint32_t offset;
-	uint32_t objects_nr;
+	size_t i, objects_nr;
 
 	assert(result);
 
 	load_reverse_index(r, bitmap_git);
 
-	if (bitmap_is_midx(bitmap_git))
-		pack = bitmap_git->midx->packs[midx_preferred_pack(bitmap_git)];
-	else
-		pack = bitmap_git->pack;
-	objects_nr = pack->num_objects;
-
-	while (i < result->word_alloc && result->words[i] == (eword_t)~0)
-		i++;
-
-	/*
-	 * Don't mark objects not in the packfile or preferred pack. This bitmap
-	 * marks objects eligible for reuse, but the pack-reuse code only
-	 * understands how to reuse a single pack. Since the preferred pack is
-	 * guaranteed to have all bases for its deltas (in a multi-pack bitmap),
-	 * we use it instead of another pack. In single-pack bitmaps, the choice
-	 * is made for us.
-	 */
-	if (i > objects_nr / BITS_IN_EWORD)
-		i = objects_nr / BITS_IN_EWORD;
-
-	reuse = bitmap_word_alloc(i);
-	memset(reuse->words, 0xFF, i * sizeof(eword_t));
+	if (bitmap_is_midx(bitmap_git)) {
+		struct multi_pack_index *m = bitmap_git->midx;
 
-	for (; i < result->word_alloc; ++i) {
-		eword_t word = result->words[i];
-		size_t pos = (i * BITS_IN_EWORD);
+		/*
+		 * Every pack of the MIDX can be reused from when the MIDX
+		 * records which range of the bitmap holds the objects
+		 * selected from it.
+		 */
+		for (i = 0; multi_pack_reuse && i < midx_num_packs(m); i++) {
+			struct bitmapped_pack pack;
 
-		for (offset = 0; offset < BITS_IN_EWORD; ++offset) {
-			if ((word >> offset) == 0)
+			if (nth_bitmapped_pack(r, m, &pack, i) < 0) {
+				packs_nr = 0;
 				break;
-
-			offset += ewah_bit_ctz64(word >> offset);
-			if (try_partial_reuse(pack, pos + offset,
-					      reuse, &w_curs) < 0) {
-				/*
-				 * try_partial_reuse indicated we couldn't reuse
-				 * any bits, so there is no point in trying more
-				 * bits in the current word, or any other words
-				 * in result.
-				 *
-				 * Jump out of both loops to avoid future
-				 * unnecessary calls to try_partial_reuse.
-				 */
-				goto done;
 			}
+			if (!pack.bitmap_nr)
+				continue;
+
+			ALLOC_GROW(packs, packs_nr + 1, packs_alloc);
+			packs[packs_nr++] = pack;
+		}
+
+		/*
+		 * Otherwise fall back to the preferred pack, whose objects
+		 * come first and are all selected by the MIDX (which is
+		 * also where it picks the bases of their deltas from).
+		 */
+		if (!packs_nr) {
+			uint32_t preferred = midx_preferred_pack(bitmap_git);
+			struct packed_git *pack = nth_midxed_pack(m, preferred);
+
+			ALLOC_GROW(packs, packs_nr + 1, packs_alloc);
+			packs[packs_nr].p = pack;
+			packs[packs_nr].bitmap_pos = 0;
+			packs[packs_nr].bitmap_nr = pack->num_objects;
+			packs[packs_nr].from_midx = m;
+			packs[packs_nr].pack_int_id = preferred;
+			packs_nr++;
 		}
+
+		QSORT(packs, packs_nr, bitmapped_pack_cmp);
+	} else {
+		ALLOC_GROW(packs, packs_nr + 1, packs_alloc);
+		packs[packs_nr].p = bitmap_git->pack;
+		packs[packs_nr].bitmap_pos = 0;
+		packs[packs_nr].bitmap_nr = bitmap_git->pack->num_objects;
+		packs[packs_nr].from_midx = NULL;
+		packs[packs_nr].pack_int_id = 0;
+		packs_nr++;
 	}
 
-done:
-	unuse_pack(&w_curs);
+	objects_nr = packs[packs_nr - 1].bitmap_pos + packs[packs_nr - 1].bitmap_nr;
+	reuse = bitmap_word_alloc(DIV_ROUND_UP(objects_nr, BITS_IN_EWORD));
+
+	for (i = 0; i < packs_nr; i++)
+		reuse_partial_packfile_from_bitmap_1(bitmap_git, &packs[i], reuse);
 
 	*entries = bitmap_popcount(reuse);
 	if (!*entries) {
 		bitmap_free(reuse);
+		free(packs);
 		return -1;
 	}
 
+	trace2_data_intmax("pack-bitmap", r, "reuse/packs", packs_nr);
+
 	/*
 	 * Drop any reused objects from the result, since they will not
 	 * need to be handled separately.
 	 */
 	bitmap_and_not(result, reuse);
-	*packfile_out = pack;
+	*packs_out = packs;
+	*packs_nr_out = packs_nr;
 	*reuse_out = reuse;
 	return 0;
 }
@@ -2268,6 +2552,34 @@ int test_bitmap_hashes(struct repository *r)
 	return 0;
 }
 
+int test_bitmap_tip_unions(struct repository *r)
+{
+	struct bitmap_index *bitmap_git = prepare_bitmap_git(r);
+	uint32_t i;
+
+	if (!bitmap_git || !bitmap_git->tip_unions_nr)
+		goto cleanup;
+
+	for (i = 0; i < bitmap_git->tip_unions_nr; i++) {
+		struct tip_union *tu = &bitmap_git->tip_unions[i];
+		struct ewah_bitmap *merged = tip_union_bitmap(bitmap_git, tu);
+		struct bitmap *objects;
+
+		if (!merged)
+			die(_("failed to load tip union %"PRIu32), i);
+		objects = ewah_to_bitmap(merged);
+		printf_ln("%"PRIu32" %"PRIuMAX" %"PRIuMAX, i,
+			  (uintmax_t)bitmap_popcount(tu->commits),
+			  (uintmax_t)bitmap_popcount(objects));
+		bitmap_free(objects);
+	}
+
+cleanup:
+	free_bitmap_index(bitmap_git);
+
+	return 0;
+}
+
 int rebuild_bitmap(const uint32_t *reposition,
 		   struct ewah_bitmap *source,
 		   struct bitmap *dest)
@@ -2339,6 +2651,8 @@ uint32_t *create_bitmap_mapping(struct bitmap_index *bitmap_git,
 
 void free_bitmap_index(struct bitmap_index *b)
 {
+	uint32_t i;
+
 	if (!b)
 		return;
 
@@ -2356,11 +2670,17 @@ void free_bitmap_index(struct bitmap_index *b)
 		});
 	}
 	kh_destroy_oid_map(b->bitmaps);
+	for (i = 0; i < b->tip_unions_nr; i++) {
+		bitmap_free(b->tip_unions[i].commits);
+		ewah_pool_free(b->tip_unions[i].bitmap);
+	}
+	free(b->tip_unions);
 	free(b->ext_index.objects);
 	free(b->ext_index.hashes);
 	kh_destroy_oid_pos(b->ext_index.positions);
 	bitmap_free(b->result);
 	bitmap_free(b->haves);
+	free_bitmap_index(b->base);
 	if (bitmap_is_midx(b)) {
 		/*
 		 * Multi-pack bitmaps need to have resources associated with
@@ -2415,7 +2735,7 @@ static off_t get_disk_usage_for_type(struct bitmap_index *bitmap_git,
 				off_t offset = nth_midxed_offset(bitmap_git->midx, midx_pos);
 
 				uint32_t pack_id = nth_midxed_pack_int_id(bitmap_git->midx, midx_pos);
-				struct packed_git *pack = bitmap_git->midx->packs[pack_id];
+				struct packed_git *pack = nth_midxed_pack(bitmap_git->midx, pack_id);
 
 				if (offset_to_pack_pos(pack, offset, &pack_pos) < 0) {
 					struct object_id oid;
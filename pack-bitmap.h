@@ -36,8 +36,16 @@ enum pack_bitmap_opts {
 	BITMAP_OPT_FULL_DAG = 0x1,
 	BITMAP_OPT_HASH_CACHE = 0x4,
 	BITMAP_OPT_LOOKUP_TABLE = 0x10,
+	/*
+	 * Private to this implementation: 0x20 is taken by upstream Git's
+	 * pseudo-merge extension, whose layout differs from ours.
+	 */
+	BITMAP_OPT_TIP_UNIONS = 0x8000,
 };
 
+/* The version of the tip-union extension, stored in its trailer. */
+#define BITMAP_TIP_UNIONS_VERSION 1
+
 enum pack_bitmap_flags {
 	BITMAP_FLAG_REUSE = 0x1
 };
@@ -52,6 +60,21 @@ typedef int (*show_reachable_fn)(
 
 struct bitmap_index;
 
+/*
+ * A pack whose objects occupy the bit positions [bitmap_pos,
+ * bitmap_pos + bitmap_nr) of a bitmap. For a MIDX bitmap, these are
+ * the objects the MIDX selected from "p", in pseudo-pack order.
+ */
+struct bitmapped_pack {
+	struct packed_git *p;
+
+	uint32_t bitmap_pos;
+	uint32_t bitmap_nr;
+
+	struct multi_pack_index *from_midx; /* MIDX only */
+	uint32_t pack_int_id; /* MIDX only */
+};
+
 struct bitmap_index *prepare_bitmap_git(struct repository *r);
 struct bitmap_index *prepare_midx_bitmap_git(struct multi_pack_index *midx);
 void count_bitmap_commit_list(struct bitmap_index *, uint32_t *commits,
@@ -62,6 +85,7 @@ void traverse_bitmap_commit_list(struct bitmap_index *,
 void test_bitmap_walk(struct rev_info *revs);
 int test_bitmap_commits(struct repository *r);
 int test_bitmap_hashes(struct repository *r);
+int test_bitmap_tip_unions(struct repository *r);
 
 #define GIT_TEST_PACK_USE_BITMAP_BOUNDARY_TRAVERSAL \
 	"GIT_TEST_PACK_USE_BITMAP_BOUNDARY_TRAVERSAL"
@@ -69,10 +93,22 @@ int test_bitmap_hashes(struct repository *r);
 struct bitmap_index *prepare_bitmap_walk(struct rev_info *revs,
 					 int filter_provided_objects);
 uint32_t midx_preferred_pack(struct bitmap_index *bitmap_git);
+/*
+ * Find the objects of the result of a bitmap walk that can be sent by
+ * copying them verbatim from their packs. With "multi_pack_reuse", all
+ * packs of a MIDX bitmap that record their bit ranges are considered,
+ * otherwise only the preferred pack is.
+ *
+ * On success, "packs_out" holds the packs to reuse from, sorted by
+ * bitmap_pos, "entries" the number of reused objects, and "reuse_out"
+ * their bits, which are removed from the walk's result.
+ */
 int reuse_partial_packfile_from_bitmap(struct bitmap_index *,
-				       struct packed_git **packfile,
+				       struct bitmapped_pack **packs_out,
+				       size_t *packs_nr_out,
 				       uint32_t *entries,
-				       struct bitmap **reuse_out);
+				       struct bitmap **reuse_out,
+				       int multi_pack_reuse);
 int rebuild_existing_bitmaps(struct bitmap_index *, struct packing_data *mapping,
 			     kh_oid_map_t *reused_bitmaps, int show_progress);
 void free_bitmap_index(struct bitmap_index *);
@@ -102,6 +138,11 @@ struct ewah_bitmap *bitmap_for_commit(struct bitmap_index *bitmap_git,
 				      struct commit *commit);
 void bitmap_writer_select_commits(struct commit **indexed_commits,
 		unsigned int indexed_commits_nr, int max_bitmaps);
+/*
+ * Make the next bitmap_writer_build() reuse the bitmaps of "bitmap_git"
+ * rather than those of the repository. The writer takes ownership of it.
+ */
+void bitmap_writer_reuse_bitmaps(struct bitmap_index *bitmap_git);
 int bitmap_writer_build(struct packing_data *to_pack);
 void bitmap_writer_finish(struct pack_idx_entry **index,
 			  uint32_t index_nr,
@@ -343,7 +343,7 @@ int verify_pack_revindex(struct packed_git *p)
 	return res;
 }
 
-int load_midx_revindex(struct multi_pack_index *m)
+static int load_midx_revindex_one(struct multi_pack_index *m)
 {
 	struct strbuf revindex_name = STRBUF_INIT;
 	int ret;
@@ -386,16 +386,28 @@ int load_midx_revindex(struct multi_pack_index *m)
 	return ret;
 }
 
+int load_midx_revindex(struct multi_pack_index *m)
+{
+	for (; m; m = m->base_midx) {
+		int ret = load_midx_revindex_one(m);
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
 int close_midx_revindex(struct multi_pack_index *m)
 {
-	if (!m || !m->revindex_map)
-		return 0;
+	for (; m; m = m->base_midx) {
+		if (!m->revindex_map)
+			continue;
 
-	munmap((void*)m->revindex_map, m->revindex_len);
+		munmap((void*)m->revindex_map, m->revindex_len);
 
-	m->revindex_map = NULL;
-	m->revindex_data = NULL;
-	m->revindex_len = 0;
+		m->revindex_map = NULL;
+		m->revindex_data = NULL;
+		m->revindex_len = 0;
+	}
 
 	return 0;
 }
@@ -455,13 +467,28 @@ off_t pack_pos_to_offset(struct packed_git *p, uint32_t pos)
 		return nth_packed_object_offset(p, pack_pos_to_index(p, pos));
 }
 
+/*
+ * Both the pseudo-pack order and the MIDX order of an incremental MIDX
+ * chain are those of its layers one after the other, bottom-most first.
+ * Return the layer that "pos" falls into.
+ */
+static struct multi_pack_index *midx_layer_for_pos(struct multi_pack_index *m,
+						   uint32_t pos)
+{
+	while (m && pos < m->num_objects_in_base)
+		m = m->base_midx;
+	return m;
+}
+
 uint32_t pack_pos_to_midx(struct multi_pack_index *m, uint32_t pos)
 {
+	m = midx_layer_for_pos(m, pos);
+	if (!m || m->num_objects <= pos - m->num_objects_in_base)
+		BUG("pack_pos_to_midx: out-of-bounds object at %"PRIu32, pos);
 	if (!m->revindex_data)
 		BUG("pack_pos_to_midx: reverse index not yet loaded");
-	if (m->num_objects <= pos)
-		BUG("pack_pos_to_midx: out-of-bounds object at %"PRIu32, pos);
-	return get_be32(m->revindex_data + pos);
+	return m->num_objects_in_base +
+		get_be32(m->revindex_data + pos - m->num_objects_in_base);
 }
 
 struct midx_pack_key {
@@ -477,7 +504,8 @@ static int midx_pack_order_cmp(const void *va, const void *vb)
 	const struct midx_pack_key *key = va;
 	struct multi_pack_index *midx = key->midx;
 
-	uint32_t versus = pack_pos_to_midx(midx, (uint32_t*)vb - (const uint32_t *)midx->revindex_data);
+	uint32_t versus = pack_pos_to_midx(midx, midx->num_objects_in_base +
+					   ((uint32_t*)vb - (const uint32_t *)midx->revindex_data));
 	uint32_t versus_pack = nth_midxed_pack_int_id(midx, versus);
 	off_t versus_offset;
 
@@ -509,19 +537,18 @@ static int midx_pack_order_cmp(const void *va, const void *vb)
 	return 0;
 }
 
-int midx_to_pack_pos(struct multi_pack_index *m, uint32_t at, uint32_t *pos)
+static int midx_key_to_pack_pos(struct multi_pack_index *m,
+				struct midx_pack_key *key,
+				uint32_t *pos)
 {
-	struct midx_pack_key key;
 	uint32_t *found;
 
 	if (!m->revindex_data)
-		BUG("midx_to_pack_pos: reverse index not yet loaded");
-	if (m->num_objects <= at)
-		BUG("midx_to_pack_pos: out-of-bounds object at %"PRIu32, at);
+		BUG("midx_key_to_pack_pos: reverse index not yet loaded");
+	if (!m->num_objects)
+		return -1;
 
-	key.pack = nth_midxed_pack_int_id(m, at);
-	key.offset = nth_midxed_offset(m, at);
-	key.midx = m;
+	key->midx = m;
 	/*
 	 * The preferred pack sorts first, so determine its identifier by
 	 * looking at the first object in pseudo-pack order.
@@ -531,14 +558,46 @@ int midx_to_pack_pos(struct multi_pack_index *m, uint32_t at, uint32_t *pos)
 	 * implicitly is preferred (and includes all its objects, since ties are
 	 * broken first by pack identifier).
 	 */
-	key.preferred_pack = nth_midxed_pack_int_id(m, pack_pos_to_midx(m, 0));
+	key->preferred_pack = nth_midxed_pack_int_id(m,
+						     pack_pos_to_midx(m, m->num_objects_in_base));
 
-	found = bsearch(&key, m->revindex_data, m->num_objects,
+	found = bsearch(key, m->revindex_data, m->num_objects,
 			sizeof(*m->revindex_data), midx_pack_order_cmp);
-
 	if (!found)
-		return error("bad offset for revindex");
+		return -1;
+
+	*pos = m->num_objects_in_base + (found - m->revindex_data);
+	return 0;
+}
+
+int midx_to_pack_pos(struct multi_pack_index *m, uint32_t at, uint32_t *pos)
+{
+	struct midx_pack_key key;
+
+	m = midx_layer_for_pos(m, at);
+	if (!m || m->num_objects <= at - m->num_objects_in_base)
+		BUG("midx_to_pack_pos: out-of-bounds object at %"PRIu32, at);
 
-	*pos = found - m->revindex_data;
+	key.pack = nth_midxed_pack_int_id(m, at);
+	key.offset = nth_midxed_offset(m, at);
+
+	if (midx_key_to_pack_pos(m, &key, pos) < 0)
+		return error("bad offset for revindex");
 	return 0;
 }
+
+int midx_pair_to_pack_pos(struct multi_pack_index *m, uint32_t pack_int_id,
+			  off_t ofs, uint32_t *pos)
+{
+	struct midx_pack_key key;
+
+	while (m && pack_int_id < m->num_packs_in_base)
+		m = m->base_midx;
+	if (!m || pack_int_id - m->num_packs_in_base >= m->num_packs)
+		BUG("midx_pair_to_pack_pos: bad pack-int-id %"PRIu32, pack_int_id);
+
+	key.pack = pack_int_id;
+	key.offset = ofs;
+
+	return midx_key_to_pack_pos(m, &key, pos);
+}
@@ -70,7 +70,8 @@ int verify_pack_revindex(struct packed_git *p);
 /*
  * load_midx_revindex loads the '.rev' file corresponding to the given
  * multi-pack index by mmap-ing it and assigning pointers in the
- * multi_pack_index to point at it.
+ * multi_pack_index to point at it. For an incremental MIDX chain, this
+ * is done for every layer.
  *
  * A negative number is returned on error.
  */
@@ -102,7 +103,8 @@ int offset_to_pack_pos(struct packed_git *p, off_t ofs, uint32_t *pos);
  * If the reverse index has not yet been loaded, or the position is out of
  * bounds, this function aborts.
  *
- * This function runs in constant time.
+ * This function runs in constant time (linear in the number of layers of
+ * an incremental MIDX chain).
  */
 uint32_t pack_pos_to_index(struct packed_git *p, uint32_t pos);
 
@@ -142,4 +144,18 @@ uint32_t pack_pos_to_midx(struct multi_pack_index *m, uint32_t pos);
  */
 int midx_to_pack_pos(struct multi_pack_index *midx, uint32_t at, uint32_t *pos);
 
+/*
+ * midx_pair_to_pack_pos finds the pack position of the object stored at
+ * offset "ofs" in the pack "pack_int_id" of the MIDX, and stores it in
+ * "pos".
+ *
+ * Returns -1 (without complaining) if the MIDX selected another copy of
+ * that object, or if there is no object at "ofs". The reverse index must
+ * have been loaded.
+ *
+ * This function runs in time O(log N) with the number of objects in the MIDX.
+ */
+int midx_pair_to_pack_pos(struct multi_pack_index *midx, uint32_t pack_int_id,
+			  off_t ofs, uint32_t *pos);
+
 #endif
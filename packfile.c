@@ -23,6 +23,8 @@
 #include "commit-graph.h"
 #include "pack-revindex.h"
 #include "promisor-remote.h"
+#include "json-writer.h"
+#include "trace2.h"
 
 char *odb_pack_name(struct strbuf *buf,
 		    const unsigned char *hash,
@@ -879,7 +881,8 @@ static void prepare_pack(const char *full_name, size_t full_name_len,
 	if (!report_garbage)
 		return;
 
-	if (!strcmp(file_name, "multi-pack-index"))
+	if (!strcmp(file_name, "multi-pack-index") ||
+	    !strcmp(file_name, "multi-pack-index.d"))
 		return;
 	if (starts_with(file_name, "multi-pack-index") &&
 	    (ends_with(file_name, ".bitmap") || ends_with(file_name, ".rev")))
@@ -935,7 +938,7 @@ unsigned long repo_approximate_object_count(struct repository *r)
 		prepare_packed_git(r);
 		count = 0;
 		for (m = get_multi_pack_index(r); m; m = m->next)
-			count += m->num_objects;
+			count += m->num_objects_in_base + m->num_objects;
 		for (p = r->objects->packed_git; p; p = p->next) {
 			if (open_pack_index(p))
 				continue;
@@ -1063,7 +1066,7 @@ struct packed_git *get_all_packs(struct repository *r)
 	prepare_packed_git(r);
 	for (m = r->objects->multi_pack_index; m; m = m->next) {
 		uint32_t i;
-		for (i = 0; i < m->num_packs; i++)
+		for (i = 0; i < midx_num_packs(m); i++)
 			prepare_midx_pack(r, m, i);
 	}
 
@@ -1358,11 +1361,38 @@ static enum object_type packed_to_object_type(struct repository *r,
 	goto out;
 }
 
+/*
+ * The delta base cache keeps recently reconstructed delta bases, so
+ * that the next delta against the same base does not have to
+ * reconstruct it again.
+ *
+ * Entries are not all equally valuable: reconstructing a base at the
+ * end of a long delta chain means inflating and applying every delta
+ * of the chain, while a base that is not a delta itself only needs to
+ * be inflated. When the cache is full, we therefore evict the entry
+ * with the lowest reconstruction cost per byte of memory it uses (its
+ * depth in the delta chain) among the least recently used entries,
+ * aged as in the GreedyDual-Size algorithm: an entry's priority is its
+ * cost plus the priority of the last evicted entry at the time it was
+ * added or last used, so that expensive entries which are not used
+ * anymore are eventually evicted, too.
+ */
 static struct hashmap delta_base_cache;
 static size_t delta_base_cached;
 
 static LIST_HEAD(delta_base_cache_lru);
 
+/* The priority of the last evicted entry. */
+static uint64_t delta_base_cache_clock;
+
+/* How many of the least recently used entries to consider for eviction. */
+#define DELTA_BASE_CACHE_EVICT_SAMPLE 8
+
+/* Statistics, reported through trace2. */
+static int delta_base_cache_atexit_registered;
+static intmax_t delta_base_cache_evictions;
+static size_t delta_base_cache_peak;
+
 struct delta_base_cache_key {
 	struct packed_git *p;
 	off_t base_offset;
@@ -1375,8 +1405,43 @@ struct delta_base_cache_entry {
 	void *data;
 	unsigned long size;
 	enum object_type type;
+	/* the number of deltas applied to reconstruct this entry */
+	unsigned int depth;
+	uint64_t priority;
 };
 
+static void trace2_delta_base_cache_statistics_atexit(void)
+{
+	struct json_writer jw = JSON_WRITER_INIT;
+	struct packed_git *p;
+	intmax_t hits = 0, misses = 0;
+
+	jw_object_begin(&jw, 0);
+	jw_object_inline_begin_array(&jw, "packs");
+	for (p = the_repository->objects ? the_repository->objects->packed_git : NULL;
+	     p; p = p->next) {
+		if (!p->delta_base_hits && !p->delta_base_misses)
+			continue;
+		jw_array_inline_begin_object(&jw);
+		jw_object_string(&jw, "pack", pack_basename(p));
+		jw_object_intmax(&jw, "hits", p->delta_base_hits);
+		jw_object_intmax(&jw, "misses", p->delta_base_misses);
+		jw_end(&jw);
+		hits += p->delta_base_hits;
+		misses += p->delta_base_misses;
+	}
+	jw_end(&jw);
+	jw_object_intmax(&jw, "hits", hits);
+	jw_object_intmax(&jw, "misses", misses);
+	jw_object_intmax(&jw, "evictions", delta_base_cache_evictions);
+	jw_object_intmax(&jw, "peak_bytes", delta_base_cache_peak);
+	jw_end(&jw);
+
+	trace2_data_json("delta_base_cache", the_repository, "statistics", &jw);
+
+	jw_release(&jw);
+}
+
 static unsigned int pack_entry_hash(struct packed_git *p, off_t base_offset)
 {
 	unsigned int hash;
@@ -1450,13 +1515,21 @@ static void *cache_or_unpack_entry(struct repository *r, struct packed_git *p,
 	struct delta_base_cache_entry *ent;
 
 	ent = get_delta_base_cache_entry(p, base_offset);
-	if (!ent)
+	if (!ent) {
+		p->delta_base_misses++;
 		return unpack_entry(r, p, base_offset, type, base_size);
+	}
+	p->delta_base_hits++;
 
 	if (type)
 		*type = ent->type;
 	if (base_size)
 		*base_size = ent->size;
+	/* Refresh the entry, as it would be if it was detached and added. */
+	list_del(&ent->lru);
+	list_add_tail(&ent->lru, &delta_base_cache_lru);
+	ent->priority = delta_base_cache_clock + ent->depth + 1;
+
 	return xmemdupz(ent->data, ent->size);
 }
 
@@ -1476,11 +1549,38 @@ void clear_delta_base_cache(void)
 	}
 }
 
+/*
+ * Evict the entry with the lowest priority among the least recently
+ * used ones.
+ */
+static void evict_delta_base_cache_entry(void)
+{
+	struct delta_base_cache_entry *victim = NULL;
+	struct list_head *lru;
+	int n = 0;
+
+	list_for_each(lru, &delta_base_cache_lru) {
+		struct delta_base_cache_entry *f =
+			list_entry(lru, struct delta_base_cache_entry, lru);
+		if (!victim || f->priority < victim->priority)
+			victim = f;
+		if (++n == DELTA_BASE_CACHE_EVICT_SAMPLE)
+			break;
+	}
+	if (!victim)
+		return;
+
+	if (victim->priority > delta_base_cache_clock)
+		delta_base_cache_clock = victim->priority;
+	delta_base_cache_evictions++;
+	release_delta_base_cache(victim);
+}
+
 static void add_delta_base_cache(struct packed_git *p, off_t base_offset,
-	void *base, unsigned long base_size, enum object_type type)
+	void *base, unsigned long base_size, enum object_type type,
+	unsigned int depth)
 {
 	struct delta_base_cache_entry *ent;
-	struct list_head *lru, *tmp;
 
 	/*
 	 * Check required to avoid redundant entries when more than one thread
@@ -1494,13 +1594,9 @@ static void add_delta_base_cache(struct packed_git *p, off_t base_offset,
 
 	delta_base_cached += base_size;
 
-	list_for_each_safe(lru, tmp, &delta_base_cache_lru) {
-		struct delta_base_cache_entry *f =
-			list_entry(lru, struct delta_base_cache_entry, lru);
-		if (delta_base_cached <= delta_base_cache_limit)
-			break;
-		release_delta_base_cache(f);
-	}
+	while (delta_base_cached > delta_base_cache_limit &&
+	       !list_empty(&delta_base_cache_lru))
+		evict_delta_base_cache_entry();
 
 	ent = xmalloc(sizeof(*ent));
 	ent->key.p = p;
@@ -1508,8 +1604,17 @@ static void add_delta_base_cache(struct packed_git *p, off_t base_offset,
 	ent->type = type;
 	ent->data = base;
 	ent->size = base_size;
+	ent->depth = depth;
+	ent->priority = delta_base_cache_clock + depth + 1;
 	list_add_tail(&ent->lru, &delta_base_cache_lru);
 
+	if (delta_base_cached > delta_base_cache_peak)
+		delta_base_cache_peak = delta_base_cached;
+	if (trace2_is_enabled() && !delta_base_cache_atexit_registered) {
+		atexit(trace2_delta_base_cache_statistics_atexit);
+		delta_base_cache_atexit_registered = 1;
+	}
+
 	if (!delta_base_cache.cmpfn)
 		hashmap_init(&delta_base_cache, delta_base_cache_hash_cmp, NULL, 0);
 	hashmap_entry_init(&ent->ent, pack_entry_hash(p, base_offset));
@@ -1605,18 +1710,45 @@ int packed_object_info(struct repository *r, struct packed_git *p,
 	return type;
 }
 
-static void *unpack_compressed_entry(struct packed_git *p,
-				    struct pack_window **w_curs,
-				    off_t curpos,
-				    unsigned long size)
+/*
+ * The most a zlib stream for "size" bytes can take up when written
+ * by zlib (or git), as given by compressBound().
+ */
+static unsigned long zlib_compress_bound(unsigned long size)
+{
+	return size + (size >> 12) + (size >> 14) + (size >> 25) + 13;
+}
+
+void *unpack_compressed_entry(struct packed_git *p,
+			      struct pack_window **w_curs,
+			      off_t curpos,
+			      unsigned long size)
 {
 	int st;
 	git_zstream stream;
 	unsigned char *buffer, *in;
+	unsigned long avail;
 
 	buffer = xmallocz_gently(size);
 	if (!buffer)
 		return NULL;
+
+	/*
+	 * As we know how large the object is, we can inflate it in one
+	 * go without the overhead of streaming, as long as the window
+	 * holds all of its compressed data. It does unless the object
+	 * straddles the end of the window, in which case the stream is
+	 * longer than the bound below and we do not even try.
+	 */
+	in = use_pack(p, w_curs, curpos, &avail);
+	if (avail >= zlib_compress_bound(size)) {
+		obj_read_unlock();
+		st = git_inflate_buffer(in, avail, buffer, size);
+		obj_read_lock();
+		if (!st)
+			return buffer;
+	}
+
 	memset(&stream, 0, sizeof(stream));
 	stream.next_out = buffer;
 	stream.avail_out = size + 1;
@@ -1678,6 +1810,7 @@ void *unpack_entry(struct repository *r, struct packed_git *p, off_t obj_offset,
 	struct unpack_entry_stack_ent *delta_stack = small_delta_stack;
 	int delta_stack_nr = 0, delta_stack_alloc = UNPACK_ENTRY_STACK_PREALLOC;
 	int base_from_cache = 0;
+	unsigned int base_depth = 0;
 
 	write_pack_access_log(p, obj_offset);
 
@@ -1692,10 +1825,15 @@ void *unpack_entry(struct repository *r, struct packed_git *p, off_t obj_offset,
 			type = ent->type;
 			data = ent->data;
 			size = ent->size;
+			base_depth = ent->depth;
 			detach_delta_base_cache_entry(ent);
 			base_from_cache = 1;
+			if (delta_stack_nr)
+				p->delta_base_hits++;
 			break;
 		}
+		if (delta_stack_nr)
+			p->delta_base_misses++;
 
 		if (do_check_packed_object_crc && p->index_version > 1) {
 			uint32_t pack_pos, index_pos;
@@ -1785,6 +1923,7 @@ void *unpack_entry(struct repository *r, struct packed_git *p, off_t obj_offset,
 		unsigned long delta_size, base_size = size;
 		int i;
 		off_t base_obj_offset = obj_offset;
+		unsigned int depth = base_depth++;
 
 		data = NULL;
 
@@ -1834,8 +1973,15 @@ void *unpack_entry(struct repository *r, struct packed_git *p, off_t obj_offset,
 			      (uintmax_t)curpos, p->pack_name);
 			data = NULL;
 		} else {
+			/*
+			 * Neither "base" nor "delta_data" can be reached
+			 * by other threads at this point (see below), so
+			 * let them read objects while we apply the delta.
+			 */
+			obj_read_unlock();
 			data = patch_delta(base, base_size, delta_data,
 					   delta_size, &size);
+			obj_read_lock();
 
 			/*
 			 * We could not apply the delta; warn the user, but
@@ -1852,14 +1998,16 @@ void *unpack_entry(struct repository *r, struct packed_git *p, off_t obj_offset,
 
 		/*
 		 * We delay adding `base` to the cache until the end of the loop
-		 * because unpack_compressed_entry() momentarily releases the
-		 * obj_read_mutex, giving another thread the chance to access
-		 * the cache. Therefore, if `base` was already there, this other
-		 * thread could free() it (e.g. to make space for another entry)
-		 * before we are done using it.
+		 * because unpack_compressed_entry() and patch_delta() above
+		 * momentarily release the obj_read_mutex, giving another
+		 * thread the chance to access the cache. Therefore, if `base`
+		 * was already there, this other thread could free() it (e.g.
+		 * to make space for another entry) before we are done using
+		 * it.
 		 */
 		if (!external_base)
-			add_delta_base_cache(p, base_obj_offset, base, base_size, type);
+			add_delta_base_cache(p, base_obj_offset, base, base_size,
+					     type, depth);
 
 		free(delta_data);
 		free(external_base);
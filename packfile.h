@@ -162,6 +162,13 @@ off_t get_delta_base(struct packed_git *p, struct pack_window **w_curs,
 		     off_t *curpos, enum object_type type,
 		     off_t delta_obj_offset);
 
+/*
+ * Inflate the "size" bytes of object (or delta) data at "curpos" in "p".
+ * Returns a NUL-terminated buffer, or NULL if the data is corrupt.
+ */
+void *unpack_compressed_entry(struct packed_git *p, struct pack_window **w_curs,
+			      off_t curpos, unsigned long size);
+
 void release_pack_memory(size_t);
 
 /* global flag to enable extra checks when accessing packed objects */
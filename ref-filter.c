@@ -1,4 +1,5 @@
 #include "git-compat-util.h"
+#include "ahead-behind-cache.h"
 #include "environment.h"
 #include "gettext.h"
 #include "config.h"
@@ -30,6 +31,7 @@
 #include "worktree.h"
 #include "hashmap.h"
 #include "strvec.h"
+#include "trace2.h"
 
 static struct ref_msg {
 	const char *gone;
@@ -2846,11 +2848,79 @@ static void reach_filter(struct ref_array *array,
 	free(to_clear);
 }
 
+/*
+ * Like ahead_behind(), but take what we can from the ahead-behind
+ * cache and only walk for the rest.
+ */
+static void ahead_behind_cached(struct repository *r,
+				struct ahead_behind_cache *cache,
+				struct commit **commits, size_t commits_nr,
+				struct ahead_behind_count *counts, size_t counts_nr)
+{
+	struct commit **todo_commits;
+	struct ahead_behind_count *todo;
+	size_t *todo_pos, *index;
+	size_t todo_nr = 0, todo_commits_nr = 0;
+
+	ALLOC_ARRAY(todo_commits, commits_nr);
+	ALLOC_ARRAY(todo, counts_nr);
+	ALLOC_ARRAY(todo_pos, counts_nr);
+	ALLOC_ARRAY(index, commits_nr);
+	for (size_t i = 0; i < commits_nr; i++)
+		index[i] = SIZE_MAX;
+
+	for (size_t i = 0; i < counts_nr; i++) {
+		struct ahead_behind_count *count = &counts[i];
+		size_t base = count->base_index, tip = count->tip_index;
+
+		if (ahead_behind_cache_lookup(cache,
+					      &commits[base]->object.oid,
+					      &commits[tip]->object.oid,
+					      &count->ahead, &count->behind))
+			continue;
+
+		if (index[base] == SIZE_MAX) {
+			index[base] = todo_commits_nr;
+			todo_commits[todo_commits_nr++] = commits[base];
+		}
+		if (index[tip] == SIZE_MAX) {
+			index[tip] = todo_commits_nr;
+			todo_commits[todo_commits_nr++] = commits[tip];
+		}
+		todo[todo_nr].base_index = index[base];
+		todo[todo_nr].tip_index = index[tip];
+		todo_pos[todo_nr++] = i;
+	}
+
+	trace2_data_intmax("ahead-behind", r, "cache-hits", counts_nr - todo_nr);
+	trace2_data_intmax("ahead-behind", r, "cache-misses", todo_nr);
+
+	ahead_behind(r, todo_commits, todo_commits_nr, todo, todo_nr);
+
+	for (size_t i = 0; i < todo_nr; i++) {
+		struct ahead_behind_count *count = &counts[todo_pos[i]];
+
+		count->ahead = todo[i].ahead;
+		count->behind = todo[i].behind;
+		ahead_behind_cache_add(cache,
+				       &commits[count->base_index]->object.oid,
+				       &commits[count->tip_index]->object.oid,
+				       count->ahead, count->behind);
+	}
+	ahead_behind_cache_write(cache);
+
+	free(todo_commits);
+	free(todo);
+	free(todo_pos);
+	free(index);
+}
+
 void filter_ahead_behind(struct repository *r,
 			 struct ref_format *format,
 			 struct ref_array *array)
 {
 	struct commit **commits;
+	struct ahead_behind_cache *cache;
 	size_t commits_nr = format->bases.nr + array->nr;
 
 	if (!format->bases.nr || !array->nr)
@@ -2883,7 +2953,14 @@ void filter_ahead_behind(struct repository *r,
 		commits_nr++;
 	}
 
-	ahead_behind(r, commits, commits_nr, array->counts, array->counts_nr);
+	cache = ahead_behind_cache_open(r);
+	if (cache)
+		ahead_behind_cached(r, cache, commits, commits_nr,
+				    array->counts, array->counts_nr);
+	else
+		ahead_behind(r, commits, commits_nr,
+			     array->counts, array->counts_nr);
+	ahead_behind_cache_free(cache);
 	free(commits);
 }
 
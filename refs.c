@@ -11,6 +11,7 @@
 #include "hex.h"
 #include "lockfile.h"
 #include "iterator.h"
+#include "ls-refs.h"
 #include "refs.h"
 #include "refs/refs-internal.h"
 #include "run-command.h"
@@ -33,17 +34,36 @@
 /*
  * List of all available backends
  */
-static struct ref_storage_be *refs_backends = &refs_be_files;
+static const struct ref_storage_be *refs_backends[] = {
+	[REF_STORAGE_FORMAT_FILES] = &refs_be_files,
+	[REF_STORAGE_FORMAT_REFTABLE] = &refs_be_reftable,
+};
 
-static struct ref_storage_be *find_ref_storage_backend(const char *name)
+static const struct ref_storage_be *find_ref_storage_backend(unsigned int ref_storage_format)
 {
-	struct ref_storage_be *be;
-	for (be = refs_backends; be; be = be->next)
-		if (!strcmp(be->name, name))
-			return be;
+	if (ref_storage_format < ARRAY_SIZE(refs_backends))
+		return refs_backends[ref_storage_format];
 	return NULL;
 }
 
+unsigned int ref_storage_format_by_name(const char *name)
+{
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(refs_backends); i++)
+		if (refs_backends[i] && !strcmp(refs_backends[i]->name, name))
+			return i;
+	return REF_STORAGE_FORMAT_UNKNOWN;
+}
+
+const char *ref_storage_format_to_name(unsigned int ref_storage_format)
+{
+	const struct ref_storage_be *be = find_ref_storage_backend(ref_storage_format);
+	if (!be)
+		return "unknown";
+	return be->name;
+}
+
 /*
  * How to handle various characters in refnames:
  * 0: An acceptable character for refs
@@ -2029,12 +2049,12 @@ static struct ref_store *ref_store_init(struct repository *repo,
 					const char *gitdir,
 					unsigned int flags)
 {
-	const char *be_name = "files";
-	struct ref_storage_be *be = find_ref_storage_backend(be_name);
+	const struct ref_storage_be *be;
 	struct ref_store *refs;
 
+	be = find_ref_storage_backend(repo->ref_storage_format);
 	if (!be)
-		BUG("reference backend %s is unknown", be_name);
+		BUG("reference backend is unknown");
 
 	refs = be->init(repo, gitdir, flags);
 	return refs;
@@ -2180,6 +2200,15 @@ int peel_iterated_oid(const struct object_id *base, struct object_id *peeled)
 	return peel_object(base, peeled) ? -1 : 0;
 }
 
+/*
+ * Tell caches of the values of references that those in `refs` may
+ * have changed.
+ */
+static void refs_changed(struct ref_store *refs)
+{
+	ls_refs_cache_invalidate(refs->repo);
+}
+
 int refs_create_symref(struct ref_store *refs,
 		       const char *ref_target,
 		       const char *refs_heads_master,
@@ -2191,6 +2220,7 @@ int refs_create_symref(struct ref_store *refs,
 	msg = normalize_reflog_message(logmsg);
 	retval = refs->be->create_symref(refs, ref_target, refs_heads_master,
 					 msg);
+	refs_changed(refs);
 	free(msg);
 	return retval;
 }
@@ -2367,6 +2397,7 @@ int ref_transaction_commit(struct ref_transaction *transaction,
 	}
 
 	ret = refs->be->transaction_finish(refs, transaction, err);
+	refs_changed(refs);
 	if (!ret)
 		run_transaction_hook(transaction, "committed");
 	return ret;
@@ -2604,6 +2635,7 @@ int refs_delete_refs(struct ref_store *refs, const char *logmsg,
 
 	msg = normalize_reflog_message(logmsg);
 	retval = refs->be->delete_refs(refs, msg, refnames, flags);
+	refs_changed(refs);
 	free(msg);
 	return retval;
 }
@@ -2622,6 +2654,7 @@ int refs_rename_ref(struct ref_store *refs, const char *oldref,
 
 	msg = normalize_reflog_message(logmsg);
 	retval = refs->be->rename_ref(refs, oldref, newref, msg);
+	refs_changed(refs);
 	free(msg);
 	return retval;
 }
@@ -2639,6 +2672,7 @@ int refs_copy_existing_ref(struct ref_store *refs, const char *oldref,
 
 	msg = normalize_reflog_message(logmsg);
 	retval = refs->be->copy_ref(refs, oldref, newref, msg);
+	refs_changed(refs);
 	free(msg);
 	return retval;
 }
@@ -11,6 +11,24 @@ struct string_list;
 struct string_list_item;
 struct worktree;
 
+/*
+ * The on-disk formats in which a repository may store its references.
+ * The format is recorded in the "extensions.refStorage" configuration
+ * and defaults to "files".
+ */
+#define REF_STORAGE_FORMAT_UNKNOWN  0
+#define REF_STORAGE_FORMAT_FILES    1
+#define REF_STORAGE_FORMAT_REFTABLE 2
+
+/*
+ * Return the ref storage format corresponding to `name`, or
+ * REF_STORAGE_FORMAT_UNKNOWN if the name is not recognized.
+ */
+unsigned int ref_storage_format_by_name(const char *name);
+
+/* Return the name of the given ref storage format. */
+const char *ref_storage_format_to_name(unsigned int ref_storage_format);
+
 /*
  * Resolve a reference, recursively following symbolic refererences.
  *
@@ -1,6 +1,8 @@
 #include "../git-compat-util.h"
 #include "../alloc.h"
+#include "../chunk-format.h"
 #include "../config.h"
+#include "../csum-file.h"
 #include "../gettext.h"
 #include "../hash.h"
 #include "../hex.h"
@@ -100,6 +102,20 @@ struct snapshot {
 	 */
 	enum { PEELED_NONE, PEELED_TAGS, PEELED_FULLY } peeled;
 
+	/*
+	 * If the header of the `packed-refs` file names an index whose
+	 * checksum matches, the mmapped `packed-refs.idx` file and its
+	 * record offsets and record data chunks. Positions in the
+	 * snapshot then point into `index_offsets` rather than into
+	 * `buf`; see `snapshot_begin()` and `snapshot_end()`.
+	 */
+	unsigned char *index_map;
+	size_t index_map_size;
+	const unsigned char *index_offsets;
+	size_t index_nr;
+	const unsigned char *index_data;
+	size_t index_data_size;
+
 	/*
 	 * Count of references to this instance, including the pointer
 	 * from `packed_ref_store::snapshot`, if any. The instance
@@ -157,8 +173,43 @@ struct packed_ref_store {
 	 * `packed_ref_store`) must not be freed.
 	 */
 	struct tempfile *tempfile;
+
+	/*
+	 * Temporary file used when writing a new "packed-refs.idx"
+	 * file alongside the new "packed-refs" file, if any.
+	 */
+	struct tempfile *index_tempfile;
 };
 
+/*
+ * The optional "packed-refs.idx" file next to "packed-refs" holds the
+ * same references in a binary form, so that they can be iterated
+ * over without parsing and copying each record. It uses the chunk
+ * format and starts with an 8-byte header: the signature "PRIX", a
+ * one-byte version (1), a one-byte hash function id (1 for SHA-1, 2
+ * for SHA-256), a one-byte number of chunks and a reserved zero byte.
+ * The chunks are:
+ *
+ *   "ROFF": one 4-byte network-order offset into "RDAT" per
+ *   reference, sorted by refname. The most significant bit is set if
+ *   the record contains a peeled value.
+ *
+ *   "RDAT": the records, each consisting of the object ID, the
+ *   peeled object ID if any, and the NUL-terminated refname.
+ *
+ * The file ends with a checksum of its contents. The header line of
+ * "packed-refs" names that checksum in an "index=<hex>" trait; an
+ * index whose checksum does not match (e.g., because the file was
+ * rewritten by a version of Git that does not know about the index)
+ * is ignored.
+ */
+#define PACKED_REFS_INDEX_SIGNATURE 0x50524958 /* "PRIX" */
+#define PACKED_REFS_INDEX_VERSION 1
+#define PACKED_REFS_INDEX_HEADER_SIZE 8
+#define PACKED_REFS_INDEX_CHUNKID_OFFSETS 0x524f4646 /* "ROFF" */
+#define PACKED_REFS_INDEX_CHUNKID_DATA 0x52444154 /* "RDAT" */
+#define PACKED_REFS_INDEX_PEELED 0x80000000
+
 /*
  * Increment the reference count of `*snapshot`.
  */
@@ -185,6 +236,15 @@ static void clear_snapshot_buffer(struct snapshot *snapshot)
 	snapshot->buf = snapshot->start = snapshot->eof = NULL;
 }
 
+static void clear_snapshot_index(struct snapshot *snapshot)
+{
+	if (snapshot->index_map)
+		munmap(snapshot->index_map, snapshot->index_map_size);
+	snapshot->index_map = NULL;
+	snapshot->index_offsets = snapshot->index_data = NULL;
+	snapshot->index_nr = snapshot->index_data_size = 0;
+}
+
 /*
  * Decrease the reference count of `*snapshot`. If it goes to zero,
  * free `*snapshot` and return true; otherwise return false.
@@ -194,6 +254,7 @@ static int release_snapshot(struct snapshot *snapshot)
 	if (!--snapshot->referrers) {
 		stat_validity_clear(&snapshot->validity);
 		clear_snapshot_buffer(snapshot);
+		clear_snapshot_index(snapshot);
 		free(snapshot);
 		return 1;
 	} else {
@@ -439,6 +500,77 @@ static const char *find_end_of_record(const char *p, const char *end)
 	return p;
 }
 
+/*
+ * Return a pointer to the first and just past the last position to
+ * iterate over in `snapshot`. These are records in `snapshot->buf`,
+ * unless the snapshot uses an index, in which case they are entries
+ * of `snapshot->index_offsets`.
+ */
+static const char *snapshot_begin(struct snapshot *snapshot)
+{
+	if (snapshot->index_map)
+		return (const char *)snapshot->index_offsets;
+	return snapshot->start;
+}
+
+static const char *snapshot_end(struct snapshot *snapshot)
+{
+	if (snapshot->index_map)
+		return (const char *)snapshot->index_offsets +
+			st_mult(snapshot->index_nr, sizeof(uint32_t));
+	return snapshot->eof;
+}
+
+/*
+ * Return the index record that the entry of `snapshot->index_offsets`
+ * at `pos` points to, and set `*peeled` if it contains a peeled
+ * value. Die if the record lies outside of the data chunk.
+ */
+static const unsigned char *index_record(struct snapshot *snapshot,
+					 const char *pos, int *peeled)
+{
+	uint32_t offset = get_be32(pos);
+	size_t len = the_hash_algo->rawsz;
+
+	*peeled = !!(offset & PACKED_REFS_INDEX_PEELED);
+	offset &= ~PACKED_REFS_INDEX_PEELED;
+	if (*peeled)
+		len *= 2;
+
+	/* The data chunk ends with a NUL, so the refname is terminated. */
+	if (offset >= snapshot->index_data_size ||
+	    snapshot->index_data_size - offset <= len)
+		die("corrupt record in %s.idx", snapshot->refs->path);
+	return snapshot->index_data + offset;
+}
+
+static const char *index_refname(struct snapshot *snapshot, const char *pos)
+{
+	int peeled;
+	const unsigned char *rec = index_record(snapshot, pos, &peeled);
+
+	return (const char *)rec + (peeled ? 2 : 1) * the_hash_algo->rawsz;
+}
+
+/*
+ * Like `cmp_record_to_refname()`, but for the NUL-terminated refname
+ * of an index record.
+ */
+static int cmp_index_name_to_refname(const char *r1, const char *r2,
+				     int start)
+{
+	while (1) {
+		if (!*r1)
+			return *r2 ? -1 : 0;
+		if (!*r2)
+			return start ? 1 : -1;
+		if (*r1 != *r2)
+			return (unsigned char)*r1 < (unsigned char)*r2 ? -1 : +1;
+		r1++;
+		r2++;
+	}
+}
+
 /*
  * We want to be able to compare mmapped reference records quickly,
  * without totally parsing them. We can do so because the records are
@@ -556,6 +688,30 @@ static const char *find_reference_location_1(struct snapshot *snapshot,
 	 */
 	const char *hi = snapshot->eof;
 
+	if (snapshot->index_map) {
+		size_t ilo = 0, ihi = snapshot->index_nr;
+
+		while (ilo < ihi) {
+			size_t mid = ilo + (ihi - ilo) / 2;
+			const char *pos = (const char *)snapshot->index_offsets +
+				mid * sizeof(uint32_t);
+			int cmp = cmp_index_name_to_refname(
+					index_refname(snapshot, pos), refname, start);
+
+			if (cmp < 0)
+				ilo = mid + 1;
+			else if (cmp > 0)
+				ihi = mid;
+			else
+				return pos;
+		}
+
+		if (mustexist)
+			return NULL;
+		return (const char *)snapshot->index_offsets +
+			ilo * sizeof(uint32_t);
+	}
+
 	while (lo != hi) {
 		const char *mid, *rec;
 		int cmp;
@@ -583,7 +739,7 @@ static const char *find_reference_location_1(struct snapshot *snapshot,
  * `refname` starts. If `mustexist` is true and the reference doesn't
  * exist, then return NULL. If `mustexist` is false and the reference
  * doesn't exist, then return the point where that reference would be
- * inserted, or `snapshot->eof` (which might be NULL) if it would be
+ * inserted, or `snapshot_end()` (which might be NULL) if it would be
  * inserted at the end of the file. In the latter mode, `refname`
  * doesn't have to be a proper reference name; for example, one could
  * search for "refs/replace/" to find the start of any replace
@@ -613,6 +769,91 @@ static const char *find_reference_location_end(struct snapshot *snapshot,
 	return find_reference_location_1(snapshot, refname, mustexist, 0);
 }
 
+static int index_read_offsets(const unsigned char *chunk_start,
+			      size_t chunk_size, void *data)
+{
+	struct snapshot *snapshot = data;
+
+	if (chunk_size % sizeof(uint32_t))
+		return error("%s.idx has a malformed offsets chunk",
+			     snapshot->refs->path);
+	snapshot->index_offsets = chunk_start;
+	snapshot->index_nr = chunk_size / sizeof(uint32_t);
+	return 0;
+}
+
+static int index_read_data(const unsigned char *chunk_start,
+			   size_t chunk_size, void *data)
+{
+	struct snapshot *snapshot = data;
+
+	if (chunk_size && chunk_start[chunk_size - 1])
+		return error("%s.idx has a malformed data chunk",
+			     snapshot->refs->path);
+	snapshot->index_data = chunk_start;
+	snapshot->index_data_size = chunk_size;
+	return 0;
+}
+
+/*
+ * Load the "packed-refs.idx" file into `snapshot` if its checksum
+ * matches `checksum`, as named by the header of `packed-refs`.
+ * Otherwise, leave the snapshot alone; it then falls back to parsing
+ * the records of `packed-refs` itself.
+ */
+static void load_index(struct snapshot *snapshot,
+		       const unsigned char *checksum)
+{
+	char *path = xstrfmt("%s.idx", snapshot->refs->path);
+	size_t rawsz = the_hash_algo->rawsz;
+	struct chunkfile *cf = NULL;
+	unsigned char *map;
+	struct stat st;
+	size_t size;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		goto out;
+	if (fstat(fd, &st)) {
+		close(fd);
+		goto out;
+	}
+	size = xsize_t(st.st_size);
+	if (size < PACKED_REFS_INDEX_HEADER_SIZE + rawsz) {
+		close(fd);
+		goto out;
+	}
+	map = xmmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (get_be32(map) != PACKED_REFS_INDEX_SIGNATURE ||
+	    map[4] != PACKED_REFS_INDEX_VERSION ||
+	    map[5] != oid_version(the_hash_algo) ||
+	    !hasheq(map + size - rawsz, checksum))
+		goto fail;
+
+	cf = init_chunkfile(NULL);
+	if (read_table_of_contents(cf, map, size,
+				   PACKED_REFS_INDEX_HEADER_SIZE, map[6]) ||
+	    read_chunk(cf, PACKED_REFS_INDEX_CHUNKID_OFFSETS,
+		       index_read_offsets, snapshot) ||
+	    read_chunk(cf, PACKED_REFS_INDEX_CHUNKID_DATA,
+		       index_read_data, snapshot))
+		goto fail;
+
+	snapshot->index_map = map;
+	snapshot->index_map_size = size;
+	goto out;
+
+fail:
+	munmap(map, size);
+	clear_snapshot_index(snapshot);
+out:
+	free_chunkfile(cf);
+	free(path);
+}
+
 /*
  * Create a newly-allocated `snapshot` of the `packed-refs` file in
  * its current state and return it. The return value will already have
@@ -645,11 +886,18 @@ static const char *find_reference_location_end(struct snapshot *snapshot,
  *   `sorted`:
  *
  *      The references in this file are known to be sorted by refname.
+ *
+ *   `index=<hex>`:
+ *
+ *      The "packed-refs.idx" file with the given checksum holds the
+ *      same references as this file. If it exists and the snapshot can
+ *      stay mmapped, it is used instead of the records of this file.
  */
 static struct snapshot *create_snapshot(struct packed_ref_store *refs)
 {
 	struct snapshot *snapshot = xcalloc(1, sizeof(*snapshot));
-	int sorted = 0;
+	unsigned char index_checksum[GIT_MAX_RAWSZ];
+	int sorted = 0, has_index = 0;
 
 	snapshot->refs = refs;
 	acquire_snapshot(snapshot);
@@ -662,6 +910,7 @@ static struct snapshot *create_snapshot(struct packed_ref_store *refs)
 	if (snapshot->buf < snapshot->eof && *snapshot->buf == '#') {
 		char *tmp, *p, *eol;
 		struct string_list traits = STRING_LIST_INIT_NODUP;
+		struct string_list_item *trait;
 
 		eol = memchr(snapshot->buf, '\n',
 			     snapshot->eof - snapshot->buf);
@@ -686,6 +935,16 @@ static struct snapshot *create_snapshot(struct packed_ref_store *refs)
 
 		sorted = unsorted_string_list_has_string(&traits, "sorted");
 
+		for_each_string_list_item(trait, &traits) {
+			const char *hex;
+
+			if (skip_prefix(trait->string, "index=", &hex) &&
+			    strlen(hex) == the_hash_algo->hexsz &&
+			    !hex_to_bytes(index_checksum, hex,
+					  the_hash_algo->rawsz))
+				has_index = 1;
+		}
+
 		/* perhaps other traits later as well */
 
 		/* The "+ 1" is for the LF character. */
@@ -722,6 +981,13 @@ static struct snapshot *create_snapshot(struct packed_ref_store *refs)
 		snapshot->eof = buf_copy + size;
 	}
 
+	/*
+	 * The index stays mmapped for as long as the snapshot lives,
+	 * so only use it where that is allowed.
+	 */
+	if (has_index && sorted && mmap_strategy == MMAP_OK)
+		load_index(snapshot, index_checksum);
+
 	return snapshot;
 }
 
@@ -775,8 +1041,13 @@ static int packed_read_raw_ref(struct ref_store *ref_store, const char *refname,
 		return -1;
 	}
 
-	if (get_oid_hex(rec, oid))
+	if (snapshot->index_map) {
+		int peeled;
+
+		oidread(oid, index_record(snapshot, rec, &peeled));
+	} else if (get_oid_hex(rec, oid)) {
 		die_invalid_line(refs->path, rec, snapshot->eof - rec);
+	}
 
 	*type = REF_ISPACKED;
 	return 0;
@@ -811,7 +1082,11 @@ struct packed_ref_iterator {
 	size_t jump_nr, jump_alloc;
 	size_t jump_cur;
 
-	/* Scratch space for current values: */
+	/*
+	 * Scratch space for current values. When iterating over an
+	 * index, `base.refname` points into the mmapped index instead of
+	 * `refname_buf`:
+	 */
 	struct object_id oid, peeled;
 	struct strbuf refname_buf;
 
@@ -819,6 +1094,56 @@ struct packed_ref_iterator {
 	unsigned int flags;
 };
 
+/*
+ * Check the refname of the record that the iterator is at, and set
+ * `REF_KNOWS_PEELED` if the header of the file says so.
+ */
+static void check_record_refname(struct packed_ref_iterator *iter)
+{
+	if (check_refname_format(iter->base.refname, REFNAME_ALLOW_ONELEVEL)) {
+		if (!refname_is_safe(iter->base.refname))
+			die("packed refname is dangerous: %s",
+			    iter->base.refname);
+		oidclr(&iter->oid);
+		iter->base.flags |= REF_BAD_NAME | REF_ISBROKEN;
+	}
+	if (iter->snapshot->peeled == PEELED_FULLY ||
+	    (iter->snapshot->peeled == PEELED_TAGS &&
+	     starts_with(iter->base.refname, "refs/tags/")))
+		iter->base.flags |= REF_KNOWS_PEELED;
+}
+
+/*
+ * Read the record of the index that the iterator is at and advance
+ * to the next one. The refname is used in place.
+ */
+static int next_index_record(struct packed_ref_iterator *iter)
+{
+	int peeled;
+	const unsigned char *rec = index_record(iter->snapshot, iter->pos,
+						&peeled);
+	size_t rawsz = the_hash_algo->rawsz;
+
+	oidread(&iter->oid, rec);
+	iter->base.refname = (const char *)rec + (peeled ? 2 : 1) * rawsz;
+	check_record_refname(iter);
+	iter->pos += sizeof(uint32_t);
+
+	if (peeled) {
+		if ((iter->base.flags & REF_ISBROKEN)) {
+			oidclr(&iter->peeled);
+			iter->base.flags &= ~REF_KNOWS_PEELED;
+		} else {
+			oidread(&iter->peeled, rec + rawsz);
+			iter->base.flags |= REF_KNOWS_PEELED;
+		}
+	} else {
+		oidclr(&iter->peeled);
+	}
+
+	return ITER_OK;
+}
+
 /*
  * Move the iterator to the next record in the snapshot, without
  * respect for whether the record is actually required by the current
@@ -857,6 +1182,9 @@ static int next_record(struct packed_ref_iterator *iter)
 		return ITER_DONE;
 
 	iter->base.flags = REF_ISPACKED;
+	if (iter->snapshot->index_map)
+		return next_index_record(iter);
+
 	p = iter->pos;
 
 	if (iter->eof - p < the_hash_algo->hexsz + 2 ||
@@ -872,18 +1200,7 @@ static int next_record(struct packed_ref_iterator *iter)
 
 	strbuf_add(&iter->refname_buf, p, eol - p);
 	iter->base.refname = iter->refname_buf.buf;
-
-	if (check_refname_format(iter->base.refname, REFNAME_ALLOW_ONELEVEL)) {
-		if (!refname_is_safe(iter->base.refname))
-			die("packed refname is dangerous: %s",
-			    iter->base.refname);
-		oidclr(&iter->oid);
-		iter->base.flags |= REF_BAD_NAME | REF_ISBROKEN;
-	}
-	if (iter->snapshot->peeled == PEELED_FULLY ||
-	    (iter->snapshot->peeled == PEELED_TAGS &&
-	     starts_with(iter->base.refname, "refs/tags/")))
-		iter->base.flags |= REF_KNOWS_PEELED;
+	check_record_refname(iter);
 
 	iter->pos = eol + 1;
 
@@ -1105,9 +1422,9 @@ static struct ref_iterator *packed_ref_iterator_begin(
 	if (prefix && *prefix)
 		start = find_reference_location(snapshot, prefix, 0);
 	else
-		start = snapshot->start;
+		start = snapshot_begin(snapshot);
 
-	if (start == snapshot->eof)
+	if (start == snapshot_end(snapshot))
 		return empty_ref_iterator_begin();
 
 	CALLOC_ARRAY(iter, 1);
@@ -1121,7 +1438,7 @@ static struct ref_iterator *packed_ref_iterator_begin(
 	acquire_snapshot(snapshot);
 
 	iter->pos = start;
-	iter->eof = snapshot->eof;
+	iter->eof = snapshot_end(snapshot);
 	strbuf_init(&iter->refname_buf, 0);
 
 	iter->base.oid = &iter->oid;
@@ -1136,13 +1453,119 @@ static struct ref_iterator *packed_ref_iterator_begin(
 	return ref_iterator;
 }
 
+/*
+ * The contents of a "packed-refs.idx" file that is being written, in
+ * the order of the references.
+ */
+struct index_builder {
+	uint32_t *offsets;
+	size_t nr, alloc;
+	struct strbuf data;
+
+	/* Set if the data grew too large for the offsets. */
+	unsigned overflow : 1;
+};
+
+#define INDEX_BUILDER_INIT { .data = STRBUF_INIT }
+
+static void index_builder_add(struct index_builder *index,
+			      const char *refname,
+			      const struct object_id *oid,
+			      const struct object_id *peeled)
+{
+	if (index->data.len >= PACKED_REFS_INDEX_PEELED) {
+		index->overflow = 1;
+		return;
+	}
+
+	ALLOC_GROW(index->offsets, index->nr + 1, index->alloc);
+	index->offsets[index->nr++] = index->data.len |
+		(peeled ? PACKED_REFS_INDEX_PEELED : 0);
+
+	strbuf_add(&index->data, oid->hash, the_hash_algo->rawsz);
+	if (peeled)
+		strbuf_add(&index->data, peeled->hash, the_hash_algo->rawsz);
+	strbuf_add(&index->data, refname, strlen(refname) + 1);
+}
+
+static void index_builder_release(struct index_builder *index)
+{
+	free(index->offsets);
+	strbuf_release(&index->data);
+}
+
+static int write_index_offsets(struct hashfile *f, void *data)
+{
+	struct index_builder *index = data;
+	size_t i;
+
+	for (i = 0; i < index->nr; i++)
+		hashwrite_be32(f, index->offsets[i]);
+	return 0;
+}
+
+static int write_index_data(struct hashfile *f, void *data)
+{
+	struct index_builder *index = data;
+
+	hashwrite(f, index->data.buf, index->data.len);
+	return 0;
+}
+
+/*
+ * Write `index` to the "packed-refs.idx" tempfile and store its
+ * checksum in `checksum`. On error, write an error message to `err`
+ * and return a nonzero value.
+ */
+static int write_index_file(struct packed_ref_store *refs,
+			    struct index_builder *index,
+			    unsigned char *checksum,
+			    struct strbuf *err)
+{
+	struct strbuf sb = STRBUF_INIT;
+	struct chunkfile *cf;
+	struct hashfile *f;
+
+	strbuf_addf(&sb, "%s.idx.new", refs->path);
+	refs->index_tempfile = create_tempfile(sb.buf);
+	if (!refs->index_tempfile) {
+		strbuf_addf(err, "unable to create file %s: %s",
+			    sb.buf, strerror(errno));
+		strbuf_release(&sb);
+		return -1;
+	}
+	strbuf_release(&sb);
+
+	f = hashfd(get_tempfile_fd(refs->index_tempfile),
+		   get_tempfile_path(refs->index_tempfile));
+	cf = init_chunkfile(f);
+	add_chunk(cf, PACKED_REFS_INDEX_CHUNKID_OFFSETS,
+		  st_mult(index->nr, sizeof(uint32_t)), write_index_offsets);
+	add_chunk(cf, PACKED_REFS_INDEX_CHUNKID_DATA,
+		  index->data.len, write_index_data);
+
+	hashwrite_be32(f, PACKED_REFS_INDEX_SIGNATURE);
+	hashwrite_u8(f, PACKED_REFS_INDEX_VERSION);
+	hashwrite_u8(f, oid_version(the_hash_algo));
+	hashwrite_u8(f, get_num_chunks(cf));
+	hashwrite_u8(f, 0); /* unused padding byte */
+
+	write_chunkfile(cf, index);
+	finalize_hashfile(f, checksum, FSYNC_COMPONENT_REFERENCE,
+			  CSUM_HASH_IN_STREAM | CSUM_FSYNC);
+	free_chunkfile(cf);
+	return 0;
+}
+
 /*
  * Write an entry to the packed-refs file for the specified refname.
- * If peeled is non-NULL, write it as the entry's peeled value. On
- * error, return a nonzero value and leave errno set at the value left
- * by the failing call to `fprintf()`.
+ * If peeled is non-NULL, write it as the entry's peeled value. If
+ * `index` is non-NULL, add the entry to it as well. On error, return
+ * a nonzero value and leave errno set at the value left by the
+ * failing call to `fprintf()`.
  */
-static int write_packed_entry(FILE *fh, const char *refname,
+static int write_packed_entry(FILE *fh, struct index_builder *index,
+			      const char *refname,
 			      const struct object_id *oid,
 			      const struct object_id *peeled)
 {
@@ -1150,6 +1573,8 @@ static int write_packed_entry(FILE *fh, const char *refname,
 	    (peeled && fprintf(fh, "^%s\n", oid_to_hex(peeled)) < 0))
 		return -1;
 
+	if (index)
+		index_builder_add(index, refname, oid, peeled);
 	return 0;
 }
 
@@ -1245,6 +1670,14 @@ int packed_refs_is_locked(struct ref_store *ref_store)
 static const char PACKED_REFS_HEADER[] =
 	"# pack-refs with: peeled fully-peeled sorted \n";
 
+/*
+ * The header line written when "core.packedRefsIndex" is enabled, up
+ * to the checksum of the index. The checksum is filled in once the
+ * index has been written, followed by the trailing space.
+ */
+static const char PACKED_REFS_HEADER_INDEX[] =
+	"# pack-refs with: peeled fully-peeled sorted index=";
+
 static int packed_init_db(struct ref_store *ref_store UNUSED,
 			  struct strbuf *err UNUSED)
 {
@@ -1272,10 +1705,15 @@ static int write_with_updates(struct packed_ref_store *refs,
 	FILE *out;
 	struct strbuf sb = STRBUF_INIT;
 	char *packed_refs_path;
+	struct index_builder index = INDEX_BUILDER_INIT;
+	int write_index = 0;
 
 	if (!is_lock_file_locked(&refs->lock))
 		BUG("write_with_updates() called while unlocked");
 
+	repo_config_get_bool(refs->base.repo, "core.packedrefsindex",
+			     &write_index);
+
 	/*
 	 * If packed-refs is a symlink, we want to overwrite the
 	 * symlinked-to file, not the symlink itself. Also, put the
@@ -1300,8 +1738,14 @@ static int write_with_updates(struct packed_ref_store *refs,
 		goto error;
 	}
 
-	if (fprintf(out, "%s", PACKED_REFS_HEADER) < 0)
+	if (write_index) {
+		/* Leave room for the checksum of the index. */
+		if (fprintf(out, "%s%s \n", PACKED_REFS_HEADER_INDEX,
+			    oid_to_hex(null_oid())) < 0)
+			goto write_error;
+	} else if (fprintf(out, "%s", PACKED_REFS_HEADER) < 0) {
 		goto write_error;
+	}
 
 	/*
 	 * We iterate in parallel through the current list of refs and
@@ -1394,7 +1838,8 @@ static int write_with_updates(struct packed_ref_store *refs,
 			struct object_id peeled;
 			int peel_error = ref_iterator_peel(iter, &peeled);
 
-			if (write_packed_entry(out, iter->refname,
+			if (write_packed_entry(out, write_index ? &index : NULL,
+					       iter->refname,
 					       iter->oid,
 					       peel_error ? NULL : &peeled))
 				goto write_error;
@@ -1415,7 +1860,8 @@ static int write_with_updates(struct packed_ref_store *refs,
 			int peel_error = peel_object(&update->new_oid,
 						     &peeled);
 
-			if (write_packed_entry(out, update->refname,
+			if (write_packed_entry(out, write_index ? &index : NULL,
+					       update->refname,
 					       &update->new_oid,
 					       peel_error ? NULL : &peeled))
 				goto write_error;
@@ -1430,6 +1876,21 @@ static int write_with_updates(struct packed_ref_store *refs,
 		goto error;
 	}
 
+	/*
+	 * If the index grew too large, the header keeps naming the null
+	 * checksum, which no index matches.
+	 */
+	if (write_index && !index.overflow) {
+		unsigned char checksum[GIT_MAX_RAWSZ];
+
+		if (write_index_file(refs, &index, checksum, err))
+			goto error;
+		if (fseek(out, strlen(PACKED_REFS_HEADER_INDEX), SEEK_SET) ||
+		    fputs(hash_to_hex(checksum), out) == EOF)
+			goto write_error;
+	}
+	index_builder_release(&index);
+
 	if (fflush(out) ||
 	    fsync_component(FSYNC_COMPONENT_REFERENCE, get_tempfile_fd(refs->tempfile)) ||
 	    close_tempfile_gently(refs->tempfile)) {
@@ -1438,6 +1899,7 @@ static int write_with_updates(struct packed_ref_store *refs,
 			    strerror(errno));
 		strbuf_release(&sb);
 		delete_tempfile(&refs->tempfile);
+		delete_tempfile(&refs->index_tempfile);
 		return -1;
 	}
 
@@ -1451,7 +1913,9 @@ static int write_with_updates(struct packed_ref_store *refs,
 	if (iter)
 		ref_iterator_abort(iter);
 
+	index_builder_release(&index);
 	delete_tempfile(&refs->tempfile);
+	delete_tempfile(&refs->index_tempfile);
 	return -1;
 }
 
@@ -1567,6 +2031,8 @@ static void packed_transaction_cleanup(struct packed_ref_store *refs,
 
 		if (is_tempfile_active(refs->tempfile))
 			delete_tempfile(&refs->tempfile);
+		if (is_tempfile_active(refs->index_tempfile))
+			delete_tempfile(&refs->index_tempfile);
 
 		if (data->own_lock && is_lock_file_locked(&refs->lock)) {
 			packed_refs_unlock(&refs->base);
@@ -1662,10 +2128,27 @@ static int packed_transaction_finish(struct ref_store *ref_store,
 			REF_STORE_READ | REF_STORE_WRITE | REF_STORE_ODB,
 			"ref_transaction_finish");
 	int ret = TRANSACTION_GENERIC_ERROR;
-	char *packed_refs_path;
+	char *packed_refs_path = NULL, *index_path;
 
 	clear_snapshot(refs);
 
+	/*
+	 * Put the index in place first. Until the new "packed-refs"
+	 * file follows, readers see a checksum mismatch and ignore it.
+	 */
+	index_path = xstrfmt("%s.idx", refs->path);
+	if (is_tempfile_active(refs->index_tempfile)) {
+		if (rename_tempfile(&refs->index_tempfile, index_path)) {
+			strbuf_addf(err, "error replacing %s: %s",
+				    index_path, strerror(errno));
+			free(index_path);
+			goto cleanup;
+		}
+	} else {
+		unlink_or_warn(index_path);
+	}
+	free(index_path);
+
 	packed_refs_path = get_locked_file_path(&refs->lock);
 	if (rename_tempfile(&refs->tempfile, packed_refs_path)) {
 		strbuf_addf(err, "error replacing %s: %s",
@@ -1754,7 +2237,6 @@ static struct ref_iterator *packed_reflog_iterator_begin(struct ref_store *ref_s
 }
 
 struct ref_storage_be refs_be_packed = {
-	.next = NULL,
 	.name = "packed",
 	.init = packed_ref_store_create,
 	.init_db = packed_init_db,
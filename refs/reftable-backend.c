@@ -0,0 +1,2375 @@
+#include "../git-compat-util.h"
+#include "../abspath.h"
+#include "../chdir-notify.h"
+#include "../environment.h"
+#include "../gettext.h"
+#include "../hash.h"
+#include "../hex.h"
+#include "../iterator.h"
+#include "../ident.h"
+#include "../lockfile.h"
+#include "../object.h"
+#include "../path.h"
+#include "../refs.h"
+#include "../reftable/reftable-stack.h"
+#include "../reftable/reftable-record.h"
+#include "../reftable/reftable-error.h"
+#include "../reftable/reftable-iterator.h"
+#include "../reftable/reftable-merged.h"
+#include "../setup.h"
+#include "../strmap.h"
+#include "refs-internal.h"
+
+struct reftable_ref_store {
+	struct ref_store base;
+
+	/*
+	 * The main stack refers to the common dir and thus contains common
+	 * refs as well as refs of the main repository.
+	 */
+	struct reftable_stack *main_stack;
+	/*
+	 * The worktree stack refers to the gitdir in case the refdb is opened
+	 * via a worktree. It thus contains the per-worktree refs.
+	 */
+	struct reftable_stack *worktree_stack;
+	/*
+	 * Map of worktree stacks by their respective worktree names. The map
+	 * is populated lazily when we try to resolve `worktrees/$worktree` refs.
+	 */
+	struct strmap worktree_stacks;
+	struct reftable_write_options write_options;
+
+	unsigned int store_flags;
+	int err;
+};
+
+/*
+ * Downcast ref_store to reftable_ref_store. Die if ref_store is not a
+ * reftable_ref_store. required_flags is compared with ref_store's store_flags
+ * to ensure the ref_store has all required capabilities. "caller" is used in
+ * any necessary error messages.
+ */
+static struct reftable_ref_store *reftable_be_downcast(struct ref_store *ref_store,
+						       unsigned int required_flags,
+						       const char *caller)
+{
+	struct reftable_ref_store *refs;
+
+	if (ref_store->be != &refs_be_reftable)
+		BUG("ref_store is type \"%s\" not \"reftable\" in %s",
+		    ref_store->be->name, caller);
+
+	refs = (struct reftable_ref_store *)ref_store;
+
+	if ((refs->store_flags & required_flags) != required_flags)
+		BUG("operation %s requires abilities 0x%x, but only have 0x%x",
+		    caller, required_flags, refs->store_flags);
+
+	return refs;
+}
+
+/*
+ * Open the stack in `dir`. Stacks of worktrees other than the main one are
+ * created lazily, so create the directory first when we may write to it.
+ */
+static int open_stack(struct reftable_ref_store *refs,
+		      struct reftable_stack **stack,
+		      const char *dir, int create_dir)
+{
+	if (create_dir && (refs->store_flags & REF_STORE_WRITE) &&
+	    mkdir(dir, 0777) < 0 && errno != EEXIST)
+		return error_errno(_("unable to create directory '%s'"), dir);
+	if (create_dir)
+		adjust_shared_perm(dir);
+
+	return reftable_new_stack(stack, dir, refs->write_options);
+}
+
+/*
+ * Some refs are global to the repository (refs/heads/{*}), while others are
+ * local to the worktree (eg. HEAD, refs/bisect/{*}). We solve this by having
+ * multiple separate databases (ie. multiple reftable/ directories), one for
+ * the shared refs, one for the current worktree refs, and one for each
+ * additional worktree. For reading, we merge the view of both the shared and
+ * the current worktree's refs, when necessary.
+ *
+ * This function also optionally assigns the rewritten reference name that is
+ * local to the stack. This translation is required when using worktree refs
+ * like `worktrees/$worktree/refs/heads/foo` as worktree stacks will store
+ * those references in their normalized form.
+ */
+static struct reftable_stack *stack_for(struct reftable_ref_store *store,
+					const char *refname,
+					const char **rewritten_ref)
+{
+	const char *wtname;
+	int wtname_len;
+
+	if (!refname)
+		return store->main_stack;
+
+	switch (parse_worktree_ref(refname, &wtname, &wtname_len, rewritten_ref)) {
+	case REF_WORKTREE_OTHER: {
+		static struct strbuf wtname_buf = STRBUF_INIT;
+		struct strbuf wt_dir = STRBUF_INIT;
+		struct reftable_stack *stack;
+
+		/*
+		 * We're using a static buffer here so that we don't need to
+		 * allocate the worktree name whenever we look up a reference.
+		 * This could be avoided if the strmap interface knew how to
+		 * handle keys with a length.
+		 */
+		strbuf_reset(&wtname_buf);
+		strbuf_add(&wtname_buf, wtname, wtname_len);
+
+		/*
+		 * There is an edge case here: when the worktree references the
+		 * current worktree, then we set up the stack once via
+		 * `worktree_stacks` and once via `worktree_stack`. This is
+		 * wasteful, but in the reading case it shouldn't matter. And
+		 * in the writing case we would notice that the stack is locked
+		 * already and error out when trying to write a reference via
+		 * both stacks.
+		 */
+		stack = strmap_get(&store->worktree_stacks, wtname_buf.buf);
+		if (!stack) {
+			strbuf_addf(&wt_dir, "%s/worktrees/%s/reftable",
+				    store->base.repo->commondir, wtname_buf.buf);
+			if (open_stack(store, &stack, wt_dir.buf, 1)) {
+				strbuf_release(&wt_dir);
+				return NULL;
+			}
+			strmap_put(&store->worktree_stacks, wtname_buf.buf, stack);
+		}
+
+		strbuf_release(&wt_dir);
+		return stack;
+	}
+	case REF_WORKTREE_CURRENT:
+		/*
+		 * If there is no worktree stack then we're currently in the
+		 * main worktree. We thus return the main stack in that case.
+		 */
+		if (!store->worktree_stack)
+			return store->main_stack;
+		return store->worktree_stack;
+	case REF_WORKTREE_MAIN:
+	case REF_WORKTREE_SHARED:
+		return store->main_stack;
+	default:
+		BUG("unhandled worktree reference type");
+	}
+}
+
+static int should_write_log(struct reftable_stack *stack, const char *refname);
+
+static void fill_reftable_log_record(struct reftable_log_record *log)
+{
+	const char *info = git_committer_info(0);
+	struct ident_split split = {0};
+	int sign = 1;
+
+	if (split_ident_line(&split, info, strlen(info)))
+		BUG("failed splitting committer info");
+
+	reftable_log_record_release(log);
+	log->value_type = REFTABLE_LOG_UPDATE;
+	log->value.update.name =
+		xstrndup(split.name_begin, split.name_end - split.name_begin);
+	log->value.update.email =
+		xstrndup(split.mail_begin, split.mail_end - split.mail_begin);
+	log->value.update.time = atol(split.date_begin);
+	if (*split.tz_begin == '-') {
+		sign = -1;
+		split.tz_begin++;
+	}
+	if (*split.tz_begin == '+') {
+		sign = 1;
+		split.tz_begin++;
+	}
+
+	log->value.update.tz_offset = sign * atoi(split.tz_begin);
+}
+
+static uint8_t *hash_dup(const struct object_id *oid)
+{
+	return xmemdupz(oid->hash, the_hash_algo->rawsz);
+}
+
+/*
+ * Read a single reference from the stack without reloading it first. Returns
+ * 0 on success, a positive value in case the reference does not exist, and a
+ * negative value on error.
+ */
+static int read_ref_without_reload(struct reftable_stack *stack,
+				   const char *refname,
+				   struct object_id *oid,
+				   struct strbuf *referent,
+				   unsigned int *type)
+{
+	struct reftable_ref_record ref = {0};
+	int ret;
+
+	ret = reftable_stack_read_ref(stack, refname, &ref);
+	if (ret)
+		goto done;
+
+	if (ref.value_type == REFTABLE_REF_SYMREF) {
+		strbuf_reset(referent);
+		strbuf_addstr(referent, ref.value.symref);
+		*type |= REF_ISSYMREF;
+	} else if (reftable_ref_record_val1(&ref)) {
+		oidread(oid, reftable_ref_record_val1(&ref));
+	} else {
+		/* We got a tombstone, which should not happen. */
+		BUG("unhandled reference value type %d", ref.value_type);
+	}
+
+done:
+	assert(ret != REFTABLE_API_ERROR);
+	reftable_ref_record_release(&ref);
+	return ret;
+}
+
+/*
+ * Resolve `refname` recursively without reloading any of the stacks. This is
+ * required while iterating over a stack: reloading it would release the
+ * tables that the iterator is reading from. Returns 0 and sets `oid` when the
+ * reference resolves to an object ID, -1 otherwise.
+ */
+static int resolve_ref_without_reload(struct reftable_ref_store *refs,
+				      const char *refname,
+				      struct object_id *oid,
+				      unsigned int *flags)
+{
+	struct strbuf name = STRBUF_INIT, referent = STRBUF_INIT;
+	int depth, ret = -1;
+
+	strbuf_addstr(&name, refname);
+	for (depth = 0; depth < SYMREF_MAXDEPTH; depth++) {
+		const char *rewritten_ref;
+		struct reftable_stack *stack = stack_for(refs, name.buf,
+							 &rewritten_ref);
+		unsigned int type = 0;
+
+		if (!stack ||
+		    read_ref_without_reload(stack, rewritten_ref, oid,
+					    &referent, &type))
+			break;
+		if (!(type & REF_ISSYMREF)) {
+			ret = 0;
+			break;
+		}
+
+		*flags |= REF_ISSYMREF;
+		strbuf_swap(&name, &referent);
+	}
+
+	if (ret)
+		oidclr(oid);
+	strbuf_release(&name);
+	strbuf_release(&referent);
+	return ret;
+}
+
+static struct ref_store *reftable_be_init(struct repository *repo,
+					  const char *gitdir,
+					  unsigned int store_flags)
+{
+	struct reftable_ref_store *refs = xcalloc(1, sizeof(*refs));
+	struct strbuf path = STRBUF_INIT;
+	int is_worktree;
+	mode_t mask;
+
+	mask = umask(0);
+	umask(mask);
+
+	base_ref_store_init(&refs->base, repo, gitdir, &refs_be_reftable);
+	strmap_init(&refs->worktree_stacks);
+	refs->store_flags = store_flags;
+	refs->write_options.hash_id = repo->hash_algo->format_id;
+	refs->write_options.default_permissions = calc_shared_perm(0666 & ~mask);
+	/*
+	 * Reference names are verified by the generic refs layer already, so
+	 * there is no need for the reftable library to check them once more
+	 * against all existing references on every write.
+	 */
+	refs->write_options.skip_name_check = 1;
+
+	/*
+	 * Set up the main reftable stack that is hosted in GIT_COMMON_DIR.
+	 * This stack contains both the shared and the main worktree refs.
+	 *
+	 * Note that we don't try to resolve the path in case we have a
+	 * worktree because `get_common_dir_noenv()` already does it for us.
+	 */
+	is_worktree = get_common_dir_noenv(&path, gitdir);
+	if (!is_worktree) {
+		strbuf_reset(&path);
+		strbuf_realpath(&path, gitdir, 0);
+	}
+	strbuf_addstr(&path, "/reftable");
+	refs->err = open_stack(refs, &refs->main_stack, path.buf, 0);
+	if (refs->err)
+		goto done;
+
+	/*
+	 * If we're in a worktree we also need to set up the worktree reftable
+	 * stack that is contained in the per-worktree GIT_DIR.
+	 *
+	 * Ideally, we would also add the stack to our worktree stack map. But
+	 * we have no way to figure out the worktree name here and thus can't
+	 * do it efficiently.
+	 */
+	if (is_worktree) {
+		strbuf_reset(&path);
+		strbuf_realpath(&path, gitdir, 0);
+		strbuf_addstr(&path, "/reftable");
+		refs->err = open_stack(refs, &refs->worktree_stack, path.buf, 1);
+		if (refs->err)
+			goto done;
+	}
+
+	chdir_notify_reparent("reftables-backend $GIT_DIR", &refs->base.gitdir);
+
+done:
+	assert(refs->err != REFTABLE_API_ERROR);
+	strbuf_release(&path);
+	return &refs->base;
+}
+
+static int reftable_be_init_db(struct ref_store *ref_store,
+			       struct strbuf *err UNUSED)
+{
+	struct reftable_ref_store *refs =
+		reftable_be_downcast(ref_store, REF_STORE_WRITE, "init_db");
+	struct strbuf sb = STRBUF_INIT;
+
+	strbuf_addf(&sb, "%s/reftable", refs->base.gitdir);
+	safe_create_dir(sb.buf, 1);
+	strbuf_reset(&sb);
+
+	/*
+	 * Older versions of Git only consider a directory to be a repository
+	 * if it has a HEAD file that looks like a ref and a "refs" directory.
+	 * Write a HEAD that points to an invalid branch name so that these
+	 * versions refuse to touch our references.
+	 */
+	strbuf_addf(&sb, "%s/HEAD", refs->base.gitdir);
+	write_file(sb.buf, "ref: refs/heads/.invalid");
+	adjust_shared_perm(sb.buf);
+	strbuf_reset(&sb);
+
+	strbuf_addf(&sb, "%s/refs", refs->base.gitdir);
+	safe_create_dir(sb.buf, 1);
+	strbuf_reset(&sb);
+
+	strbuf_addf(&sb, "%s/refs/heads", refs->base.gitdir);
+	write_file(sb.buf, "this repository uses the reftable format");
+	adjust_shared_perm(sb.buf);
+
+	strbuf_release(&sb);
+	return 0;
+}
+
+struct reftable_ref_iterator {
+	struct ref_iterator base;
+	struct reftable_ref_store *refs;
+	struct reftable_iterator iter;
+	struct reftable_ref_record ref;
+	struct object_id oid;
+
+	char *prefix;
+	unsigned int flags;
+	/*
+	 * Skip per-worktree refs. This is set for the main stack when the
+	 * store has been opened via a linked worktree, as per-worktree refs
+	 * contained in the main stack belong to the main worktree.
+	 */
+	unsigned int skip_worktree_refs : 1;
+	int err;
+};
+
+static int reftable_ref_iterator_advance(struct ref_iterator *ref_iterator)
+{
+	struct reftable_ref_iterator *iter =
+		(struct reftable_ref_iterator *)ref_iterator;
+	struct reftable_ref_store *refs = iter->refs;
+
+	while (!iter->err) {
+		unsigned int flags = 0;
+
+		iter->err = reftable_iterator_next_ref(&iter->iter, &iter->ref);
+		if (iter->err)
+			break;
+
+		/*
+		 * The files backend only lists references contained in
+		 * "refs/". We emulate the same behaviour here and thus skip
+		 * all references that don't start with this prefix.
+		 */
+		if (!starts_with(iter->ref.refname, "refs/"))
+			continue;
+
+		if (iter->prefix &&
+		    !starts_with(iter->ref.refname, iter->prefix)) {
+			iter->err = 1;
+			break;
+		}
+
+		if ((iter->flags & DO_FOR_EACH_PER_WORKTREE_ONLY ||
+		     iter->skip_worktree_refs) &&
+		    (parse_worktree_ref(iter->ref.refname, NULL, NULL, NULL) ==
+		     REF_WORKTREE_CURRENT) == !!iter->skip_worktree_refs)
+			continue;
+
+		switch (iter->ref.value_type) {
+		case REFTABLE_REF_VAL1:
+			oidread(&iter->oid, iter->ref.value.val1);
+			break;
+		case REFTABLE_REF_VAL2:
+			oidread(&iter->oid, iter->ref.value.val2.value);
+			break;
+		case REFTABLE_REF_SYMREF:
+			flags |= REF_ISSYMREF;
+			resolve_ref_without_reload(refs, iter->ref.refname,
+						   &iter->oid, &flags);
+			break;
+		default:
+			BUG("unhandled reference value type %d",
+			    iter->ref.value_type);
+		}
+
+		if (is_null_oid(&iter->oid))
+			flags |= REF_ISBROKEN;
+
+		if (check_refname_format(iter->ref.refname, REFNAME_ALLOW_ONELEVEL)) {
+			if (!refname_is_safe(iter->ref.refname))
+				die(_("refname is dangerous: %s"), iter->ref.refname);
+			oidclr(&iter->oid);
+			flags |= REF_BAD_NAME | REF_ISBROKEN;
+		}
+
+		if (iter->flags & DO_FOR_EACH_OMIT_DANGLING_SYMREFS &&
+		    flags & REF_ISSYMREF &&
+		    flags & REF_ISBROKEN)
+			continue;
+
+		if (!(iter->flags & DO_FOR_EACH_INCLUDE_BROKEN) &&
+		    !ref_resolves_to_object(iter->ref.refname, refs->base.repo,
+					    &iter->oid, flags))
+			continue;
+
+		iter->base.refname = iter->ref.refname;
+		iter->base.oid = &iter->oid;
+		iter->base.flags = flags;
+
+		break;
+	}
+
+	if (iter->err > 0) {
+		if (ref_iterator_abort(ref_iterator) != ITER_DONE)
+			return ITER_ERROR;
+		return ITER_DONE;
+	}
+
+	if (iter->err < 0) {
+		ref_iterator_abort(ref_iterator);
+		return ITER_ERROR;
+	}
+
+	return ITER_OK;
+}
+
+static int reftable_ref_iterator_peel(struct ref_iterator *ref_iterator,
+				      struct object_id *peeled)
+{
+	struct reftable_ref_iterator *iter =
+		(struct reftable_ref_iterator *)ref_iterator;
+
+	if (iter->ref.value_type == REFTABLE_REF_VAL2) {
+		oidread(peeled, iter->ref.value.val2.target_value);
+		return 0;
+	}
+
+	return peel_object(&iter->oid, peeled) ? -1 : 0;
+}
+
+static int reftable_ref_iterator_abort(struct ref_iterator *ref_iterator)
+{
+	struct reftable_ref_iterator *iter =
+		(struct reftable_ref_iterator *)ref_iterator;
+	reftable_ref_record_release(&iter->ref);
+	reftable_iterator_destroy(&iter->iter);
+	free(iter->prefix);
+	base_ref_iterator_free(ref_iterator);
+	return ITER_DONE;
+}
+
+static struct ref_iterator_vtable reftable_ref_iterator_vtable = {
+	.advance = reftable_ref_iterator_advance,
+	.peel = reftable_ref_iterator_peel,
+	.abort = reftable_ref_iterator_abort
+};
+
+static struct reftable_ref_iterator *ref_iterator_for_stack(struct reftable_ref_store *refs,
+							    struct reftable_stack *stack,
+							    const char *prefix,
+							    int flags)
+{
+	struct reftable_merged_table *merged_table;
+	struct reftable_ref_iterator *iter;
+	int ret;
+
+	iter = xcalloc(1, sizeof(*iter));
+	base_ref_iterator_init(&iter->base, &reftable_ref_iterator_vtable, 1);
+	iter->prefix = xstrdup_or_null(prefix);
+	iter->base.oid = &iter->oid;
+	iter->flags = flags;
+	iter->refs = refs;
+
+	ret = refs->err;
+	if (ret)
+		goto done;
+
+	ret = reftable_stack_reload(stack);
+	if (ret)
+		goto done;
+
+	merged_table = reftable_stack_merged_table(stack);
+
+	ret = reftable_merged_table_seek_ref(merged_table, &iter->iter,
+					     prefix ? prefix : "");
+	if (ret)
+		goto done;
+
+done:
+	iter->err = ret;
+	return iter;
+}
+
+static struct ref_iterator *reftable_be_iterator_begin(struct ref_store *ref_store,
+						       const char *prefix,
+						       const char **exclude_patterns UNUSED,
+						       unsigned int flags)
+{
+	struct reftable_ref_iterator *main_iter, *worktree_iter;
+	struct reftable_ref_store *refs;
+	unsigned int required_flags = REF_STORE_READ;
+
+	if (!(flags & DO_FOR_EACH_INCLUDE_BROKEN))
+		required_flags |= REF_STORE_ODB;
+	refs = reftable_be_downcast(ref_store, required_flags, "ref_iterator_begin");
+
+	main_iter = ref_iterator_for_stack(refs, refs->main_stack, prefix, flags);
+
+	/*
+	 * The worktree stack is only set when we're in an actual worktree
+	 * right now. If we aren't, then we return the common reftable
+	 * iterator, only.
+	 */
+	if (!refs->worktree_stack)
+		return &main_iter->base;
+
+	/*
+	 * Otherwise we merge both the common and the per-worktree refs into a
+	 * single iterator. Per-worktree refs of the main worktree must not be
+	 * visible from a linked worktree, so we hide them.
+	 */
+	main_iter->skip_worktree_refs = 1;
+	worktree_iter = ref_iterator_for_stack(refs, refs->worktree_stack, prefix, flags);
+	return overlay_ref_iterator_begin(&worktree_iter->base, &main_iter->base);
+}
+
+static int reftable_be_read_raw_ref(struct ref_store *ref_store,
+				    const char *refname,
+				    struct object_id *oid,
+				    struct strbuf *referent,
+				    unsigned int *type,
+				    int *failure_errno)
+{
+	struct reftable_ref_store *refs =
+		reftable_be_downcast(ref_store, REF_STORE_READ, "read_raw_ref");
+	struct reftable_stack *stack = stack_for(refs, refname, &refname);
+	int ret;
+
+	if (refs->err < 0 || !stack) {
+		*failure_errno = EIO;
+		return -1;
+	}
+
+	ret = reftable_stack_reload(stack);
+	if (ret)
+		goto error;
+
+	ret = read_ref_without_reload(stack, refname, oid, referent, type);
+	if (ret < 0)
+		goto error;
+	if (ret > 0) {
+		*failure_errno = ENOENT;
+		return -1;
+	}
+
+	return 0;
+
+error:
+	error(_("unable to read reference '%s': %s"), refname,
+	      reftable_error_str(ret));
+	*failure_errno = EIO;
+	return -1;
+}
+
+static int reftable_be_read_symbolic_ref(struct ref_store *ref_store,
+					 const char *refname,
+					 struct strbuf *referent)
+{
+	struct reftable_ref_store *refs =
+		reftable_be_downcast(ref_store, REF_STORE_READ, "read_symbolic_ref");
+	struct reftable_stack *stack = stack_for(refs, refname, &refname);
+	struct reftable_ref_record ref = {0};
+	int ret;
+
+	if (!stack)
+		return -1;
+
+	ret = reftable_stack_reload(stack);
+	if (ret)
+		return ret;
+
+	ret = reftable_stack_read_ref(stack, refname, &ref);
+	if (ret == 0 && ref.value_type == REFTABLE_REF_SYMREF)
+		strbuf_addstr(referent, ref.value.symref);
+	else
+		ret = -1;
+
+	reftable_ref_record_release(&ref);
+	return ret;
+}
+
+/*
+ * Return the refname under which update was originally requested.
+ */
+static const char *original_update_refname(struct ref_update *update)
+{
+	while (update->parent_update)
+		update = update->parent_update;
+	return update->refname;
+}
+
+/*
+ * Check whether the REF_HAVE_OLD and old_oid values stored in update
+ * are consistent with oid, which is the reference's current value. If
+ * everything is OK, return 0; otherwise, write an error message to
+ * err and return -1.
+ */
+static int check_old_oid(struct ref_update *update, struct object_id *oid,
+			 struct strbuf *err)
+{
+	if (!(update->flags & REF_HAVE_OLD) ||
+		   oideq(oid, &update->old_oid))
+		return 0;
+
+	if (is_null_oid(&update->old_oid))
+		strbuf_addf(err, "cannot lock ref '%s': "
+			    "reference already exists",
+			    original_update_refname(update));
+	else if (is_null_oid(oid))
+		strbuf_addf(err, "cannot lock ref '%s': "
+			    "reference is missing but expected %s",
+			    original_update_refname(update),
+			    oid_to_hex(&update->old_oid));
+	else
+		strbuf_addf(err, "cannot lock ref '%s': "
+			    "is at %s but expected %s",
+			    original_update_refname(update),
+			    oid_to_hex(oid),
+			    oid_to_hex(&update->old_oid));
+
+	return -1;
+}
+
+/*
+ * All updates of a transaction that go into the same stack are written as a
+ * single new table on top of that stack.
+ */
+struct write_transaction_table_arg {
+	struct reftable_ref_store *refs;
+	struct reftable_stack *stack;
+	struct reftable_addition *addition;
+	struct ref_update **updates;
+	size_t updates_nr;
+	size_t updates_alloc;
+};
+
+struct reftable_transaction_data {
+	struct write_transaction_table_arg *args;
+	size_t args_nr, args_alloc;
+};
+
+static void free_transaction_data(struct reftable_transaction_data *tx_data)
+{
+	if (!tx_data)
+		return;
+	for (size_t i = 0; i < tx_data->args_nr; i++) {
+		reftable_addition_destroy(tx_data->args[i].addition);
+		free(tx_data->args[i].updates);
+	}
+	free(tx_data->args);
+	free(tx_data);
+}
+
+/*
+ * Prepare transaction update for the given reference update. This will cause
+ * us to lock the corresponding reftable stack for concurrent modification.
+ */
+static int prepare_transaction_update(struct reftable_ref_store *refs,
+				      struct reftable_transaction_data *tx_data,
+				      struct ref_update *update,
+				      struct strbuf *err)
+{
+	struct reftable_stack *stack = stack_for(refs, update->refname, NULL);
+	struct write_transaction_table_arg *arg = NULL;
+	size_t i;
+	int ret;
+
+	if (!stack) {
+		strbuf_addf(err, _("cannot open reference database for '%s'"),
+			    update->refname);
+		return -1;
+	}
+
+	/*
+	 * Search for a preexisting stack update. If there is one then we add
+	 * the update to it, otherwise we set up a new stack update.
+	 */
+	for (i = 0; !arg && i < tx_data->args_nr; i++)
+		if (tx_data->args[i].stack == stack)
+			arg = &tx_data->args[i];
+
+	if (!arg) {
+		struct reftable_addition *addition;
+
+		ret = reftable_stack_reload(stack);
+		if (ret)
+			return ret;
+
+		ret = reftable_stack_new_addition(&addition, stack);
+		if (ret) {
+			/*
+			 * A positive return value indicates that somebody
+			 * else modified the stack between our reload and
+			 * taking the lock.
+			 */
+			if (ret > 0 || ret == REFTABLE_LOCK_ERROR)
+				strbuf_addstr(err, "cannot lock references");
+			return ret > 0 ? REFTABLE_LOCK_ERROR : ret;
+		}
+
+		ALLOC_GROW(tx_data->args, tx_data->args_nr + 1,
+			   tx_data->args_alloc);
+		arg = &tx_data->args[tx_data->args_nr++];
+		arg->refs = refs;
+		arg->stack = stack;
+		arg->addition = addition;
+		arg->updates = NULL;
+		arg->updates_nr = 0;
+		arg->updates_alloc = 0;
+	}
+
+	ALLOC_GROW(arg->updates, arg->updates_nr + 1, arg->updates_alloc);
+	arg->updates[arg->updates_nr++] = update;
+
+	/*
+	 * The current value of the reference is stashed in the update's
+	 * backend data so that we can record it in the reflog.
+	 */
+	if (!update->backend_data)
+		update->backend_data = xcalloc(1, sizeof(struct object_id));
+
+	return 0;
+}
+
+static int transaction_error(int ret, struct strbuf *err)
+{
+	switch (ret) {
+	case TRANSACTION_NAME_CONFLICT:
+	case TRANSACTION_GENERIC_ERROR:
+		return ret;
+	case REFTABLE_LOCK_ERROR:
+		if (!err->len)
+			strbuf_addstr(err, "cannot lock references");
+		return TRANSACTION_GENERIC_ERROR;
+	default:
+		if (!err->len)
+			strbuf_addf(err, _("reftable: transaction failure: %s"),
+				    reftable_error_str(ret));
+		return TRANSACTION_GENERIC_ERROR;
+	}
+}
+
+static void release_update_data(struct ref_transaction *transaction)
+{
+	for (size_t i = 0; i < transaction->nr; i++)
+		FREE_AND_NULL(transaction->updates[i]->backend_data);
+}
+
+static int reftable_be_transaction_prepare(struct ref_store *ref_store,
+					   struct ref_transaction *transaction,
+					   struct strbuf *err)
+{
+	struct reftable_ref_store *refs =
+		reftable_be_downcast(ref_store, REF_STORE_WRITE|REF_STORE_MAIN,
+				     "ref_transaction_prepare");
+	struct strbuf referent = STRBUF_INIT, head_referent = STRBUF_INIT;
+	struct string_list affected_refnames = STRING_LIST_INIT_NODUP;
+	struct reftable_transaction_data *tx_data = NULL;
+	struct reftable_stack *head_stack;
+	struct object_id head_oid;
+	unsigned int head_type = 0;
+	size_t i;
+	int ret;
+
+	ret = refs->err;
+	if (ret < 0)
+		goto done;
+
+	tx_data = xcalloc(1, sizeof(*tx_data));
+
+	/*
+	 * Preprocess all updates. For one we check that there are no duplicate
+	 * reference updates in this transaction. Second, we lock all stacks
+	 * that will be modified during the transaction.
+	 */
+	for (i = 0; i < transaction->nr; i++) {
+		ret = prepare_transaction_update(refs, tx_data,
+						 transaction->updates[i], err);
+		if (ret)
+			goto done;
+
+		string_list_append(&affected_refnames,
+				   transaction->updates[i]->refname);
+	}
+
+	/*
+	 * Now that we have counted updates per stack we can preallocate their
+	 * arrays. This avoids having to reallocate many times.
+	 */
+	string_list_sort(&affected_refnames);
+	if (ref_update_reject_duplicates(&affected_refnames, err)) {
+		ret = TRANSACTION_GENERIC_ERROR;
+		goto done;
+	}
+
+	/*
+	 * If HEAD is a symbolic reference then updates of the reference it
+	 * points to need to be reflected in the reflog of HEAD, too. We thus
+	 * remember where HEAD points to.
+	 */
+	head_stack = stack_for(refs, "HEAD", NULL);
+	ret = reftable_stack_reload(head_stack);
+	if (ret)
+		goto done;
+	ret = read_ref_without_reload(head_stack, "HEAD", &head_oid,
+				      &head_referent, &head_type);
+	if (ret < 0)
+		goto done;
+	ret = 0;
+
+	for (i = 0; i < transaction->nr; i++) {
+		struct ref_update *u = transaction->updates[i];
+		struct object_id current_oid = {0};
+		struct reftable_stack *stack;
+		const char *rewritten_ref;
+		struct ref_update *parent;
+
+		stack = stack_for(refs, u->refname, &rewritten_ref);
+
+		/* Verify that the new object ID is valid. */
+		if ((u->flags & REF_HAVE_NEW) && !is_null_oid(&u->new_oid) &&
+		    !(u->flags & REF_SKIP_OID_VERIFICATION) &&
+		    !(u->flags & REF_LOG_ONLY)) {
+			struct object *o = parse_object(refs->base.repo, &u->new_oid);
+			if (!o) {
+				strbuf_addf(err,
+					    "cannot update ref '%s': "
+					    "trying to write ref '%s' with nonexistent object %s",
+					    u->refname, u->refname,
+					    oid_to_hex(&u->new_oid));
+				ret = TRANSACTION_GENERIC_ERROR;
+				goto done;
+			}
+
+			if (o->type != OBJ_COMMIT && is_branch(u->refname)) {
+				strbuf_addf(err,
+					    "cannot update ref '%s': "
+					    "trying to write non-commit object %s to branch '%s'",
+					    u->refname, oid_to_hex(&u->new_oid),
+					    u->refname);
+				ret = TRANSACTION_GENERIC_ERROR;
+				goto done;
+			}
+		}
+
+		/*
+		 * When we update the reference that HEAD points to we enqueue
+		 * a second log-only update for HEAD so that its reflog is
+		 * updated accordingly.
+		 */
+		if (head_type == REF_ISSYMREF &&
+		    !(u->flags & REF_LOG_ONLY) &&
+		    !(u->flags & REF_UPDATE_VIA_HEAD) &&
+		    !strcmp(u->refname, head_referent.buf)) {
+			struct ref_update *new_update;
+
+			/*
+			 * First make sure that HEAD is not already in the
+			 * transaction. This check is O(lg N) in the transaction
+			 * size, but it happens at most once per transaction.
+			 */
+			if (string_list_has_string(&affected_refnames, "HEAD")) {
+				/* An entry already existed */
+				strbuf_addf(err,
+					    "multiple updates for 'HEAD' (including one "
+					    "via its referent '%s') are not allowed",
+					    u->refname);
+				ret = TRANSACTION_NAME_CONFLICT;
+				goto done;
+			}
+
+			new_update = ref_transaction_add_update(
+					transaction, "HEAD",
+					u->flags | REF_LOG_ONLY | REF_NO_DEREF,
+					&u->new_oid, &u->old_oid, u->msg);
+			string_list_insert(&affected_refnames, new_update->refname);
+			ret = prepare_transaction_update(refs, tx_data,
+							 new_update, err);
+			if (ret)
+				goto done;
+		}
+
+		ret = read_ref_without_reload(stack, rewritten_ref,
+					      &current_oid, &referent, &u->type);
+		if (ret < 0)
+			goto done;
+		if (ret > 0) {
+			/*
+			 * The reference does not exist. If we're about to
+			 * create it then we need to verify that there is no
+			 * conflicting reference so that we can output a
+			 * proper error message instead of writing a broken
+			 * table.
+			 */
+			ret = 0;
+			if ((u->flags & REF_HAVE_NEW) &&
+			    !is_null_oid(&u->new_oid) &&
+			    !(u->flags & REF_LOG_ONLY) &&
+			    refs_verify_refname_available(ref_store, u->refname,
+							  &affected_refnames, NULL,
+							  err)) {
+				ret = TRANSACTION_NAME_CONFLICT;
+				goto done;
+			}
+		}
+
+		if (u->type & REF_ISSYMREF) {
+			if (!(u->flags & REF_NO_DEREF)) {
+				/*
+				 * The reference is a symbolic reference that
+				 * we need to dereference. Split it up into a
+				 * log-only update of the symref and a
+				 * separate update of its referent. The old
+				 * object ID is verified when processing the
+				 * referent.
+				 */
+				struct ref_update *new_update;
+				unsigned int new_flags = u->flags;
+
+				/*
+				 * Record that the new update came via HEAD,
+				 * so that we don't add another reflog update
+				 * for HEAD when processing it.
+				 */
+				if (!strcmp(rewritten_ref, "HEAD"))
+					new_flags |= REF_UPDATE_VIA_HEAD;
+
+				/*
+				 * First make sure that referent is not already
+				 * in the transaction. This check is O(lg N) in
+				 * the transaction size, but it happens at most
+				 * once per symref in a transaction.
+				 */
+				if (string_list_has_string(&affected_refnames,
+							   referent.buf)) {
+					strbuf_addf(err,
+						    "multiple updates for '%s' (including one "
+						    "via symref '%s') are not allowed",
+						    referent.buf, u->refname);
+					ret = TRANSACTION_NAME_CONFLICT;
+					goto done;
+				}
+
+				new_update = ref_transaction_add_update(
+						transaction, referent.buf, new_flags,
+						&u->new_oid, &u->old_oid, u->msg);
+				new_update->parent_update = u;
+
+				/*
+				 * Change the symbolic ref update to log only.
+				 * Also, it doesn't need to check its old OID
+				 * value, as that will be done when new_update
+				 * is processed.
+				 */
+				u->flags |= REF_LOG_ONLY | REF_NO_DEREF;
+				u->flags &= ~REF_HAVE_OLD;
+
+				string_list_insert(&affected_refnames,
+						   new_update->refname);
+				ret = prepare_transaction_update(refs, tx_data,
+								 new_update, err);
+				if (ret)
+					goto done;
+				continue;
+			}
+
+			/*
+			 * We won't be reading the referent as part of the
+			 * transaction, so we have to read it here to record
+			 * and possibly check its old object ID.
+			 */
+			if (!refs_resolve_ref_unsafe(ref_store, referent.buf, 0,
+						     &current_oid, NULL)) {
+				if (u->flags & REF_HAVE_OLD) {
+					strbuf_addf(err, "cannot lock ref '%s': "
+						    "error reading reference",
+						    original_update_refname(u));
+					ret = TRANSACTION_GENERIC_ERROR;
+					goto done;
+				}
+				oidclr(&current_oid);
+			}
+		}
+
+		if (check_old_oid(u, &current_oid, err)) {
+			ret = TRANSACTION_GENERIC_ERROR;
+			goto done;
+		}
+
+		/*
+		 * Record the current value of the reference so that it can be
+		 * written into the reflog. If this update is happening
+		 * indirectly because of a symref update, record the old
+		 * object ID in the parent update, too.
+		 */
+		oidcpy(u->backend_data, &current_oid);
+		for (parent = u->parent_update; parent; parent = parent->parent_update)
+			oidcpy(parent->backend_data, &current_oid);
+	}
+
+	transaction->backend_data = tx_data;
+	transaction->state = REF_TRANSACTION_PREPARED;
+
+done:
+	assert(ret != REFTABLE_API_ERROR);
+	if (ret) {
+		free_transaction_data(tx_data);
+		release_update_data(transaction);
+		transaction->state = REF_TRANSACTION_CLOSED;
+		ret = transaction_error(ret, err);
+	}
+	string_list_clear(&affected_refnames, 0);
+	strbuf_release(&referent);
+	strbuf_release(&head_referent);
+
+	return ret;
+}
+
+static int reftable_be_transaction_abort(struct ref_store *ref_store UNUSED,
+					 struct ref_transaction *transaction,
+					 struct strbuf *err UNUSED)
+{
+	struct reftable_transaction_data *tx_data = transaction->backend_data;
+	free_transaction_data(tx_data);
+	release_update_data(transaction);
+	transaction->state = REF_TRANSACTION_CLOSED;
+	return 0;
+}
+
+static int transaction_update_cmp(const void *a, const void *b)
+{
+	const struct ref_update *ua = *(const struct ref_update **)a;
+	const struct ref_update *ub = *(const struct ref_update **)b;
+	return strcmp(ua->refname, ub->refname);
+}
+
+/*
+ * Collect deletion records for all reflog entries of `refname` so that the
+ * reflog goes away together with the reference.
+ */
+static int add_log_tombstones(struct reftable_merged_table *mt,
+			      const char *refname,
+			      struct reftable_log_record **logs,
+			      size_t *logs_nr, size_t *logs_alloc)
+{
+	struct reftable_iterator it = {0};
+	struct reftable_log_record log = {0};
+	int ret;
+
+	ret = reftable_merged_table_seek_log(mt, &it, refname);
+	while (!ret) {
+		struct reftable_log_record *tombstone;
+
+		ret = reftable_iterator_next_log(&it, &log);
+		if (ret < 0)
+			break;
+		if (ret > 0 || strcmp(log.refname, refname)) {
+			ret = 0;
+			break;
+		}
+
+		ALLOC_GROW(*logs, *logs_nr + 1, *logs_alloc);
+		tombstone = &(*logs)[(*logs_nr)++];
+		memset(tombstone, 0, sizeof(*tombstone));
+		tombstone->refname = xstrdup(refname);
+		tombstone->value_type = REFTABLE_LOG_DELETION;
+		tombstone->update_index = log.update_index;
+	}
+
+	if (ret > 0)
+		ret = 0;
+	reftable_log_record_release(&log);
+	reftable_iterator_destroy(&it);
+	return ret;
+}
+
+static int write_transaction_table(struct reftable_writer *writer, void *cb_data)
+{
+	struct write_transaction_table_arg *arg = cb_data;
+	struct reftable_merged_table *mt =
+		reftable_stack_merged_table(arg->stack);
+	uint64_t ts = reftable_stack_next_update_index(arg->stack);
+	struct reftable_log_record *logs = NULL, committer = {0};
+	struct reftable_ref_record *refs = NULL;
+	size_t logs_nr = 0, logs_alloc = 0, refs_nr = 0, refs_alloc = 0, i;
+	struct object_id peeled;
+	int ret = 0;
+
+	QSORT(arg->updates, arg->updates_nr, transaction_update_cmp);
+
+	reftable_writer_set_limits(writer, ts, ts);
+	fill_reftable_log_record(&committer);
+
+	for (i = 0; i < arg->updates_nr; i++) {
+		struct ref_update *u = arg->updates[i];
+		struct object_id *old_oid = u->backend_data;
+		const char *refname;
+
+		if (!(u->flags & REF_HAVE_NEW))
+			continue;
+
+		stack_for(arg->refs, u->refname, &refname);
+
+		if (!(u->flags & REF_LOG_ONLY)) {
+			if (is_null_oid(&u->new_oid)) {
+				/*
+				 * Deleting a reference also deletes its
+				 * reflog.
+				 */
+				ret = add_log_tombstones(mt, refname, &logs,
+							 &logs_nr, &logs_alloc);
+				if (ret < 0)
+					goto done;
+			} else if (!(u->type & REF_ISSYMREF) &&
+				   oideq(old_oid, &u->new_oid)) {
+				/*
+				 * The reference already has the desired
+				 * value, so we don't need to write it.
+				 */
+				continue;
+			}
+
+			ALLOC_GROW(refs, refs_nr + 1, refs_alloc);
+			memset(&refs[refs_nr], 0, sizeof(refs[refs_nr]));
+			refs[refs_nr].refname = (char *)refname;
+			refs[refs_nr].update_index = ts;
+			if (is_null_oid(&u->new_oid)) {
+				refs[refs_nr].value_type = REFTABLE_REF_DELETION;
+			} else if (!peel_object(&u->new_oid, &peeled)) {
+				refs[refs_nr].value_type = REFTABLE_REF_VAL2;
+				refs[refs_nr].value.val2.value = u->new_oid.hash;
+				refs[refs_nr].value.val2.target_value = peeled.hash;
+			} else {
+				refs[refs_nr].value_type = REFTABLE_REF_VAL1;
+				refs[refs_nr].value.val1 = u->new_oid.hash;
+			}
+			refs_nr++;
+
+			if (is_null_oid(&u->new_oid))
+				continue;
+		}
+
+		if (!(u->flags & REF_FORCE_CREATE_REFLOG) &&
+		    !should_write_log(arg->stack, refname))
+			continue;
+
+		ALLOC_GROW(logs, logs_nr + 1, logs_alloc);
+		memset(&logs[logs_nr], 0, sizeof(logs[logs_nr]));
+		logs[logs_nr].refname = xstrdup(refname);
+		logs[logs_nr].update_index = ts;
+		logs[logs_nr].value_type = REFTABLE_LOG_UPDATE;
+		logs[logs_nr].value.update.name = xstrdup(committer.value.update.name);
+		logs[logs_nr].value.update.email = xstrdup(committer.value.update.email);
+		logs[logs_nr].value.update.time = committer.value.update.time;
+		logs[logs_nr].value.update.tz_offset = committer.value.update.tz_offset;
+		logs[logs_nr].value.update.message = xstrdup(u->msg ? u->msg : "");
+		logs[logs_nr].value.update.old_hash = hash_dup(old_oid);
+		logs[logs_nr].value.update.new_hash = hash_dup(&u->new_oid);
+		logs_nr++;
+	}
+
+	ret = reftable_writer_add_refs(writer, refs, refs_nr);
+	if (ret < 0)
+		goto done;
+
+	ret = reftable_writer_add_logs(writer, logs, logs_nr);
+	if (ret < 0)
+		goto done;
+
+done:
+	assert(ret != REFTABLE_API_ERROR);
+	for (i = 0; i < logs_nr; i++)
+		reftable_log_record_release(&logs[i]);
+	reftable_log_record_release(&committer);
+	free(logs);
+	free(refs);
+	return ret;
+}
+
+static int reftable_be_transaction_finish(struct ref_store *ref_store UNUSED,
+					  struct ref_transaction *transaction,
+					  struct strbuf *err)
+{
+	struct reftable_transaction_data *tx_data = transaction->backend_data;
+	int ret = 0;
+
+	for (size_t i = 0; tx_data && i < tx_data->args_nr; i++) {
+		ret = reftable_addition_add(tx_data->args[i].addition,
+					    write_transaction_table, &tx_data->args[i]);
+		if (ret < 0)
+			goto done;
+
+		ret = reftable_addition_commit(tx_data->args[i].addition);
+		if (ret < 0)
+			goto done;
+	}
+
+done:
+	assert(ret != REFTABLE_API_ERROR);
+	free_transaction_data(tx_data);
+	release_update_data(transaction);
+	transaction->backend_data = NULL;
+	transaction->state = REF_TRANSACTION_CLOSED;
+
+	if (ret) {
+		strbuf_addf(err, _("reftable: transaction failure: %s"),
+			    reftable_error_str(ret));
+		return -1;
+	}
+	return ret;
+}
+
+static int reftable_be_initial_transaction_commit(struct ref_store *ref_store UNUSED,
+						  struct ref_transaction *transaction,
+						  struct strbuf *err)
+{
+	return ref_transaction_commit(transaction, err);
+}
+
+static int reftable_be_pack_refs(struct ref_store *ref_store,
+				 struct pack_refs_opts *opts UNUSED)
+{
+	struct reftable_ref_store *refs =
+		reftable_be_downcast(ref_store, REF_STORE_WRITE | REF_STORE_ODB, "pack_refs");
+	struct reftable_stack *stacks[2] = { refs->main_stack, refs->worktree_stack };
+	int ret = 0;
+
+	if (refs->err)
+		return refs->err;
+
+	for (size_t i = 0; i < ARRAY_SIZE(stacks) && stacks[i]; i++) {
+		ret = reftable_stack_compact_all(stacks[i], NULL);
+		if (ret)
+			break;
+		ret = reftable_stack_clean(stacks[i]);
+		if (ret)
+			break;
+	}
+
+	if (ret)
+		return error(_("unable to compact stack: %s"),
+			     reftable_error_str(ret));
+	return 0;
+}
+
+struct write_create_symref_arg {
+	struct reftable_ref_store *refs;
+	struct reftable_stack *stack;
+	const char *refname;
+	const char *target;
+	const char *logmsg;
+};
+
+static int write_create_symref_table(struct reftable_writer *writer, void *cb_data)
+{
+	struct write_create_symref_arg *create = cb_data;
+	uint64_t ts = reftable_stack_next_update_index(create->stack);
+	struct reftable_ref_record ref = {
+		.refname = (char *)create->refname,
+		.value_type = REFTABLE_REF_SYMREF,
+		.value.symref = (char *)create->target,
+		.update_index = ts,
+	};
+	struct reftable_log_record log = {0};
+	struct object_id new_oid;
+	struct object_id old_oid;
+	unsigned int flags = 0;
+	int ret;
+
+	reftable_writer_set_limits(writer, ts, ts);
+
+	ret = reftable_writer_add_ref(writer, &ref);
+	if (ret)
+		return ret;
+
+	/*
+	 * Note that it is important to try and resolve the reference before we
+	 * write the log entry. This is because `should_write_log()` will munge
+	 * `core.logAllRefUpdates`, which is undesirable when we create a new
+	 * repository because it would be written into the config. As HEAD will
+	 * not resolve for new repositories this ordering will ensure that this
+	 * never happens.
+	 */
+	if (!create->logmsg ||
+	    resolve_ref_without_reload(create->refs, create->target,
+				       &new_oid, &flags) ||
+	    !should_write_log(create->stack, create->refname))
+		return 0;
+
+	if (resolve_ref_without_reload(create->refs, create->refname,
+				       &old_oid, &flags))
+		oidclr(&old_oid);
+
+	fill_reftable_log_record(&log);
+	log.refname = xstrdup(create->refname);
+	log.update_index = ts;
+	log.value.update.message = xstrdup(create->logmsg);
+	log.value.update.new_hash = hash_dup(&new_oid);
+	log.value.update.old_hash = hash_dup(&old_oid);
+
+	ret = reftable_writer_add_log(writer, &log);
+	reftable_log_record_release(&log);
+	return ret;
+}
+
+static int reftable_be_create_symref(struct ref_store *ref_store,
+				     const char *refname,
+				     const char *target,
+				     const char *logmsg)
+{
+	struct reftable_ref_store *refs =
+		reftable_be_downcast(ref_store, REF_STORE_WRITE, "create_symref");
+	struct reftable_stack *stack = stack_for(refs, refname, &refname);
+	struct write_create_symref_arg arg = {
+		.refs = refs,
+		.stack = stack,
+		.refname = refname,
+		.target = target,
+		.logmsg = logmsg,
+	};
+	int ret;
+
+	ret = refs->err;
+	if (ret < 0 || !stack)
+		goto done;
+
+	ret = reftable_stack_reload(stack);
+	if (ret)
+		goto done;
+
+	ret = reftable_stack_add(stack, &write_create_symref_table, &arg);
+
+done:
+	assert(ret != REFTABLE_API_ERROR);
+	if (ret)
+		error("unable to write symref for %s: %s", refname,
+		      ret < 0 ? reftable_error_str(ret) : "unknown error");
+	return ret;
+}
+
+static int reftable_be_delete_refs(struct ref_store *ref_store,
+				   const char *msg,
+				   struct string_list *refnames,
+				   unsigned int flags)
+{
+	struct ref_transaction *transaction;
+	struct strbuf err = STRBUF_INIT;
+	struct string_list_item *item;
+	int ret = 0, failures = 0;
+
+	if (!refnames->nr)
+		return 0;
+
+	transaction = ref_store_transaction_begin(ref_store, &err);
+	if (!transaction)
+		goto error;
+
+	for_each_string_list_item(item, refnames) {
+		if (ref_transaction_delete(transaction, item->string, NULL,
+					   flags, msg, &err)) {
+			warning(_("could not delete reference %s: %s"),
+				item->string, err.buf);
+			strbuf_reset(&err);
+			failures = 1;
+		}
+	}
+
+	if (ref_transaction_commit(transaction, &err))
+		goto error;
+
+	ref_transaction_free(transaction);
+	strbuf_release(&err);
+	return failures ? -1 : 0;
+
+error:
+	if (refnames->nr == 1)
+		error(_("could not delete reference %s: %s"),
+		      refnames->items[0].string, err.buf);
+	else
+		error(_("could not delete references: %s"), err.buf);
+
+	if (transaction)
+		ref_transaction_free(transaction);
+	strbuf_release(&err);
+	ret = -1;
+	return ret;
+}
+
+struct write_copy_arg {
+	struct reftable_ref_store *refs;
+	struct reftable_stack *stack;
+	const char *oldname;
+	const char *newname;
+	const char *logmsg;
+	int delete_old;
+};
+
+static int write_copy_table(struct reftable_writer *writer, void *cb_data)
+{
+	struct write_copy_arg *arg = cb_data;
+	uint64_t ts = reftable_stack_next_update_index(arg->stack);
+	struct reftable_merged_table *mt = reftable_stack_merged_table(arg->stack);
+	struct reftable_ref_record old_ref = {0}, refs[2] = {0};
+	struct reftable_log_record old_log = {0}, *logs = NULL;
+	struct reftable_iterator it = {0};
+	struct string_list skip = STRING_LIST_INIT_NODUP;
+	struct strbuf errbuf = STRBUF_INIT;
+	struct object_id old_oid, new_oid;
+	size_t logs_nr = 0, logs_alloc = 0, refs_nr = 0, i;
+	unsigned int flags = 0;
+	int ret;
+
+	if (reftable_stack_read_ref(arg->stack, arg->oldname, &old_ref)) {
+		ret = error(_("refname %s not found"), arg->oldname);
+		goto done;
+	}
+	if (old_ref.value_type == REFTABLE_REF_SYMREF) {
+		ret = error(_("refname %s is a symbolic ref, copying it is not supported"),
+			    arg->oldname);
+		goto done;
+	}
+
+	/*
+	 * There's nothing to do in case the old and new name are the same, so
+	 * we exit early in that case.
+	 */
+	if (!strcmp(arg->oldname, arg->newname)) {
+		ret = 0;
+		goto done;
+	}
+
+	/*
+	 * Verify that the new refname is available.
+	 */
+	string_list_insert(&skip, arg->oldname);
+	if (refs_verify_refname_available(&arg->refs->base, arg->newname,
+					  NULL, &skip, &errbuf)) {
+		ret = error("%s", errbuf.buf);
+		goto done;
+	}
+
+	reftable_writer_set_limits(writer, ts, ts);
+
+	/*
+	 * Write the new reference, and delete the old one if we are
+	 * renaming.
+	 */
+	refs[refs_nr] = old_ref;
+	refs[refs_nr].refname = (char *)arg->newname;
+	refs[refs_nr].update_index = ts;
+	refs_nr++;
+
+	if (arg->delete_old) {
+		refs[refs_nr].refname = (char *)arg->oldname;
+		refs[refs_nr].value_type = REFTABLE_REF_DELETION;
+		refs[refs_nr].update_index = ts;
+		refs_nr++;
+	}
+
+	ret = reftable_writer_add_refs(writer, refs, refs_nr);
+	if (ret < 0)
+		goto done;
+
+	/*
+	 * Copy over the reflog of the old reference and, when renaming,
+	 * delete the old one.
+	 */
+	ret = reftable_merged_table_seek_log(mt, &it, arg->oldname);
+	while (!ret) {
+		ret = reftable_iterator_next_log(&it, &old_log);
+		if (ret < 0)
+			goto done;
+		if (ret > 0 || strcmp(old_log.refname, arg->oldname)) {
+			ret = 0;
+			break;
+		}
+
+		ALLOC_GROW(logs, logs_nr + 1, logs_alloc);
+		memset(&logs[logs_nr], 0, sizeof(logs[logs_nr]));
+		logs[logs_nr].refname = xstrdup(arg->newname);
+		logs[logs_nr].update_index = old_log.update_index;
+		logs[logs_nr].value_type = REFTABLE_LOG_UPDATE;
+		logs[logs_nr].value.update = old_log.value.update;
+		logs[logs_nr].value.update.name = xstrdup_or_null(old_log.value.update.name);
+		logs[logs_nr].value.update.email = xstrdup_or_null(old_log.value.update.email);
+		logs[logs_nr].value.update.message = xstrdup_or_null(old_log.value.update.message);
+		logs[logs_nr].value.update.new_hash =
+			xmemdupz(old_log.value.update.new_hash, the_hash_algo->rawsz);
+		logs[logs_nr].value.update.old_hash =
+			xmemdupz(old_log.value.update.old_hash, the_hash_algo->rawsz);
+		logs_nr++;
+
+		if (arg->delete_old) {
+			ALLOC_GROW(logs, logs_nr + 1, logs_alloc);
+			memset(&logs[logs_nr], 0, sizeof(logs[logs_nr]));
+			logs[logs_nr].refname = xstrdup(arg->oldname);
+			logs[logs_nr].update_index = old_log.update_index;
+			logs[logs_nr].value_type = REFTABLE_LOG_DELETION;
+			logs_nr++;
+		}
+	}
+
+	/*
+	 * Record the copy or rename itself in the new reflog, the same way
+	 * the files backend does.
+	 */
+	if (logs_nr || should_write_log(arg->stack, arg->newname)) {
+		if (resolve_ref_without_reload(arg->refs, arg->newname,
+					       &old_oid, &flags))
+			oidclr(&old_oid);
+		oidread(&new_oid, reftable_ref_record_val1(&old_ref));
+
+		ALLOC_GROW(logs, logs_nr + 1, logs_alloc);
+		memset(&logs[logs_nr], 0, sizeof(logs[logs_nr]));
+		fill_reftable_log_record(&logs[logs_nr]);
+		logs[logs_nr].refname = xstrdup(arg->newname);
+		logs[logs_nr].update_index = ts;
+		logs[logs_nr].value.update.message =
+			xstrdup(arg->logmsg ? arg->logmsg : "");
+		logs[logs_nr].value.update.old_hash = hash_dup(&old_oid);
+		logs[logs_nr].value.update.new_hash = hash_dup(&new_oid);
+		logs_nr++;
+	}
+
+	ret = reftable_writer_add_logs(writer, logs, logs_nr);
+
+done:
+	assert(ret != REFTABLE_API_ERROR);
+	reftable_iterator_destroy(&it);
+	string_list_clear(&skip, 0);
+	strbuf_release(&errbuf);
+	for (i = 0; i < logs_nr; i++)
+		reftable_log_record_release(&logs[i]);
+	free(logs);
+	reftable_ref_record_release(&old_ref);
+	reftable_log_record_release(&old_log);
+	return ret;
+}
+
+static int copy_or_rename_ref(struct ref_store *ref_store,
+			      const char *oldrefname,
+			      const char *newrefname,
+			      const char *logmsg, int delete_old,
+			      const char *caller)
+{
+	struct reftable_ref_store *refs =
+		reftable_be_downcast(ref_store, REF_STORE_WRITE, caller);
+	struct reftable_stack *stack = stack_for(refs, newrefname, &newrefname);
+	struct write_copy_arg arg = {
+		.refs = refs,
+		.stack = stack,
+		.newname = newrefname,
+		.logmsg = logmsg,
+		.delete_old = delete_old,
+	};
+	int ret;
+
+	ret = refs->err;
+	if (ret < 0)
+		goto done;
+
+	if (!stack || stack_for(refs, oldrefname, &arg.oldname) != stack) {
+		ret = error(_("cannot move references across worktrees: '%s' to '%s'"),
+			    oldrefname, newrefname);
+		goto done;
+	}
+
+	ret = reftable_stack_reload(stack);
+	if (ret)
+		goto done;
+	ret = reftable_stack_add(stack, &write_copy_table, &arg);
+
+done:
+	assert(ret != REFTABLE_API_ERROR);
+	return ret;
+}
+
+static int reftable_be_rename_ref(struct ref_store *ref_store,
+				  const char *oldrefname,
+				  const char *newrefname,
+				  const char *logmsg)
+{
+	return copy_or_rename_ref(ref_store, oldrefname, newrefname, logmsg,
+				  1, "rename_ref");
+}
+
+static int reftable_be_copy_ref(struct ref_store *ref_store,
+				const char *oldrefname,
+				const char *newrefname,
+				const char *logmsg)
+{
+	return copy_or_rename_ref(ref_store, oldrefname, newrefname, logmsg,
+				  0, "copy_ref");
+}
+
+struct reftable_reflog_iterator {
+	struct ref_iterator base;
+	struct reftable_ref_store *refs;
+	struct reftable_iterator iter;
+	struct reftable_log_record log;
+	struct object_id oid;
+	char *last_name;
+	unsigned int skip_worktree_refs : 1;
+	int err;
+};
+
+static int reftable_reflog_iterator_advance(struct ref_iterator *ref_iterator)
+{
+	struct reftable_reflog_iterator *iter =
+		(struct reftable_reflog_iterator *)ref_iterator;
+
+	while (!iter->err) {
+		unsigned int flags = 0;
+
+		iter->err = reftable_iterator_next_log(&iter->iter, &iter->log);
+		if (iter->err)
+			break;
+
+		/*
+		 * We want the refnames that we have reflogs for, so we skip if
+		 * we've already produced this name. This could be faster by
+		 * seeking directly to reflog@update_index==0.
+		 */
+		if (iter->last_name && !strcmp(iter->log.refname, iter->last_name))
+			continue;
+
+		free(iter->last_name);
+		iter->last_name = xstrdup(iter->log.refname);
+
+		if (iter->skip_worktree_refs &&
+		    parse_worktree_ref(iter->log.refname, NULL, NULL, NULL) ==
+		    REF_WORKTREE_CURRENT)
+			continue;
+
+		resolve_ref_without_reload(iter->refs, iter->log.refname,
+					   &iter->oid, &flags);
+
+		iter->base.refname = iter->log.refname;
+		iter->base.oid = &iter->oid;
+		iter->base.flags = flags;
+
+		break;
+	}
+
+	if (iter->err > 0) {
+		if (ref_iterator_abort(ref_iterator) != ITER_DONE)
+			return ITER_ERROR;
+		return ITER_DONE;
+	}
+
+	if (iter->err < 0) {
+		ref_iterator_abort(ref_iterator);
+		return ITER_ERROR;
+	}
+
+	return ITER_OK;
+}
+
+static int reftable_reflog_iterator_peel(struct ref_iterator *ref_iterator UNUSED,
+					 struct object_id *peeled UNUSED)
+{
+	BUG("reftable reflog iterator cannot be peeled");
+	return -1;
+}
+
+static int reftable_reflog_iterator_abort(struct ref_iterator *ref_iterator)
+{
+	struct reftable_reflog_iterator *iter =
+		(struct reftable_reflog_iterator *)ref_iterator;
+	reftable_log_record_release(&iter->log);
+	reftable_iterator_destroy(&iter->iter);
+	free(iter->last_name);
+	base_ref_iterator_free(ref_iterator);
+	return ITER_DONE;
+}
+
+static struct ref_iterator_vtable reftable_reflog_iterator_vtable = {
+	.advance = reftable_reflog_iterator_advance,
+	.peel = reftable_reflog_iterator_peel,
+	.abort = reftable_reflog_iterator_abort
+};
+
+static struct reftable_reflog_iterator *reflog_iterator_for_stack(struct reftable_ref_store *refs,
+								  struct reftable_stack *stack)
+{
+	struct reftable_merged_table *merged_table;
+	struct reftable_reflog_iterator *iter;
+	int ret;
+
+	iter = xcalloc(1, sizeof(*iter));
+	base_ref_iterator_init(&iter->base, &reftable_reflog_iterator_vtable, 1);
+	iter->refs = refs;
+	iter->base.oid = &iter->oid;
+
+	ret = refs->err;
+	if (ret)
+		goto done;
+
+	ret = reftable_stack_reload(stack);
+	if (ret < 0)
+		goto done;
+
+	merged_table = reftable_stack_merged_table(stack);
+
+	ret = reftable_merged_table_seek_log(merged_table, &iter->iter, "");
+	if (ret < 0)
+		goto done;
+
+done:
+	iter->err = ret;
+	return iter;
+}
+
+static struct ref_iterator *reftable_be_reflog_iterator_begin(struct ref_store *ref_store)
+{
+	struct reftable_ref_store *refs =
+		reftable_be_downcast(ref_store, REF_STORE_READ, "reflog_iterator_begin");
+	struct reftable_reflog_iterator *main_iter, *worktree_iter;
+
+	main_iter = reflog_iterator_for_stack(refs, refs->main_stack);
+	if (!refs->worktree_stack)
+		return &main_iter->base;
+
+	main_iter->skip_worktree_refs = 1;
+	worktree_iter = reflog_iterator_for_stack(refs, refs->worktree_stack);
+
+	return overlay_ref_iterator_begin(&worktree_iter->base, &main_iter->base);
+}
+
+static int yield_log_record(struct reftable_log_record *log,
+			    each_reflog_ent_fn fn,
+			    void *cb_data)
+{
+	struct object_id old_oid, new_oid;
+	struct strbuf committer = STRBUF_INIT;
+	int ret;
+
+	oidread(&old_oid, log->value.update.old_hash);
+	oidread(&new_oid, log->value.update.new_hash);
+
+	/*
+	 * When both the old object ID and the new object ID are null
+	 * then this is the reflog existence marker. The caller must
+	 * not be aware of it.
+	 */
+	if (is_null_oid(&old_oid) && is_null_oid(&new_oid))
+		return 0;
+
+	strbuf_addf(&committer, "%s <%s>", log->value.update.name,
+		    log->value.update.email);
+	ret = fn(&old_oid, &new_oid, committer.buf,
+		 log->value.update.time, log->value.update.tz_offset,
+		 log->value.update.message ? log->value.update.message : "",
+		 cb_data);
+	strbuf_release(&committer);
+	return ret;
+}
+
+/*
+ * Read all reflog entries of `refname`, newest first. Existence markers are
+ * included.
+ */
+static int read_reflog_without_reload(struct reftable_stack *stack,
+				      const char *refname,
+				      struct reftable_log_record **logs,
+				      size_t *logs_nr)
+{
+	struct reftable_merged_table *mt = reftable_stack_merged_table(stack);
+	struct reftable_iterator it = {0};
+	struct reftable_log_record log = {0};
+	size_t logs_alloc = 0;
+	int ret;
+
+	ret = reftable_merged_table_seek_log(mt, &it, refname);
+	while (!ret) {
+		ret = reftable_iterator_next_log(&it, &log);
+		if (ret < 0)
+			break;
+		if (ret > 0 || strcmp(log.refname, refname)) {
+			ret = 0;
+			break;
+		}
+
+		ALLOC_GROW(*logs, *logs_nr + 1, logs_alloc);
+		(*logs)[(*logs_nr)++] = log;
+		memset(&log, 0, sizeof(log));
+	}
+
+	if (ret > 0)
+		ret = 0;
+	reftable_log_record_release(&log);
+	reftable_iterator_destroy(&it);
+	return ret;
+}
+
+static int reftable_be_for_each_reflog_ent_reverse(struct ref_store *ref_store,
+						   const char *refname,
+						   each_reflog_ent_fn fn,
+						   void *cb_data)
+{
+	struct reftable_ref_store *refs =
+		reftable_be_downcast(ref_store, REF_STORE_READ, "for_each_reflog_ent_reverse");
+	struct reftable_stack *stack = stack_for(refs, refname, &refname);
+	struct reftable_merged_table *mt = NULL;
+	struct reftable_log_record log = {0};
+	struct reftable_iterator it = {0};
+	int ret;
+
+	if (refs->err < 0)
+		return refs->err;
+	if (!stack)
+		return 0;
+
+	ret = reftable_stack_reload(stack);
+	if (ret < 0)
+		goto done;
+
+	mt = reftable_stack_merged_table(stack);
+	ret = reftable_merged_table_seek_log(mt, &it, refname);
+	while (!ret) {
+		ret = reftable_iterator_next_log(&it, &log);
+		if (ret < 0)
+			break;
+		if (ret > 0 || strcmp(log.refname, refname)) {
+			ret = 0;
+			break;
+		}
+
+		ret = yield_log_record(&log, fn, cb_data);
+		if (ret)
+			break;
+	}
+
+done:
+	reftable_log_record_release(&log);
+	reftable_iterator_destroy(&it);
+	return ret;
+}
+
+static int reftable_be_for_each_reflog_ent(struct ref_store *ref_store,
+					   const char *refname,
+					   each_reflog_ent_fn fn,
+					   void *cb_data)
+{
+	struct reftable_ref_store *refs =
+		reftable_be_downcast(ref_store, REF_STORE_READ, "for_each_reflog_ent");
+	struct reftable_stack *stack = stack_for(refs, refname, &refname);
+	struct reftable_log_record *logs = NULL;
+	size_t logs_nr = 0, i;
+	int ret;
+
+	if (refs->err < 0)
+		return refs->err;
+	if (!stack)
+		return 0;
+
+	ret = reftable_stack_reload(stack);
+	if (ret < 0)
+		goto done;
+
+	ret = read_reflog_without_reload(stack, refname, &logs, &logs_nr);
+	if (ret < 0)
+		goto done;
+
+	for (i = logs_nr; i > 0; i--) {
+		ret = yield_log_record(&logs[i - 1], fn, cb_data);
+		if (ret)
+			break;
+	}
+
+done:
+	for (i = 0; i < logs_nr; i++)
+		reftable_log_record_release(&logs[i]);
+	free(logs);
+	return ret;
+}
+
+static int reflog_exists_without_reload(struct reftable_stack *stack,
+					const char *refname)
+{
+	struct reftable_merged_table *mt = reftable_stack_merged_table(stack);
+	struct reftable_log_record log = {0};
+	struct reftable_iterator it = {0};
+	int ret;
+
+	ret = reftable_merged_table_seek_log(mt, &it, refname);
+	if (ret)
+		goto done;
+
+	/*
+	 * Check whether we get at least one log record for the given ref name.
+	 * If so, the reflog exists, otherwise it doesn't.
+	 */
+	ret = reftable_iterator_next_log(&it, &log);
+	if (ret)
+		goto done;
+
+	ret = strcmp(log.refname, refname);
+
+done:
+	reftable_iterator_destroy(&it);
+	reftable_log_record_release(&log);
+	return !ret;
+}
+
+static int should_write_log(struct reftable_stack *stack, const char *refname)
+{
+	if (log_all_ref_updates == LOG_REFS_UNSET)
+		log_all_ref_updates = is_bare_repository() ? LOG_REFS_NONE : LOG_REFS_NORMAL;
+
+	switch (log_all_ref_updates) {
+	case LOG_REFS_NONE:
+		return reflog_exists_without_reload(stack, refname);
+	case LOG_REFS_ALWAYS:
+		return 1;
+	case LOG_REFS_NORMAL:
+		if (should_autocreate_reflog(refname))
+			return 1;
+		return reflog_exists_without_reload(stack, refname);
+	default:
+		BUG("unhandled core.logAllRefUpdates value %d", log_all_ref_updates);
+	}
+}
+
+static int reftable_be_reflog_exists(struct ref_store *ref_store,
+				     const char *refname)
+{
+	struct reftable_ref_store *refs =
+		reftable_be_downcast(ref_store, REF_STORE_READ, "reflog_exists");
+	struct reftable_stack *stack = stack_for(refs, refname, &refname);
+
+	if (refs->err < 0 || !stack)
+		return 0;
+
+	if (reftable_stack_reload(stack) < 0)
+		return 0;
+
+	return reflog_exists_without_reload(stack, refname);
+}
+
+struct write_reflog_existence_arg {
+	struct reftable_ref_store *refs;
+	const char *refname;
+	struct reftable_stack *stack;
+};
+
+static int write_reflog_existence_table(struct reftable_writer *writer,
+					void *cb_data)
+{
+	struct write_reflog_existence_arg *arg = cb_data;
+	uint64_t ts = reftable_stack_next_update_index(arg->stack);
+	struct reftable_log_record log = {0};
+	int ret;
+
+	if (reflog_exists_without_reload(arg->stack, arg->refname))
+		return 0;
+
+	reftable_writer_set_limits(writer, ts, ts);
+
+	/*
+	 * The existence entry has both old and new object ID set to the the
+	 * null object ID. Our iterators are aware of this and will not present
+	 * them to their callers.
+	 */
+	fill_reftable_log_record(&log);
+	log.refname = xstrdup(arg->refname);
+	log.update_index = ts;
+	log.value.update.message = xstrdup("");
+	log.value.update.old_hash = hash_dup(null_oid());
+	log.value.update.new_hash = hash_dup(null_oid());
+
+	ret = reftable_writer_add_log(writer, &log);
+	reftable_log_record_release(&log);
+	return ret;
+}
+
+static int reftable_be_create_reflog(struct ref_store *ref_store,
+				     const char *refname,
+				     struct strbuf *errmsg)
+{
+	struct reftable_ref_store *refs =
+		reftable_be_downcast(ref_store, REF_STORE_WRITE, "create_reflog");
+	struct reftable_stack *stack = stack_for(refs, refname, &refname);
+	struct write_reflog_existence_arg arg = {
+		.refs = refs,
+		.stack = stack,
+		.refname = refname,
+	};
+	int ret;
+
+	ret = refs->err;
+	if (ret < 0 || !stack)
+		goto done;
+
+	ret = reftable_stack_reload(stack);
+	if (ret)
+		goto done;
+
+	ret = reftable_stack_add(stack, &write_reflog_existence_table, &arg);
+
+done:
+	if (ret)
+		strbuf_addf(errmsg, _("unable to create reflog for '%s': %s"),
+			    refname, ret < 0 ? reftable_error_str(ret) : "");
+	return ret ? -1 : 0;
+}
+
+struct write_reflog_delete_arg {
+	struct reftable_stack *stack;
+	const char *refname;
+};
+
+static int write_reflog_delete_table(struct reftable_writer *writer, void *cb_data)
+{
+	struct write_reflog_delete_arg *arg = cb_data;
+	struct reftable_merged_table *mt =
+		reftable_stack_merged_table(arg->stack);
+	struct reftable_log_record *tombstones = NULL;
+	size_t tombstones_nr = 0, tombstones_alloc = 0, i;
+	uint64_t ts = reftable_stack_next_update_index(arg->stack);
+	int ret;
+
+	reftable_writer_set_limits(writer, ts, ts);
+
+	ret = add_log_tombstones(mt, arg->refname, &tombstones,
+				 &tombstones_nr, &tombstones_alloc);
+	if (ret < 0)
+		goto done;
+
+	ret = reftable_writer_add_logs(writer, tombstones, tombstones_nr);
+
+done:
+	for (i = 0; i < tombstones_nr; i++)
+		reftable_log_record_release(&tombstones[i]);
+	free(tombstones);
+	return ret;
+}
+
+static int reftable_be_delete_reflog(struct ref_store *ref_store,
+				     const char *refname)
+{
+	struct reftable_ref_store *refs =
+		reftable_be_downcast(ref_store, REF_STORE_WRITE, "delete_reflog");
+	struct reftable_stack *stack = stack_for(refs, refname, &refname);
+	struct write_reflog_delete_arg arg = {
+		.stack = stack,
+		.refname = refname,
+	};
+	int ret;
+
+	ret = refs->err;
+	if (ret < 0 || !stack)
+		return -1;
+
+	ret = reftable_stack_reload(stack);
+	if (ret)
+		return ret;
+	ret = reftable_stack_add(stack, &write_reflog_delete_table, &arg);
+
+	assert(ret != REFTABLE_API_ERROR);
+	return ret;
+}
+
+struct reflog_expiry_arg {
+	struct reftable_stack *stack;
+	struct reftable_log_record *records;
+	struct object_id update_oid;
+	const char *refname;
+	size_t len;
+};
+
+static int write_reflog_expiry_table(struct reftable_writer *writer, void *cb_data)
+{
+	struct reflog_expiry_arg *arg = cb_data;
+	uint64_t ts = reftable_stack_next_update_index(arg->stack);
+	uint64_t live_records = 0;
+	size_t i;
+	int ret;
+
+	for (i = 0; i < arg->len; i++)
+		if (arg->records[i].value_type == REFTABLE_LOG_UPDATE)
+			live_records++;
+
+	reftable_writer_set_limits(writer, ts, ts);
+
+	if (!is_null_oid(&arg->update_oid)) {
+		struct reftable_ref_record ref = {0};
+		struct object_id peeled;
+
+		ref.refname = (char *)arg->refname;
+		ref.update_index = ts;
+
+		if (!peel_object(&arg->update_oid, &peeled)) {
+			ref.value_type = REFTABLE_REF_VAL2;
+			ref.value.val2.target_value = peeled.hash;
+			ref.value.val2.value = arg->update_oid.hash;
+		} else {
+			ref.value_type = REFTABLE_REF_VAL1;
+			ref.value.val1 = arg->update_oid.hash;
+		}
+
+		ret = reftable_writer_add_ref(writer, &ref);
+		if (ret < 0)
+			return ret;
+	}
+
+	/*
+	 * When there are no more entries left in the reflog we empty it
+	 * completely, but write a placeholder reflog entry that indicates that
+	 * the reflog still exists.
+	 */
+	if (!live_records) {
+		struct reftable_log_record log = {
+			.refname = (char *)arg->refname,
+			.value_type = REFTABLE_LOG_UPDATE,
+			.update_index = ts,
+		};
+		struct object_id null = {0};
+
+		log.value.update.old_hash = null.hash;
+		log.value.update.new_hash = null.hash;
+		log.value.update.message = (char *)"";
+		log.value.update.name = (char *)"";
+		log.value.update.email = (char *)"";
+
+		ret = reftable_writer_add_log(writer, &log);
+		if (ret)
+			return ret;
+	}
+
+	for (i = 0; i < arg->len; i++) {
+		ret = reftable_writer_add_log(writer, &arg->records[i]);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+static int reftable_be_reflog_expire(struct ref_store *ref_store,
+				     const char *refname,
+				     unsigned int flags,
+				     reflog_expiry_prepare_fn prepare_fn,
+				     reflog_expiry_should_prune_fn should_prune_fn,
+				     reflog_expiry_cleanup_fn cleanup_fn,
+				     void *policy_cb_data)
+{
+	/*
+	 * For log expiry, we write tombstones for every single reflog entry
+	 * that is to be expired. This means that the entries are still
+	 * retrievable by delving into the stack, and expiring entries
+	 * paradoxically takes extra memory. This memory is only reclaimed when
+	 * compacting the reftable stack.
+	 *
+	 * It would be better if the refs backend supported an API that sets a
+	 * criterion for all refs, passing the criterion to pack_refs().
+	 *
+	 * On the plus side, because we do the expiration per ref, we can easily
+	 * insert the reflog existence dummies.
+	 */
+	struct reftable_ref_store *refs =
+		reftable_be_downcast(ref_store, REF_STORE_WRITE, "reflog_expire");
+	struct reftable_stack *stack = stack_for(refs, refname, &refname);
+	struct reftable_log_record *logs = NULL;
+	struct reflog_expiry_arg arg = {0};
+	struct reftable_addition *add = NULL;
+	struct reftable_ref_record ref_record = {0};
+	struct strbuf committer = STRBUF_INIT;
+	struct object_id oid = {0};
+	struct object_id last_kept = {0};
+	size_t logs_nr = 0, i;
+	int ret;
+
+	if (refs->err < 0)
+		return refs->err;
+	if (!stack)
+		return -1;
+
+	ret = reftable_stack_reload(stack);
+	if (ret < 0)
+		goto done;
+
+	ret = reftable_stack_new_addition(&add, stack);
+	if (ret > 0)
+		ret = REFTABLE_LOCK_ERROR;
+	if (ret < 0)
+		goto done;
+
+	ret = reftable_stack_read_ref(stack, refname, &ref_record);
+	if (ret < 0)
+		goto done;
+	if (reftable_ref_record_val1(&ref_record))
+		oidread(&oid, reftable_ref_record_val1(&ref_record));
+
+	ret = read_reflog_without_reload(stack, refname, &logs, &logs_nr);
+	if (ret < 0)
+		goto done;
+
+	prepare_fn(refname, &oid, policy_cb_data);
+
+	/*
+	 * Walk the reflog oldest-first so that `last_kept` tracks the entry
+	 * preceding the current one, same as the files backend does. Entries
+	 * that are kept are rewritten in place, all others are replaced by
+	 * tombstones.
+	 */
+	for (i = logs_nr; i > 0; i--) {
+		struct reftable_log_record *log = &logs[i - 1];
+		struct object_id old_oid, new_oid;
+
+		oidread(&old_oid, log->value.update.old_hash);
+		oidread(&new_oid, log->value.update.new_hash);
+
+		/*
+		 * Drop the existence marker; a new one is written if no
+		 * entries are left.
+		 */
+		if (is_null_oid(&old_oid) && is_null_oid(&new_oid)) {
+			log->value_type = REFTABLE_LOG_DELETION;
+			continue;
+		}
+
+		if (flags & EXPIRE_REFLOGS_REWRITE)
+			oidcpy(&old_oid, &last_kept);
+
+		strbuf_reset(&committer);
+		strbuf_addf(&committer, "%s <%s>", log->value.update.name,
+			    log->value.update.email);
+
+		if (should_prune_fn(&old_oid, &new_oid, committer.buf,
+				    log->value.update.time,
+				    log->value.update.tz_offset,
+				    log->value.update.message,
+				    policy_cb_data)) {
+			log->value_type = REFTABLE_LOG_DELETION;
+		} else {
+			memcpy(log->value.update.old_hash, old_oid.hash,
+			       the_hash_algo->rawsz);
+			oidcpy(&last_kept, &new_oid);
+		}
+	}
+
+	cleanup_fn(policy_cb_data);
+
+	if (flags & EXPIRE_REFLOGS_DRY_RUN || !logs_nr)
+		goto done;
+
+	arg.stack = stack;
+	arg.records = logs;
+	arg.len = logs_nr;
+	arg.refname = refname;
+
+	/*
+	 * It doesn't make sense to adjust a reference pointed to by a
+	 * symbolic ref based on expiring entries in the symbolic reference's
+	 * reflog. Nor can we update a reference if there are no remaining
+	 * reflog entries.
+	 */
+	if (flags & EXPIRE_REFLOGS_UPDATE_REF && !is_null_oid(&last_kept) &&
+	    ref_record.value_type != REFTABLE_REF_SYMREF)
+		oidcpy(&arg.update_oid, &last_kept);
+
+	ret = reftable_addition_add(add, &write_reflog_expiry_table, &arg);
+	if (ret < 0)
+		goto done;
+
+	ret = reftable_addition_commit(add);
+
+done:
+	if (add)
+		reftable_addition_destroy(add);
+	for (i = 0; i < logs_nr; i++)
+		reftable_log_record_release(&logs[i]);
+	free(logs);
+	reftable_ref_record_release(&ref_record);
+	strbuf_release(&committer);
+	return ret;
+}
+
+struct ref_storage_be refs_be_reftable = {
+	.name = "reftable",
+	.init = reftable_be_init,
+	.init_db = reftable_be_init_db,
+	.transaction_prepare = reftable_be_transaction_prepare,
+	.transaction_finish = reftable_be_transaction_finish,
+	.transaction_abort = reftable_be_transaction_abort,
+	.initial_transaction_commit = reftable_be_initial_transaction_commit,
+
+	.pack_refs = reftable_be_pack_refs,
+	.create_symref = reftable_be_create_symref,
+	.delete_refs = reftable_be_delete_refs,
+	.rename_ref = reftable_be_rename_ref,
+	.copy_ref = reftable_be_copy_ref,
+
+	.iterator_begin = reftable_be_iterator_begin,
+	.read_raw_ref = reftable_be_read_raw_ref,
+	.read_symbolic_ref = reftable_be_read_symbolic_ref,
+
+	.reflog_iterator_begin = reftable_be_reflog_iterator_begin,
+	.for_each_reflog_ent = reftable_be_for_each_reflog_ent,
+	.for_each_reflog_ent_reverse = reftable_be_for_each_reflog_ent_reverse,
+	.reflog_exists = reftable_be_reflog_exists,
+	.create_reflog = reftable_be_create_reflog,
+	.delete_reflog = reftable_be_delete_reflog,
+	.reflog_expire = reftable_be_reflog_expire,
+};
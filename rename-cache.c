@@ -0,0 +1,174 @@
+#include "git-compat-util.h"
+#include "dir.h"
+#include "hex.h"
+#include "lockfile.h"
+#include "object-file.h"
+#include "object-store-ll.h"
+#include "path.h"
+#include "rename-cache.h"
+#include "repository.h"
+#include "strmap.h"
+#include "string-list.h"
+#include "trace2.h"
+#include "wrapper.h"
+
+/*
+ * File format:
+ *
+ *   "rename-cache v2\n"
+ *
+ * followed by one record per source path, each consisting of the old
+ * path and the new path, both NUL-terminated.  An empty new path means
+ * that the old path was deleted.
+ */
+#define RENAME_CACHE_SIGNATURE "rename-cache v2\n"
+
+static char *rename_cache_dir(struct repository *r)
+{
+	return xstrfmt("%s/info/rename-cache", r->objects->odb->path);
+}
+
+static char *rename_cache_path(struct repository *r,
+			       const struct object_id *key)
+{
+	return xstrfmt("%s/info/rename-cache/%s", r->objects->odb->path,
+		       oid_to_hex(key));
+}
+
+int rename_cache_read(struct repository *r,
+		      const struct object_id *key,
+		      struct strmap *pairs)
+{
+	struct strbuf sb = STRBUF_INIT;
+	char *path = rename_cache_path(r, key);
+	const size_t header_len = strlen(RENAME_CACHE_SIGNATURE);
+	const char *p, *end;
+	int nr = 0;
+
+	if (strbuf_read_file(&sb, path, 0) < 0)
+		goto fail;
+
+	if (!starts_with(sb.buf, RENAME_CACHE_SIGNATURE))
+		goto fail;
+
+	/*
+	 * Validate the whole file before touching "pairs", so that a
+	 * truncated entry does not leave partial results behind.
+	 */
+	p = sb.buf + header_len;
+	end = sb.buf + sb.len;
+	while (p < end) {
+		const char *new_path = memchr(p, '\0', end - p);
+		const char *next;
+
+		if (!new_path || new_path == p)
+			goto fail;
+		new_path++;
+		next = memchr(new_path, '\0', end - new_path);
+		if (!next)
+			goto fail;
+		p = next + 1;
+	}
+
+	p = sb.buf + header_len;
+	while (p < end) {
+		const char *old_path = p;
+		const char *new_path = p + strlen(p) + 1;
+
+		p = new_path + strlen(new_path) + 1;
+		if (strmap_contains(pairs, old_path))
+			continue;
+		strmap_put(pairs, old_path,
+			   *new_path ? xstrdup(new_path) : NULL);
+		nr++;
+	}
+
+	/* Keep entries that are still in use from being pruned. */
+	utime(path, NULL);
+
+	strbuf_release(&sb);
+	free(path);
+	return nr;
+
+fail:
+	strbuf_release(&sb);
+	free(path);
+	return -1;
+}
+
+void rename_cache_write(struct repository *r,
+			const struct object_id *key,
+			struct strmap *pairs)
+{
+	struct lock_file lk = LOCK_INIT;
+	struct string_list sorted = STRING_LIST_INIT_NODUP;
+	struct hashmap_iter iter;
+	struct strmap_entry *e;
+	struct strbuf sb = STRBUF_INIT;
+	char *path = rename_cache_path(r, key);
+	size_t i;
+
+	if (safe_create_leading_directories(path) ||
+	    hold_lock_file_for_update(&lk, path, 0) < 0)
+		goto out;
+
+	strmap_for_each_entry(pairs, &iter, e)
+		string_list_append(&sorted, e->key)->util = e->value;
+	string_list_sort(&sorted);
+
+	strbuf_addstr(&sb, RENAME_CACHE_SIGNATURE);
+	for (i = 0; i < sorted.nr; i++) {
+		const char *new_path = sorted.items[i].util;
+
+		strbuf_add(&sb, sorted.items[i].string,
+			   strlen(sorted.items[i].string) + 1);
+		if (new_path)
+			strbuf_addstr(&sb, new_path);
+		strbuf_addch(&sb, '\0');
+	}
+
+	if (write_in_full(get_lock_file_fd(&lk), sb.buf, sb.len) < 0 ||
+	    commit_lock_file(&lk) < 0) {
+		rollback_lock_file(&lk);
+		goto out;
+	}
+	adjust_shared_perm(path);
+	trace2_data_intmax("merge", r, "rename_cache/written", sorted.nr);
+
+out:
+	string_list_clear(&sorted, 0);
+	strbuf_release(&sb);
+	free(path);
+}
+
+void rename_cache_prune(struct repository *r, timestamp_t expire)
+{
+	char *dirpath = rename_cache_dir(r);
+	struct strbuf path = STRBUF_INIT;
+	struct dirent *de;
+	size_t baselen;
+	DIR *dir;
+
+	dir = opendir(dirpath);
+	if (!dir)
+		goto out;
+
+	strbuf_addf(&path, "%s/", dirpath);
+	baselen = path.len;
+	while ((de = readdir_skip_dot_and_dotdot(dir))) {
+		struct stat st;
+
+		strbuf_setlen(&path, baselen);
+		strbuf_addstr(&path, de->d_name);
+		if (lstat(path.buf, &st) || !S_ISREG(st.st_mode))
+			continue;
+		if (st.st_mtime <= expire)
+			unlink_or_warn(path.buf);
+	}
+	closedir(dir);
+	rmdir(dirpath);
+
+out:
+	strbuf_release(&path);
+	free(dirpath);
+}
@@ -0,0 +1,49 @@
+#ifndef RENAME_CACHE_H
+#define RENAME_CACHE_H
+
+/*
+ * On-disk cache of rename detection results.
+ *
+ * Each entry records which paths were found to be renamed (and to
+ * what) and which were found to be deleted by detecting renames between
+ * two trees, without regard to which of those paths a particular merge
+ * cares about.  Entries are looked up by a key that the caller derives
+ * from the two trees and the rename options (see rename_cache_key() in
+ * merge-ort.c).  The cache lives in $GIT_OBJECT_DIR/info/rename-cache/,
+ * one file per key, so that merges that keep replaying the same changes
+ * (e.g. a merge queue merging many topics onto the same upstream, or
+ * repeatedly rebasing the same topic) do not have to redo inexact rename
+ * detection every time.
+ *
+ * Entries are a hint only: a missing or unreadable entry just means
+ * that renames are detected as usual.
+ */
+
+struct object_id;
+struct repository;
+struct strmap;
+
+/*
+ * Look up the pairs recorded under "key" and add them to "pairs", which
+ * maps an old path to either its new path or NULL for a deletion.
+ * Returns the number of pairs added, or -1 if there is no usable entry.
+ */
+int rename_cache_read(struct repository *r,
+		      const struct object_id *key,
+		      struct strmap *pairs);
+
+/*
+ * Record "pairs" (in the same format as above) under "key", replacing
+ * any existing entry.  Errors are not fatal; the entry is simply not
+ * written.
+ */
+void rename_cache_write(struct repository *r,
+			const struct object_id *key,
+			struct strmap *pairs);
+
+/*
+ * Remove entries that have not been used since "expire".
+ */
+void rename_cache_prune(struct repository *r, timestamp_t expire);
+
+#endif /* RENAME_CACHE_H */
@@ -12,6 +12,7 @@
 #include "lockfile.h"
 #include "path.h"
 #include "read-cache-ll.h"
+#include "refs.h"
 #include "remote.h"
 #include "setup.h"
 #include "submodule-config.h"
@@ -36,6 +37,7 @@ void initialize_the_repository(void)
 	index_state_init(&the_index, the_repository);
 
 	repo_set_hash_algo(&the_repo, GIT_HASH_SHA1);
+	repo_set_ref_storage_format(&the_repo, REF_STORAGE_FORMAT_FILES);
 }
 
 static void expand_base_dir(char **out, const char *in,
@@ -104,6 +106,11 @@ void repo_set_hash_algo(struct repository *repo, int hash_algo)
 	repo->hash_algo = &hash_algos[hash_algo];
 }
 
+void repo_set_ref_storage_format(struct repository *repo, unsigned int format)
+{
+	repo->ref_storage_format = format;
+}
+
 /*
  * Attempt to resolve and set the provided 'gitdir' for repository 'repo'.
  * Return 0 upon success and a non-zero value upon failure.
@@ -184,6 +191,7 @@ int repo_init(struct repository *repo,
 		goto error;
 
 	repo_set_hash_algo(repo, format.hash_algo);
+	repo_set_ref_storage_format(repo, format.ref_storage_format);
 	repo->repository_format_worktree_config = format.worktree_config;
 
 	/* take ownership of format.partial_clone */
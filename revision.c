@@ -647,6 +647,9 @@ static unsigned int count_bloom_filter_maybe;
 static unsigned int count_bloom_filter_definitely_not;
 static unsigned int count_bloom_filter_false_positive;
 static unsigned int count_bloom_filter_not_present;
+static unsigned int count_tree_bloom_filter_maybe;
+static unsigned int count_tree_bloom_filter_definitely_not;
+static unsigned int count_tree_bloom_filter_not_present;
 
 static void trace2_bloom_filter_statistics_atexit(void)
 {
@@ -657,6 +660,9 @@ static void trace2_bloom_filter_statistics_atexit(void)
 	jw_object_intmax(&jw, "maybe", count_bloom_filter_maybe);
 	jw_object_intmax(&jw, "definitely_not", count_bloom_filter_definitely_not);
 	jw_object_intmax(&jw, "false_positive", count_bloom_filter_false_positive);
+	jw_object_intmax(&jw, "tree_filter_not_present", count_tree_bloom_filter_not_present);
+	jw_object_intmax(&jw, "tree_maybe", count_tree_bloom_filter_maybe);
+	jw_object_intmax(&jw, "tree_definitely_not", count_tree_bloom_filter_definitely_not);
 	jw_end(&jw);
 
 	trace2_data_json("bloom", the_repository, "statistics", &jw);
@@ -666,25 +672,69 @@ static void trace2_bloom_filter_statistics_atexit(void)
 
 static int forbid_bloom_filters(struct pathspec *spec)
 {
-	if (spec->has_wildcard)
-		return 1;
-	if (spec->nr > 1)
-		return 1;
-	if (spec->magic & ~PATHSPEC_LITERAL)
-		return 1;
-	if (spec->nr && (spec->items[0].magic & ~PATHSPEC_LITERAL))
+	const unsigned allowed_magic = PATHSPEC_LITERAL | PATHSPEC_GLOB;
+	int i;
+
+	if (spec->magic & ~allowed_magic)
 		return 1;
+	for (i = 0; i < spec->nr; i++)
+		if (spec->items[i].magic & ~allowed_magic)
+			return 1;
 
 	return 0;
 }
 
+/*
+ * Return the keys for the path of a pathspec item and its leading
+ * directories, or NULL if the item could match anywhere in the tree.
+ * For an item with wildcards only the leading directories before
+ * the first wildcard are known, e.g. 'dir/sub' for 'dir/sub/foo*.c'.
+ */
+static struct bloom_keyvec *bloom_keyvec_for_item(const struct pathspec_item *pi,
+						  const struct bloom_filter_settings *settings)
+{
+	struct bloom_keyvec *vec;
+	size_t len = pi->len;
+	int is_dir = 0;
+
+	if (pi->nowildcard_len < pi->len) {
+		len = pi->nowildcard_len;
+		while (len && pi->match[len - 1] != '/')
+			len--;
+	}
+
+	/* remove single trailing slash from path, if needed */
+	if (len && pi->match[len - 1] == '/') {
+		len--;
+		is_dir = 1;
+	}
+	if (!len)
+		return NULL;
+
+	/*
+	 * At this point, the path is normalized to use Unix-style
+	 * path separators. This is required due to how the
+	 * changed-path Bloom filters store the paths.
+	 */
+	vec = bloom_keyvec_new(pi->match, len, settings);
+	vec->is_dir = is_dir;
+	return vec;
+}
+
+static void release_bloom_keyvecs(struct rev_info *revs)
+{
+	int i;
+
+	for (i = 0; i < revs->bloom_keyvecs_nr; i++)
+		bloom_keyvec_free(revs->bloom_keyvecs[i]);
+	FREE_AND_NULL(revs->bloom_keyvecs);
+	revs->bloom_keyvecs_nr = 0;
+}
+
 static void prepare_to_use_bloom_filter(struct rev_info *revs)
 {
-	struct pathspec_item *pi;
-	char *path_alloc = NULL;
-	const char *path, *p;
-	size_t len;
-	int path_component_nr = 1;
+	struct commit_graph *g;
+	int i;
 
 	if (!revs->commits)
 		return;
@@ -701,63 +751,35 @@ static void prepare_to_use_bloom_filter(struct rev_info *revs)
 	if (!revs->pruning.pathspec.nr)
 		return;
 
-	pi = &revs->pruning.pathspec.items[0];
+	ALLOC_ARRAY(revs->bloom_keyvecs, revs->pruning.pathspec.nr);
+	for (i = 0; i < revs->pruning.pathspec.nr; i++) {
+		struct bloom_keyvec *vec;
 
-	/* remove single trailing slash from path, if needed */
-	if (pi->len > 0 && pi->match[pi->len - 1] == '/') {
-		path_alloc = xmemdupz(pi->match, pi->len - 1);
-		path = path_alloc;
-	} else
-		path = pi->match;
-
-	len = strlen(path);
-	if (!len) {
-		revs->bloom_filter_settings = NULL;
-		free(path_alloc);
-		return;
-	}
-
-	p = path;
-	while (*p) {
-		/*
-		 * At this point, the path is normalized to use Unix-style
-		 * path separators. This is required due to how the
-		 * changed-path Bloom filters store the paths.
-		 */
-		if (*p == '/')
-			path_component_nr++;
-		p++;
+		vec = bloom_keyvec_for_item(&revs->pruning.pathspec.items[i],
+					    revs->bloom_filter_settings);
+		if (!vec) {
+			release_bloom_keyvecs(revs);
+			revs->bloom_filter_settings = NULL;
+			return;
+		}
+		revs->bloom_keyvecs[revs->bloom_keyvecs_nr++] = vec;
 	}
 
-	revs->bloom_keys_nr = path_component_nr;
-	ALLOC_ARRAY(revs->bloom_keys, revs->bloom_keys_nr);
-
-	fill_bloom_key(path, len, &revs->bloom_keys[0],
-		       revs->bloom_filter_settings);
-	path_component_nr = 1;
-
-	p = path + len - 1;
-	while (p > path) {
-		if (*p == '/')
-			fill_bloom_key(path, p - path,
-				       &revs->bloom_keys[path_component_nr++],
-				       revs->bloom_filter_settings);
-		p--;
-	}
+	for (g = revs->repo->objects->commit_graph; g; g = g->base_graph)
+		if (g->chunk_tree_bloom_data)
+			revs->bloom_tree_filters = 1;
 
 	if (trace2_is_enabled() && !bloom_filter_atexit_registered) {
 		atexit(trace2_bloom_filter_statistics_atexit);
 		bloom_filter_atexit_registered = 1;
 	}
-
-	free(path_alloc);
 }
 
 static int check_maybe_different_in_bloom_filter(struct rev_info *revs,
 						 struct commit *commit)
 {
 	struct bloom_filter *filter;
-	int result = 1, j;
+	int result = 0, j;
 
 	if (!revs->repo->objects->commit_graph)
 		return -1;
@@ -772,10 +794,11 @@ static int check_maybe_different_in_bloom_filter(struct rev_info *revs,
 		return -1;
 	}
 
-	for (j = 0; result && j < revs->bloom_keys_nr; j++) {
-		result = bloom_filter_contains(filter,
-					       &revs->bloom_keys[j],
-					       revs->bloom_filter_settings);
+	/* The commit is interesting if it may have touched any of the items. */
+	for (j = 0; !result && j < revs->bloom_keyvecs_nr; j++) {
+		result = bloom_filter_contains_vec(filter,
+						   revs->bloom_keyvecs[j],
+						   revs->bloom_filter_settings);
 	}
 
 	if (result)
@@ -786,6 +809,34 @@ static int check_maybe_different_in_bloom_filter(struct rev_info *revs,
 	return result;
 }
 
+/*
+ * Returns 1 if the tree-path Bloom filter of 'commit' proves that
+ * none of the pathspec items exist in its tree, and 0 otherwise.
+ */
+static int absent_in_tree_bloom_filter(struct rev_info *revs,
+				       struct commit *commit)
+{
+	struct tree_bloom_filter *tf;
+	int j;
+
+	tf = get_tree_bloom_filter(revs->repo, commit);
+	if (!tf) {
+		count_tree_bloom_filter_not_present++;
+		return 0;
+	}
+
+	for (j = 0; j < revs->bloom_keyvecs_nr; j++) {
+		if (tree_bloom_filter_contains_vec(tf, revs->bloom_keyvecs[j],
+						   revs->bloom_filter_settings)) {
+			count_tree_bloom_filter_maybe++;
+			return 0;
+		}
+	}
+
+	count_tree_bloom_filter_definitely_not++;
+	return 1;
+}
+
 static int rev_compare_tree(struct rev_info *revs,
 			    struct commit *parent, struct commit *commit, int nth_parent)
 {
@@ -816,13 +867,23 @@ static int rev_compare_tree(struct rev_info *revs,
 			return REV_TREE_SAME;
 	}
 
-	if (revs->bloom_keys_nr && !nth_parent) {
+	if (revs->bloom_keyvecs_nr && !nth_parent) {
 		bloom_ret = check_maybe_different_in_bloom_filter(revs, commit);
 
 		if (bloom_ret == 0)
 			return REV_TREE_SAME;
 	}
 
+	/*
+	 * Nothing can have changed if the pathspec is absent from both
+	 * sides. This works for any parent, unlike the changed-path
+	 * filters which are relative to the first one.
+	 */
+	if (revs->bloom_tree_filters &&
+	    absent_in_tree_bloom_filter(revs, commit) &&
+	    absent_in_tree_bloom_filter(revs, parent))
+		return REV_TREE_SAME;
+
 	tree_difference = REV_TREE_SAME;
 	revs->pruning.flags.has_changes = 0;
 	diff_tree_oid(&t1->object.oid, &t2->object.oid, "", &revs->pruning);
@@ -841,6 +902,10 @@ static int rev_same_tree_as_empty(struct rev_info *revs, struct commit *commit)
 	if (!t1)
 		return 0;
 
+	if (revs->bloom_tree_filters &&
+	    absent_in_tree_bloom_filter(revs, commit))
+		return 1;
+
 	tree_difference = REV_TREE_SAME;
 	revs->pruning.flags.has_changes = 0;
 	diff_tree_oid(NULL, &t1->object.oid, "", &revs->pruning);
@@ -3093,6 +3158,7 @@ void release_revisions(struct rev_info *revs)
 	diff_free(&revs->pruning);
 	reflog_walk_info_release(revs->reflog_info);
 	release_revisions_topo_walk_info(revs->topo_walk_info);
+	release_bloom_keyvecs(revs);
 }
 
 static void add_child(struct rev_info *revs, struct commit *parent, struct commit *child)
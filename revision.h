@@ -61,7 +61,7 @@ struct repository;
 struct rev_info;
 struct string_list;
 struct saved_parents;
-struct bloom_key;
+struct bloom_keyvec;
 struct bloom_filter_settings;
 struct option;
 struct parse_opt_ctx_t;
@@ -225,6 +225,15 @@ struct rev_info {
 			 */
 			do_not_die_on_missing_tree:1,
 
+			/*
+			 * Read trees ahead of time on worker threads when
+			 * walking objects (see tree-preload.h). Callers set
+			 * this only when their show_object() and
+			 * show_commit() callbacks are safe to run while
+			 * other threads read objects.
+			 */
+			preload_trees:1,
+
 			/* for internal use only */
 			exclude_promisor_objects:1;
 
@@ -356,9 +365,12 @@ struct rev_info {
 	struct topo_walk_info *topo_walk_info;
 
 	/* Commit graph bloom filter fields */
-	/* The bloom filter key(s) for the pathspec */
-	struct bloom_key *bloom_keys;
-	int bloom_keys_nr;
+	/* The bloom filter keys, one vector per pathspec item */
+	struct bloom_keyvec **bloom_keyvecs;
+	int bloom_keyvecs_nr;
+
+	/* Whether the commit-graph carries tree-path Bloom filters */
+	unsigned bloom_tree_filters:1;
 
 	/*
 	 * The bloom filter settings used to generate the key.
@@ -143,6 +143,11 @@ static struct protocol_capability capabilities[] = {
 		.advertise = bundle_uri_advertise,
 		.command = bundle_uri_command,
 	},
+	{
+		.name = "object-fetch",
+		.advertise = upload_pack_object_fetch_advertise,
+		.command = upload_pack_object_fetch,
+	},
 };
 
 void protocol_v2_advertise_capabilities(void)
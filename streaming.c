@@ -10,6 +10,8 @@
 #include "object-store-ll.h"
 #include "replace-object.h"
 #include "packfile.h"
+#include "delta.h"
+#include "tempfile.h"
 
 typedef int (*open_istream_fn)(struct git_istream *,
 			       struct repository *,
@@ -30,6 +32,16 @@ struct filtered_istream {
 	int input_finished;
 };
 
+struct pack_delta_istream {
+	struct git_istream *delta; /* inflated delta data */
+	struct tempfile *base; /* inflated base object */
+	unsigned long base_size;
+	unsigned long left; /* bytes of the result not yet produced */
+	unsigned long copy_offset, copy_left, insert_left;
+	unsigned char buf[FILTER_BUFFER];
+	int b_ptr, b_end;
+};
+
 struct git_istream {
 	open_istream_fn open;
 	close_istream_fn close;
@@ -58,6 +70,8 @@ struct git_istream {
 			off_t pos;
 		} in_pack;
 
+		struct pack_delta_istream pack_delta;
+
 		struct filtered_istream filtered;
 	} u;
 };
@@ -347,7 +361,7 @@ static int open_istream_pack_non_delta(struct git_istream *st,
 	unuse_pack(&window);
 	switch (in_pack_type) {
 	default:
-		return -1; /* we do not do deltas for now */
+		return -1; /* see open_istream_pack_delta() */
 	case OBJ_COMMIT:
 	case OBJ_TREE:
 	case OBJ_BLOB:
@@ -362,6 +376,349 @@ static int open_istream_pack_non_delta(struct git_istream *st,
 }
 
 
+/*****************************************************************
+ *
+ * Delta packed object stream
+ *
+ * The delta may copy from anywhere in its base, so the base is first
+ * inflated into a temporary file, and the object is then produced
+ * while the delta data is read. Neither of them has to be held in
+ * memory in full. If the base is a delta itself, the chain is resolved
+ * from its root up, each delta applied from one temporary file into
+ * another, so that at most two of them exist at any time.
+ *
+ *****************************************************************/
+
+/*
+ * Each level of the chain is written out in full once, so deeper
+ * chains are read in core instead. This is the default pack.depth.
+ */
+#define MAX_STREAM_DELTA_DEPTH 50
+
+struct delta_link {
+	off_t pos; /* of the delta data, after the entry header */
+	unsigned long size; /* of the inflated delta data */
+};
+
+/*
+ * Make sure that at least "want" bytes of delta data are buffered,
+ * unless the delta ends before that.
+ */
+static int fill_delta_buffer(struct pack_delta_istream *pd, int want)
+{
+	if (pd->b_end - pd->b_ptr >= want)
+		return 0;
+
+	memmove(pd->buf, pd->buf + pd->b_ptr, pd->b_end - pd->b_ptr);
+	pd->b_end -= pd->b_ptr;
+	pd->b_ptr = 0;
+	while (pd->b_end < want) {
+		ssize_t readlen = read_istream(pd->delta, pd->buf + pd->b_end,
+					       sizeof(pd->buf) - pd->b_end);
+		if (readlen < 0)
+			return -1;
+		if (!readlen)
+			break;
+		pd->b_end += readlen;
+	}
+	return 0;
+}
+
+/*
+ * Decode the next copy or insert instruction; see patch_delta().
+ */
+static int next_delta_opcode(struct pack_delta_istream *pd)
+{
+	const unsigned char *data, *top;
+	unsigned char cmd;
+
+	/* an opcode is followed by at most 7 bytes of arguments */
+	if (fill_delta_buffer(pd, 8) < 0)
+		return -1;
+	data = pd->buf + pd->b_ptr;
+	top = pd->buf + pd->b_end;
+	if (data >= top)
+		goto bad_length;
+
+	cmd = *data++;
+	if (cmd & 0x80) {
+		unsigned long cp_off = 0, cp_size = 0;
+#define PARSE_CP_PARAM(bit, var, shift) do { \
+			if (cmd & (bit)) { \
+				if (data >= top) \
+					goto bad_length; \
+				var |= ((unsigned) *data++ << (shift)); \
+			} } while (0)
+		PARSE_CP_PARAM(0x01, cp_off, 0);
+		PARSE_CP_PARAM(0x02, cp_off, 8);
+		PARSE_CP_PARAM(0x04, cp_off, 16);
+		PARSE_CP_PARAM(0x08, cp_off, 24);
+		PARSE_CP_PARAM(0x10, cp_size, 0);
+		PARSE_CP_PARAM(0x20, cp_size, 8);
+		PARSE_CP_PARAM(0x40, cp_size, 16);
+#undef PARSE_CP_PARAM
+		if (cp_size == 0) cp_size = 0x10000;
+		if (unsigned_add_overflows(cp_off, cp_size) ||
+		    cp_off + cp_size > pd->base_size ||
+		    cp_size > pd->left)
+			goto bad_length;
+		pd->copy_offset = cp_off;
+		pd->copy_left = cp_size;
+	} else if (cmd) {
+		if (cmd > pd->left)
+			goto bad_length;
+		pd->insert_left = cmd;
+	} else {
+		return error("unexpected delta opcode 0");
+	}
+	pd->b_ptr = data - pd->buf;
+	return 0;
+
+bad_length:
+	return error("delta replay has gone wild");
+}
+
+static ssize_t read_istream_pack_delta(struct git_istream *st, char *buf,
+				       size_t sz)
+{
+	struct pack_delta_istream *pd = &st->u.pack_delta;
+	size_t total_read = 0;
+
+	while (total_read < sz && pd->left) {
+		size_t len = sz - total_read;
+
+		if (pd->copy_left) {
+			if (len > pd->copy_left)
+				len = pd->copy_left;
+			if (pread_in_full(get_tempfile_fd(pd->base),
+					  buf + total_read, len,
+					  pd->copy_offset) != len)
+				return -1;
+			pd->copy_offset += len;
+			pd->copy_left -= len;
+		} else if (pd->insert_left) {
+			if (fill_delta_buffer(pd, 1) < 0 ||
+			    pd->b_ptr == pd->b_end)
+				return -1;
+			if (len > pd->insert_left)
+				len = pd->insert_left;
+			if (len > pd->b_end - pd->b_ptr)
+				len = pd->b_end - pd->b_ptr;
+			memcpy(buf + total_read, pd->buf + pd->b_ptr, len);
+			pd->b_ptr += len;
+			pd->insert_left -= len;
+		} else {
+			if (next_delta_opcode(pd) < 0)
+				return -1;
+			continue;
+		}
+		total_read += len;
+		pd->left -= len;
+	}
+	return total_read;
+}
+
+static int close_istream_pack_delta(struct git_istream *st)
+{
+	struct pack_delta_istream *pd = &st->u.pack_delta;
+
+	close_istream(pd->delta);
+	delete_tempfile(&pd->base);
+	return 0;
+}
+
+/*
+ * Set up "st" to apply the delta "link" of "p" to "base", which holds
+ * base_size bytes. The temporary file is owned by "st" from then on,
+ * even if this fails.
+ */
+static int open_delta_link(struct git_istream *st, struct packed_git *p,
+			   const struct delta_link *link,
+			   struct tempfile *base, unsigned long base_size)
+{
+	struct pack_delta_istream *pd = &st->u.pack_delta;
+	struct git_istream *delta;
+	const unsigned char *data;
+
+	/* the delta data is read like a non-delta object */
+	delta = xmalloc(sizeof(*delta));
+	delta->u.in_pack.pack = p;
+	delta->u.in_pack.pos = link->pos;
+	delta->size = link->size;
+	delta->z_state = z_unused;
+	delta->close = close_istream_pack_non_delta;
+	delta->read = read_istream_pack_non_delta;
+
+	memset(pd, 0, sizeof(*pd));
+	pd->delta = delta;
+	pd->base = base;
+	st->close = close_istream_pack_delta;
+	st->read = read_istream_pack_delta;
+
+	/* the sizes of the base and the result, up to 10 bytes each */
+	if (fill_delta_buffer(pd, 20) < 0)
+		return -1;
+	data = pd->buf;
+	pd->base_size = get_delta_hdr_size(&data, pd->buf + pd->b_end);
+	pd->left = get_delta_hdr_size(&data, pd->buf + pd->b_end);
+	pd->b_ptr = data - pd->buf;
+	if (pd->b_ptr > pd->b_end || pd->base_size != base_size)
+		return -1;
+
+	st->size = pd->left;
+	return 0;
+}
+
+/*
+ * Copy all of "st" into a new temporary file in the object directory,
+ * which is returned in "out". Returns the number of bytes copied, or
+ * -1 on error.
+ */
+static ssize_t spool_istream(struct git_istream *st, struct repository *r,
+			     char *buf, struct tempfile **out)
+{
+	struct strbuf path = STRBUF_INIT;
+	ssize_t total = 0;
+
+	strbuf_addf(&path, "%s/tmp_delta_base_XXXXXX", r->objects->odb->path);
+	*out = mks_tempfile(path.buf);
+	strbuf_release(&path);
+	if (!*out)
+		return -1;
+
+	for (;;) {
+		ssize_t readlen = read_istream(st, buf, FILTER_BUFFER);
+
+		if (readlen < 0)
+			return -1;
+		if (!readlen)
+			break;
+		if (write_in_full(get_tempfile_fd(*out), buf, readlen) < 0)
+			return -1;
+		total += readlen;
+	}
+	return total;
+}
+
+/*
+ * Find the deltas from the entry at "offset" down to the first non-delta
+ * object, and return their number, or -1 if the chain is broken or
+ * longer than MAX_STREAM_DELTA_DEPTH. The offset of the non-delta base
+ * is returned in "root".
+ */
+static int find_delta_chain(struct packed_git *p, off_t offset,
+			    struct delta_link *chain, off_t *root)
+{
+	int nr = 0;
+
+	for (;;) {
+		struct pack_window *window = NULL;
+		off_t pos = offset;
+		enum object_type type;
+		unsigned long size;
+
+		type = unpack_object_header(p, &window, &pos, &size);
+		switch (type) {
+		case OBJ_COMMIT:
+		case OBJ_TREE:
+		case OBJ_BLOB:
+		case OBJ_TAG:
+			unuse_pack(&window);
+			*root = offset;
+			return nr;
+		case OBJ_OFS_DELTA:
+		case OBJ_REF_DELTA:
+			break;
+		default:
+			unuse_pack(&window);
+			return -1;
+		}
+		if (nr == MAX_STREAM_DELTA_DEPTH) {
+			unuse_pack(&window);
+			return -1;
+		}
+		offset = get_delta_base(p, &window, &pos, type, offset);
+		unuse_pack(&window);
+		if (!offset || size < DELTA_SIZE_MIN)
+			return -1;
+		chain[nr].pos = pos;
+		chain[nr].size = size;
+		nr++;
+	}
+}
+
+static int open_istream_pack_delta(struct git_istream *st,
+				   struct repository *r,
+				   const struct object_id *oid UNUSED,
+				   enum object_type *type UNUSED)
+{
+	struct packed_git *p = st->u.in_pack.pack;
+	struct delta_link *chain;
+	struct git_istream *tmp;
+	struct tempfile *base = NULL;
+	ssize_t base_size;
+	off_t root;
+	char *buf;
+	int nr, ret = -1;
+
+	ALLOC_ARRAY(chain, MAX_STREAM_DELTA_DEPTH);
+	nr = find_delta_chain(p, st->u.in_pack.pos, chain, &root);
+	if (nr <= 0) {
+		free(chain);
+		return -1;
+	}
+
+	buf = xmalloc(FILTER_BUFFER);
+	tmp = xmalloc(sizeof(*tmp));
+
+	/* spool the root of the chain */
+	tmp->u.in_pack.pack = p;
+	tmp->u.in_pack.pos = root;
+	if (open_istream_pack_non_delta(tmp, r, NULL, NULL))
+		goto out;
+	base_size = spool_istream(tmp, r, buf, &base);
+	tmp->close(tmp);
+	if (base_size < 0 || base_size != tmp->size)
+		goto out;
+
+	/* apply all deltas but the last one from one file into another */
+	while (--nr > 0) {
+		struct tempfile *result = NULL;
+		ssize_t size;
+
+		if (open_delta_link(tmp, p, &chain[nr], base, base_size)) {
+			base = NULL;
+			tmp->close(tmp);
+			goto out;
+		}
+		size = spool_istream(tmp, r, buf, &result);
+		if (size != tmp->size) {
+			delete_tempfile(&result);
+			tmp->close(tmp);
+			base = NULL;
+			goto out;
+		}
+		/* deletes the previous base */
+		tmp->close(tmp);
+		base = result;
+		base_size = size;
+	}
+
+	/* and stream the last one */
+	ret = open_delta_link(st, p, &chain[0], base, base_size);
+	base = NULL;
+	if (ret)
+		st->close(st);
+
+out:
+	delete_tempfile(&base);
+	free(tmp);
+	free(buf);
+	free(chain);
+	return ret;
+}
+
+
 /*****************************************************************
  *
  * In-core stream
@@ -428,10 +785,13 @@ static int istream_source(struct git_istream *st,
 		st->open = open_istream_loose;
 		return 0;
 	case OI_PACKED:
-		if (!oi.u.packed.is_delta && big_file_threshold < size) {
+		if (big_file_threshold < size) {
 			st->u.in_pack.pack = oi.u.packed.pack;
 			st->u.in_pack.pos = oi.u.packed.offset;
-			st->open = open_istream_pack_non_delta;
+			if (oi.u.packed.is_delta)
+				st->open = open_istream_pack_delta;
+			else
+				st->open = open_istream_pack_non_delta;
 			return 0;
 		}
 		/* fallthru */
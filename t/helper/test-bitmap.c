@@ -13,6 +13,11 @@ static int bitmap_dump_hashes(void)
 	return test_bitmap_hashes(the_repository);
 }
 
+static int bitmap_dump_tip_unions(void)
+{
+	return test_bitmap_tip_unions(the_repository);
+}
+
 int cmd__bitmap(int argc, const char **argv)
 {
 	setup_git_directory();
@@ -24,10 +29,13 @@ int cmd__bitmap(int argc, const char **argv)
 		return bitmap_list_commits();
 	if (!strcmp(argv[1], "dump-hashes"))
 		return bitmap_dump_hashes();
+	if (!strcmp(argv[1], "dump-tip-unions"))
+		return bitmap_dump_tip_unions();
 
 usage:
 	usage("\ttest-tool bitmap list-commits\n"
-	      "\ttest-tool bitmap dump-hashes");
+	      "\ttest-tool bitmap dump-hashes\n"
+	      "\ttest-tool bitmap dump-tip-unions");
 
 	return -1;
 }
@@ -0,0 +1,29 @@
+#include "test-tool.h"
+#include "git-compat-util.h"
+#include "run-command.h"
+
+/*
+ * Run a command and print the peak resident set size of it, or of the
+ * largest of its descendants, as reported by getrusage(). The unit is
+ * kilobytes on Linux (and bytes on some other systems).
+ */
+int cmd__max_rss(int argc, const char **argv)
+{
+#ifdef GIT_WINDOWS_NATIVE
+	die("test-tool max-rss is not supported on this platform");
+#else
+	struct child_process cp = CHILD_PROCESS_INIT;
+	struct rusage ru;
+
+	if (argc < 2)
+		usage("test-tool max-rss <command> [<args>...]");
+
+	strvec_pushv(&cp.args, argv + 1);
+	if (run_command(&cp))
+		return 1;
+	if (getrusage(RUSAGE_CHILDREN, &ru))
+		die_errno("getrusage");
+	printf("%ld\n", (long)ru.ru_maxrss);
+	return 0;
+#endif
+}
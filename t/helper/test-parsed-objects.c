@@ -0,0 +1,237 @@
+#include "test-tool.h"
+#include "blob.h"
+#include "commit.h"
+#include "hex.h"
+#include "object.h"
+#include "object-store-ll.h"
+#include "repository.h"
+#include "tag.h"
+#include "thread-utils.h"
+#include "trace.h"
+#include "tree.h"
+
+static struct object_id *oids;
+static int nr_oids;
+
+struct worker {
+	pthread_t thread;
+	int id, nr_threads;
+	int verify;
+	struct object **found;
+};
+
+static void make_oids(int nr)
+{
+	int i;
+
+	ALLOC_ARRAY(oids, nr);
+	for (i = 0; i < nr; i++) {
+		char buf[32];
+		int len = xsnprintf(buf, sizeof(buf), "%d", i);
+		hash_object_file(the_hash_algo, buf, len, OBJ_BLOB, &oids[i]);
+	}
+	nr_oids = nr;
+}
+
+static void reset_pool(void)
+{
+	parsed_object_pool_clear(the_repository->parsed_objects);
+	free(the_repository->parsed_objects);
+	the_repository->parsed_objects = parsed_object_pool_new();
+}
+
+/* The objects are looked up as all four types in turn. */
+static const enum object_type types[] = {
+	OBJ_BLOB, OBJ_TREE, OBJ_COMMIT, OBJ_TAG,
+};
+
+static struct object *lookup_by_index(int i)
+{
+	struct repository *r = the_repository;
+
+	switch (types[i % ARRAY_SIZE(types)]) {
+	case OBJ_BLOB:
+		return &lookup_blob(r, &oids[i])->object;
+	case OBJ_TREE:
+		return &lookup_tree(r, &oids[i])->object;
+	case OBJ_COMMIT:
+		return &lookup_commit(r, &oids[i])->object;
+	default:
+		return &lookup_tag(r, &oids[i])->object;
+	}
+}
+
+/*
+ * In "verify" mode, every thread looks up all objects, starting at a
+ * different place, so that they race to create the same objects. Every
+ * other thread looks them up with lookup_unknown_object() first, so
+ * that objects created as OBJ_NONE race with typed lookups, too.
+ * Otherwise the threads work on disjoint parts of the list, once to
+ * create the objects and once to look them up again.
+ */
+static void *insert_worker(void *data)
+{
+	struct worker *w = data;
+	int i;
+
+	if (w->verify) {
+		int start = w->id * (nr_oids / w->nr_threads);
+		for (i = 0; i < nr_oids; i++) {
+			int j = (start + i) % nr_oids;
+			if (w->id % 2)
+				lookup_unknown_object(the_repository, &oids[j]);
+			w->found[j] = lookup_by_index(j);
+		}
+	} else {
+		for (i = w->id; i < nr_oids; i += w->nr_threads)
+			lookup_blob(the_repository, &oids[i]);
+	}
+	return NULL;
+}
+
+static void *lookup_worker(void *data)
+{
+	struct worker *w = data;
+	int i;
+
+	for (i = w->id; i < nr_oids; i += w->nr_threads)
+		if (!lookup_object(the_repository, &oids[i]))
+			BUG("object %s went missing", oid_to_hex(&oids[i]));
+	return NULL;
+}
+
+static void run_threads(int nr_threads, void *(*fn)(void *), int verify,
+			struct worker *workers)
+{
+	int i;
+
+	for (i = 0; i < nr_threads; i++) {
+		workers[i].id = i;
+		workers[i].nr_threads = nr_threads;
+		workers[i].verify = verify;
+		if (pthread_create(&workers[i].thread, NULL, fn, &workers[i]))
+			die("unable to create thread");
+	}
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(workers[i].thread, NULL);
+}
+
+static int verify(int nr_threads)
+{
+	struct worker *workers;
+	unsigned int i, max, nr = 0;
+	int t, ret = 0;
+
+	CALLOC_ARRAY(workers, nr_threads);
+	for (t = 0; t < nr_threads; t++)
+		ALLOC_ARRAY(workers[t].found, nr_oids);
+
+	enable_parsed_object_lock();
+	run_threads(nr_threads, insert_worker, 1, workers);
+	disable_parsed_object_lock();
+
+	for (i = 0; i < nr_oids; i++) {
+		struct object *obj = lookup_object(the_repository, &oids[i]);
+
+		if (!obj || !oideq(&obj->oid, &oids[i]) ||
+		    obj->type != types[i % ARRAY_SIZE(types)]) {
+			printf("wrong object for %s\n", oid_to_hex(&oids[i]));
+			ret = 1;
+		}
+		for (t = 0; t < nr_threads; t++) {
+			if (workers[t].found[i] != obj) {
+				printf("thread %d got another object for %s\n",
+				       t, oid_to_hex(&oids[i]));
+				ret = 1;
+			}
+		}
+	}
+
+	max = get_max_object_index();
+	for (i = 0; i < max; i++)
+		if (get_indexed_object(i))
+			nr++;
+	printf("%u objects\n", nr);
+
+	for (t = 0; t < nr_threads; t++)
+		free(workers[t].found);
+	free(workers);
+	return ret;
+}
+
+static double mops(uint64_t start, uint64_t end)
+{
+	return (double)nr_oids * 1000 / (end - start);
+}
+
+static void perf(int nr_threads)
+{
+	struct worker *workers;
+	uint64_t start, mid, end;
+
+	CALLOC_ARRAY(workers, nr_threads ? nr_threads : 1);
+	reset_pool();
+	if (nr_threads)
+		enable_parsed_object_lock();
+
+	start = getnanotime();
+	if (nr_threads) {
+		run_threads(nr_threads, insert_worker, 0, workers);
+	} else {
+		workers[0].nr_threads = 1;
+		insert_worker(&workers[0]);
+	}
+	mid = getnanotime();
+	if (nr_threads) {
+		run_threads(nr_threads, lookup_worker, 0, workers);
+	} else {
+		lookup_worker(&workers[0]);
+	}
+	end = getnanotime();
+
+	disable_parsed_object_lock();
+	if (nr_threads)
+		printf("%d threads", nr_threads);
+	else
+		printf("no locking");
+	printf(": insert %.2f Mops/s, lookup %.2f Mops/s\n",
+	       mops(start, mid), mops(mid, end));
+	free(workers);
+}
+
+/*
+ * "perf" with 0 threads runs on the main thread without locking, as a
+ * baseline for the others.
+ */
+static const char *usage_msg =
+	"test-tool parsed-objects verify <nr-objects> <nr-threads>\n"
+	"test-tool parsed-objects perf <nr-objects> [<nr-threads>...]";
+
+int cmd__parsed_objects(int argc, const char **argv)
+{
+	int ret = 0;
+
+	if (argc < 3)
+		usage(usage_msg);
+	if (!HAVE_THREADS)
+		die("test-tool parsed-objects requires thread support");
+
+	make_oids(atoi(argv[2]));
+
+	if (!strcmp(argv[1], "verify") && argc == 4 && atoi(argv[3]) > 0) {
+		ret = verify(atoi(argv[3]));
+	} else if (!strcmp(argv[1], "perf")) {
+		static const char *default_threads[] = {
+			"0", "1", "2", "4", "8", "16", "32", "64", NULL
+		};
+		const char **threads = argc > 3 ? argv + 3 : default_threads;
+
+		for (; *threads; threads++)
+			perf(atoi(*threads));
+	} else {
+		usage(usage_msg);
+	}
+
+	free(oids);
+	return ret;
+}
@@ -114,7 +114,19 @@ int cmd__reach(int ac, const char **av)
 	else if (!strcmp(av[1], "in_merge_bases_many"))
 		printf("%s(A,X):%d\n", av[1],
 		       repo_in_merge_bases_many(the_repository, A, X_nr, X_array));
-	else if (!strcmp(av[1], "is_descendant_of"))
+	else if (!strcmp(av[1], "in_merge_bases_all")) {
+		/*
+		 * Ask every (X,Y) pair, for timing the common case of many
+		 * separate ancestry queries.
+		 */
+		int i, j, count = 0;
+
+		for (i = 0; i < X_nr; i++)
+			for (j = 0; j < Y_nr; j++)
+				count += repo_in_merge_bases(r, Y_array[j],
+							     X_array[i]);
+		printf("%s(X,Y):%d\n", av[1], count);
+	} 	else if (!strcmp(av[1], "is_descendant_of"))
 		printf("%s(A,X):%d\n", av[1], repo_is_descendant_of(r, A, X));
 	else if (!strcmp(av[1], "get_merge_bases_many")) {
 		struct commit_list *list = repo_get_merge_bases_many(the_repository,
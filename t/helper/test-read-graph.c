@@ -44,6 +44,12 @@ int cmd__read_graph(int argc UNUSED, const char **argv UNUSED)
 		printf(" bloom_indexes");
 	if (graph->chunk_bloom_data)
 		printf(" bloom_data");
+	if (graph->chunk_tree_bloom_indexes)
+		printf(" tree_bloom_indexes");
+	if (graph->chunk_tree_bloom_data)
+		printf(" tree_bloom_data");
+	if (graph->chunk_reach_labels)
+		printf(" reach_labels");
 	printf("\n");
 
 	printf("options:");
@@ -76,6 +76,27 @@ static int read_midx_checksum(const char *object_dir)
 	return 0;
 }
 
+static void print_midx_layer(struct multi_pack_index *m)
+{
+	if (m->base_midx)
+		print_midx_layer(m->base_midx);
+	printf("%s %"PRIu32" %"PRIu32"\n", hash_to_hex(get_midx_checksum(m)),
+	       m->num_packs, m->num_objects);
+}
+
+static int read_midx_layers(const char *object_dir)
+{
+	struct multi_pack_index *m;
+
+	setup_git_directory();
+	m = load_multi_pack_index(object_dir, 1);
+	if (!m)
+		return 1;
+	print_midx_layer(m);
+	close_midx(m);
+	return 0;
+}
+
 static int read_midx_preferred_pack(const char *object_dir)
 {
 	struct multi_pack_index *midx = NULL;
@@ -95,7 +116,7 @@ static int read_midx_preferred_pack(const char *object_dir)
 		return 1;
 	}
 
-	printf("%s\n", midx->pack_names[midx_preferred_pack(bitmap)]);
+	printf("%s\n", nth_midxed_pack_name(midx, midx_preferred_pack(bitmap)));
 	free_bitmap_index(bitmap);
 	return 0;
 }
@@ -103,12 +124,14 @@ static int read_midx_preferred_pack(const char *object_dir)
 int cmd__read_midx(int argc, const char **argv)
 {
 	if (!(argc == 2 || argc == 3))
-		usage("read-midx [--show-objects|--checksum|--preferred-pack] <object-dir>");
+		usage("read-midx [--show-objects|--checksum|--layers|--preferred-pack] <object-dir>");
 
 	if (!strcmp(argv[1], "--show-objects"))
 		return read_midx_file(argv[2], 1);
 	else if (!strcmp(argv[1], "--checksum"))
 		return read_midx_checksum(argv[2]);
+	else if (!strcmp(argv[1], "--layers"))
+		return read_midx_layers(argv[2]);
 	else if (!strcmp(argv[1], "--preferred-pack"))
 		return read_midx_preferred_pack(argv[2]);
 	return read_midx_file(argv[1], 0);
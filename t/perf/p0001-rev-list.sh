@@ -14,6 +14,13 @@ test_perf 'rev-list --all --objects' '
 	git rev-list --all --objects >/dev/null
 '
 
+for preload in false true
+do
+	test_perf "rev-list --all --objects, core.preloadTrees=$preload" "
+		git -c core.preloadTrees=$preload rev-list --all --objects >/dev/null
+	"
+done
+
 test_perf 'rev-list --parents' '
 	git rev-list --parents HEAD >/dev/null
 '
@@ -72,4 +72,12 @@ test_perf "switch between aliases ($nr_files)" '
 	git checkout -q br_ballast
 '
 
+for preload in false true
+do
+	test_perf "switch between br_base br_ballast, core.preloadTrees=$preload ($nr_files)" "
+		git -c core.preloadTrees=$preload checkout -q br_base &&
+		git -c core.preloadTrees=$preload checkout -q br_ballast
+	"
+done
+
 test_done
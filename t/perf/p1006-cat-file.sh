@@ -9,4 +9,12 @@ test_perf 'cat-file --batch-check' '
 	git cat-file --batch-all-objects --batch-check
 '
 
+test_perf 'cat-file --batch' '
+	git cat-file --batch-all-objects --batch >/dev/null
+'
+
+test_perf 'cat-file --batch --unordered' '
+	git cat-file --batch-all-objects --batch --unordered >/dev/null
+'
+
 test_done
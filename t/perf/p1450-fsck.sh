@@ -10,4 +10,11 @@ test_perf 'fsck' '
 	git fsck
 '
 
+for preload in false true
+do
+	test_perf "fsck --connectivity-only, core.preloadTrees=$preload" "
+		git -c core.preloadTrees=$preload fsck --connectivity-only
+	"
+done
+
 test_done
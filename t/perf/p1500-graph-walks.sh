@@ -47,4 +47,39 @@ test_perf 'contains: git tag --merged' '
 	xargs git tag --merged=HEAD <tags
 '
 
+test_expect_success 'setup reachability labels' '
+	git commit-graph write --reachable --reach-labels &&
+	for ref in $(cat refs)
+	do
+		echo "X:$ref" &&
+		echo "Y:$ref" ||
+		return 1
+	done >reach-input
+'
+
+test_perf 'contains with labels: git for-each-ref --merged' '
+	git for-each-ref --merged=HEAD --stdin <refs
+'
+
+test_perf 'contains with labels: git tag --merged' '
+	xargs git tag --merged=HEAD <tags
+'
+
+test_perf 'contains with labels: all pairs of refs' '
+	test-tool reach in_merge_bases_all <reach-input
+'
+
+test_expect_success 'setup ahead-behind cache' '
+	git config commitGraph.aheadBehindCache true &&
+	git for-each-ref --format="%(ahead-behind:HEAD)" --stdin <refs
+'
+
+test_perf 'ahead-behind counts with cache: git for-each-ref' '
+	git for-each-ref --format="%(ahead-behind:HEAD)" --stdin <refs
+'
+
+test_perf 'ahead-behind counts with cache: git branch' '
+	xargs git branch -l --format="%(ahead-behind:HEAD)" <branches
+'
+
 test_done
@@ -0,0 +1,45 @@
+#!/bin/sh
+
+test_description="Tests performance of iterating over packed-refs"
+
+. ./perf-lib.sh
+
+test_perf_fresh_repo
+
+test_expect_success "setup" '
+	test_commit base &&
+	for i in $(test_seq 100000)
+	do
+		echo "create refs/pull/$i/head HEAD" || return 1
+	done >in &&
+	git update-ref --stdin <in &&
+	git pack-refs --all &&
+	cp .git/packed-refs packed-refs.text
+'
+
+for index in false true
+do
+	test_expect_success "setup (index=$index)" '
+		if test $index = true
+		then
+			git -c core.packedRefsIndex=true pack-refs --all
+		else
+			cp packed-refs.text .git/packed-refs &&
+			rm -f .git/packed-refs.idx
+		fi
+	'
+
+	test_perf "iterate all refs (index=$index)" '
+		test-tool ref-store main for-each-ref refs/ >/dev/null
+	'
+
+	test_perf "iterate one prefix (index=$index)" '
+		test-tool ref-store main for-each-ref refs/heads/ >/dev/null
+	'
+
+	test_perf "show-ref (index=$index)" '
+		git show-ref >/dev/null
+	'
+done
+
+test_done
@@ -26,4 +26,20 @@ test_perf 'log -p -3000 --patience' '
 	git log -p -3000 --patience >/dev/null
 '
 
+test_expect_success 'setup multi-megabyte files' '
+	git ls-files -z -- "*.c" "*.h" >files &&
+	xargs -0 cat <files >sources &&
+	head -c 8000000 sources >big.orig &&
+	awk "NR % 97 == 0 { print \"+\" \$0; next } { print }" \
+		big.orig >big.new
+'
+
+for algo in myers histogram patience
+do
+	test_perf "diff --no-index --diff-algorithm=$algo (multi-megabyte files)" "
+		test_expect_code 1 git diff --no-index --diff-algorithm=$algo \\
+			--stat big.orig big.new >/dev/null
+	"
+done
+
 test_done
@@ -47,4 +47,15 @@ test_perf 'index-pack default number of threads' \
 	GIT_DIR=repo.git git index-pack --stdin < $PACK
 '
 
+# Objects read back from an existing pack are inflated in one go when
+# their compressed data is at hand; compare builds with and without
+# USE_LIBDEFLATE to see the difference the backend makes.
+test_perf 'verify-pack' '
+	git verify-pack "${PACK%.pack}.idx"
+'
+
+test_perf 'cat-file --batch-all-objects' '
+	git cat-file --batch-all-objects --batch --unordered >/dev/null
+'
+
 test_done
@@ -0,0 +1,57 @@
+#!/bin/sh
+
+test_description='memory use of pack-objects with large blobs
+
+Blobs above core.bigFileThreshold are written by streaming them, so the
+memory pack-objects allocates should not grow with their size, whether
+they are loose, packed, or packed as a delta against another blob.
+Mapped files are counted as resident memory, too; pack windows are kept
+small here, but a loose object is still mapped in full.
+'
+. ./perf-lib.sh
+
+test_perf_fresh_repo
+
+blob_size=${GIT_PERF_LARGE_BLOB_SIZE:-$((64 * 1024 * 1024))}
+
+test_expect_success 'set up large blobs' '
+	test-tool genrandom base $blob_size >base &&
+	{ cat base && echo more; } >delta &&
+	git add base delta &&
+	git commit -q -m large &&
+	git rev-parse HEAD:base >base.oid &&
+	git rev-parse HEAD:delta >delta.oid &&
+
+	mkdir loose &&
+	git -C loose init -q --bare &&
+	git cat-file blob $(cat base.oid) |
+	git -C loose hash-object -w --stdin &&
+
+	git -c core.bigFileThreshold=1g repack -adfq &&
+	git cat-file --batch-all-objects --batch-check="%(deltabase)" >bases &&
+	grep -v "^0*$" bases
+'
+
+pack_rss () {
+	test-tool max-rss sh -c "git \
+		-c core.bigFileThreshold=$1 \
+		-c core.packedGitWindowSize=1m \
+		-c core.packedGitLimit=8m \
+		pack-objects --stdout <$2 >/dev/null"
+}
+
+for threshold in 1g 1m
+do
+	test_size "max RSS, loose blob (threshold=$threshold)" "
+		GIT_DIR=loose pack_rss $threshold base.oid
+	"
+
+	for blob in base delta
+	do
+		test_size "max RSS, packed $blob (threshold=$threshold)" "
+			pack_rss $threshold $blob.oid
+		"
+	done
+done
+
+test_done
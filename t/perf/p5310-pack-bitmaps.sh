@@ -37,4 +37,32 @@ test_lookup_pack_bitmap () {
 test_lookup_pack_bitmap false
 test_lookup_pack_bitmap true
 
+test_tip_union_bitmap () {
+	test_perf "repack with tip unions: $1" '
+		git -c pack.bitmapTipUnions='"$1"' \
+			-c pack.bitmapTipUnionThreshold=now repack -adb
+	'
+
+	test_perf "rev-list --all with tip unions: $1" '
+		git rev-list --all --objects --use-bitmap-index >/dev/null
+	'
+
+	test_perf "rev-list with many haves, tip unions: $1" '
+		git rev-list --objects --use-bitmap-index HEAD \
+			--not --glob=refs/tip-union-perf/ >/dev/null
+	'
+}
+
+# Tip unions pay off with many refs, which are not all bitmapped.
+test_expect_success 'create many refs' '
+	git rev-list --first-parent HEAD~1 |
+	awk "NR % 10 == 0 && NR <= 20000 {
+		print \"create refs/tip-union-perf/\" NR \" \" \$1
+	}" |
+	git update-ref --stdin
+'
+
+test_tip_union_bitmap 0
+test_tip_union_bitmap 64
+
 test_done
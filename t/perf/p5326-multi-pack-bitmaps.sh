@@ -61,7 +61,65 @@ test_bitmap () {
 	test_partial_bitmap
 }
 
+test_multi_pack_reuse () {
+	test_expect_success 'remove existing repo (multi-pack reuse)' '
+		rm -fr * .git
+	'
+
+	test_perf_large_repo
+
+	test_expect_success 'split history into several packs' '
+		# keep only HEAD, so that all remaining objects are in the
+		# packs written below
+		orig_tip=$(git rev-parse HEAD) &&
+		rm -rf .git/logs .git/refs/* .git/packed-refs &&
+		git update-ref HEAD $orig_tip &&
+		git repack -ad &&
+		ls .git/objects/pack/pack-*.pack >old &&
+
+		# one pack per slice of history, oldest first, as a
+		# geometric repack would leave them
+		nr=$(git rev-list --first-parent --count HEAD) &&
+		prev= &&
+		for i in 4 3 2 1 0
+		do
+			tip=$(git rev-parse HEAD~$(($nr * $i / 5))) &&
+			{
+				echo $tip &&
+				if test -n "$prev"
+				then
+					echo ^$prev
+				fi
+			} | git pack-objects --revs .git/objects/pack/pack &&
+			prev=$tip || return 1
+		done &&
+		for p in $(cat old)
+		do
+			rm -f "${p%.pack}".* || return 1
+		done &&
+		git multi-pack-index write --bitmap
+	'
+
+	for reuse in single multi
+	do
+		test_perf "clone from several packs (reuse=$reuse)" "
+			git -c pack.allowPackReuse=$reuse \
+				pack-objects --stdout --all </dev/null >/dev/null
+		"
+
+		test_perf "fetch from several packs (reuse=$reuse)" "
+			have=\$(git rev-list HEAD~100 -1) &&
+			{
+				echo HEAD &&
+				echo ^\$have
+			} | git -c pack.allowPackReuse=$reuse \
+				pack-objects --revs --stdout >/dev/null
+		"
+	done
+}
+
 test_bitmap false
 test_bitmap true
+test_multi_pack_reuse
 
 test_done
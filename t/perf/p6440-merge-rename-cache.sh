@@ -0,0 +1,46 @@
+#!/bin/sh
+
+test_description='Tests performance of merges with merge.renameCache'
+. ./perf-lib.sh
+
+test_perf_default_repo
+
+test_expect_success 'setup many inexact renames' '
+	git checkout -f -B base &&
+	git ls-files -- "*.c" | head -n 500 >to-rename &&
+	test_line_count -gt 0 to-rename &&
+
+	git checkout -B upstream &&
+	mkdir -p renamed &&
+	while read path
+	do
+		new=renamed/$(echo "$path" | tr / _) &&
+		git mv "$path" "$new" &&
+		echo upstream >>"$new" || return 1
+	done <to-rename &&
+	git add renamed &&
+	git commit -q -m "rename and modify many files" &&
+
+	git checkout -B topic base &&
+	while read path
+	do
+		{ echo topic && cat "$path"; } >tmp &&
+		mv tmp "$path" || return 1
+	done <to-rename &&
+	git commit -q -a -m "modify many files"
+'
+
+test_perf 'merge-tree without rename cache' '
+	git -c merge.renameCache=false merge-tree --write-tree topic upstream
+'
+
+test_expect_success 'populate rename cache' '
+	git -c merge.renameCache=true merge-tree --write-tree topic upstream &&
+	test_path_is_dir .git/objects/info/rename-cache
+'
+
+test_perf 'merge-tree with rename cache' '
+	git -c merge.renameCache=true merge-tree --write-tree topic upstream
+'
+
+test_done
@@ -106,6 +106,29 @@ test_expect_success "Setup borrowed repo (temp ballast branch)" "
 	git -C $REPO checkout $TMP_BR
 "
 
+# On Linux the daemon has to create an inotify watch on every directory
+# in the working tree, so it cannot start if the per-user watch limit
+# is smaller than the number of directories in the synthetic repo.
+#
+if test -r /proc/sys/fs/inotify/max_user_watches
+then
+	nr_dirs=$(find $REPO -path $REPO/.git -prune -o -type d -print | wc -l)
+	max_watches=$(cat /proc/sys/fs/inotify/max_user_watches)
+	if test $max_watches -le $nr_dirs
+	then
+		skip_all="fs.inotify.max_user_watches ($max_watches) is too small for $nr_dirs directories"
+		test_done
+	fi
+	test_set_prereq INOTIFY
+fi
+
+# Time how long it takes the daemon to set up its recursive inotify
+# watches and start answering requests.
+#
+test_perf INOTIFY "[fsm] daemon startup (inotify)" "
+	git -C $REPO fsmonitor--daemon start &&
+	git -C $REPO fsmonitor--daemon stop
+"
 
 echo Data >data.txt
 
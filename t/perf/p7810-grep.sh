@@ -20,4 +20,15 @@ test_perf 'grep --cached, expensive regex' '
 	git grep --cached "^.* *some_nonexistent_string$" || :
 '
 
+for threads in 1 4 16
+do
+	test_perf "grep HEAD, cheap regex, $threads threads" "
+		git grep --threads=$threads some_nonexistent_string HEAD || :
+	"
+	test_perf "grep HEAD, cheap regex, $threads threads, no read-ahead" "
+		git -c grep.readAhead=false grep --threads=$threads \
+			some_nonexistent_string HEAD || :
+	"
+done
+
 test_done
@@ -0,0 +1,22 @@
+#!/bin/sh
+
+test_description='Tests performance of blame with prefetching threads'
+. ./perf-lib.sh
+
+test_perf_default_repo
+
+test_expect_success 'find the file with the longest history' '
+	git log --format= --name-only --diff-filter=M -n 5000 >paths &&
+	grep . paths | sort | uniq -c | sort -n -r |
+	sed -n -e "1s/^ *[0-9]* //p" >file &&
+	test -s file
+'
+
+for threads in 1 2 4 0
+do
+	test_perf "blame --threads=$threads" "
+		git blame --threads=$threads -- \"\$(cat file)\" >/dev/null
+	"
+done
+
+test_done
@@ -0,0 +1,20 @@
+#!/bin/sh
+
+test_description='concurrent use of the parsed object pool'
+
+TEST_PASSES_SANITIZE_LEAK=true
+. ./test-lib.sh
+
+test_expect_success PTHREADS 'objects are created once' '
+	echo "1000 objects" >expect &&
+	test-tool parsed-objects verify 1000 1 >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success PTHREADS 'racing threads agree on the objects they create' '
+	echo "5000 objects" >expect &&
+	test-tool parsed-objects verify 5000 8 >actual &&
+	test_cmp expect actual
+'
+
+test_done
@@ -0,0 +1,264 @@
+#!/bin/sh
+#
+# Copyright (c) 2020 Google LLC
+#
+
+test_description='reftable basics'
+GIT_TEST_DEFAULT_INITIAL_BRANCH_NAME=main
+export GIT_TEST_DEFAULT_INITIAL_BRANCH_NAME
+
+. ./test-lib.sh
+
+INVALID_OID=$(test_oid 001)
+
+test_expect_success 'init: creates basic reftable structures' '
+	test_when_finished "rm -rf repo" &&
+	git init --ref-format=reftable repo &&
+	test_path_is_dir repo/.git/reftable &&
+	test_path_is_file repo/.git/reftable/tables.list &&
+	echo reftable >expect &&
+	git -C repo rev-parse --show-ref-format >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'init: sha256 object format via environment variable' '
+	test_when_finished "rm -rf repo" &&
+	GIT_DEFAULT_HASH=sha256 git init --ref-format=reftable repo &&
+	cat >expect <<-EOF &&
+	sha256
+	reftable
+	EOF
+	git -C repo rev-parse --show-object-format --show-ref-format >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'init: ref format via environment variable' '
+	test_when_finished "rm -rf repo" &&
+	GIT_DEFAULT_REF_FORMAT=reftable git init repo &&
+	echo reftable >expect &&
+	git -C repo rev-parse --show-ref-format >actual &&
+	test_cmp expect actual &&
+	test_cmp_config -C repo reftable extensions.refstorage
+'
+
+test_expect_success 'init: unknown ref format is rejected' '
+	test_when_finished "rm -rf repo" &&
+	test_must_fail git init --ref-format=garbage repo 2>err &&
+	test_i18ngrep "unknown ref storage format ${SQ}garbage${SQ}" err
+'
+
+test_expect_success 'init: reinitializing with a different format fails' '
+	test_when_finished "rm -rf repo" &&
+	git init --ref-format=files repo &&
+	test_must_fail git init --ref-format=reftable repo 2>err &&
+	test_i18ngrep "attempt to reinitialize repository with different reference storage format" err
+'
+
+test_expect_success 'init: reinitializing reftable repository succeeds' '
+	test_when_finished "rm -rf repo" &&
+	git init --ref-format=reftable repo &&
+	git init repo &&
+	echo reftable >expect &&
+	git -C repo rev-parse --show-ref-format >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'init: old clients refuse to touch the repository' '
+	test_when_finished "rm -rf repo" &&
+	git init --ref-format=reftable repo &&
+	echo "ref: refs/heads/.invalid" >expect &&
+	test_cmp expect repo/.git/HEAD &&
+	test_path_is_file repo/.git/refs/heads
+'
+
+test_expect_success 'setup repository' '
+	git init --ref-format=reftable repo &&
+	test_commit -C repo file &&
+	test_commit -C repo second
+'
+
+test_expect_success 'ref transaction: basic create, update and delete' '
+	git -C repo update-ref refs/heads/topic HEAD~ &&
+	git -C repo rev-parse file >expect &&
+	git -C repo rev-parse refs/heads/topic >actual &&
+	test_cmp expect actual &&
+
+	git -C repo update-ref refs/heads/topic HEAD HEAD~ &&
+	git -C repo rev-parse second >expect &&
+	git -C repo rev-parse refs/heads/topic >actual &&
+	test_cmp expect actual &&
+
+	git -C repo update-ref -d refs/heads/topic &&
+	test_must_fail git -C repo rev-parse --verify refs/heads/topic
+'
+
+test_expect_success 'ref transaction: old value mismatch is rejected' '
+	git -C repo update-ref refs/heads/topic HEAD &&
+	test_must_fail git -C repo update-ref refs/heads/topic HEAD~ HEAD~ 2>err &&
+	test_i18ngrep "cannot lock ref ${SQ}refs/heads/topic${SQ}: is at" err &&
+	test_must_fail git -C repo update-ref refs/heads/topic HEAD $ZERO_OID 2>err &&
+	test_i18ngrep "reference already exists" err &&
+	git -C repo update-ref -d refs/heads/topic
+'
+
+test_expect_success 'ref transaction: writing a missing object fails' '
+	test_must_fail git -C repo update-ref refs/heads/topic $INVALID_OID 2>err &&
+	test_i18ngrep "trying to write ref ${SQ}refs/heads/topic${SQ} with nonexistent object" err
+'
+
+test_expect_success 'ref transaction: D/F conflicts are detected' '
+	git -C repo update-ref refs/heads/df HEAD &&
+	test_must_fail git -C repo update-ref refs/heads/df/nested HEAD 2>err &&
+	test_i18ngrep "${SQ}refs/heads/df${SQ} exists" err &&
+	git -C repo update-ref -d refs/heads/df &&
+	git -C repo update-ref refs/heads/df/nested HEAD &&
+	git -C repo update-ref -d refs/heads/df/nested
+'
+
+test_expect_success 'ref transaction: multiple updates via --stdin' '
+	cat >instructions <<-EOF &&
+	start
+	create refs/heads/a HEAD
+	create refs/heads/b HEAD~
+	commit
+	EOF
+	git -C repo update-ref --stdin <instructions &&
+	git -C repo for-each-ref --format="%(refname)" refs/heads/ >actual &&
+	cat >expect <<-EOF &&
+	refs/heads/a
+	refs/heads/b
+	refs/heads/main
+	EOF
+	test_cmp expect actual &&
+	git -C repo update-ref -d refs/heads/a &&
+	git -C repo update-ref -d refs/heads/b
+'
+
+test_expect_success 'ref transaction: updating HEAD updates its referent' '
+	git -C repo update-ref HEAD HEAD~ &&
+	git -C repo rev-parse file >expect &&
+	git -C repo rev-parse refs/heads/main >actual &&
+	test_cmp expect actual &&
+	git -C repo reflog show HEAD >head-log &&
+	git -C repo reflog show main >main-log &&
+	test_line_count = 3 head-log &&
+	test_line_count = 3 main-log &&
+	git -C repo update-ref HEAD second
+'
+
+test_expect_success 'symbolic refs can be created and read' '
+	git -C repo symbolic-ref refs/heads/sym refs/heads/main &&
+	echo refs/heads/main >expect &&
+	git -C repo symbolic-ref refs/heads/sym >actual &&
+	test_cmp expect actual &&
+	git -C repo rev-parse main >expect &&
+	git -C repo rev-parse sym >actual &&
+	test_cmp expect actual &&
+	git -C repo symbolic-ref -d refs/heads/sym
+'
+
+test_expect_success 'for-each-ref lists peeled tags' '
+	git -C repo tag -a -m annotated annotated &&
+	git -C repo rev-parse annotated^{commit} >expect &&
+	git -C repo for-each-ref --format="%(*objectname)" refs/tags/annotated >actual &&
+	test_cmp expect actual &&
+	git -C repo tag -d annotated
+'
+
+test_expect_success 'show-ref lists refs' '
+	git -C repo show-ref >actual &&
+	cat >expect <<-EOF &&
+	$(git -C repo rev-parse main) refs/heads/main
+	$(git -C repo rev-parse file) refs/tags/file
+	$(git -C repo rev-parse second) refs/tags/second
+	EOF
+	test_cmp expect actual
+'
+
+test_expect_success 'reflog: deleting a ref deletes its reflog' '
+	git -C repo update-ref refs/heads/reflog HEAD &&
+	git -C repo reflog exists refs/heads/reflog &&
+	git -C repo update-ref -d refs/heads/reflog &&
+	test_must_fail git -C repo reflog exists refs/heads/reflog
+'
+
+test_expect_success 'reflog: expire drops old entries' '
+	test_when_finished "rm -rf expire" &&
+	git init --ref-format=reftable expire &&
+	test_commit -C expire one &&
+	test_commit -C expire two &&
+	test_commit -C expire three &&
+	git -C expire reflog show main >actual &&
+	test_line_count = 3 actual &&
+	git -C expire reflog expire --expire=all main &&
+	git -C expire reflog show main >actual &&
+	test_must_be_empty actual &&
+	git -C expire reflog exists refs/heads/main
+'
+
+test_expect_success 'branch: rename and copy carry over reflogs' '
+	git -C repo branch original &&
+	git -C repo branch -m original renamed &&
+	test_must_fail git -C repo rev-parse --verify original &&
+	test_must_fail git -C repo reflog exists refs/heads/original &&
+	git -C repo reflog show renamed >actual &&
+	test_line_count = 2 actual &&
+	git -C repo branch -c renamed copied &&
+	git -C repo rev-parse renamed >expect &&
+	git -C repo rev-parse copied >actual &&
+	test_cmp expect actual &&
+	git -C repo reflog exists refs/heads/renamed &&
+	git -C repo branch -D renamed copied
+'
+
+test_expect_success 'pack-refs: compacts the stack' '
+	test_when_finished "rm -rf pack" &&
+	git init --ref-format=reftable pack &&
+	test_commit -C pack first &&
+	for i in $(test_seq 10)
+	do
+		git -C pack \
+			update-ref refs/heads/branch-$i HEAD || return 1
+	done &&
+	git -C pack pack-refs &&
+	test_line_count = 1 pack/.git/reftable/tables.list &&
+	git -C pack for-each-ref refs/heads/ >actual &&
+	test_line_count = 11 actual
+'
+
+test_expect_success 'worktree: refs are shared and per-worktree refs are not' '
+	test_when_finished "rm -rf wt-repo" &&
+	git init --ref-format=reftable wt-repo &&
+	test_commit -C wt-repo base &&
+	git -C wt-repo worktree add ../wt &&
+	test_when_finished "rm -rf wt" &&
+	test_path_is_dir wt-repo/.git/worktrees/wt/reftable &&
+
+	git -C wt update-ref refs/heads/shared HEAD &&
+	git -C wt-repo rev-parse shared &&
+
+	git -C wt update-ref refs/bisect/wt-only HEAD &&
+	test_must_fail git -C wt-repo rev-parse --verify refs/bisect/wt-only &&
+	git -C wt-repo rev-parse worktrees/wt/refs/bisect/wt-only &&
+
+	git -C wt-repo update-ref refs/bisect/main-only HEAD &&
+	test_must_fail git -C wt rev-parse --verify refs/bisect/main-only &&
+	git -C wt rev-parse main-worktree/refs/bisect/main-only &&
+
+	git -C wt for-each-ref --format="%(refname)" refs/bisect/ >actual &&
+	echo refs/bisect/wt-only >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'clone: honors --ref-format' '
+	test_when_finished "rm -rf cloned" &&
+	git clone --ref-format=reftable repo cloned &&
+	echo reftable >expect &&
+	git -C cloned rev-parse --show-ref-format >actual &&
+	test_cmp expect actual &&
+	git -C repo for-each-ref --format="%(objectname)" refs/heads/ >expect &&
+	git -C cloned for-each-ref --format="%(objectname)" refs/remotes/origin/main >actual &&
+	test_cmp expect actual
+'
+
+test_done
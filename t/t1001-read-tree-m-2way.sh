@@ -417,4 +417,50 @@ test_expect_success '-m references the correct modified tree' '
 	test_cmp expect actual
 '
 
+test_expect_success 'preloading trees does not change the result' '
+	git checkout -f initial-mod &&
+	for i in 1 2 3 4 5 6 7 8
+	do
+		mkdir -p dir$i/sub$i &&
+		echo $i >dir$i/sub$i/file &&
+		echo $i >dir$i/file || return 1
+	done &&
+	git add dir* &&
+	git commit -m "many directories" &&
+	git branch many-dirs &&
+	for i in 2 4 6 8
+	do
+		echo changed >dir$i/sub$i/file || return 1
+	done &&
+	git rm -r -q dir3 &&
+	git commit -a -m "change some directories" &&
+
+	git read-tree -m many-dirs HEAD &&
+	git ls-files --stage >expect &&
+	GIT_TEST_PRELOAD_TREES=1 git read-tree -m many-dirs HEAD &&
+	git ls-files --stage >actual &&
+	test_cmp expect actual &&
+
+	GIT_TEST_PRELOAD_TREES=1 git checkout -q many-dirs &&
+	git ls-tree -r many-dirs >expect-tree &&
+	git ls-files -s | awk "{print \$2, \$4}" >actual-files &&
+	awk "{print \$3, \$4}" expect-tree >expect-files &&
+	test_cmp expect-files actual-files &&
+	git diff --exit-code many-dirs
+'
+
+test_expect_success 'tree preloading threads start only when there are subtrees' '
+	blob=$(git rev-parse many-dirs:dir1/file) &&
+	flat=$(printf "100644 blob $blob\tfile\n" | git mktree) &&
+	rm -f trace.event &&
+	GIT_TEST_PRELOAD_TREES=1 GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+		git read-tree $flat &&
+	! grep "\"key\":\"threads\"" trace.event &&
+
+	rm -f trace.event &&
+	GIT_TEST_PRELOAD_TREES=1 GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+		git read-tree many-dirs &&
+	grep "\"category\":\"tree-preload\",\"key\":\"threads\"" trace.event
+'
+
 test_done
@@ -1078,6 +1078,36 @@ test_expect_success 'cat-file --unordered works' '
 	test_cmp expect actual
 '
 
+test_expect_success 'cat-file --unordered --batch reads packs in bulk' '
+	git init bulk &&
+	(
+		cd bulk &&
+		test_seq 1000 >file &&
+		git add file &&
+		git commit -qm base &&
+		for i in 1 2 3 4 5
+		do
+			test_seq $i 1000 >file &&
+			echo $i >>file &&
+			git commit -qam "change $i" || return 1
+		done &&
+		git repack -adf --depth=3 &&
+		echo loose | git hash-object -w --stdin &&
+		git cat-file --batch-all-objects --batch >expect.unsorted &&
+		GIT_TRACE2_EVENT="$(pwd)/trace" \
+			git cat-file --batch-all-objects --unordered \
+			--batch >actual.unsorted &&
+		grep "\"key\":\"shared_bases\",\"value\":\"[1-9]" trace &&
+		sort expect.unsorted >expect &&
+		sort actual.unsorted >actual &&
+		test_cmp expect actual &&
+		git -c core.bigFileThreshold=1k cat-file --batch-all-objects \
+			--unordered --batch >actual.unsorted &&
+		sort actual.unsorted >actual &&
+		test_cmp expect actual
+	)
+'
+
 test_expect_success 'set up object list for --batch-all-objects tests' '
 	git -C all-two cat-file --batch-all-objects --batch-check="%(objectname)" >objects
 '
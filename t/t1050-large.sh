@@ -195,6 +195,58 @@ test_expect_success 'pack-objects with large loose object' '
 	test_cmp huge actual
 '
 
+test_expect_success 'pack-objects with large object stored as delta' '
+	test_create_repo delta &&
+	(
+		cd delta &&
+		test-tool genrandom a 2000000 >one &&
+		{ cat one && echo more; } >two &&
+		git add one two &&
+		git commit -q -m delta &&
+		GIT_ALLOC_LIMIT=0 git -c core.bigfilethreshold=1g repack -adfq &&
+		git cat-file --batch-all-objects --batch-check="%(deltabase)" >bases &&
+		grep -v $ZERO_OID bases
+	) &&
+	for f in one two
+	do
+		SHA1=$(git -C delta rev-parse HEAD:$f) &&
+		echo $SHA1 | git -C delta pack-objects --stdout >one-$f.pack &&
+		rm -rf unpacked-$f &&
+		test_create_repo unpacked-$f &&
+		GIT_ALLOC_LIMIT=0 git -C unpacked-$f index-pack --stdin <one-$f.pack &&
+		git -C unpacked-$f cat-file blob $SHA1 >actual &&
+		test_cmp delta/$f actual || return 1
+	done
+'
+
+test_expect_success 'stream large object at the end of a delta chain' '
+	test_create_repo chain &&
+	(
+		cd chain &&
+		test-tool genrandom a 2000000 >file &&
+		git add file &&
+		git commit -q -m 1 &&
+		for i in 2 3 4
+		do
+			echo $i >>file &&
+			git commit -q -a -m $i &&
+			GIT_ALLOC_LIMIT=0 git -c core.bigfilethreshold=1g \
+				repack -adq || return 1
+		done &&
+		GIT_ALLOC_LIMIT=0 git verify-pack -v .git/objects/pack/*.idx >verify &&
+		grep "chain length = 3" verify &&
+
+		for i in 0 1 2 3
+		do
+			git cat-file blob HEAD~$i:file >actual &&
+			git rev-parse HEAD~$i:file >expect &&
+			git hash-object actual >hash &&
+			test_cmp expect hash || return 1
+		done &&
+		! ls .git/objects/tmp_delta_base_*
+	)
+'
+
 test_expect_success 'tar archiving' '
 	git archive --format=tar HEAD >/dev/null
 '
@@ -1060,4 +1060,29 @@ test_expect_success 'fsck reports problems in current worktree index without fil
 	test_cmp expect actual
 '
 
+test_expect_success 'fsck with preloaded trees' '
+	test_create_repo preload &&
+	(
+		cd preload &&
+		for i in 1 2 3 4 5 6
+		do
+			mkdir -p dir$i/sub$i &&
+			echo $i >dir$i/sub$i/file &&
+			echo $i >dir$i/file &&
+			git add . &&
+			git commit -q -m "preload $i" || return 1
+		done &&
+		GIT_TEST_PRELOAD_TREES=1 git fsck &&
+		GIT_TEST_PRELOAD_TREES=1 git fsck --connectivity-only &&
+
+		tree=$(git rev-parse HEAD~2:dir3) &&
+		remove_object $tree &&
+		test_must_fail git fsck --connectivity-only >expect 2>&1 &&
+		test_must_fail env GIT_TEST_PRELOAD_TREES=1 \
+			git fsck --connectivity-only >actual 2>&1 &&
+		test_cmp expect actual &&
+		test_i18ngrep "broken link" actual
+	)
+'
+
 test_done
@@ -0,0 +1,102 @@
+#!/bin/sh
+
+test_description='packed-refs index'
+
+GIT_TEST_DEFAULT_INITIAL_BRANCH_NAME=main
+export GIT_TEST_DEFAULT_INITIAL_BRANCH_NAME
+
+TEST_PASSES_SANITIZE_LEAK=true
+. ./test-lib.sh
+
+# Compare the output of various ways to read references with and
+# without the index.
+test_refs_unchanged () {
+	git for-each-ref >expect.all &&
+	git show-ref -d >expect.peeled &&
+	git for-each-ref refs/heads/b >expect.prefix &&
+	test-tool ref-store main for-each-ref--exclude refs/heads \
+		refs/heads/b >expect.exclude &&
+	git rev-parse heads-a-1 refs/heads/c/3 v1 >expect.single &&
+
+	mv .git/packed-refs.idx packed-refs.idx &&
+	git for-each-ref >actual.all &&
+	git show-ref -d >actual.peeled &&
+	git for-each-ref refs/heads/b >actual.prefix &&
+	test-tool ref-store main for-each-ref--exclude refs/heads \
+		refs/heads/b >actual.exclude &&
+	git rev-parse heads-a-1 refs/heads/c/3 v1 >actual.single &&
+	mv packed-refs.idx .git/packed-refs.idx &&
+
+	for f in all peeled prefix exclude single
+	do
+		test_cmp expect.$f actual.$f || return 1
+	done
+}
+
+test_expect_success 'setup' '
+	test_commit base &&
+	git tag -a -m tag v1 &&
+	git tag -a -m nested v2 v1 &&
+	for name in a b c
+	do
+		for i in 1 2 3
+		do
+			echo "create refs/heads/$name/$i HEAD" &&
+			echo "create refs/tags/heads-$name-$i HEAD" || return 1
+		done || return 1
+	done >in &&
+	git update-ref --stdin <in &&
+	git config core.packedRefsIndex true
+'
+
+test_expect_success 'pack-refs writes an index' '
+	git pack-refs --all &&
+	test_path_is_file .git/packed-refs.idx &&
+	sum=$(tail -c $(test_oid rawsz) .git/packed-refs.idx |
+	      od -An -tx1 | tr -d " \n") &&
+	head -n 1 .git/packed-refs >header &&
+	grep "sorted index=$sum \$" header
+'
+
+test_expect_success 'references read from the index are unchanged' '
+	test_refs_unchanged
+'
+
+test_expect_success 'the index is used for iteration' '
+	cp .git/packed-refs packed-refs.orig &&
+	head -n 1 packed-refs.orig >.git/packed-refs &&
+	git for-each-ref >actual &&
+	cp packed-refs.orig .git/packed-refs &&
+	git for-each-ref >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'transactions update the index' '
+	git update-ref -d refs/heads/b/2 &&
+	git update-ref --no-deref refs/heads/b/4 HEAD &&
+	git pack-refs --all &&
+	test_must_fail git rev-parse --verify refs/heads/b/2 &&
+	git rev-parse --verify refs/heads/b/4 &&
+	test_refs_unchanged
+'
+
+test_expect_success 'stale index is ignored' '
+	cp .git/packed-refs.idx packed-refs.idx.old &&
+	git update-ref -d refs/heads/b/4 &&
+	cp packed-refs.idx.old .git/packed-refs.idx &&
+	test_must_fail git rev-parse --verify refs/heads/b/4 &&
+	git show-ref >actual &&
+	! grep refs/heads/b/4 actual
+'
+
+test_expect_success 'index is removed when disabled' '
+	git -c core.packedRefsIndex=false pack-refs --all &&
+	test_path_is_missing .git/packed-refs.idx &&
+	! grep "index=" .git/packed-refs &&
+	git for-each-ref >actual &&
+	git pack-refs --all &&
+	git for-each-ref >expect &&
+	test_cmp expect actual
+'
+
+test_done
@@ -121,8 +121,9 @@ test_expect_success 'git log with --walk-reflogs does not use Bloom filters' '
 	test_bloom_filters_not_used "--walk-reflogs -- A"
 '
 
-test_expect_success 'git log -- multiple path specs does not use Bloom filters' '
-	test_bloom_filters_not_used "-- file4 A/file1"
+test_expect_success 'git log -- multiple path specs uses Bloom filters' '
+	test_bloom_filters_used "-- file4 A/file1" &&
+	test_bloom_filters_used "-- A/B/C file5"
 '
 
 test_expect_success 'git log -- "." pathspec at root does not use Bloom filters' '
@@ -134,9 +135,25 @@ test_expect_success 'git log with wildcard that resolves to a single path uses B
 	test_bloom_filters_used "-- *renamed"
 '
 
-test_expect_success 'git log with wildcard that resolves to a multiple paths does not uses Bloom filters' '
-	test_bloom_filters_not_used "-- *" &&
-	test_bloom_filters_not_used "-- file*"
+test_expect_success 'git log with wildcard that resolves to a multiple paths uses Bloom filters' '
+	test_bloom_filters_used "-- *" &&
+	test_bloom_filters_used "-- file*"
+'
+
+test_expect_success 'git log with wildcard without a leading directory does not use Bloom filters' '
+	test_bloom_filters_not_used "-- :(glob)*" &&
+	test_bloom_filters_not_used "-- :(glob)file*"
+'
+
+test_expect_success 'git log with wildcard after a leading directory uses Bloom filters' '
+	test_bloom_filters_used "-- :(glob)A/**/file3" &&
+	test_bloom_filters_used "-- :(glob)A/B/*" &&
+	test_bloom_filters_used "-- :(glob)A/B/*2 file4"
+'
+
+test_expect_success 'git log with icase or exclude pathspecs does not use Bloom filters' '
+	test_bloom_filters_not_used "-- :(icase)a/b" &&
+	test_bloom_filters_not_used "-- A :(exclude)A/B"
 '
 
 test_expect_success 'setup - add commit-graph to the chain without Bloom filters' '
@@ -404,4 +421,87 @@ test_expect_success 'Bloom generation backfills empty commits' '
 	)
 '
 
+test_expect_success 'Bloom filters computed in threads are identical' '
+	git init threads &&
+	test_when_finished "rm -fr threads" &&
+	(
+		cd threads &&
+		for i in $(test_seq 1 40)
+		do
+			mkdir -p d$((i % 4))/e$((i % 3)) &&
+			echo $i >d$((i % 4))/e$((i % 3))/f$i &&
+			echo $i >>top &&
+			git add . &&
+			git commit -q -m $i || return 1
+		done &&
+		git rm -rq d1 &&
+		git commit -q -m "remove d1" &&
+
+		git commit-graph write --reachable --changed-paths --threads=1 &&
+		mv .git/objects/info/commit-graph serial &&
+		GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+			git commit-graph write --reachable --changed-paths --threads=3 &&
+		test_filter_computed 41 trace.event &&
+		test_cmp_bin serial .git/objects/info/commit-graph
+	)
+'
+
+test_expect_success 'commit-graph write rejects a negative thread count' '
+	test_must_fail git commit-graph write --reachable --threads=-1 2>err &&
+	test_i18ngrep "invalid number of threads" err
+'
+
+test_tree_filters_used () {
+	log_args=$1
+	setup "$log_args" &&
+	grep -q "\"tree_definitely_not\":[1-9]" "$TRASH_DIRECTORY/trace.perf" &&
+	test_cmp log_wo_bloom log_w_bloom
+}
+
+test_expect_success 'setup - write tree-path Bloom filters' '
+	rm -rf .git/objects/info/commit-graph* &&
+	git commit-graph write --reachable --changed-paths --tree-paths &&
+	test-tool read-graph >out &&
+	grep "^chunks: .* tree_bloom_indexes tree_bloom_data$" out
+'
+
+test_expect_success 'tree-path filters skip paths missing on both sides' '
+	test_tree_filters_used "-- file5_renamed" &&
+	test_tree_filters_used "--full-history -- file4" &&
+	test_tree_filters_used "--full-history --simplify-merges -- A/B/C" &&
+	test_tree_filters_used "--all -- :(glob)A/B/C/*3 file5" &&
+	test_tree_filters_used "-- path_does_not_exist"
+'
+
+test_expect_success 'tree-path filters are kept and can be dropped' '
+	git commit-graph write --reachable &&
+	test-tool read-graph >out &&
+	grep "tree_bloom_data" out &&
+	git commit-graph write --reachable --no-tree-paths &&
+	test-tool read-graph >out &&
+	! grep "tree_bloom_data" out &&
+	grep "bloom_data" out
+'
+
+test_expect_success 'identical tree-path filters are stored once' '
+	rm -rf .git/objects/info/commit-graph* &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+		git commit-graph write --reachable --changed-paths --tree-paths &&
+	grep "\"key\":\"tree-filter-computed\",\"value\":\"20\"" trace.event &&
+	grep "\"key\":\"tree-filter-shared\",\"value\":\"7\"" trace.event
+'
+
+test_expect_success 'large trees only record their directories' '
+	rm -rf .git/objects/info/commit-graph* trace.event &&
+	GIT_TEST_BLOOM_SETTINGS_MAX_TREE_PATHS=4 GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+		git commit-graph write --reachable --changed-paths --tree-paths &&
+	grep "\"key\":\"tree-filter-dirs-only\",\"value\":\"[1-9]" trace.event &&
+	test_tree_filters_used "-- A/B/C/nothing" &&
+	for path in A A/B/C A/B/file2 file4 file5_renamed path_does_not_exist
+	do
+		setup "--full-history -- $path" || return 1
+		test_cmp log_wo_bloom log_w_bloom || return 1
+	done
+'
+
 test_done
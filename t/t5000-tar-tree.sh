@@ -239,6 +239,17 @@ test_expect_success 'git archive vs. the same in a bare repo' '
 	test_cmp_bin b.tar b3.tar
 '
 
+test_expect_success 'git archive vs. the same from a pack' '
+	git clone --template= --no-local --bare . packed.git &&
+	mkdir packed.git/info &&
+	cp .git/info/attributes packed.git/info/attributes &&
+	git --git-dir packed.git archive HEAD >b5.tar &&
+	test_cmp_bin b.tar b5.tar &&
+	git --git-dir packed.git -c core.bigfilethreshold=1 \
+		archive HEAD >b5.tar &&
+	test_cmp_bin b.tar b5.tar
+'
+
 test_expect_success 'git archive with --output' '
 	git archive --output=b4.tar HEAD &&
 	test_cmp_bin b.tar b4.tar
@@ -211,6 +211,80 @@ test_expect_success 'unpack with OFS_DELTA (core.fsyncmethod=batch)' '
 	check_unpack test-3-${packname_3} obj-list "$BATCH_CONFIGURATION"
 '
 
+test_expect_success 'unpack with REF_DELTA (threaded)' '
+	check_unpack test-2-${packname_2} obj-list "-c unpack.threads=4"
+'
+
+test_expect_success 'unpack with OFS_DELTA (threaded)' '
+	check_unpack test-3-${packname_3} obj-list "-c unpack.threads=4"
+'
+
+test_expect_success 'unpack with OFS_DELTA (threaded, core.fsyncmethod=batch)' '
+	check_unpack test-3-${packname_3} obj-list \
+		"-c unpack.threads=4 $BATCH_CONFIGURATION"
+'
+
+test_expect_success 'setup long delta chains' '
+	git init chain &&
+	for i in $(test_seq 40)
+	do
+		test_seq $i >chain/file &&
+		git -C chain add file &&
+		git -C chain commit -q -m $i || return 1
+	done &&
+
+	printf "%s\n" HEAD~20 >chain-revs &&
+	git -C chain pack-objects --revs --delta-base-offset --depth=50 \
+		--stdout <chain-revs >chain-base.pack &&
+	printf "%s\n" HEAD ^HEAD~20 >chain-revs &&
+	git -C chain pack-objects --revs --thin --depth=50 \
+		--stdout <chain-revs >chain-thin.pack &&
+	git -C chain rev-list --objects HEAD~20 >chain-base-expect &&
+	git -C chain rev-list --objects HEAD >chain-expect
+'
+
+test_expect_success 'threaded unpack of long delta chains and thin packs' '
+	test_when_finished "rm -rf chain-dst" &&
+	git init --bare chain-dst &&
+
+	git -C chain-dst unpack-objects --threads=4 <chain-base.pack &&
+	git -C chain-dst rev-list --objects $(git -C chain rev-parse HEAD~20) >chain-actual &&
+	test_cmp chain-base-expect chain-actual &&
+
+	git -C chain-dst -c unpack.threads=4 unpack-objects <chain-thin.pack &&
+	git -C chain-dst rev-list --objects $(git -C chain rev-parse HEAD) >chain-actual &&
+	test_cmp chain-expect chain-actual &&
+	git -C chain-dst fsck --no-dangling
+'
+
+test_expect_success 'threaded unpack stops buffering past the limit' '
+	test_when_finished "rm -rf chain chain-dst chain-*" &&
+	git init --bare chain-dst &&
+
+	GIT_TEST_UNPACK_OBJECTS_PENDING_LIMIT=200 \
+		git -C chain-dst unpack-objects --threads=4 <chain-base.pack &&
+	GIT_TEST_UNPACK_OBJECTS_PENDING_LIMIT=200 \
+		git -C chain-dst unpack-objects --threads=4 <chain-thin.pack &&
+	git -C chain-dst rev-list --objects $(git -C chain rev-parse HEAD) >chain-actual &&
+	test_cmp chain-expect chain-actual &&
+	git -C chain-dst fsck --no-dangling
+'
+
+test_expect_success 'threaded unpack fails on unresolvable deltas' '
+	test_when_finished "rm -rf chain chain-dst chain-*" &&
+	git init chain &&
+	test_commit -C chain one &&
+	test_seq 100 >chain/one.t &&
+	git -C chain commit -q -a -m two &&
+	test_seq 101 >chain/one.t &&
+	git -C chain commit -q -a -m three &&
+	printf "%s\n" HEAD ^HEAD~1 >chain-revs &&
+	git -C chain pack-objects --revs --thin --stdout <chain-revs >chain-thin.pack &&
+	git init --bare chain-dst &&
+	test_must_fail git -C chain-dst unpack-objects --threads=4 <chain-thin.pack 2>chain-err &&
+	grep "unresolved deltas left after unpacking" chain-err
+'
+
 test_expect_success 'compare delta flavors' '
 	perl -e '\''
 		defined($_ = -s $_) or die for @ARGV;
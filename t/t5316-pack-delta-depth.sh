@@ -97,6 +97,17 @@ test_expect_success 'packing produces a long delta' '
 	test_cmp expect actual
 '
 
+test_expect_success 'long delta chains with a small delta base cache' '
+	git log -p --format=%H >expect &&
+	GIT_TRACE2_EVENT="$PWD/trace.cache" \
+		git -c core.deltaBaseCacheLimit=6k log -p --format=%H >actual &&
+	test_cmp expect actual &&
+	grep "\"category\":\"delta_base_cache\",\"key\":\"statistics\"" \
+		trace.cache >stats &&
+	grep "\"evictions\":[1-9]" stats &&
+	grep "\"pack\":\"pack-[0-9a-f]*.pack\",\"hits\":[0-9]*,\"misses\":[1-9]" stats
+'
+
 test_expect_success '--depth limits depth' '
 	pack=$(git pack-objects --all --depth=5 </dev/null pack) &&
 	echo 5 >expect &&
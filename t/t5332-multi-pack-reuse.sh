@@ -0,0 +1,146 @@
+#!/bin/sh
+
+test_description='pack-objects multi-pack reuse'
+
+. ./test-lib.sh
+. "$TEST_DIRECTORY"/lib-bitmap.sh
+
+GIT_TEST_MULTI_PACK_INDEX=0
+GIT_TEST_MULTI_PACK_INDEX_WRITE_BITMAP=0
+
+objdir=.git/objects
+packdir=$objdir/pack
+
+# test_pack_reused <nr> <pack-objects arguments...>
+#
+# Run pack-objects with the given arguments and make sure that "nr"
+# objects were sent verbatim, and that the result is a valid pack.
+test_pack_reused () {
+	expect=$1 &&
+	shift &&
+	GIT_PROGRESS_DELAY=0 git pack-objects --stdout --progress "$@" \
+		>got.pack 2>stderr &&
+	grep "pack-reused $expect" stderr &&
+	rm -fr got.git &&
+	git init --bare -q got.git &&
+	git -C got.git index-pack --strict --stdin <got.pack
+}
+
+test_expect_success 'setup' '
+	git config core.multiPackIndex true &&
+	git config pack.allowPackReuse multi &&
+	for p in 1 2 3 4
+	do
+		for i in 1 2 3 4 5
+		do
+			test_seq $(($p * 100 + $i * 7)) >file-$i &&
+			test_seq $p $(($p * 50)) >>common &&
+			git add . &&
+			git commit -q -m "$p-$i" || return 1
+		done &&
+		git repack -d -q || return 1
+	done &&
+	ls $packdir/pack-*.pack >packs &&
+	test_line_count = 4 packs &&
+	git multi-pack-index write --bitmap &&
+	git rev-list --objects --all >objects
+'
+
+test_expect_success 'objects from all packs are reused' '
+	test_pack_reused $(wc -l <objects) --all </dev/null
+'
+
+test_expect_success 'pack.allowPackReuse=single only reuses the preferred pack' '
+	preferred=$(test-tool read-midx --preferred-pack $objdir) &&
+	nr=$(git show-index <$packdir/${preferred%.*}.idx | wc -l) &&
+	test_when_finished "git config pack.allowPackReuse multi" &&
+	git config pack.allowPackReuse single &&
+	test_pack_reused $nr --all </dev/null
+'
+
+test_expect_success 'pack.allowPackReuse defaults to single-pack reuse' '
+	preferred=$(test-tool read-midx --preferred-pack $objdir) &&
+	nr=$(git show-index <$packdir/${preferred%.*}.idx | wc -l) &&
+	test_when_finished "git config pack.allowPackReuse multi" &&
+	test_unconfig pack.allowPackReuse &&
+	test_pack_reused $nr --all </dev/null &&
+	git config pack.allowPackReuse true &&
+	test_pack_reused $nr --all </dev/null
+'
+
+test_expect_success 'pack.allowPackReuse=false disables reuse' '
+	test_when_finished "git config pack.allowPackReuse multi" &&
+	git config pack.allowPackReuse false &&
+	test_pack_reused 0 --all </dev/null
+'
+
+test_expect_success 'invalid pack.allowPackReuse' '
+	test_must_fail git -c pack.allowPackReuse=sometimes \
+		pack-objects --stdout --all </dev/null 2>err &&
+	test_i18ngrep "invalid pack.allowPackReuse" err
+'
+
+test_expect_success 'partial reuse patches offsets of skipped bases' '
+	git pack-objects --stdout --revs >got.pack <<-EOF &&
+	HEAD
+	^HEAD~7
+	EOF
+	rm -fr got.git &&
+	git init --bare -q got.git &&
+	git -C got.git index-pack --stdin <got.pack &&
+	git -C got.git cat-file --batch-all-objects --batch-check >got &&
+	git rev-list --objects HEAD ^HEAD~7 >want &&
+	test_line_count = $(wc -l <want) got
+'
+
+test_expect_success 'deltas against a base selected from another pack' '
+	git init cross &&
+	(
+		cd cross &&
+		git config core.multiPackIndex true &&
+		git config pack.allowPackReuse multi &&
+		test_seq 1000 >base &&
+		git add base &&
+		git commit -q -m base &&
+		test_seq 990 >delta &&
+		git add delta &&
+		git commit -q -m delta &&
+
+		base=$(git rev-parse HEAD:base) &&
+		delta=$(git rev-parse HEAD:delta) &&
+		first=$(git rev-list --objects HEAD~ |
+			git pack-objects $packdir/pack) &&
+		second=$(git pack-objects $packdir/pack <<-EOF
+		$base
+		$delta
+		$(git rev-parse HEAD)
+		$(git rev-parse HEAD^{tree})
+		EOF
+		) &&
+		git prune-packed &&
+		git verify-pack -v $packdir/pack-$second.idx >verify &&
+		grep "^$delta .* $base\$" verify &&
+
+		# The copy of "base" in the preferred pack is the one that
+		# the MIDX selects, and which the delta has to point to.
+		git multi-pack-index write --bitmap \
+			--preferred-pack=pack-$first.pack &&
+		git rev-list --objects --all >objects &&
+		test_pack_reused $(wc -l <objects) --all </dev/null &&
+		git verify-pack -v got.git/objects/pack/pack-*.idx >got &&
+		grep "^$delta .* $base\$" got &&
+
+		test_pack_reused $(wc -l <objects) --all --no-delta-base-offset \
+			</dev/null
+	)
+'
+
+test_expect_success 'packs without bitmapped pack ranges reuse the preferred pack' '
+	rm -f $packdir/multi-pack-index* &&
+	GIT_TEST_MIDX_WRITE_BTMP=0 git multi-pack-index write --bitmap &&
+	preferred=$(test-tool read-midx --preferred-pack $objdir) &&
+	nr=$(git show-index <$packdir/${preferred%.*}.idx | wc -l) &&
+	test_pack_reused $nr --all </dev/null
+'
+
+test_done
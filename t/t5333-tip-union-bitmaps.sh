@@ -0,0 +1,158 @@
+#!/bin/sh
+
+test_description='tip union bitmaps'
+
+. ./test-lib.sh
+
+GIT_TEST_MULTI_PACK_INDEX_WRITE_BITMAP=0
+
+# Create "nr" branches of "len" commits each, with the committer dates
+# of the tips (and everything else) far in the past.
+create_branches () {
+	nr=$1 len=$2 &&
+	for i in $(test_seq $nr)
+	do
+		for j in $(test_seq $len)
+		do
+			echo "commit refs/heads/b$i" &&
+			echo "committer C <c@example.com> $((1000000000 + $i * 1000 + $j)) +0000" &&
+			echo "data <<EOF" &&
+			echo "b$i-$j" &&
+			echo "EOF" &&
+			echo "M 100644 inline b$i/$j" &&
+			echo "data <<EOF" &&
+			echo "$i-$j" &&
+			echo "EOF" || return 1
+		done
+	done >in &&
+	git fast-import <in
+}
+
+tip_unions_applied () {
+	grep "\"category\":\"bitmap\",\"key\":\"tip_unions_applied\",\"value\":\"$1\""
+}
+
+test_expect_success 'setup' '
+	create_branches 40 20 &&
+	git repack -adb &&
+	test-tool bitmap dump-tip-unions >out &&
+	test_must_be_empty out
+'
+
+test_expect_success 'tip unions are off by default' '
+	GIT_TRACE2_EVENT="$(pwd)/trace" \
+		git rev-list --all --objects --use-bitmap-index >/dev/null &&
+	! grep tip_unions_applied trace
+'
+
+test_expect_success 'write tip unions' '
+	git -c pack.bitmapTipUnions=4 -c pack.bitmapTipUnionSize=8 \
+		repack -adb &&
+	test-tool bitmap dump-tip-unions >out &&
+	cat >expect <<-\EOF &&
+	0 10 800
+	1 10 800
+	2 10 800
+	3 10 800
+	EOF
+	test_cmp expect out
+'
+
+test_expect_success 'groups have at least pack.bitmapTipUnionSize tips' '
+	git -c pack.bitmapTipUnions=4 -c pack.bitmapTipUnionSize=16 \
+		repack -adb &&
+	test-tool bitmap dump-tip-unions >out &&
+	cut -d" " -f2 out >actual &&
+	printf "16\n16\n8\n" >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'recent tips are not grouped' '
+	git -c pack.bitmapTipUnions=4 -c pack.bitmapTipUnionSize=10 \
+		-c pack.bitmapTipUnionThreshold="2001-09-09 07:20:20 +0000" \
+		repack -adb &&
+	test-tool bitmap dump-tip-unions >out &&
+	cut -d" " -f2 out >actual &&
+	printf "10\n10\n" >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'traversals use tip unions' '
+	git -c pack.bitmapTipUnions=4 -c pack.bitmapTipUnionSize=8 \
+		repack -adb &&
+
+	git rev-list --all --objects >expect.raw &&
+	cut -d" " -f1 expect.raw | sort >expect &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" \
+		git rev-list --all --objects --use-bitmap-index >actual.raw &&
+	sort actual.raw >actual &&
+	test_cmp expect actual &&
+	tip_unions_applied 4 <trace
+'
+
+test_expect_success 'tip unions are only applied when all tips are wanted' '
+	git rev-list --objects b1 b2 b3 >expect.raw &&
+	cut -d" " -f1 expect.raw | sort >expect &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" \
+		git rev-list --objects --use-bitmap-index b1 b2 b3 >actual.raw &&
+	sort actual.raw >actual &&
+	test_cmp expect actual &&
+	tip_unions_applied 0 <trace
+'
+
+test_expect_success 'tip unions on the uninteresting side' '
+	git rev-list --objects b40 --not b1 b2 b3 b4 b5 b6 b7 b8 b9 b10 >expect.raw &&
+	cut -d" " -f1 expect.raw | sort >expect &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" \
+		git rev-list --objects --use-bitmap-index b40 \
+		--not b1 b2 b3 b4 b5 b6 b7 b8 b9 b10 >actual.raw &&
+	sort actual.raw >actual &&
+	test_cmp expect actual &&
+	tip_unions_applied 1 <trace
+'
+
+test_expect_success 'tip unions and lookup table' '
+	git -c pack.bitmapTipUnions=4 -c pack.bitmapTipUnionSize=8 \
+		-c pack.writeBitmapLookupTable=true repack -adb &&
+	test-tool bitmap dump-tip-unions >out &&
+	test_line_count = 4 out &&
+
+	git rev-list --all --objects >expect.raw &&
+	cut -d" " -f1 expect.raw | sort >expect &&
+	git rev-list --all --objects --use-bitmap-index >actual.raw &&
+	sort actual.raw >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'tip unions of an unknown version are ignored' '
+	git -c pack.bitmapTipUnions=4 -c pack.bitmapTipUnionSize=8 \
+		-c pack.writeBitmapHashCache=false \
+		-c pack.writeBitmapLookupTable=false repack -adb &&
+	test-tool bitmap dump-tip-unions >out &&
+	test_line_count = 4 out &&
+
+	# The version precedes the 8-byte extension size, which ends
+	# right before the trailing checksum.
+	bitmap=$(ls .git/objects/pack/pack-*.bitmap) &&
+	chmod +w "$bitmap" &&
+	perl -e '\''
+		open(my $fh, "+<", $ARGV[0]) or die;
+		binmode $fh;
+		seek($fh, -($ARGV[1] + 12), 2) or die;
+		print $fh pack("N", 2);
+		close($fh) or die;
+	'\'' "$bitmap" $(test_oid rawsz) &&
+	test-tool bitmap dump-tip-unions >out &&
+	test_must_be_empty out &&
+
+	git rev-list --all --objects >expect.raw &&
+	cut -d" " -f1 expect.raw | sort >expect &&
+	rm -f trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" \
+		git rev-list --all --objects --use-bitmap-index >actual.raw &&
+	sort actual.raw >actual &&
+	test_cmp expect actual &&
+	! grep tip_unions_applied trace
+'
+
+test_done
@@ -0,0 +1,300 @@
+#!/bin/sh
+
+test_description='incremental multi-pack-index chains'
+
+. ./test-lib.sh
+
+GIT_TEST_MULTI_PACK_INDEX=0
+GIT_TEST_MULTI_PACK_INDEX_WRITE_BITMAP=0
+
+objdir=.git/objects
+midxdir=$objdir/pack/multi-pack-index.d
+chain=$midxdir/multi-pack-index-chain
+
+# Add "nr" commits with a new file each and put them into a new pack.
+new_pack () {
+	prefix=$1 nr=$2 &&
+	for i in $(test_seq $nr)
+	do
+		echo "$prefix-$i" >"$prefix-$i" &&
+		git add "$prefix-$i" &&
+		git commit -q -m "$prefix-$i" || return 1
+	done &&
+	git repack -d -q
+}
+
+layers () {
+	test-tool read-midx --layers $objdir >layers &&
+	test_line_count = $1 layers
+}
+
+objects_match () {
+	git rev-list --objects --all >expect.raw &&
+	cut -d" " -f1 expect.raw | sort >expect &&
+	git rev-list --objects --all --use-bitmap-index >actual.raw &&
+	sort actual.raw >actual &&
+	test_cmp expect actual
+}
+
+test_expect_success 'setup' '
+	git config core.multiPackIndex true &&
+	new_pack a 30
+'
+
+test_expect_success 'write the first layer' '
+	git multi-pack-index write --incremental &&
+	test_path_is_missing $objdir/pack/multi-pack-index &&
+	test_line_count = 1 $chain &&
+	layers 1 &&
+	echo "$(cat $chain) 1 90" >expect &&
+	test_cmp expect layers &&
+	git multi-pack-index verify
+'
+
+test_expect_success 'small layers are added on top' '
+	new_pack b 5 &&
+	git multi-pack-index write --incremental &&
+	layers 2 &&
+	cut -d" " -f1 layers >hashes &&
+	test_cmp $chain hashes &&
+	tail -n 1 layers >top &&
+	echo "$(tail -n 1 $chain) 1 15" >expect &&
+	test_cmp expect top &&
+	git multi-pack-index verify
+'
+
+test_expect_success 'objects are found in all layers' '
+	git cat-file -p HEAD:a-1 >actual &&
+	echo a-1 >expect &&
+	test_cmp expect actual &&
+	git cat-file -p HEAD:b-5 >actual &&
+	echo b-5 >expect &&
+	test_cmp expect actual &&
+	test-tool read-midx --show-objects $objdir >out &&
+	git count-objects -v >count &&
+	grep "^in-pack: 105" count
+'
+
+test_expect_success 'abbreviations consider all layers' '
+	git rev-parse --short=4 HEAD~10 >short &&
+	git rev-parse $(cat short) >actual &&
+	git rev-parse HEAD~10 >expect &&
+	test_cmp expect actual &&
+	git log --oneline --all >/dev/null
+'
+
+test_expect_success 'unchanged chain is not rewritten' '
+	cp $chain chain.before &&
+	git multi-pack-index write --incremental &&
+	test_cmp chain.before $chain
+'
+
+test_expect_success 'layers of similar size are merged' '
+	new_pack c 5 &&
+	git multi-pack-index write --incremental &&
+	layers 2 &&
+	tail -n 1 layers >top &&
+	echo "$(tail -n 1 $chain) 2 30" >expect &&
+	test_cmp expect top &&
+	git multi-pack-index verify &&
+	ls $midxdir/*.midx >files &&
+	test_line_count = 2 files
+'
+
+test_expect_success 'large new layers absorb the whole chain' '
+	new_pack d 50 &&
+	git multi-pack-index write --incremental &&
+	layers 1 &&
+	echo "$(cat $chain) 4 270" >expect &&
+	test_cmp expect layers &&
+	ls $midxdir/*.midx >files &&
+	test_line_count = 1 files
+'
+
+test_expect_success 'bitmaps cover the whole chain' '
+	new_pack e 5 &&
+	git multi-pack-index write --incremental --bitmap &&
+	layers 2 &&
+	ls $midxdir/*.bitmap >bitmaps &&
+	echo "$midxdir/multi-pack-index-$(tail -n 1 $chain).bitmap" >expect &&
+	test_cmp expect bitmaps &&
+	git rev-list --test-bitmap HEAD &&
+	objects_match
+'
+
+test_expect_success 'bitmaps are used with pack-objects' '
+	GIT_TRACE2_EVENT="$(pwd)/trace" \
+		git pack-objects --use-bitmap-index --stdout --revs \
+		<<-\EOF >packed.pack &&
+	HEAD
+	EOF
+	grep "\"category\":\"load_midx_revindex\"" trace &&
+	git index-pack packed.pack &&
+	git show-index <packed.idx >packed.objects &&
+	git rev-list --objects HEAD >expect &&
+	test_line_count = $(wc -l <expect) packed.objects
+'
+
+test_expect_success 'a missing bitmap makes the top layer be rewritten' '
+	new_pack f 5 &&
+	git multi-pack-index write --incremental &&
+	layers 2 &&
+	test_path_is_missing $midxdir/multi-pack-index-$(tail -n 1 $chain).bitmap &&
+	git multi-pack-index write --incremental --bitmap &&
+	layers 2 &&
+	test_path_is_file $midxdir/multi-pack-index-$(tail -n 1 $chain).bitmap &&
+	objects_match
+'
+
+test_expect_success 'new layers get bitmaps of their own' '
+	new_pack n 3 &&
+	rm -f trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" \
+		git multi-pack-index write --incremental --bitmap &&
+	layers 3 &&
+	ls $midxdir/*.bitmap >bitmaps &&
+	tail -n 2 $chain | sed -e "s,.*,$midxdir/multi-pack-index-&.bitmap," >expect &&
+	test_cmp expect bitmaps &&
+	grep "\"key\":\"num_selected_commits\",\"value\":\"3\"" trace &&
+	git rev-list --test-bitmap HEAD &&
+	git rev-list --test-bitmap HEAD~3 &&
+	objects_match
+'
+
+test_expect_success 'layers referring to removed packs are rewritten' '
+	top=$(tail -n 1 $chain) &&
+	idx=$(ls -t $objdir/pack/pack-*.idx | head -n 1) &&
+	{
+		git show-index <$idx | cut -d" " -f2 &&
+		echo extra | git hash-object -w --stdin
+	} | git pack-objects $objdir/pack/pack &&
+	rm -f ${idx%.idx}.* &&
+	git multi-pack-index write --incremental &&
+	! grep $top $chain &&
+	test_path_is_missing $midxdir/multi-pack-index-$top.midx &&
+	git multi-pack-index verify &&
+	git fsck
+'
+
+test_expect_success 'a full write replaces the chain' '
+	git multi-pack-index write --bitmap &&
+	test_path_is_file $objdir/pack/multi-pack-index &&
+	test_path_is_missing $midxdir &&
+	git multi-pack-index verify &&
+	objects_match
+'
+
+test_expect_success 'an incremental write replaces a single MIDX' '
+	new_pack g 5 &&
+	git multi-pack-index write --incremental &&
+	test_path_is_missing $objdir/pack/multi-pack-index &&
+	! ls $objdir/pack/multi-pack-index-* &&
+	git multi-pack-index verify
+'
+
+test_expect_success 'corrupt chain is reported by verify' '
+	cp $chain chain.good &&
+	echo "not a hash" >$chain &&
+	test_must_fail git multi-pack-index verify 2>err &&
+	test_i18ngrep "failed to parse" err &&
+	cp chain.good $chain &&
+	git multi-pack-index verify
+'
+
+test_expect_success 'repack.midxIncremental adds layers' '
+	git repack -d --write-midx &&
+	test_path_is_file $objdir/pack/multi-pack-index &&
+	new_pack h 5 &&
+	git -c repack.midxIncremental=true repack -d --write-midx &&
+	test_path_is_missing $objdir/pack/multi-pack-index &&
+	layers 1 &&
+	new_pack i 5 &&
+	git -c repack.midxIncremental=true repack -d --write-midx -b &&
+	layers 2 &&
+	test_path_is_file $midxdir/multi-pack-index-$(tail -n 1 $chain).bitmap &&
+	git multi-pack-index verify &&
+	objects_match
+'
+
+test_expect_success 'all-into-one repack with an incremental chain' '
+	git -c repack.midxIncremental=true repack -ad --write-midx -b &&
+	layers 1 &&
+	git multi-pack-index verify &&
+	objects_match
+'
+
+test_expect_success 'repeated incremental repacks keep the chain short' '
+	for i in $(test_seq 16)
+	do
+		new_pack r$i 1 &&
+		git -c repack.midxIncremental=true repack -d --write-midx ||
+		return 1
+	done &&
+	test-tool read-midx --layers $objdir >layers &&
+	test $(wc -l <layers) -le 4 &&
+	git multi-pack-index verify
+'
+
+test_expect_success 'repack only rewrites the layers of repacked packs' '
+	git -c repack.midxIncremental=true repack -ad --write-midx -b &&
+	bottom=$(cat $chain) &&
+	ls $objdir/pack/pack-*.pack >bottom-packs &&
+	new_pack j 5 &&
+	git multi-pack-index write --incremental --bitmap &&
+	new_pack k 5 &&
+	git multi-pack-index write --incremental --bitmap &&
+	layers 2 &&
+	test_when_finished "rm -f $objdir/pack/*.keep" &&
+	sed -e "s,pack\$,keep," bottom-packs | xargs touch &&
+	git multi-pack-index repack --batch-size=0 &&
+	layers 2 &&
+	echo $bottom >expect &&
+	head -n 1 $chain >actual &&
+	test_cmp expect actual &&
+	tail -n 1 layers >top &&
+	grep " 3 30\$" top &&
+	test_path_is_file $midxdir/multi-pack-index-$bottom.bitmap &&
+	test_path_is_file $midxdir/multi-pack-index-$(tail -n 1 $chain).bitmap &&
+	git multi-pack-index verify &&
+	objects_match
+'
+
+test_expect_success 'expire only rewrites the layers that lost packs' '
+	bottom=$(head -n 1 $chain) &&
+	git multi-pack-index expire &&
+	layers 2 &&
+	echo $bottom >expect &&
+	head -n 1 $chain >actual &&
+	test_cmp expect actual &&
+	tail -n 1 layers >top &&
+	grep " 1 30\$" top &&
+	ls $objdir/pack/pack-*.pack >packs &&
+	test_line_count = $(($(wc -l <bottom-packs) + 1)) packs &&
+	test_path_is_file $midxdir/multi-pack-index-$bottom.bitmap &&
+	test_path_is_file $midxdir/multi-pack-index-$(tail -n 1 $chain).bitmap &&
+	git multi-pack-index verify &&
+	objects_match
+'
+
+test_expect_success 'expire drops a layer whose packs are all unreferenced' '
+	cp $chain chain.before &&
+	git rev-parse HEAD HEAD^{tree} | git pack-objects $objdir/pack/pack &&
+	git multi-pack-index write --incremental &&
+	layers 3 &&
+	git multi-pack-index expire &&
+	test_cmp chain.before $chain &&
+	ls $midxdir/*.midx >files &&
+	test_line_count = 2 files &&
+	git multi-pack-index verify &&
+	objects_match
+'
+
+test_expect_success 'incremental-repack maintenance task with a chain' '
+	new_pack m 5 &&
+	git multi-pack-index write --incremental &&
+	git maintenance run --task=incremental-repack &&
+	git multi-pack-index verify &&
+	git fsck
+'
+
+test_done
@@ -430,6 +430,100 @@ test_expect_success 'fetch what is specified on CLI even if already promised' '
 	! grep "?$(cat blob)" missing_after
 '
 
+test_expect_success 'lazy fetch uses object-fetch if the server allows it' '
+	rm -rf src dst.git &&
+	git init src &&
+	mkdir src/dir &&
+	echo one >src/dir/one &&
+	echo two >src/dir/two &&
+	git -C src add dir &&
+	git -C src commit -m dir &&
+	test_config -C src uploadpack.allowfilter 1 &&
+	test_config -C src uploadpack.allowObjectFetch 1 &&
+
+	git clone --bare --filter=tree:0 "file://$(pwd)/src" dst.git &&
+	tree=$(git -C src rev-parse HEAD:dir) &&
+	GIT_TRACE_PACKET="$(pwd)/trace" \
+		git -C dst.git cat-file -p $tree >actual &&
+	git -C src cat-file -p $tree >expect &&
+	test_cmp expect actual &&
+	grep "fetch> command=object-fetch" trace &&
+	! grep "fetch> command=fetch" trace &&
+
+	# Only the tree itself was fetched, not the blobs it refers to.
+	git -C dst.git rev-list --objects --missing=print $tree >missing &&
+	grep "^?$(git -C src rev-parse HEAD:dir/one)" missing &&
+	grep "^?$(git -C src rev-parse HEAD:dir/two)" missing &&
+
+	rm trace &&
+	git -C dst.git cat-file -p HEAD:dir/one >actual &&
+	echo one >expect &&
+	test_cmp expect actual &&
+	test_unconfig -C src uploadpack.allowObjectFetch &&
+	GIT_TRACE_PACKET="$(pwd)/trace" \
+		git -C dst.git cat-file -p HEAD:dir/two >actual &&
+	echo two >expect &&
+	test_cmp expect actual &&
+	grep "fetch> command=fetch" trace
+'
+
+test_expect_success 'object-fetch of a tree in a tree:0 clone brings its subtrees' '
+	rm -rf src dst.git &&
+	git init src &&
+	mkdir -p src/dir/sub/subsub &&
+	echo one >src/dir/one &&
+	echo two >src/dir/sub/two &&
+	echo three >src/dir/sub/subsub/three &&
+	git -C src add dir &&
+	git -C src commit -m dir &&
+	test_config -C src uploadpack.allowfilter 1 &&
+	test_config -C src uploadpack.allowObjectFetch 1 &&
+
+	git clone --bare --filter=tree:0 "file://$(pwd)/src" dst.git &&
+	tree=$(git -C src rev-parse HEAD:dir) &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.json" \
+		git -C dst.git cat-file -p $tree >actual &&
+	git -C src cat-file -p $tree >expect &&
+	test_cmp expect actual &&
+	grep "\"key\":\"fetch_count\",\"value\":\"1\"" trace.json &&
+	test $(grep -c "\"key\":\"fetch_count\"" trace.json) = 1 &&
+	grep "\"key\":\"object-fetch/walk\",\"value\":\"revs\"" trace.json &&
+
+	# The subtrees came along in the same round trip, the blobs did not.
+	git -C dst.git rev-list --objects --missing=print $tree >missing &&
+	! grep "^?$(git -C src rev-parse HEAD:dir/sub)" missing &&
+	! grep "^?$(git -C src rev-parse HEAD:dir/sub/subsub)" missing &&
+	grep "^?$(git -C src rev-parse HEAD:dir/one)" missing &&
+	grep "^?$(git -C src rev-parse HEAD:dir/sub/subsub/three)" missing &&
+
+	rm trace.json &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.json" \
+		git -C dst.git ls-tree -r -t $tree >actual &&
+	! grep "\"key\":\"fetch_count\"" trace.json
+'
+
+test_expect_success 'lazy fetch of a blob in a blob:none clone uses object-fetch' '
+	rm -rf src dst &&
+	git init src &&
+	echo content >src/f &&
+	git -C src add f &&
+	git -C src commit -m f &&
+	test_config -C src uploadpack.allowfilter 1 &&
+	test_config -C src uploadpack.allowObjectFetch 1 &&
+
+	git clone --filter=blob:none --no-checkout "file://$(pwd)/src" dst &&
+	rm -f trace trace.json &&
+	GIT_TRACE_PACKET="$(pwd)/trace" GIT_TRACE2_EVENT="$(pwd)/trace.json" \
+		git -C dst cat-file -p HEAD:f >actual &&
+	echo content >expect &&
+	test_cmp expect actual &&
+	grep "fetch> command=object-fetch" trace &&
+
+	# The blob is sent without walking from it, filter or not.
+	grep "\"key\":\"object-fetch/walk\",\"value\":\"none\"" trace.json &&
+	! grep "\"key\":\"object-fetch/walk\",\"value\":\"revs\"" trace.json
+'
+
 test_expect_success 'setup src repo for sparse filter' '
 	git init sparse-src &&
 	git -C sparse-src config --local uploadpack.allowfilter 1 &&
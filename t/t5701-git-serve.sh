@@ -281,6 +281,133 @@ test_expect_success 'symrefs parameter' '
 	test_cmp expect actual
 '
 
+test_expect_success 'ls-refs responses are cached' '
+	test_config lsrefs.cache true &&
+	test-tool pkt-line pack >in <<-EOF &&
+	command=ls-refs
+	object-format=$(test_oid algo)
+	0001
+	peel
+	symrefs
+	ref-prefix refs/tags/
+	ref-prefix refs/heads/
+	0000
+	EOF
+
+	GIT_TRACE2_EVENT="$(pwd)/trace-miss" \
+		test-tool serve-v2 --stateless-rpc <in >out.miss &&
+	grep "\"key\":\"cache\",\"value\":\"miss\"" trace-miss &&
+	GIT_TRACE2_EVENT="$(pwd)/trace-hit" \
+		test-tool serve-v2 --stateless-rpc <in >out.hit &&
+	grep "\"key\":\"cache\",\"value\":\"hit\"" trace-hit &&
+	test_cmp out.miss out.hit &&
+
+	test_unconfig lsrefs.cache &&
+	test-tool serve-v2 --stateless-rpc <in >out.uncached &&
+	test_cmp out.uncached out.hit
+'
+
+test_expect_success 'ls-refs cache is keyed by the request' '
+	test_config lsrefs.cache true &&
+	test-tool pkt-line pack >in <<-EOF &&
+	command=ls-refs
+	object-format=$(test_oid algo)
+	0001
+	ref-prefix refs/heads/
+	ref-prefix refs/tags/
+	0000
+	EOF
+
+	rm -f trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" \
+		test-tool serve-v2 --stateless-rpc <in >out &&
+	grep "\"key\":\"cache\",\"value\":\"miss\"" trace &&
+	test-tool pkt-line unpack <out >actual &&
+	! grep peeled: actual &&
+
+	test-tool pkt-line pack >in.reordered <<-EOF &&
+	command=ls-refs
+	object-format=$(test_oid algo)
+	0001
+	ref-prefix refs/tags/
+	ref-prefix refs/heads/
+	ref-prefix refs/heads/
+	0000
+	EOF
+	rm -f trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" \
+		test-tool serve-v2 --stateless-rpc <in.reordered >out.reordered &&
+	grep "\"key\":\"cache\",\"value\":\"hit\"" trace &&
+	test_cmp out out.reordered &&
+
+
+	test_config uploadpack.hideRefs refs/tags &&
+	rm -f trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" \
+		test-tool serve-v2 --stateless-rpc <in >out &&
+	grep "\"key\":\"cache\",\"value\":\"miss\"" trace &&
+	test-tool pkt-line unpack <out >actual &&
+	! grep refs/tags/ actual
+'
+
+test_expect_success 'ls-refs cache is invalidated by ref updates' '
+	test_config lsrefs.cache true &&
+	test-tool pkt-line pack >in <<-EOF &&
+	command=ls-refs
+	object-format=$(test_oid algo)
+	0001
+	symrefs
+	ref-prefix refs/heads/
+	0000
+	EOF
+
+	test-tool serve-v2 --stateless-rpc <in >out &&
+	test_path_is_dir .git/ls-refs-cache &&
+	git branch cached main &&
+	test_path_is_missing .git/ls-refs-cache &&
+	test-tool serve-v2 --stateless-rpc <in >out &&
+	test-tool pkt-line unpack <out >actual &&
+	grep refs/heads/cached actual &&
+
+	git symbolic-ref refs/heads/release refs/heads/dev &&
+	test-tool serve-v2 --stateless-rpc <in >out &&
+	test-tool pkt-line unpack <out >actual &&
+	grep "refs/heads/release symref-target:refs/heads/dev" actual &&
+
+	git branch -D cached &&
+	git symbolic-ref refs/heads/release refs/heads/main &&
+	test-tool serve-v2 --stateless-rpc <in >out &&
+	test-tool pkt-line unpack <out >actual &&
+	! grep refs/heads/cached actual
+'
+
+test_expect_success 'ls-refs cache does not grow past lsrefs.cacheMaxEntries' '
+	test_config lsrefs.cache true &&
+	test_config lsrefs.cacheMaxEntries 2 &&
+	git branch -f cached main &&
+	for prefix in refs/heads/ refs/tags/ refs/notes/ refs/heads/ca
+	do
+		test-tool pkt-line pack >in <<-EOF &&
+		command=ls-refs
+		object-format=$(test_oid algo)
+		0001
+		ref-prefix $prefix
+		0000
+		EOF
+		test-tool serve-v2 --stateless-rpc <in >out || return 1
+	done &&
+	ls .git/ls-refs-cache >entries &&
+	grep -v "^token$" entries >actual &&
+	test_line_count = 2 actual &&
+
+	rm -f trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" \
+		test-tool serve-v2 --stateless-rpc <in >out &&
+	grep "\"key\":\"cache\",\"value\":\"miss\"" trace &&
+	test-tool pkt-line unpack <out >actual &&
+	grep refs/heads/cached actual
+'
+
 test_expect_success 'sending server-options' '
 	test-tool pkt-line pack >in <<-EOF &&
 	command=ls-refs
@@ -345,6 +472,143 @@ test_expect_success 'basics of object-info' '
 	test_cmp expect actual
 '
 
+test_expect_success 'object-info with type and disk-size' '
+	test-tool pkt-line pack >in <<-EOF &&
+	command=object-info
+	object-format=$(test_oid algo)
+	0001
+	disk-size
+	type
+	size
+	oid $(git rev-parse two:two.t)
+	oid $(git rev-parse two)
+	oid $(test_oid deadbeef)
+	0000
+	EOF
+
+	git rev-parse two:two.t two >oids &&
+	git cat-file --batch-check="%(objectname) %(objectsize) %(objecttype) %(objectsize:disk)" \
+		<oids >info &&
+	{
+		echo "size type disk-size" &&
+		cat info &&
+		# A missing object gets empty values.
+		echo "$(test_oid deadbeef)   " &&
+		echo 0000
+	} >expect &&
+
+	test-tool serve-v2 --stateless-rpc <in >out &&
+	test-tool pkt-line unpack <out >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'object-fetch is not advertised by default' '
+	test-tool serve-v2 --advertise-capabilities >out &&
+	test-tool pkt-line unpack <out >actual &&
+	! grep object-fetch actual &&
+
+	test_config uploadpack.allowObjectFetch true &&
+	test-tool serve-v2 --advertise-capabilities >out &&
+	test-tool pkt-line unpack <out >actual &&
+	grep "^object-fetch\$" actual
+'
+
+test_expect_success 'object-fetch sends exactly the requested objects' '
+	test_config uploadpack.allowObjectFetch true &&
+	test-tool pkt-line pack >in <<-EOF &&
+	command=object-fetch
+	object-format=$(test_oid algo)
+	0001
+	no-progress
+	oid $(git rev-parse two:two.t)
+	oid $(git rev-parse two)
+	oid $(git rev-parse two:two.t)
+	0000
+	EOF
+
+	test-tool serve-v2 --stateless-rpc <in >out &&
+	test-tool pkt-line unpack-sideband <out >pack &&
+	rm -rf object-fetch.git &&
+	git init --bare object-fetch.git &&
+	git -C object-fetch.git index-pack --stdin <pack &&
+	git -C object-fetch.git cat-file --batch-all-objects \
+		--batch-check="%(objectname)" >actual &&
+	git rev-parse two:two.t two >expect.unsorted &&
+	sort expect.unsorted >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'object-fetch serves what fetch would serve' '
+	test_config uploadpack.allowObjectFetch true &&
+	test_config uploadpack.hideRefs refs/tags/one &&
+	git config --add uploadpack.hideRefs refs/heads/dev &&
+	test-tool pkt-line pack >in <<-EOF &&
+	command=object-fetch
+	object-format=$(test_oid algo)
+	0001
+	no-progress
+	oid $(git rev-parse two:two.t)
+	oid $(git rev-parse one)
+	0000
+	EOF
+
+	test-tool serve-v2 --stateless-rpc <in >out &&
+	test-tool pkt-line unpack-sideband <out >pack &&
+	rm -rf object-fetch.git &&
+	git init --bare object-fetch.git &&
+	git -C object-fetch.git index-pack --stdin <pack &&
+	git -C object-fetch.git cat-file --batch-all-objects \
+		--batch-check="%(objectname)" >actual &&
+	git rev-parse two:two.t one >expect.unsorted &&
+	sort expect.unsorted >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'object-fetch with a filter' '
+	test_config uploadpack.allowObjectFetch true &&
+	test_config uploadpack.allowFilter true &&
+	test-tool serve-v2 --advertise-capabilities >out &&
+	test-tool pkt-line unpack <out >actual &&
+	grep "^object-fetch=filter\$" actual &&
+
+	test-tool pkt-line pack >in <<-EOF &&
+	command=object-fetch
+	object-format=$(test_oid algo)
+	0001
+	no-progress
+	filter blob:limit=1k
+	oid $(git rev-parse two^{tree})
+	0000
+	EOF
+
+	test-tool serve-v2 --stateless-rpc <in >out &&
+	test-tool pkt-line unpack-sideband <out >pack &&
+	rm -rf object-fetch.git &&
+	git init --bare object-fetch.git &&
+	git -C object-fetch.git index-pack --stdin <pack &&
+	git -C object-fetch.git cat-file --batch-all-objects \
+		--batch-check="%(objectname)" >actual &&
+	git rev-list --objects --filter=blob:limit=1k --no-object-names \
+		two^{tree} >expect.unsorted &&
+	test_line_count = 3 expect.unsorted &&
+	sort expect.unsorted >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'object-fetch dies on missing objects' '
+	test_config uploadpack.allowObjectFetch true &&
+	test-tool pkt-line pack >in <<-EOF &&
+	command=object-fetch
+	object-format=$(test_oid algo)
+	0001
+	oid $(test_oid deadbeef)
+	0000
+	EOF
+
+	test_must_fail test-tool serve-v2 --stateless-rpc <in >out 2>err &&
+	grep "not our object" err
+'
+
 test_expect_success 'test capability advertisement with uploadpack.advertiseBundleURIs' '
 	test_config uploadpack.advertiseBundleURIs true &&
 
@@ -169,4 +169,24 @@ test_expect_success 'rev-list --count --objects' '
 	test_line_count = $count actual
 '
 
+test_expect_success 'rev-list --objects with preloaded trees' '
+	test_when_finished "git checkout -f - && git branch -D preload-trees" &&
+	git checkout -b preload-trees &&
+	for i in 1 2 3 4 5 6
+	do
+		mkdir -p preload/dir$i/sub$i &&
+		echo $i >preload/dir$i/sub$i/file &&
+		echo $i >preload/dir$i/file &&
+		git add preload &&
+		git commit -q -m "preload $i" || return 1
+	done &&
+	git rev-list --objects --all >expect &&
+	GIT_TEST_PRELOAD_TREES=1 git rev-list --objects --all >actual &&
+	test_cmp expect actual &&
+	git rev-list --objects HEAD --not HEAD~3 >expect &&
+	GIT_TEST_PRELOAD_TREES=1 \
+		git rev-list --objects HEAD --not HEAD~3 >actual &&
+	test_cmp expect actual
+'
+
 test_done
@@ -0,0 +1,137 @@
+#!/bin/sh
+
+test_description='remember renames across merges with merge.renameCache'
+
+GIT_TEST_DEFAULT_INITIAL_BRANCH_NAME=main
+export GIT_TEST_DEFAULT_INITIAL_BRANCH_NAME
+
+. ./test-lib.sh
+
+# Setup:
+#   Base:     numbers, values, olddir/{a,b,c}
+#   Upstream: sequence (numbers, renamed and modified),
+#             amounts (values, renamed and modified), newdir/{a,b,c}
+#   Topic1:   numbers (modified), olddir/d (new file)
+#   Topic2:   values (modified), olddir/a (modified)
+#
+# Merging either topic into upstream needs rename detection on the
+# upstream side against the same pair of trees, but only the merge of
+# topic2 cares about where "values" went, so the two merges only share
+# their cache entry because it holds all the renames of that side.
+
+test_expect_success 'setup' '
+	git config merge.directoryRenames true &&
+	test_seq 2 10 >numbers &&
+	test_seq 20 30 >values &&
+	mkdir olddir &&
+	for f in a b c
+	do
+		echo $f >olddir/$f || return 1
+	done &&
+	git add . &&
+	git commit -m base &&
+
+	git branch topic1 &&
+	git branch topic2 &&
+
+	test_seq 1 10 >numbers &&
+	git mv numbers sequence &&
+	test_seq 19 30 >values &&
+	git mv values amounts &&
+	git mv olddir newdir &&
+	git add . &&
+	git commit -m upstream &&
+	git branch upstream &&
+
+	git switch topic1 &&
+	test_seq 2 12 >numbers &&
+	echo d >olddir/d &&
+	git add . &&
+	git commit -m topic1 &&
+
+	git switch topic2 &&
+	test_seq 20 32 >values &&
+	echo modified >>olddir/a &&
+	git add . &&
+	git commit -m topic2 &&
+
+	git checkout --detach topic1 &&
+	git -c merge.renameCache=false merge -s ort -m merged upstream &&
+	git ls-files -s >expect-topic1 &&
+
+	git checkout --detach topic2 &&
+	git -c merge.renameCache=false merge -s ort -m merged upstream &&
+	git ls-files -s >expect-topic2 &&
+
+	cache_dir=$(git rev-parse --git-path objects/info/rename-cache) &&
+	test_path_is_missing "$cache_dir"
+'
+
+test_expect_success 'renames are written to the cache' '
+	git checkout --detach topic1 &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+		git -c merge.renameCache=true merge -s ort -m merged upstream &&
+	git ls-files -s >actual &&
+	test_cmp expect-topic1 actual &&
+	grep "\"key\":\"rename_cache/written\"" trace.event &&
+	! grep "\"key\":\"rename_cache/loaded\"" trace.event &&
+	ls "$cache_dir" >entries &&
+	test_line_count = 1 entries
+'
+
+test_expect_success 'cached renames are reused' '
+	git checkout --detach topic1 &&
+	rm -f trace.event &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+		git -c merge.renameCache=true merge -s ort -m merged upstream &&
+	git ls-files -s >actual &&
+	test_cmp expect-topic1 actual &&
+	grep "\"key\":\"rename_cache/loaded\"" trace.event &&
+	! grep "\"key\":\"rename_cache/written\"" trace.event
+'
+
+test_expect_success 'merges of different topics share entries' '
+	git checkout --detach topic2 &&
+	rm -f trace.event &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+		git -c merge.renameCache=true merge -s ort -m merged upstream &&
+	git ls-files -s >actual &&
+	test_cmp expect-topic2 actual &&
+	grep "\"key\":\"rename_cache/loaded\"" trace.event &&
+	! grep "\"key\":\"rename_cache/written\"" trace.event &&
+	ls "$cache_dir" >entries &&
+	test_line_count = 1 entries
+'
+
+test_expect_success 'cache entries are only used with the same rename score' '
+	git checkout --detach topic1 &&
+	rm -f trace.event &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+		git -c merge.renameCache=true merge -s ort -Xfind-renames=60 \
+		-m merged upstream &&
+	! grep "\"key\":\"rename_cache/loaded\"" trace.event &&
+	grep "\"key\":\"rename_cache/written\"" trace.event &&
+	ls "$cache_dir" >entries &&
+	test_line_count = 2 entries
+'
+
+test_expect_success 'corrupt cache entries are ignored' '
+	for f in "$cache_dir"/*
+	do
+		printf "rename-cache v2\nnumbers" >"$f" || return 1
+	done &&
+	git checkout --detach topic1 &&
+	git -c merge.renameCache=true merge -s ort -m merged upstream &&
+	git ls-files -s >actual &&
+	test_cmp expect-topic1 actual
+'
+
+test_expect_success 'gc prunes unused cache entries' '
+	git gc --quiet &&
+	ls "$cache_dir" >entries &&
+	test_line_count = 2 entries &&
+	git -c gc.renameCacheExpire=now gc --quiet &&
+	test_path_is_missing "$cache_dir"
+'
+
+test_done
@@ -58,6 +58,9 @@ test_expect_success 'setup' '
 	git -c commitGraph.generationVersion=1 commit-graph write --reachable &&
 	mv .git/objects/info/commit-graph commit-graph-no-gdat &&
 	chmod u+w commit-graph-no-gdat &&
+	git commit-graph write --reachable --reach-labels &&
+	mv .git/objects/info/commit-graph commit-graph-labels &&
+	chmod u+w commit-graph-labels &&
 	git config core.commitGraph true
 '
 
@@ -73,6 +76,9 @@ run_all_modes () {
 	test_cmp expect actual &&
 	cp commit-graph-no-gdat .git/objects/info/commit-graph &&
 	"$@" <input >actual &&
+	test_cmp expect actual &&
+	cp commit-graph-labels .git/objects/info/commit-graph &&
+	"$@" <input >actual &&
 	test_cmp expect actual
 }
 
@@ -146,6 +152,20 @@ test_expect_success 'in_merge_bases_many:miss-heuristic' '
 	test_all_modes in_merge_bases_many
 '
 
+test_expect_success 'in_merge_bases_all' '
+	for x in $(test_seq 1 10)
+	do
+		for y in $(test_seq 1 10)
+		do
+			echo "X:commit-$x-$y" &&
+			echo "Y:commit-$x-$y" || return 1
+		done
+	done >input &&
+	# (x,y) can reach (u,v) if and only if u <= x and v <= y
+	echo "in_merge_bases_all(X,Y):$((55 * 55))" >expect &&
+	test_all_modes in_merge_bases_all
+'
+
 test_expect_success 'is_descendant_of:hit' '
 	cat >input <<-\EOF &&
 	A:commit-5-7
@@ -612,4 +632,108 @@ test_expect_success 'for-each-ref merged:none' '
 		--format="%(refname)" --stdin
 '
 
+test_expect_success 'ahead-behind with threads' '
+	test_when_finished rm -f .git/objects/info/commit-graph &&
+	cp commit-graph-full .git/objects/info/commit-graph &&
+	git for-each-ref --format="%(refname)" refs/heads >input &&
+	git for-each-ref --stdin \
+		--format="%(refname) %(ahead-behind:commit-5-5) %(ahead-behind:commit-9-2)" \
+		<input >expect &&
+	for threads in 2 3 7
+	do
+		GIT_TEST_AHEAD_BEHIND_THREADS=$threads git for-each-ref --stdin \
+			--format="%(refname) %(ahead-behind:commit-5-5) %(ahead-behind:commit-9-2)" \
+			<input >actual &&
+		test_cmp expect actual || return 1
+	done
+'
+
+test_expect_success 'ahead-behind cache' '
+	cache=.git/objects/info/ahead-behind-cache &&
+	test_when_finished rm -f .git/objects/info/commit-graph $cache &&
+	cp commit-graph-full .git/objects/info/commit-graph &&
+	test_config commitGraph.aheadBehindCache true &&
+	cat >input <<-\EOF &&
+	refs/heads/commit-1-1
+	refs/heads/commit-5-3
+	refs/heads/commit-4-8
+	refs/heads/commit-9-9
+	EOF
+	cat >expect <<-\EOF &&
+	refs/heads/commit-1-1 0 53
+	refs/heads/commit-4-8 8 30
+	refs/heads/commit-5-3 0 39
+	refs/heads/commit-9-9 27 0
+	EOF
+	GIT_TRACE2_EVENT="$(pwd)/trace" git for-each-ref --stdin \
+		--format="%(refname) %(ahead-behind:commit-9-6)" <input >actual &&
+	test_cmp expect actual &&
+	test_path_is_file $cache &&
+	grep "\"key\":\"cache-misses\",\"value\":\"4\"" trace &&
+
+	rm -f trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" git for-each-ref --stdin \
+		--format="%(refname) %(ahead-behind:commit-9-6)" <input >actual &&
+	test_cmp expect actual &&
+	grep "\"key\":\"cache-hits\",\"value\":\"4\"" trace &&
+
+	rm -f trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" git for-each-ref \
+		--format="%(ahead-behind:commit-9-6)" \
+		refs/heads/commit-1-1 refs/heads/commit-2-2 >actual &&
+	printf "0 53\n0 50\n" >expect &&
+	test_cmp expect actual &&
+	grep "\"key\":\"cache-hits\",\"value\":\"1\"" trace &&
+	grep "\"key\":\"cache-misses\",\"value\":\"1\"" trace
+'
+
+test_expect_success 'corrupt ahead-behind cache is ignored and replaced' '
+	cache=.git/objects/info/ahead-behind-cache &&
+	test_when_finished rm -f .git/objects/info/commit-graph $cache &&
+	cp commit-graph-full .git/objects/info/commit-graph &&
+	test_config commitGraph.aheadBehindCache true &&
+	echo garbage >$cache &&
+	git for-each-ref --format="%(ahead-behind:commit-9-6)" \
+		refs/heads/commit-1-1 >actual 2>err &&
+	echo "0 53" >expect &&
+	test_cmp expect actual &&
+	test_i18ngrep "ahead-behind cache .* is corrupt" err &&
+	git for-each-ref --format="%(ahead-behind:commit-9-6)" \
+		refs/heads/commit-1-1 >actual 2>err &&
+	test_cmp expect actual &&
+	test_must_be_empty err
+'
+
+test_expect_success 'reachability labels are verified' '
+	test_when_finished rm -f .git/objects/info/commit-graph &&
+	cp commit-graph-labels .git/objects/info/commit-graph &&
+	git commit-graph verify
+'
+
+test_expect_success 'reachability labels are kept, but not in split layers' '
+	test_when_finished rm -rf .git/objects/info/commit-graph* &&
+	cp commit-graph-labels .git/objects/info/commit-graph &&
+	git commit-graph write --reachable &&
+	test-tool read-graph >out &&
+	grep reach_labels out &&
+	git commit-graph write --reachable --no-reach-labels &&
+	test-tool read-graph >out &&
+	! grep reach_labels out &&
+	git commit-graph write --reachable --reach-labels &&
+
+	git checkout --detach commit-10-10 &&
+	test_commit split-tip &&
+	git commit-graph write --reachable --split=no-merge &&
+	test-tool read-graph >out &&
+	! grep reach_labels out &&
+	git commit-graph verify &&
+	cat >input <<-\EOF &&
+	A:commit-3-3
+	B:split-tip
+	EOF
+	echo "in_merge_bases(A,B):1" >expect &&
+	test-tool reach in_merge_bases <input >actual &&
+	test_cmp expect actual
+'
+
 test_done
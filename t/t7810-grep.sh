@@ -1108,6 +1108,37 @@ do
 	"
 done
 
+test_expect_success PTHREADS 'grep <tree> reads blobs ahead in pack order' '
+	test_when_finished "rm -rf read-ahead" &&
+	git init read-ahead &&
+	(
+		cd read-ahead &&
+		for i in $(test_seq 1 20)
+		do
+			mkdir -p dir$i &&
+			for j in $(test_seq 1 20)
+			do
+				test_seq $i $(($i * $j + 50)) >dir$i/file$j || return 1
+			done || return 1
+		done &&
+		echo content >dir1/loose &&
+		git add . &&
+		git commit -q -m one &&
+		git repack -adq &&
+		echo more >>dir2/file3 &&
+		git commit -q -a -m two &&
+		git -c grep.readAhead=false grep --threads=1 -e 1 -e 9 HEAD HEAD^ >expect &&
+		for threads in 2 4 16
+		do
+			git grep --threads=$threads -e 1 -e 9 HEAD HEAD^ >actual &&
+			test_cmp expect actual &&
+			git -c grep.readAhead=false grep --threads=$threads \
+				-e 1 -e 9 HEAD HEAD^ >actual &&
+			test_cmp expect actual || return 1
+		done
+	)
+'
+
 test_expect_success !PTHREADS,!FAIL_PREREQS \
 	'grep --threads=N or pack.threads=N warns when no pthreads' '
 	git grep --threads=2 Hello hello_world 2>err &&
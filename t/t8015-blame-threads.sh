@@ -0,0 +1,124 @@
+#!/bin/sh
+
+test_description='git blame with diff prefetching threads'
+
+GIT_TEST_DEFAULT_INITIAL_BRANCH_NAME=main
+export GIT_TEST_DEFAULT_INITIAL_BRANCH_NAME
+
+. ./test-lib.sh
+
+# A history with a rename, a merge of a side branch that touches the
+# same file, and plenty of commits that change only parts of it, so
+# that the threads have something to look ahead for.
+test_expect_success 'setup' '
+	test_seq 1 200 >file &&
+	git add file &&
+	test_tick &&
+	git commit -m base &&
+
+	for i in $(test_seq 1 20)
+	do
+		sed -e "$((i * 9))s/\$/ main $i/" file >file.new &&
+		mv file.new file &&
+		test_tick &&
+		git commit -q -a -m "main $i" || return 1
+	done &&
+
+	git checkout -b side HEAD~10 &&
+	for i in $(test_seq 1 5)
+	do
+		sed -e "$((i * 7 + 3))s/\$/ side $i/" file >file.new &&
+		mv file.new file &&
+		test_tick &&
+		git commit -q -a -m "side $i" || return 1
+	done &&
+
+	git checkout main &&
+	test_tick &&
+	git merge -m merge side &&
+	git mv file renamed &&
+	test_tick &&
+	git commit -m rename &&
+	sed -e "100s/\$/ after rename/" renamed >renamed.new &&
+	mv renamed.new renamed &&
+	test_tick &&
+	git commit -a -m "after rename" &&
+
+	git blame --threads=1 -p renamed >expect &&
+	git blame --threads=1 --show-stats renamed >expect-stats
+'
+
+for threads in 2 4 0
+do
+	test_expect_success "blame --threads=$threads gives the same result" '
+		git blame --threads=$threads -p renamed >actual &&
+		test_cmp expect actual &&
+		git blame --threads=$threads --show-stats renamed >actual &&
+		test_cmp expect-stats actual
+	'
+done
+
+test_expect_success 'blame.threads is honored' '
+	git -c blame.threads=3 blame -p renamed >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'blame with threads and uncommitted changes' '
+	test_when_finished "git checkout renamed" &&
+	sed -e "50s/\$/ uncommitted/" renamed >renamed.new &&
+	mv renamed.new renamed &&
+	git blame --threads=1 -s renamed >expect-wt &&
+	git blame --threads=3 -s renamed >actual &&
+	test_cmp expect-wt actual
+'
+
+test_expect_success 'blame with threads, -M and -C' '
+	git blame --threads=1 -M -C -p renamed >expect-copies &&
+	git blame --threads=3 -M -C -p renamed >actual &&
+	test_cmp expect-copies actual
+'
+
+test_expect_success 'blame with threads across a rename from a textconv path' '
+	test_when_finished "rm -f .gitattributes" &&
+	write_script upcase <<-\EOF &&
+	tr a-z A-Z <"$1"
+	EOF
+	test_config diff.upcase.textconv ./upcase &&
+	echo "*.up diff=upcase" >.gitattributes &&
+	git checkout -b textconv main &&
+	git mv renamed conv.up &&
+	test_tick &&
+	git commit -m "rename to textconv path" &&
+	for i in $(test_seq 1 5)
+	do
+		sed -e "$((i * 11))s/\$/ textconv $i/" conv.up >conv.new &&
+		mv conv.new conv.up &&
+		test_tick &&
+		git commit -q -a -m "textconv $i" || return 1
+	done &&
+	git mv conv.up plain &&
+	sed -e "3s/\$/ plain/" plain >plain.new &&
+	mv plain.new plain &&
+	test_tick &&
+	git commit -a -m "rename away from textconv path" &&
+	git blame --threads=1 -p plain >expect-textconv &&
+	git blame --threads=3 -p plain >actual &&
+	test_cmp expect-textconv actual &&
+	git checkout main
+'
+
+test_expect_success 'GIT_TEST_BLAME_THREADS overrides blame.threads' '
+	GIT_TRACE2_EVENT="$(pwd)/trace.1" GIT_TEST_BLAME_THREADS=1 \
+		git -c blame.threads=3 blame renamed >/dev/null &&
+	! grep "prefetch/hits" trace.1 &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.3" GIT_TEST_BLAME_THREADS=1 \
+		git -c blame.threads=1 blame --threads=3 renamed >/dev/null &&
+	grep "prefetch/hits" trace.3
+'
+
+test_expect_success 'negative thread counts are rejected' '
+	test_must_fail git blame --threads=-1 renamed &&
+	test_must_fail git -c blame.threads=-1 blame renamed
+'
+
+test_done
@@ -105,10 +105,7 @@ struct object *deref_tag_noverify(struct object *o)
 
 struct tag *lookup_tag(struct repository *r, const struct object_id *oid)
 {
-	struct object *obj = lookup_object(r, oid);
-	if (!obj)
-		return create_object(r, oid, alloc_tag_node(r));
-	return object_as_type(obj, OBJ_TAG, 0);
+	return lookup_or_create_object(r, oid, OBJ_TAG, alloc_tag_node);
 }
 
 static timestamp_t parse_tag_date(const char *buf, const char *tail)
@@ -261,6 +261,9 @@ static int set_git_option(struct git_transport_options *opts,
 	} else if (!strcmp(name, TRANS_OPT_REFETCH)) {
 		opts->refetch = !!value;
 		return 0;
+	} else if (!strcmp(name, TRANS_OPT_OBJECT_FETCH)) {
+		opts->object_fetch = !!value;
+		return 0;
 	} else if (!strcmp(name, TRANS_OPT_REJECT_SHALLOW)) {
 		opts->reject_shallow = !!value;
 		return 0;
@@ -434,6 +437,7 @@ static int fetch_refs_via_pack(struct transport *transport,
 	list_objects_filter_copy(&args.filter_options,
 				 &data->options.filter_options);
 	args.refetch = data->options.refetch;
+	args.object_fetch = data->options.object_fetch;
 	args.stateless_rpc = transport->stateless_rpc;
 	args.server_options = transport->server_options;
 	args.negotiation_tips = data->options.negotiation_tips;
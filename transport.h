@@ -17,6 +17,9 @@ struct git_transport_options {
 	unsigned deepen_relative : 1;
 	unsigned refetch : 1;
 
+	/* see documentation of corresponding flag in fetch-pack.h */
+	unsigned object_fetch : 1;
+
 	/* see documentation of corresponding flag in fetch-pack.h */
 	unsigned from_promisor : 1;
 
@@ -233,6 +236,9 @@ void transport_check_allowed(const char *type);
 /* Refetch all objects without negotiating */
 #define TRANS_OPT_REFETCH "refetch"
 
+/* Fetch objects given by object ID without the objects they refer to */
+#define TRANS_OPT_OBJECT_FETCH "object-fetch"
+
 /* Request atomic (all-or-nothing) updates when pushing */
 #define TRANS_OPT_ATOMIC "atomic"
 
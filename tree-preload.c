@@ -0,0 +1,359 @@
+#include "git-compat-util.h"
+#include "config.h"
+#include "list.h"
+#include "object-store-ll.h"
+#include "oidmap.h"
+#include "repository.h"
+#include "thread-utils.h"
+#include "trace2.h"
+#include "tree.h"
+#include "tree-preload.h"
+
+#define MAX_PRELOAD_TREES_THREADS 8
+
+/*
+ * The number of trees that may be kept inflated without having been
+ * taken by the caller, for urgent and other trees each.
+ */
+#define MAX_PRELOADED_TREES 1024
+
+enum tree_preload_state {
+	TREE_PRELOAD_QUEUED = 0,
+	TREE_PRELOAD_LOADING,
+	TREE_PRELOAD_DONE,
+	/* taken or discarded before a worker got to it */
+	TREE_PRELOAD_TAKEN,
+};
+
+/*
+ * An entry is in "map" from the time it is queued until it is taken
+ * or discarded, and in one of the queues until a worker picks it up.
+ * Whoever removes it from the last of the two frees it.
+ */
+struct tree_preload_entry {
+	struct oidmap_entry entry;
+	enum tree_preload_state state;
+	unsigned urgent:1;
+	void *buf;
+	unsigned long size;
+	/* in "loaded" while an urgent entry holds a buffer */
+	struct list_head list;
+};
+
+struct tree_preload {
+	struct repository *repo;
+	struct oidmap map;
+
+	/* urgent trees, the last one is read first */
+	struct tree_preload_entry **stack;
+	size_t stack_nr, stack_alloc;
+
+	/* all other trees, in the order they were queued */
+	struct tree_preload_entry **fifo;
+	size_t fifo_nr, fifo_alloc, fifo_pos;
+
+	/*
+	 * Inflated trees that were not taken yet. When there are too
+	 * many of them, the oldest urgent ones are dropped again, as
+	 * in a depth-first walk they are the ones needed last, while
+	 * the workers stop reading other trees until some are taken.
+	 */
+	struct list_head loaded;
+	size_t nr_loaded_urgent, nr_loaded_fifo;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t work_cond;
+	pthread_cond_t done_cond;
+	pthread_t *threads;
+	/* workers to start on the first tree_preload_add() */
+	int max_threads;
+	int nr_threads;
+	int stop;
+	int owns_obj_read_lock;
+};
+
+static struct tree_preload_entry *next_entry(struct tree_preload *tp)
+{
+	struct tree_preload_entry *e;
+
+	while (tp->stack_nr) {
+		e = tp->stack[--tp->stack_nr];
+		if (e->state == TREE_PRELOAD_TAKEN) {
+			free(e);
+			continue;
+		}
+		return e;
+	}
+
+	while (tp->fifo_pos < tp->fifo_nr) {
+		e = tp->fifo[tp->fifo_pos];
+		if (e->state == TREE_PRELOAD_TAKEN) {
+			free(e);
+		} else if (tp->nr_loaded_fifo >= MAX_PRELOADED_TREES) {
+			return NULL;
+		} else {
+			tp->fifo_pos++;
+			return e;
+		}
+		tp->fifo_pos++;
+	}
+	tp->fifo_nr = tp->fifo_pos = 0;
+	return NULL;
+}
+
+/*
+ * Detach the buffer of a loaded entry and return it.
+ */
+static void *unload_entry(struct tree_preload *tp, struct tree_preload_entry *e)
+{
+	void *buf = e->buf;
+
+	if (!buf)
+		return NULL;
+	e->buf = NULL;
+	if (e->urgent) {
+		list_del(&e->list);
+		tp->nr_loaded_urgent--;
+	} else {
+		tp->nr_loaded_fifo--;
+		pthread_cond_signal(&tp->work_cond);
+	}
+	return buf;
+}
+
+static void *tree_preload_worker(void *data)
+{
+	struct tree_preload *tp = data;
+
+	pthread_mutex_lock(&tp->mutex);
+	for (;;) {
+		struct tree_preload_entry *e;
+		enum object_type type;
+		unsigned long size;
+		void *buf;
+
+		while (!tp->stop && !(e = next_entry(tp)))
+			pthread_cond_wait(&tp->work_cond, &tp->mutex);
+		if (tp->stop)
+			break;
+
+		e->state = TREE_PRELOAD_LOADING;
+		pthread_mutex_unlock(&tp->mutex);
+
+		buf = repo_read_object_file(tp->repo, &e->entry.oid,
+					    &type, &size);
+		if (buf && type != OBJ_TREE)
+			FREE_AND_NULL(buf);
+
+		pthread_mutex_lock(&tp->mutex);
+		if (e->state == TREE_PRELOAD_TAKEN) {
+			/* discarded while we were reading it */
+			free(buf);
+			free(e);
+			continue;
+		}
+		e->buf = buf;
+		e->size = size;
+		e->state = TREE_PRELOAD_DONE;
+		if (buf && e->urgent) {
+			list_add_tail(&e->list, &tp->loaded);
+			if (++tp->nr_loaded_urgent > MAX_PRELOADED_TREES)
+				free(unload_entry(tp, list_first_entry(&tp->loaded,
+								       struct tree_preload_entry,
+								       list)));
+		} else if (buf) {
+			tp->nr_loaded_fifo++;
+		}
+		pthread_cond_broadcast(&tp->done_cond);
+	}
+	pthread_mutex_unlock(&tp->mutex);
+
+	return NULL;
+}
+
+struct tree_preload *tree_preload_start(struct repository *r)
+{
+	struct tree_preload *tp;
+	int enabled, nr_threads = online_cpus();
+
+	if (!HAVE_THREADS)
+		return NULL;
+	if (repo_config_get_bool(r, "core.preloadtrees", &enabled))
+		enabled = 1;
+	if (!enabled)
+		return NULL;
+	if (git_env_bool("GIT_TEST_PRELOAD_TREES", 0) && nr_threads < 2)
+		nr_threads = 2;
+	if (nr_threads < 2)
+		return NULL;
+	if (nr_threads > MAX_PRELOAD_TREES_THREADS)
+		nr_threads = MAX_PRELOAD_TREES_THREADS;
+
+	CALLOC_ARRAY(tp, 1);
+	tp->repo = r;
+	oidmap_init(&tp->map, 0);
+	INIT_LIST_HEAD(&tp->loaded);
+	pthread_mutex_init(&tp->mutex, NULL);
+	pthread_cond_init(&tp->work_cond, NULL);
+	pthread_cond_init(&tp->done_cond, NULL);
+	tp->max_threads = nr_threads;
+
+	return tp;
+}
+
+/*
+ * Start the workers, and with them the locking of object reads. This
+ * is put off until the first tree is queued, so that walks that never
+ * get to queue any pay for neither.
+ */
+static void start_workers(struct tree_preload *tp)
+{
+	int i;
+
+	if (!obj_read_use_lock) {
+		enable_obj_read_lock();
+		tp->owns_obj_read_lock = 1;
+	}
+
+	CALLOC_ARRAY(tp->threads, tp->max_threads);
+	for (i = 0; i < tp->max_threads; i++) {
+		if (pthread_create(&tp->threads[i], NULL, tree_preload_worker, tp))
+			break;
+		tp->nr_threads++;
+	}
+	trace2_data_intmax("tree-preload", tp->repo, "threads", tp->nr_threads);
+}
+
+void tree_preload_stop(struct tree_preload *tp)
+{
+	struct oidmap_iter iter;
+	struct tree_preload_entry *e;
+	size_t i;
+
+	if (!tp)
+		return;
+
+	pthread_mutex_lock(&tp->mutex);
+	tp->stop = 1;
+	pthread_cond_broadcast(&tp->work_cond);
+	pthread_mutex_unlock(&tp->mutex);
+	for (i = 0; i < tp->nr_threads; i++)
+		pthread_join(tp->threads[i], NULL);
+	free(tp->threads);
+
+	if (tp->owns_obj_read_lock)
+		disable_obj_read_lock();
+
+	/* Queued entries are freed with the queues, all others here. */
+	oidmap_iter_init(&tp->map, &iter);
+	while ((e = oidmap_iter_next(&iter))) {
+		if (e->state != TREE_PRELOAD_DONE)
+			continue;
+		free(e->buf);
+		free(e);
+	}
+	oidmap_free(&tp->map, 0);
+	for (i = 0; i < tp->stack_nr; i++)
+		free(tp->stack[i]);
+	free(tp->stack);
+	for (i = tp->fifo_pos; i < tp->fifo_nr; i++)
+		free(tp->fifo[i]);
+	free(tp->fifo);
+
+	pthread_cond_destroy(&tp->work_cond);
+	pthread_cond_destroy(&tp->done_cond);
+	pthread_mutex_destroy(&tp->mutex);
+	free(tp);
+}
+
+void tree_preload_add(struct tree_preload *tp, const struct object_id *oid,
+		      int urgent)
+{
+	struct tree_preload_entry *e;
+
+	if (!tp)
+		return;
+	if (!tp->threads)
+		start_workers(tp);
+
+	pthread_mutex_lock(&tp->mutex);
+	if (oidmap_get(&tp->map, oid))
+		goto out;
+
+	CALLOC_ARRAY(e, 1);
+	oidcpy(&e->entry.oid, oid);
+	e->urgent = !!urgent;
+	oidmap_put(&tp->map, e);
+	if (urgent) {
+		ALLOC_GROW(tp->stack, tp->stack_nr + 1, tp->stack_alloc);
+		tp->stack[tp->stack_nr++] = e;
+	} else {
+		if (tp->fifo_pos > 1024 && tp->fifo_pos * 2 > tp->fifo_nr) {
+			tp->fifo_nr -= tp->fifo_pos;
+			MOVE_ARRAY(tp->fifo, tp->fifo + tp->fifo_pos, tp->fifo_nr);
+			tp->fifo_pos = 0;
+		}
+		ALLOC_GROW(tp->fifo, tp->fifo_nr + 1, tp->fifo_alloc);
+		tp->fifo[tp->fifo_nr++] = e;
+	}
+	pthread_cond_signal(&tp->work_cond);
+out:
+	pthread_mutex_unlock(&tp->mutex);
+}
+
+static void *remove_entry(struct tree_preload *tp, const struct object_id *oid,
+			  unsigned long *size, int wait)
+{
+	struct tree_preload_entry *e;
+	void *buf = NULL;
+
+	pthread_mutex_lock(&tp->mutex);
+	e = oidmap_remove(&tp->map, oid);
+	if (!e)
+		goto out;
+
+	while (wait && e->state == TREE_PRELOAD_LOADING)
+		pthread_cond_wait(&tp->done_cond, &tp->mutex);
+
+	if (e->state != TREE_PRELOAD_DONE) {
+		/* still queued or being read; leave it to the workers */
+		e->state = TREE_PRELOAD_TAKEN;
+		goto out;
+	}
+
+	*size = e->size;
+	buf = unload_entry(tp, e);
+	free(e);
+out:
+	pthread_mutex_unlock(&tp->mutex);
+	return buf;
+}
+
+void *tree_preload_take(struct tree_preload *tp, const struct object_id *oid,
+			unsigned long *size)
+{
+	if (!tp)
+		return NULL;
+	return remove_entry(tp, oid, size, 1);
+}
+
+void tree_preload_discard(struct tree_preload *tp, const struct object_id *oid)
+{
+	unsigned long size;
+
+	if (!tp)
+		return;
+	free(remove_entry(tp, oid, &size, 0));
+}
+
+void tree_preload_fill(struct tree_preload *tp, struct tree *tree)
+{
+	unsigned long size;
+	void *buf;
+
+	if (!tp || tree->object.parsed)
+		return;
+	buf = tree_preload_take(tp, &tree->object.oid, &size);
+	if (buf)
+		parse_tree_buffer(tree, buf, size);
+}
@@ -0,0 +1,80 @@
+#ifndef TREE_PRELOAD_H
+#define TREE_PRELOAD_H
+
+/*
+ * Reading trees ahead of time on worker threads.
+ *
+ * Walks over many trees (unpack_trees(), rev-list --objects, the
+ * connectivity check of fsck) spend much of their time inflating tree
+ * objects one after the other. The walks themselves keep state in
+ * object flags and callbacks and are hard to split up, but they
+ * usually know early which trees they are going to read: the callers
+ * queue those trees here and later take the inflated contents instead
+ * of reading them themselves. The result of the walk does not change,
+ * as anything that was not preloaded (yet) is simply read by the
+ * caller as before.
+ *
+ * The worker threads are only started when the first tree is queued.
+ * From then on, object reads go through obj_read_lock, which stays
+ * enabled until preloading is stopped. Callers must make sure that the
+ * code running on the main thread meanwhile only accesses the object
+ * store through functions that take that lock.
+ *
+ * All functions accept a NULL "struct tree_preload" and do nothing.
+ */
+
+struct object_id;
+struct repository;
+struct tree;
+
+struct tree_preload;
+
+/*
+ * Prepare to preload trees from "r", if core.preloadTrees allows it and
+ * there is more than one CPU. Returns NULL otherwise.
+ */
+struct tree_preload *tree_preload_start(struct repository *r);
+
+/*
+ * Stop the worker threads and free everything that was not taken.
+ */
+void tree_preload_stop(struct tree_preload *tp);
+
+/*
+ * Queue the tree "oid" for preloading, unless it is already queued.
+ * "Urgent" trees are read before all others, the most recently queued
+ * one first, which suits depth-first walks; the others are read in the
+ * order they were queued. The first call starts the worker threads, so
+ * it must come from the thread that called tree_preload_start().
+ */
+void tree_preload_add(struct tree_preload *tp, const struct object_id *oid,
+		      int urgent);
+
+/*
+ * Queue all subtrees of the (parsed) "tree" as urgent, so that they are
+ * read in the order they appear in "tree".
+ */
+void tree_preload_add_subtrees(struct tree_preload *tp, struct tree *tree);
+
+/*
+ * Remove "oid" from the queue and return its contents, waiting for a
+ * worker that is still reading it. Returns NULL if the tree was not
+ * queued, could not be read, or was not picked up by a worker yet; the
+ * caller then has to read it itself.
+ */
+void *tree_preload_take(struct tree_preload *tp, const struct object_id *oid,
+			unsigned long *size);
+
+/*
+ * Remove "oid" from the queue; the caller does not need it after all.
+ */
+void tree_preload_discard(struct tree_preload *tp, const struct object_id *oid);
+
+/*
+ * If "tree" is not parsed yet and its contents were preloaded, parse
+ * them. Callers still call parse_tree() afterwards as usual, which
+ * does nothing if the tree is parsed and reads it otherwise.
+ */
+void tree_preload_fill(struct tree_preload *tp, struct tree *tree);
+
+#endif /* TREE_PRELOAD_H */
@@ -169,10 +169,7 @@ int name_compare(const char *name1, size_t len1, const char *name2, size_t len2)
 
 struct tree *lookup_tree(struct repository *r, const struct object_id *oid)
 {
-	struct object *obj = lookup_object(r, oid);
-	if (!obj)
-		return create_object(r, oid, alloc_tree_node(r));
-	return object_as_type(obj, OBJ_TREE, 0);
+	return lookup_or_create_object(r, oid, OBJ_TREE, alloc_tree_node);
 }
 
 int parse_tree_buffer(struct tree *item, void *buffer, unsigned long size)
@@ -24,10 +24,13 @@
 #include "trace2.h"
 #include "fsmonitor.h"
 #include "object-store-ll.h"
+#include "oid-array.h"
+#include "oidset.h"
 #include "promisor-remote.h"
 #include "entry.h"
 #include "parallel-checkout.h"
 #include "setup.h"
+#include "tree-preload.h"
 
 /*
  * Error messages expected by scripts out of plumbing commands such as
@@ -856,6 +859,98 @@ static int traverse_by_cache_tree(int pos, int nr_entries, int nr_names,
 	return 0;
 }
 
+/*
+ * Like fill_tree_descriptor(), but use the preloaded tree if there is
+ * one, waiting for a worker that is still reading it.
+ */
+static void *fill_tree_descriptor_preloaded(struct unpack_trees_options *o,
+					    struct tree_desc *desc,
+					    const struct object_id *oid)
+{
+	void *buf;
+	unsigned long size;
+
+	if (!oid)
+		return fill_tree_descriptor(the_repository, desc, oid);
+	buf = tree_preload_take(o->internal.tree_preload, oid, &size);
+	if (!buf)
+		return fill_tree_descriptor(the_repository, desc, oid);
+	init_tree_desc(desc, buf, size);
+	return buf;
+}
+
+static void collect_subtrees(struct tree_desc *t, struct oidset *set)
+{
+	struct tree_desc desc = *t;
+	struct name_entry entry;
+
+	while (tree_entry(&desc, &entry))
+		if (S_ISDIR(entry.mode))
+			oidset_insert(set, &entry.oid);
+}
+
+/*
+ * Queue the subtrees of the "n" trees that describe the directory
+ * "info" for preloading. Subtrees that are identical in all trees and
+ * match the cache tree are skipped, as traverse_trees_recursive() will
+ * not need to read them.
+ */
+static void preload_subtrees(struct unpack_trees_options *o, int n,
+			     struct tree_desc *t, struct traverse_info *info)
+{
+	struct tree_preload *tp = o->internal.tree_preload;
+	struct oid_array subtrees = OID_ARRAY_INIT;
+	struct oidset *sets;
+	int i, j, nr_sets = 0, all_present = 1;
+
+	if (!tp)
+		return;
+
+	CALLOC_ARRAY(sets, n);
+	for (i = 0; i < n; i++) {
+		if (!t[i].size)
+			all_present = 0;
+		if (i && t[i].buffer == t[i - 1].buffer)
+			continue;
+		oidset_init(&sets[nr_sets], 0);
+		collect_subtrees(&t[i], &sets[nr_sets]);
+		nr_sets++;
+	}
+
+	for (i = 0; i < n; i++) {
+		struct tree_desc desc = t[i];
+		struct name_entry entry;
+
+		if (i && t[i].buffer == t[i - 1].buffer)
+			continue;
+
+		while (tree_entry(&desc, &entry)) {
+			int in_all = all_present;
+
+			if (!S_ISDIR(entry.mode))
+				continue;
+
+			for (j = 0; in_all && j < nr_sets; j++)
+				in_all = oidset_contains(&sets[j], &entry.oid);
+			if (in_all && o->merge &&
+			    cache_tree_matches_traversal(o->src_index->cache_tree,
+							 &entry, info))
+				continue;
+
+			oid_array_append(&subtrees, &entry.oid);
+		}
+	}
+
+	/* The traversal is depth-first; have the first subtree read first. */
+	for (i = subtrees.nr; i > 0; i--)
+		tree_preload_add(tp, &subtrees.oid[i - 1], 1);
+	oid_array_clear(&subtrees);
+
+	for (i = 0; i < nr_sets; i++)
+		oidset_clear(&sets[i]);
+	free(sets);
+}
+
 static int traverse_trees_recursive(int n, unsigned long dirmask,
 				    unsigned long df_conflicts,
 				    struct name_entry *names,
@@ -930,10 +1025,12 @@ static int traverse_trees_recursive(int n, unsigned long dirmask,
 			const struct object_id *oid = NULL;
 			if (dirmask & 1)
 				oid = &names[i].oid;
-			buf[nr_buf++] = fill_tree_descriptor(the_repository, t + i, oid);
+			buf[nr_buf++] = fill_tree_descriptor_preloaded(o, t + i, oid);
 		}
 	}
 
+	preload_subtrees(o, n, t, &newinfo);
+
 	bottom = switch_cache_bottom(&newinfo);
 	ret = traverse_trees(o->src_index, n, t, &newinfo);
 	restore_cache_bottom(&newinfo, bottom);
@@ -1999,7 +2096,11 @@ int unpack_trees(unsigned len, struct tree_desc *t, struct unpack_trees_options
 
 		trace_performance_enter();
 		trace2_region_enter("unpack_trees", "traverse_trees", the_repository);
+		o->internal.tree_preload = tree_preload_start(the_repository);
+		preload_subtrees(o, len, t, &info);
 		ret = traverse_trees(o->src_index, len, t, &info);
+		tree_preload_stop(o->internal.tree_preload);
+		o->internal.tree_preload = NULL;
 		trace2_region_leave("unpack_trees", "traverse_trees", the_repository);
 		trace_performance_leave("traverse_trees");
 		if (ret < 0)
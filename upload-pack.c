@@ -116,6 +116,7 @@ struct upload_pack_data {
 	unsigned long tree_filter_max_depth;
 
 	unsigned done : 1;					/* v2 only */
+	unsigned object_fetch : 1;				/* v2 only */
 	unsigned allow_ref_in_want : 1;				/* v2 only */
 	unsigned allow_sideband_all : 1;			/* v2 only */
 	unsigned advertise_sid : 1;
@@ -308,7 +309,12 @@ static void create_pack_file(struct upload_pack_data *pack_data,
 		strvec_push(&pack_objects.args, "");
 	}
 	strvec_push(&pack_objects.args, "pack-objects");
-	strvec_push(&pack_objects.args, "--revs");
+	/*
+	 * For "object-fetch", pack exactly the objects that were asked
+	 * for instead of what can be reached from them.
+	 */
+	if (!pack_data->object_fetch)
+		strvec_push(&pack_objects.args, "--revs");
 	if (pack_data->use_thin_pack)
 		strvec_push(&pack_objects.args, "--thin");
 
@@ -321,7 +327,8 @@ static void create_pack_file(struct upload_pack_data *pack_data,
 		strvec_push(&pack_objects.args, "--delta-base-offset");
 	if (pack_data->use_include_tag)
 		strvec_push(&pack_objects.args, "--include-tag");
-	if (pack_data->filter_options.choice) {
+	/* Without --revs there is no walk for a filter to apply to */
+	if (pack_data->filter_options.choice && !pack_data->object_fetch) {
 		const char *spec =
 			expand_list_objects_filter_spec(&pack_data->filter_options);
 		strvec_pushf(&pack_objects.args, "--filter=%s", spec);
@@ -348,14 +355,16 @@ static void create_pack_file(struct upload_pack_data *pack_data,
 	for (i = 0; i < pack_data->want_obj.nr; i++)
 		fprintf(pipe_fd, "%s\n",
 			oid_to_hex(&pack_data->want_obj.objects[i].item->oid));
-	fprintf(pipe_fd, "--not\n");
-	for (i = 0; i < pack_data->have_obj.nr; i++)
-		fprintf(pipe_fd, "%s\n",
-			oid_to_hex(&pack_data->have_obj.objects[i].item->oid));
-	for (i = 0; i < pack_data->extra_edge_obj.nr; i++)
-		fprintf(pipe_fd, "%s\n",
-			oid_to_hex(&pack_data->extra_edge_obj.objects[i].item->oid));
-	fprintf(pipe_fd, "\n");
+	if (!pack_data->object_fetch) {
+		fprintf(pipe_fd, "--not\n");
+		for (i = 0; i < pack_data->have_obj.nr; i++)
+			fprintf(pipe_fd, "%s\n",
+				oid_to_hex(&pack_data->have_obj.objects[i].item->oid));
+		for (i = 0; i < pack_data->extra_edge_obj.nr; i++)
+			fprintf(pipe_fd, "%s\n",
+				oid_to_hex(&pack_data->extra_edge_obj.objects[i].item->oid));
+		fprintf(pipe_fd, "\n");
+	}
 	fflush(pipe_fd);
 	fclose(pipe_fd);
 
@@ -1814,6 +1823,125 @@ int upload_pack_v2(struct repository *r UNUSED, struct packet_reader *request)
 	return 0;
 }
 
+/*
+ * Parse an "oid <oid>" line of an "object-fetch" request into
+ * `want_obj`. Like "want" lines of "fetch" in protocol v2, any object
+ * we have is accepted, so that partial clones can lazily fetch blobs
+ * and trees, which are never ref tips. Unlike with "fetch", the object
+ * is sent on its own.
+ */
+static int parse_object_fetch_oid(struct packet_writer *writer,
+				  const char *line,
+				  struct object_array *want_obj)
+{
+	const char *arg;
+	struct object_id oid;
+	struct object *o;
+
+	if (!skip_prefix(line, "oid ", &arg))
+		return 0;
+
+	if (get_oid_hex(arg, &oid))
+		die("git upload-pack: protocol error, "
+		    "expected to get oid, not '%s'", line);
+
+	o = parse_object_with_flags(the_repository, &oid,
+				    PARSE_OBJECT_SKIP_HASH_CHECK);
+	if (!o) {
+		packet_writer_error(writer, "upload-pack: not our object %s",
+				    oid_to_hex(&oid));
+		die("git upload-pack: not our object %s", oid_to_hex(&oid));
+	}
+
+	if (!(o->flags & WANTED)) {
+		o->flags |= WANTED;
+		add_object_array(o, NULL, want_obj);
+	}
+	return 1;
+}
+
+static int all_wants_are_blobs(struct object_array *want_obj)
+{
+	unsigned int i;
+
+	for (i = 0; i < want_obj->nr; i++)
+		if (want_obj->objects[i].item->type != OBJ_BLOB)
+			return 0;
+	return 1;
+}
+
+int upload_pack_object_fetch(struct repository *r,
+			     struct packet_reader *request)
+{
+	struct upload_pack_data data;
+
+	clear_object_flags(ALL_FLAGS);
+
+	upload_pack_data_init(&data);
+	data.use_sideband = LARGE_PACKET_MAX;
+	data.object_fetch = 1;
+	get_upload_pack_config(&data);
+
+	while (packet_reader_read(request) == PACKET_READ_NORMAL) {
+		const char *arg = request->line;
+		const char *p;
+
+		if (parse_object_fetch_oid(&data.writer, arg, &data.want_obj))
+			continue;
+		if (data.allow_filter && skip_prefix(arg, "filter ", &p)) {
+			list_objects_filter_die_if_populated(&data.filter_options);
+			parse_list_objects_filter(&data.filter_options, p);
+			die_if_using_banned_filter(&data);
+			continue;
+		}
+		if (!strcmp(arg, "ofs-delta")) {
+			data.use_ofs_delta = 1;
+			continue;
+		}
+		if (!strcmp(arg, "no-progress")) {
+			data.no_progress = 1;
+			continue;
+		}
+
+		die("unexpected line: '%s'", arg);
+	}
+
+	if (request->status != PACKET_READ_FLUSH)
+		die(_("expected flush after object-fetch arguments"));
+
+	/*
+	 * With a filter, send what can be reached from the objects and
+	 * passes the filter along with them, as "fetch" would. Blobs reach
+	 * nothing, so wants that are all blobs (as in lazy fetches, which
+	 * always send a filter) are sent on their own without a walk.
+	 */
+	if (data.filter_options.choice && !all_wants_are_blobs(&data.want_obj))
+		data.object_fetch = 0;
+	trace2_data_string("upload-pack", r, "object-fetch/walk",
+			   data.object_fetch ? "none" : "revs");
+
+	if (data.want_obj.nr) {
+		packet_writer_write(&data.writer, "packfile\n");
+		create_pack_file(&data, NULL);
+	}
+
+	upload_pack_data_clear(&data);
+	return 0;
+}
+
+int upload_pack_object_fetch_advertise(struct repository *r,
+				       struct strbuf *value)
+{
+	int allow = 0, allow_filter = 0;
+
+	repo_config_get_bool(r, "uploadpack.allowobjectfetch", &allow);
+	if (allow && value &&
+	    !repo_config_get_bool(r, "uploadpack.allowfilter", &allow_filter) &&
+	    allow_filter)
+		strbuf_addstr(value, "filter");
+	return allow;
+}
+
 int upload_pack_advertise(struct repository *r,
 			  struct strbuf *value)
 {
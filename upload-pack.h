@@ -12,4 +12,13 @@ struct strbuf;
 int upload_pack_advertise(struct repository *r,
 			  struct strbuf *value);
 
+/*
+ * The "object-fetch" command sends the objects it is given as a pack,
+ * without negotiation and without the objects they refer to.
+ */
+int upload_pack_object_fetch(struct repository *r,
+			     struct packet_reader *request);
+int upload_pack_object_fetch_advertise(struct repository *r,
+				       struct strbuf *value);
+
 #endif /* UPLOAD_PACK_H */
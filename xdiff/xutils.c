@@ -294,20 +294,90 @@ static unsigned long xdl_hash_record_with_whitespace(char const **data,
 	return ha;
 }
 
+/*
+ * When no whitespace flags are in effect, lines are hashed a machine
+ * word at a time: each 8-byte word is checked for a newline with a few
+ * bitwise operations and folded into the hash as a whole, with the
+ * bytes from the newline on cleared in the last word of the line.
+ *
+ * Record hashes are only ever compared with other hashes computed with
+ * the same flags in the same process, so this need not agree with
+ * xdl_hash_record_with_whitespace().
+ */
+#define XDL_WORD_ONES 0x0101010101010101ULL
+#define XDL_WORD_HIGHS 0x8080808080808080ULL
+#define XDL_WORD_MUL 0x9e3779b97f4a7c15ULL
+
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && \
+	__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define XDL_WORD_CTZ_LE 1
+#endif
+
+static inline uint64_t xdl_hash_word(uint64_t ha, uint64_t w) {
+	ha = (ha ^ w) * XDL_WORD_MUL;
+	return ha ^ (ha >> 29);
+}
+
+/*
+ * Return the number of bytes of "w" (as laid out in memory) before its
+ * first newline, or sizeof(w) if it has none.  On little-endian
+ * machines the lowest bit set by the zero-byte test below is always
+ * that of the first newline, so its position can be counted directly.
+ */
+static inline size_t xdl_word_eol(uint64_t w) {
+	uint64_t x = w ^ (XDL_WORD_ONES * '\n');
+	uint64_t found = (x - XDL_WORD_ONES) & ~x & XDL_WORD_HIGHS;
+	size_t n = 0;
+
+	if (!found)
+		return sizeof(w);
+#ifdef XDL_WORD_CTZ_LE
+	n = __builtin_ctzll(found) / 8;
+#else
+	while (((const char *) &w)[n] != '\n')
+		n++;
+#endif
+	return n;
+}
+
 unsigned long xdl_hash_record(char const **data, char const *top, long flags) {
-	unsigned long ha = 5381;
+	uint64_t ha = 5381, w;
 	char const *ptr = *data;
+	size_t n;
 
 	if (flags & XDF_WHITESPACE_FLAGS)
 		return xdl_hash_record_with_whitespace(data, top, flags);
 
-	for (; ptr < top && *ptr != '\n'; ptr++) {
-		ha += (ha << 5);
-		ha ^= (unsigned long) *ptr;
+	for (;;) {
+		if (top - ptr < (long) sizeof(w)) {
+			/* fewer than sizeof(w) bytes left in the buffer */
+			for (n = 0; ptr + n < top && ptr[n] != '\n'; n++)
+				;
+			w = 0;
+			memcpy(&w, ptr, n);
+			break;
+		}
+		memcpy(&w, ptr, sizeof(w));
+		n = xdl_word_eol(w);
+		if (n < sizeof(w)) {
+#ifdef XDL_WORD_CTZ_LE
+			w &= (1ULL << (8 * n)) - 1;
+#else
+			w = 0;
+			memcpy(&w, ptr, n);
+#endif
+			break;
+		}
+		ha = xdl_hash_word(ha, w);
+		ptr += sizeof(w);
 	}
-	*data = ptr < top ? ptr + 1: ptr;
+	if (n)
+		ha = xdl_hash_word(ha, w);
+	ptr += n;
+	ha = xdl_hash_word(ha, (uint64_t) (ptr - *data));
+	*data = ptr < top ? ptr + 1 : ptr;
 
-	return ha;
+	return (unsigned long) (ha ^ (ha >> 32));
 }
 
 unsigned int xdl_hashbits(unsigned int size) {